@@ -0,0 +1,672 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Throughput benchmark. Starts the compositor headless on a private
+ * socket, connects synthetic wl_shm clients that commit at a fixed rate
+ * with a chosen damage pattern, and reads the compositor's own stats
+ * socket before and after the measured interval:
+ *
+ *   frames/s                 presented frames over all outputs
+ *   commit-to-present        p50/p90/p99 from the compositor histogram
+ *   CPU per frame            compositor user+system time / frames
+ *   RSS                      compositor resident and peak set size
+ *
+ * Percentiles are upper bounds of power-of-two buckets, as in the stats
+ * socket itself, so they are good for spotting regressions rather than
+ * for absolute numbers.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#define BENCH_MAX_CLIENTS 256
+#define BENCH_BUCKETS 64
+#define BENCH_STARTUP_TIMEOUT_MS 5000
+
+enum bench_damage {
+    BENCH_DAMAGE_FULL,      /* whole surface every commit */
+    BENCH_DAMAGE_QUARTER,   /* a quarter-size rectangle sweeping the surface */
+    BENCH_DAMAGE_CURSOR,    /* a 32x32 square, like a cursor or spinner */
+    BENCH_DAMAGE_NONE,      /* commits without damage, protocol cost only */
+};
+
+static const char *const bench_damage_names[] = { "full", "quarter", "cursor", "none" };
+
+struct bench_options {
+    const char *compositor;
+    const char *output_mode;
+    uint32_t n_outputs;
+    uint32_t n_clients;
+    int32_t width, height;          /* client surface size */
+    double rate;                    /* commits per second per client */
+    enum bench_damage damage;
+    double warmup_s;
+    double duration_s;
+};
+
+struct bench_client {
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct wl_surface *surface;
+    struct wl_shm_pool *pool;
+    struct wl_buffer *buffers[2];
+    bool busy[2];                   /* attached and not released yet */
+    bool filled[2];                 /* painted in full once */
+    uint32_t *data;
+    size_t size;
+    int32_t width, height;
+    int32_t x, y;                   /* offset applied with the first commit */
+    uint32_t frame;
+    bool placed;
+};
+
+/* One stats socket read */
+struct bench_sample {
+    double time_s;
+    uint64_t frames;
+    uint64_t commits[BENCH_BUCKETS];   /* commit_to_present_ns bucket counts */
+    uint64_t cpu_ticks;
+};
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Clients
+ */
+static void registry_global(void *data, struct wl_registry *registry, uint32_t name,
+                            const char *interface, uint32_t version) {
+    struct bench_client *client = data;
+    if (strcmp(interface, wl_compositor_interface.name) == 0 && version >= 5) {
+        client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 5);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        client->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+    (void)data;
+    (void)registry;
+    (void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+static void buffer_release(void *data, struct wl_buffer *buffer) {
+    struct bench_client *client = data;
+    for (int i = 0; i < 2; i++) {
+        if (client->buffers[i] == buffer) {
+            client->busy[i] = false;
+        }
+    }
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static bool bench_client_init(struct bench_client *client, const char *socket_name,
+                              int32_t width, int32_t height, int32_t x, int32_t y) {
+    memset(client, 0, sizeof(*client));
+    client->width = width;
+    client->height = height;
+    client->x = x;
+    client->y = y;
+
+    client->display = wl_display_connect(socket_name);
+    if (!client->display) {
+        return false;
+    }
+    client->registry = wl_display_get_registry(client->display);
+    wl_registry_add_listener(client->registry, &registry_listener, client);
+    wl_display_roundtrip(client->display);
+    if (!client->compositor || !client->shm) {
+        fprintf(stderr, "cwc-bench: compositor lacks wl_compositor v5 or wl_shm\n");
+        return false;
+    }
+
+    /* Two buffers in one pool, written alternately */
+    int32_t stride = width * 4;
+    client->size = (size_t)stride * (size_t)height * 2;
+    int fd = memfd_create("cwc-bench", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, (off_t)client->size) != 0) {
+        perror("cwc-bench: memfd");
+        return false;
+    }
+    client->data = mmap(NULL, client->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (client->data == MAP_FAILED) {
+        perror("cwc-bench: mmap");
+        close(fd);
+        return false;
+    }
+
+    client->pool = wl_shm_create_pool(client->shm, fd, (int32_t)client->size);
+    close(fd);
+    for (int i = 0; i < 2; i++) {
+        client->buffers[i] = wl_shm_pool_create_buffer(client->pool, i * stride * height,
+                                                       width, height, stride,
+                                                       WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(client->buffers[i], &buffer_listener, client);
+    }
+    client->surface = wl_compositor_create_surface(client->compositor);
+    return true;
+}
+
+static void bench_client_finish(struct bench_client *client) {
+    if (client->surface) wl_surface_destroy(client->surface);
+    for (int i = 0; i < 2; i++) {
+        if (client->buffers[i]) wl_buffer_destroy(client->buffers[i]);
+    }
+    if (client->pool) wl_shm_pool_destroy(client->pool);
+    if (client->data && client->data != MAP_FAILED) munmap(client->data, client->size);
+    if (client->shm) wl_shm_destroy(client->shm);
+    if (client->compositor) wl_compositor_destroy(client->compositor);
+    if (client->registry) wl_registry_destroy(client->registry);
+    if (client->display) wl_display_disconnect(client->display);
+}
+
+/* Damaged rectangle of a frame under the chosen pattern */
+static void bench_damage_box(const struct bench_client *client, enum bench_damage damage,
+                             int32_t box[4]) {
+    int32_t w = client->width, h = client->height;
+    switch (damage) {
+        case BENCH_DAMAGE_FULL:
+            box[0] = 0; box[1] = 0; box[2] = w; box[3] = h;
+            break;
+        case BENCH_DAMAGE_QUARTER:
+            box[2] = w / 2;
+            box[3] = h / 2;
+            box[0] = (int32_t)(client->frame * 7u % (uint32_t)(w - box[2] + 1));
+            box[1] = (int32_t)(client->frame * 5u % (uint32_t)(h - box[3] + 1));
+            break;
+        case BENCH_DAMAGE_CURSOR:
+            box[2] = w < 32 ? w : 32;
+            box[3] = h < 32 ? h : 32;
+            box[0] = (int32_t)(client->frame * 13u % (uint32_t)(w - box[2] + 1));
+            box[1] = (int32_t)(client->frame * 11u % (uint32_t)(h - box[3] + 1));
+            break;
+        case BENCH_DAMAGE_NONE:
+            box[0] = box[1] = box[2] = box[3] = 0;
+            break;
+    }
+}
+
+/*
+ * Like a well-behaved client, never write a buffer the compositor has not
+ * released: take the other one, or skip the commit when both are busy.
+ * Returns false if skipped.
+ */
+static bool bench_client_commit(struct bench_client *client, enum bench_damage damage) {
+    uint32_t index = client->frame & 1;
+    if (client->busy[index]) {
+        index ^= 1;
+    }
+    if (client->busy[index]) {
+        return false;
+    }
+    uint32_t *pixels = client->data + (size_t)index * (size_t)client->width * (size_t)client->height;
+    int32_t box[4];
+    bench_damage_box(client, damage, box);
+
+    /* Repaint the whole buffer where it is used for the first time */
+    if (!client->filled[index]) {
+        box[0] = 0; box[1] = 0; box[2] = client->width; box[3] = client->height;
+        client->filled[index] = true;
+    }
+
+    uint32_t colour = 0xff000000u | (client->frame * 0x010305u);
+    for (int32_t y = box[1]; y < box[1] + box[3]; y++) {
+        uint32_t *row = pixels + (size_t)y * (size_t)client->width;
+        for (int32_t x = box[0]; x < box[0] + box[2]; x++) {
+            row[x] = colour;
+        }
+    }
+
+    if (!client->placed) {
+        wl_surface_offset(client->surface, client->x, client->y);
+        client->placed = true;
+    }
+    wl_surface_attach(client->surface, client->buffers[index], 0, 0);
+    if (box[2] > 0 && box[3] > 0) {
+        wl_surface_damage_buffer(client->surface, box[0], box[1], box[2], box[3]);
+    }
+    wl_surface_commit(client->surface);
+    wl_display_flush(client->display);
+    client->busy[index] = true;
+    client->frame++;
+    return true;
+}
+
+/*
+ * Compositor process
+ */
+static pid_t bench_spawn(const struct bench_options *options, const char *socket_name) {
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    char *argv[8 + 2 * 16];
+    int argc = 0;
+    argv[argc++] = (char *)options->compositor;
+    argv[argc++] = (char *)"--headless";
+    argv[argc++] = (char *)"--quiet";
+    argv[argc++] = (char *)"--socket";
+    argv[argc++] = (char *)socket_name;
+    for (uint32_t i = 0; i < options->n_outputs && i < 16; i++) {
+        argv[argc++] = (char *)"--output";
+        argv[argc++] = (char *)options->output_mode;
+    }
+    argv[argc] = NULL;
+
+    execv(options->compositor, argv);
+    perror("cwc-bench: exec");
+    _exit(127);
+}
+
+/* Whole stats document from the compositor's stats socket */
+static char *bench_read_stats(const char *socket_name) {
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    if (!runtime_dir) {
+        return NULL;
+    }
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%s.stats", runtime_dir, socket_name);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    size_t length = 0, capacity = 4096;
+    char *text = malloc(capacity);
+    for (;;) {
+        if (length + 1 == capacity) {
+            capacity *= 2;
+            text = realloc(text, capacity);
+        }
+        ssize_t n = read(fd, text + length, capacity - length - 1);
+        if (n <= 0) {
+            break;
+        }
+        length += (size_t)n;
+    }
+    close(fd);
+    text[length] = '\0';
+    return text;
+}
+
+/* Sum of every "frames": value, one per output */
+static uint64_t bench_parse_frames(const char *text) {
+    uint64_t frames = 0;
+    for (const char *p = strstr(text, "\"frames\":"); p; p = strstr(p + 1, "\"frames\":")) {
+        frames += strtoull(p + strlen("\"frames\":"), NULL, 10);
+    }
+    return frames;
+}
+
+/* [upper bound, count] pairs of a histogram's buckets into per-bucket counts */
+static void bench_parse_histogram(const char *text, const char *name,
+                                  uint64_t counts[BENCH_BUCKETS]) {
+    memset(counts, 0, BENCH_BUCKETS * sizeof(*counts));
+    char key[64];
+    snprintf(key, sizeof(key), "\"%s\":{", name);
+    const char *p = strstr(text, key);
+    p = p ? strstr(p, "\"buckets\":[") : NULL;
+    if (!p) {
+        return;
+    }
+
+    p += strlen("\"buckets\":[");
+    while (*p == '[' || *p == ',') {
+        if (*p == ',') {
+            p++;
+            continue;
+        }
+        char *end;
+        uint64_t limit = strtoull(p + 1, &end, 10);
+        uint64_t count = strtoull(end + 1, &end, 10);
+        /* Bucket i is bounded by 2^i - 1 */
+        uint32_t bucket = (uint32_t)(63 - __builtin_clzll(limit + 1));
+        if (limit < UINT64_MAX && bucket < BENCH_BUCKETS) {
+            counts[bucket] = count;
+        }
+        p = end + 1;
+    }
+}
+
+static uint64_t bench_cpu_ticks(pid_t pid) {
+    char path[64], line[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (!file || !fgets(line, sizeof(line), file)) {
+        if (file) fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    /* utime and stime are fields 14 and 15, counted after the comm field */
+    const char *p = strrchr(line, ')');
+    unsigned long long utime = 0, stime = 0;
+    if (p) {
+        sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime);
+    }
+    return utime + stime;
+}
+
+static long bench_status_kb(pid_t pid, const char *field) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    FILE *file = fopen(path, "r");
+    long value = -1;
+    while (file && fgets(line, sizeof(line), file)) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            value = strtol(line + strlen(field), NULL, 10);
+            break;
+        }
+    }
+    if (file) fclose(file);
+    return value;
+}
+
+static bool bench_sample(pid_t pid, const char *socket_name, struct bench_sample *sample) {
+    char *text = bench_read_stats(socket_name);
+    if (!text) {
+        return false;
+    }
+    sample->time_s = bench_now();
+    sample->frames = bench_parse_frames(text);
+    bench_parse_histogram(text, "commit_to_present_ns", sample->commits);
+    sample->cpu_ticks = bench_cpu_ticks(pid);
+    free(text);
+    return true;
+}
+
+/* Bucket upper bound holding the given fraction of the interval's samples */
+static double bench_percentile_ms(const uint64_t counts[BENCH_BUCKETS], double fraction) {
+    uint64_t total = 0;
+    for (int i = 0; i < BENCH_BUCKETS; i++) total += counts[i];
+    if (total == 0) {
+        return 0.0;
+    }
+
+    uint64_t target = (uint64_t)((double)total * fraction), seen = 0;
+    if (target == 0) target = 1;
+    for (int i = 0; i < BENCH_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= target) {
+            return (double)((UINT64_C(1) << i) - 1) / 1e6;
+        }
+    }
+    return 0.0;
+}
+
+/*
+ * Driver
+ */
+static void bench_usage(const char *program) {
+    printf("Usage: %s [OPTIONS]\n", program);
+    printf("\nOptions:\n");
+    printf("  -c, --compositor PATH  Compositor binary (default: ./cwc)\n");
+    printf("  -n, --clients N        Synthetic clients (default: 4)\n");
+    printf("  -s, --size WxH         Client surface size (default: 512x512)\n");
+    printf("  -r, --rate HZ          Commits per second per client (default: 60)\n");
+    printf("  -D, --damage PATTERN   full, quarter, cursor or none (default: quarter)\n");
+    printf("  -O, --outputs N        Headless outputs (default: 1)\n");
+    printf("  -m, --mode MODE        Output mode WIDTHxHEIGHT[@HZ] (default: 1920x1080@60)\n");
+    printf("  -w, --warmup SECONDS   Unmeasured lead-in (default: 1)\n");
+    printf("  -t, --time SECONDS     Measured interval (default: 5)\n");
+}
+
+static bool bench_parse_options(int argc, char **argv, struct bench_options *options) {
+    static const struct option long_options[] = {
+        {"help", no_argument, 0, 'h'},
+        {"compositor", required_argument, 0, 'c'},
+        {"clients", required_argument, 0, 'n'},
+        {"size", required_argument, 0, 's'},
+        {"rate", required_argument, 0, 'r'},
+        {"damage", required_argument, 0, 'D'},
+        {"outputs", required_argument, 0, 'O'},
+        {"mode", required_argument, 0, 'm'},
+        {"warmup", required_argument, 0, 'w'},
+        {"time", required_argument, 0, 't'},
+        {0, 0, 0, 0}
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "hc:n:s:r:D:O:m:w:t:", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'h':
+                bench_usage(argv[0]);
+                exit(EXIT_SUCCESS);
+            case 'c':
+                options->compositor = optarg;
+                break;
+            case 'n':
+                options->n_clients = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &options->width, &options->height) != 2) {
+                    return false;
+                }
+                break;
+            case 'r':
+                options->rate = strtod(optarg, NULL);
+                break;
+            case 'D': {
+                bool found = false;
+                for (size_t i = 0; i < sizeof(bench_damage_names) / sizeof(*bench_damage_names); i++) {
+                    if (strcmp(optarg, bench_damage_names[i]) == 0) {
+                        options->damage = (enum bench_damage)i;
+                        found = true;
+                    }
+                }
+                if (!found) {
+                    return false;
+                }
+                break;
+            }
+            case 'O':
+                options->n_outputs = (uint32_t)strtoul(optarg, NULL, 10);
+                break;
+            case 'm':
+                options->output_mode = optarg;
+                break;
+            case 'w':
+                options->warmup_s = strtod(optarg, NULL);
+                break;
+            case 't':
+                options->duration_s = strtod(optarg, NULL);
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return options->n_clients > 0 && options->n_clients <= BENCH_MAX_CLIENTS &&
+           options->width > 0 && options->height > 0 && options->rate > 0.0 &&
+           options->n_outputs > 0 && options->n_outputs <= 16 &&
+           options->warmup_s >= 0.0 && options->duration_s > 0.0;
+}
+
+/* Wait for the compositor socket; the stats socket comes up with it */
+static bool bench_wait_ready(pid_t pid, const char *socket_name) {
+    for (int waited = 0; waited < BENCH_STARTUP_TIMEOUT_MS; waited += 10) {
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return false;
+        }
+        struct wl_display *display = wl_display_connect(socket_name);
+        if (display) {
+            wl_display_disconnect(display);
+            return true;
+        }
+        usleep(10000);
+    }
+    return false;
+}
+
+static void bench_drain(struct bench_client *clients, uint32_t n_clients) {
+    for (uint32_t i = 0; i < n_clients; i++) {
+        while (wl_display_prepare_read(clients[i].display) != 0) {
+            wl_display_dispatch_pending(clients[i].display);
+        }
+        struct pollfd pfd = { .fd = wl_display_get_fd(clients[i].display), .events = POLLIN };
+        if (poll(&pfd, 1, 0) > 0) {
+            wl_display_read_events(clients[i].display);
+            wl_display_dispatch_pending(clients[i].display);
+        } else {
+            wl_display_cancel_read(clients[i].display);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    struct bench_options options = {
+        .compositor = "./cwc",
+        .output_mode = "1920x1080@60",
+        .n_outputs = 1,
+        .n_clients = 4,
+        .width = 512,
+        .height = 512,
+        .rate = 60.0,
+        .damage = BENCH_DAMAGE_QUARTER,
+        .warmup_s = 1.0,
+        .duration_s = 5.0,
+    };
+    if (!bench_parse_options(argc, argv, &options)) {
+        bench_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    int32_t output_width = 1920, output_height = 1080;
+    sscanf(options.output_mode, "%dx%d", &output_width, &output_height);
+
+    char socket_name[64];
+    snprintf(socket_name, sizeof(socket_name), "cwc-bench-%d", (int)getpid());
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t pid = bench_spawn(&options, socket_name);
+    if (pid < 0 || !bench_wait_ready(pid, socket_name)) {
+        fprintf(stderr, "cwc-bench: compositor did not start\n");
+        if (pid > 0) kill(pid, SIGTERM);
+        return EXIT_FAILURE;
+    }
+
+    /* Spread clients over the outputs, cascading within each */
+    struct bench_client *clients = calloc(options.n_clients, sizeof(*clients));
+    int status = EXIT_SUCCESS;
+    for (uint32_t i = 0; i < options.n_clients; i++) {
+        uint32_t output = i % options.n_outputs;
+        int32_t step = (int32_t)(i / options.n_outputs) * 16;
+        int32_t x = (int32_t)output * output_width + step % (output_width / 2 + 1);
+        int32_t y = step % (output_height / 2 + 1);
+        if (!bench_client_init(&clients[i], socket_name, options.width, options.height, x, y)) {
+            fprintf(stderr, "cwc-bench: client %u failed to start\n", i);
+            status = EXIT_FAILURE;
+            options.n_clients = i + 1;
+            goto out;
+        }
+    }
+
+    int timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    long interval_ns = (long)(1e9 / options.rate);
+    struct itimerspec its = {
+        .it_interval = { interval_ns / 1000000000L, interval_ns % 1000000000L },
+        .it_value = { 0, 1 },
+    };
+    timerfd_settime(timer, 0, &its, NULL);
+
+    struct bench_sample start = { 0 }, end = { 0 };
+    bool started = false;
+    uint64_t commits = 0, skipped = 0;
+    double begin = bench_now();
+    for (;;) {
+        uint64_t ticks;
+        if (read(timer, &ticks, sizeof(ticks)) != sizeof(ticks)) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        double now = bench_now();
+        if (!started && now - begin >= options.warmup_s) {
+            started = bench_sample(pid, socket_name, &start);
+            commits = 0;
+            skipped = 0;
+        }
+        if (started && now - start.time_s >= options.duration_s) {
+            break;
+        }
+
+        for (uint32_t i = 0; i < options.n_clients; i++) {
+            if (bench_client_commit(&clients[i], options.damage)) {
+                commits++;
+            } else {
+                skipped++;
+            }
+        }
+        bench_drain(clients, options.n_clients);
+    }
+    close(timer);
+
+    if (!started || !bench_sample(pid, socket_name, &end)) {
+        fprintf(stderr, "cwc-bench: stats socket unavailable\n");
+        status = EXIT_FAILURE;
+        goto out;
+    }
+
+    double elapsed = end.time_s - start.time_s;
+    uint64_t frames = end.frames - start.frames;
+    uint64_t latency[BENCH_BUCKETS];
+    for (int i = 0; i < BENCH_BUCKETS; i++) {
+        latency[i] = end.commits[i] - start.commits[i];
+    }
+    double cpu_s = (double)(end.cpu_ticks - start.cpu_ticks) / (double)sysconf(_SC_CLK_TCK);
+
+    printf("scenario          %u clients %dx%d @ %.1f Hz, %s damage, %u x %s\n",
+           options.n_clients, options.width, options.height, options.rate,
+           bench_damage_names[options.damage], options.n_outputs, options.output_mode);
+    printf("commits/s         %.1f (%llu skipped, both buffers busy)\n",
+           (double)commits / elapsed, (unsigned long long)skipped);
+    printf("frames/s          %.1f\n", (double)frames / elapsed);
+    printf("commit-to-present p50 %.3f ms  p90 %.3f ms  p99 %.3f ms\n",
+           bench_percentile_ms(latency, 0.50), bench_percentile_ms(latency, 0.90),
+           bench_percentile_ms(latency, 0.99));
+    printf("cpu/frame         %.3f ms (%.1f%% of a core)\n",
+           frames ? cpu_s * 1e3 / (double)frames : 0.0, cpu_s * 100.0 / elapsed);
+    printf("rss               %ld KiB (peak %ld KiB)\n",
+           bench_status_kb(pid, "VmRSS:"), bench_status_kb(pid, "VmHWM:"));
+
+out:
+    for (uint32_t i = 0; i < options.n_clients; i++) {
+        bench_client_finish(&clients[i]);
+    }
+    free(clients);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return status;
+}
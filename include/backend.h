@@ -0,0 +1,72 @@
+#ifndef CWC_BACKEND_H
+#define CWC_BACKEND_H
+
+#include "cwc.h"
+
+struct cwc_backend;
+struct cwc_buffer;
+struct cwc_output;
+
+struct cwc_region;
+
+/* Most --output modes accepted for the virtual backend */
+#define CWC_MAX_VIRTUAL_OUTPUTS 16
+
+/*
+ * Display backend: whatever is physically behind each cwc_output. It
+ * creates the outputs, and frames normally reach it through the output
+ * framebuffer; a backend with hardware planes can also be offered client
+ * buffers directly. All hooks run on the dispatch thread, NULL where the
+ * backend lacks the feature.
+ */
+struct cwc_backend_impl {
+    const char *name;
+    void (*destroy)(struct cwc_backend *backend);
+    void (*output_destroy)(struct cwc_backend *backend, struct cwc_output *output);
+
+    /*
+     * Queue the frame for the next vblank: output->scanout_pending when
+     * scanout_flip is set and it is non-NULL, else the framebuffer, of
+     * which damage (output-local, NULL if none) changed. Return true if
+     * the backend will call cwc_output_present_done() once it is shown;
+     * false leaves pacing to the output's vblank timer. A client buffer
+     * that cannot be shown after all is reported with
+     * cwc_output_scanout_rejected() before returning false.
+     */
+    bool (*present)(struct cwc_backend *backend, struct cwc_output *output,
+                    const struct cwc_region *damage);
+
+    /*
+     * Show buffer on output from the next vblank instead of the composited
+     * framebuffer. The buffer already matches the output mode, is opaque
+     * and in a native XRGB8888 layout. Return false if no plane can take
+     * it, and the frame is composited instead. A referenced buffer stays
+     * on screen until the following frame has been presented.
+     */
+    bool (*scanout)(struct cwc_backend *backend, struct cwc_output *output,
+                    struct cwc_buffer *buffer);
+};
+
+struct cwc_backend {
+    const struct cwc_backend_impl *impl;
+    struct cwc_server *server;
+};
+
+/* Function declarations */
+
+/* "drm", "virtual", or NULL/"auto" for DRM when a device can be driven */
+struct cwc_backend *cwc_backend_create(struct cwc_server *server, const char *name);
+void cwc_backend_destroy(struct cwc_backend *backend);
+
+/* Backends; both create their outputs, NULL if there are none */
+struct cwc_backend *cwc_backend_create_virtual(struct cwc_server *server);
+struct cwc_backend *cwc_backend_create_drm(struct cwc_server *server);
+
+/* Hook wrappers */
+void cwc_backend_output_destroy(struct cwc_backend *backend, struct cwc_output *output);
+bool cwc_backend_present(struct cwc_backend *backend, struct cwc_output *output,
+                         const struct cwc_region *damage);
+bool cwc_backend_scanout(struct cwc_backend *backend, struct cwc_output *output,
+                         struct cwc_buffer *buffer);
+
+#endif /* CWC_BACKEND_H */
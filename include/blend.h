@@ -0,0 +1,46 @@
+#ifndef CWC_BLEND_H
+#define CWC_BLEND_H
+
+#include "cwc.h"
+
+/*
+ * Row kernels used by the software renderer. All operate on n 32-bit
+ * pixels in memory order B, G, R, A (ARGB8888/XRGB8888 on little endian)
+ * and impose no alignment requirement.
+ */
+typedef void (*cwc_blend_over_func_t)(uint32_t *dst, const uint32_t *src, size_t n);
+typedef void (*cwc_blend_copy_func_t)(uint32_t *dst, const uint32_t *src, size_t n);
+typedef void (*cwc_blend_fill_func_t)(uint32_t *dst, uint32_t color, size_t n);
+
+struct cwc_blend_kernels {
+    const char *name;
+    cwc_blend_over_func_t over;     /* premultiplied src over dst */
+    cwc_blend_copy_func_t copy_xrgb; /* copy, forcing alpha to 0xff */
+    cwc_blend_fill_func_t fill;     /* solid fill */
+};
+
+/* Premultiplied src over dst for one pixel, the rounding every kernel matches */
+static inline uint32_t cwc_blend_over_pixel(uint32_t src, uint32_t dst) {
+    uint32_t alpha = src >> 24;
+    if (alpha == 0xff) return src;
+    if (alpha == 0) return dst;
+
+    uint32_t inv = 255 - alpha;
+    uint32_t rb = (dst & 0x00ff00ffu) * inv + 0x00800080u;
+    rb = ((rb + ((rb >> 8) & 0x00ff00ffu)) >> 8) & 0x00ff00ffu;
+    uint32_t ag = ((dst >> 8) & 0x00ff00ffu) * inv + 0x00800080u;
+    ag = (ag + ((ag >> 8) & 0x00ff00ffu)) & 0xff00ff00u;
+
+    return src + (rb | ag);
+}
+
+/* Kernels selected by cwc_blend_init(), scalar until then */
+extern const struct cwc_blend_kernels *cwc_blend;
+
+/* Function declarations */
+
+/* Pick the best kernels for this CPU; CWC_BLEND=<name> overrides */
+void cwc_blend_init(struct cwc_server *server);
+const struct cwc_blend_kernels *cwc_blend_find(const char *name);
+
+#endif /* CWC_BLEND_H */
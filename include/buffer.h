@@ -0,0 +1,57 @@
+#ifndef CWC_BUFFER_H
+#define CWC_BUFFER_H
+
+#include "cwc.h"
+#include "format.h"
+
+struct cwc_buffer;
+
+/* Where a wl_buffer's pixels come from */
+enum cwc_buffer_type {
+    CWC_BUFFER_SHM,                 /* struct cwc_shm_buffer */
+    CWC_BUFFER_DMABUF,              /* struct cwc_dmabuf_buffer */
+};
+
+struct cwc_buffer_impl {
+    /* Final teardown, called once the last reference is dropped */
+    void (*destroy)(struct cwc_buffer *buffer);
+};
+
+/*
+ * Part common to every wl_buffer, embedded first in each buffer type.
+ * Surfaces and render snapshots only hold this; code that needs the
+ * backing storage switches on type.
+ */
+struct cwc_buffer {
+    enum cwc_buffer_type type;
+    const struct cwc_buffer_impl *impl;
+    struct wl_resource *resource;   /* NULL once the client destroyed the buffer */
+
+    int32_t width, height;
+    uint32_t format;                /* wl_shm format code, also for dma-bufs */
+    const struct cwc_format *pixel_format;  /* descriptor for format, never NULL */
+
+    /* Reference counting: one for the resource, one per surface using it */
+    int ref_count;
+
+    /*
+     * Readers that still need the pixels: the surface showing it until
+     * the renderer holds a copy, every snapshot item and direct scanout.
+     * wl_buffer.release goes out when the last one unlocks.
+     */
+    int busy_count;
+    bool release_pending;           /* committed and not released since */
+};
+
+/* Function declarations */
+void cwc_buffer_init(struct cwc_buffer *buffer, enum cwc_buffer_type type,
+                     const struct cwc_buffer_impl *impl, struct wl_resource *resource,
+                     int32_t width, int32_t height, uint32_t format);
+struct cwc_buffer *cwc_buffer_from_resource(struct wl_resource *resource);
+struct cwc_buffer *cwc_buffer_ref(struct cwc_buffer *buffer);
+void cwc_buffer_unref(struct cwc_buffer *buffer);
+struct cwc_buffer *cwc_buffer_lock(struct cwc_buffer *buffer);
+void cwc_buffer_unlock(struct cwc_buffer *buffer);
+void cwc_buffer_resource_destroyed(struct cwc_buffer *buffer);
+
+#endif /* CWC_BUFFER_H */
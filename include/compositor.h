@@ -2,27 +2,79 @@
 #define CWC_COMPOSITOR_H
 
 #include "cwc.h"
+#include "region.h"
+#include "scene.h"
+
+struct cwc_buffer;
+
+/* Fields of a cwc_surface_state the client set since the last commit */
+enum cwc_surface_state_field {
+    CWC_SURFACE_STATE_BUFFER   = 1 << 0,    /* wl_surface.attach, possibly of NULL */
+    CWC_SURFACE_STATE_OFFSET   = 1 << 1,
+    CWC_SURFACE_STATE_DAMAGE   = 1 << 2,
+    CWC_SURFACE_STATE_OPAQUE   = 1 << 3,
+    CWC_SURFACE_STATE_FRAME    = 1 << 4,
+    CWC_SURFACE_STATE_FEEDBACK = 1 << 5,
+};
+
+/*
+ * One side of the surface's double-buffered state. A commit swaps the
+ * pending and current blocks; fields outside the dirty mask are moved
+ * back from the old current one, so nothing is copied or reallocated.
+ */
+struct cwc_surface_state {
+    uint32_t committed;             /* CWC_SURFACE_STATE_* set in this block */
+
+    /* Attached buffer, only held by the pending block until the commit applies it */
+    struct wl_resource *buffer;
+    struct wl_listener buffer_destroy;
+
+    int32_t dx, dy;
+    struct cwc_region damage;       /* surface-local */
+    struct cwc_region opaque;       /* surface-local, as set by the client */
+    struct wl_list frame_callbacks; /* current: waiting for the next repaint */
+    struct wl_list feedbacks;       /* wp_presentation_feedback resources, likewise */
+};
 
 /* Surface state */
 struct cwc_surface {
-    struct wl_list link;
     struct wl_resource *resource;
     struct cwc_server *server;
     struct cwc_client_state *client_state;
-    
+    struct wl_list client_link;     /* cwc_client_state::surfaces */
+
+    /* Stacking; higher stack_order is closer to the viewer */
+    uint64_t stack_order;
+
+    /* Scene node under the root tree; holds the world box and spatial entry */
+    struct cwc_scene_node node;
+
     /* Surface properties */
-    int32_t x, y;
+    int32_t x, y;                   /* position relative to the parent node */
     int32_t width, height;
     bool mapped;
-    
-    /* Buffer management */
-    struct wl_resource *buffer;
-    void *buffer_data;
-    size_t buffer_size;
-    
-    /* Damage tracking */
-    struct wl_list damage_list;
-    
+
+    /* Double-buffered state; both point into states */
+    struct cwc_surface_state states[2];
+    struct cwc_surface_state *pending;
+    struct cwc_surface_state *current;
+
+    /* Buffer management: committed buffer, sampled in place by the renderer */
+    struct cwc_buffer *buffer;
+    bool buffer_locked;             /* buffer is busy until the renderer copies it */
+
+    /* Renderer's cache for the surface contents, e.g. a GL texture */
+    void *render_data;
+
+    /* Oldest commit with visible changes not yet presented, 0 if none */
+    uint64_t commit_ns;
+
+    /* Oldest input event answered by such a commit, 0 if none */
+    uint64_t input_ns;
+
+    /* Damaged pixels counted in the client's budget until the next repaint */
+    uint64_t charged_area;
+
     /* Creation time for debugging */
     time_t create_time;
 };
@@ -34,6 +86,12 @@ struct cwc_compositor {
     struct cwc_server *server;
 };
 
+/* wl_region resource */
+struct cwc_region_resource {
+    struct wl_resource *resource;
+    struct cwc_region region;
+};
+
 /* Function declarations */
 
 /* Compositor interface */
@@ -42,15 +100,31 @@ void cwc_compositor_create_surface(struct wl_client *client, struct wl_resource
 void cwc_compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id);
 
 /* Surface management */
-struct cwc_surface *cwc_surface_create(struct wl_client *client, struct cwc_server *server, uint32_t id);
+struct cwc_surface *cwc_surface_create(struct wl_client *client, struct cwc_server *server,
+                                       uint32_t version, uint32_t id);
 void cwc_surface_destroy(struct cwc_surface *surface);
 void cwc_surface_commit(struct wl_client *client, struct wl_resource *resource);
-void cwc_surface_attach(struct wl_client *client, struct wl_resource *resource, 
+void cwc_surface_attach(struct wl_client *client, struct wl_resource *resource,
                        struct wl_resource *buffer, int32_t x, int32_t y);
+void cwc_surface_get_box(const struct cwc_surface *surface, struct cwc_box *box);
+void cwc_surface_get_opaque_region(const struct cwc_surface *surface, struct cwc_region *opaque);
+void cwc_surface_send_frame_done(struct cwc_surface *surface, uint32_t time_ms);
+void cwc_surface_discharge_damage(struct cwc_surface *surface);
+void cwc_surface_buffer_copied(struct cwc_surface *surface);
+
+/* Lookup through the spatial index */
+struct cwc_surface *cwc_surface_at(struct cwc_server *server, int32_t x, int32_t y,
+                                   int32_t *sx, int32_t *sy);
+uint32_t cwc_surface_collect_box(struct cwc_server *server, const struct cwc_box *box,
+                                 struct cwc_surface ***surfaces);
+
+/* Region management */
+struct cwc_region *cwc_region_from_resource(struct wl_resource *resource);
 
 /* Resource cleanup */
 void cwc_compositor_resource_destroy(struct wl_resource *resource);
 void cwc_surface_resource_destroy(struct wl_resource *resource);
+void cwc_region_resource_destroy(struct wl_resource *resource);
 
 /* Validation functions */
 bool cwc_surface_validate(struct cwc_surface *surface);
@@ -14,6 +14,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <signal.h>
 
 /* Version information */
 #define CWC_VERSION_MAJOR 1
@@ -21,11 +22,25 @@
 #define CWC_VERSION_PATCH 0
 
 /* Configuration constants */
-#define CWC_MAX_CLIENTS 100
-#define CWC_MAX_SURFACES 1000
+#define CWC_MAX_CLIENTS 4096       /* default, see --max-clients */
+#define CWC_MAX_SURFACES 1000       /* default, see --max-surfaces */
 #define CWC_DEFAULT_SOCKET "wayland-1"
 #define CWC_LOG_BUFFER_SIZE 1024
 
+/* Largest a client's wire buffers may grow; idle clients stay at the minimum */
+#define CWC_CLIENT_MAX_BUFFER_SIZE (1024 * 1024)
+
+/* Default per-client budgets, see --client-budget */
+#define CWC_CLIENT_BUDGET_SHM_BYTES (256ULL * 1024 * 1024)
+#define CWC_CLIENT_BUDGET_BUFFERS 256
+#define CWC_CLIENT_BUDGET_COMMITS 1000
+#define CWC_CLIENT_BUDGET_DAMAGE_AREA (4ULL * 3840 * 2160)
+#define CWC_CLIENT_BUDGET_CAPTURES 0    /* no cap: every presented frame */
+#define CWC_CLIENT_THROTTLE_MS 100  /* frame callback interval while over budget */
+
+/* Event loop batches drained before clients are flushed, bounds flush latency */
+#define CWC_DISPATCH_MAX_ROUNDS 4
+
 /* Concise unsigned typedefs */
 typedef unsigned char uchar;
 typedef unsigned int uint;
@@ -36,6 +51,19 @@ struct cwc_server;
 struct cwc_output;
 struct cwc_surface;
 struct cwc_client_state;
+struct cwc_hash;
+struct cwc_spatial_grid;
+struct cwc_scene;
+struct cwc_logger;
+struct cwc_stats;
+struct cwc_thread_pool;
+struct cwc_renderer;
+struct cwc_backend;
+struct cwc_output_config;
+struct cwc_socket;
+struct cwc_seat;
+struct cwc_input;
+struct cwc_memory;
 
 /* Error codes */
 typedef enum {
@@ -55,27 +83,86 @@ typedef enum {
     CWC_LOG_DEBUG = 3
 } cwc_log_level_t;
 
+/* Most verbose level compiled in; debug messages vanish from release builds */
+#ifndef CWC_LOG_MAX_LEVEL
+#ifdef NDEBUG
+#define CWC_LOG_MAX_LEVEL CWC_LOG_INFO
+#else
+#define CWC_LOG_MAX_LEVEL CWC_LOG_DEBUG
+#endif
+#endif
+
+/*
+ * What a single client may use before its frame callbacks are slowed
+ * down to one per CWC_CLIENT_THROTTLE_MS. Zero disables a limit.
+ */
+struct cwc_client_budget {
+    uint64_t shm_bytes;          /* mapped wl_shm pool memory, orphaned pools included */
+    uint32_t buffers;            /* live wl_buffer objects */
+    uint32_t commits_per_sec;    /* wl_surface.commit requests per second */
+    uint64_t damage_area;        /* damaged pixels committed but not yet repainted */
+    uint32_t captures_per_sec;   /* screencopy frames per output; a cap, not a throttle */
+};
+
 /* Main server state */
 struct cwc_server {
     struct wl_display *display;
     struct wl_event_loop *event_loop;
     const char *socket_name;
+    struct cwc_socket *socket;   /* listening socket, see socket.h */
     
-    /* Global objects */
+    /* Global objects (each cwc_output owns its wl_output global) */
     struct wl_global *compositor_global;
-    struct wl_global *output_global;
+    struct wl_global *shm_global;
+    struct wl_global *dmabuf_global;
+    struct wl_global *presentation_global;
+    struct wl_global *screencopy_global;
     
     /* Resource lists */
     struct wl_list outputs;      /* cwc_output::link */
-    struct wl_list surfaces;     /* cwc_surface::link */
     struct wl_list clients;      /* cwc_client_state::link */
+    struct wl_list shms;         /* cwc_shm::link */
+    struct wl_list startup_tasks;   /* cwc_startup_task::link, still initializing */
+    struct wl_listener client_created;
+    
+    /*
+     * Emitted once per event loop iteration, after every ready source was
+     * dispatched and right before clients are flushed. Work that bursts
+     * of requests or events would repeat is coalesced into this.
+     */
+    struct wl_signal dispatch_done;
+    
+    /* Lookup indices */
+    struct cwc_hash *client_index;           /* wl_client -> cwc_client_state */
+    struct cwc_spatial_grid *surface_grid;   /* mapped surfaces by layout box */
+    struct cwc_scene *scene;                 /* retained scene graph, see scene.h */
+    uint64_t stack_seq;                      /* last stacking order handed out */
+    uint32_t output_seq;                     /* names render worker threads */
     
     /* Configuration */
     bool debug_mode;
     int log_fd;
     cwc_log_level_t log_level;
+    bool log_async;              /* drain log records on a background thread */
+    struct cwc_logger *logger;   /* NULL while logging synchronously */
+    uint32_t max_surfaces;       /* 0 selects CWC_MAX_SURFACES */
+    uint32_t max_clients;        /* 0 selects CWC_MAX_CLIENTS */
+    uint64_t memory_budget;      /* --memory-budget for the caches, 0 for none */
+    struct cwc_client_budget client_budget;
+    struct cwc_thread_pool *thread_pool;    /* tile rasterizer, NULL if single-threaded */
+    const char *renderer_name;   /* --renderer, NULL picks automatically */
+    struct cwc_renderer *renderer;
+    const char *backend_name;    /* --backend, NULL picks automatically */
+    const struct cwc_output_config *output_configs;  /* --output modes for virtual outputs */
+    uint32_t n_output_configs;
+    struct cwc_backend *backend; /* display hardware behind the outputs */
+    struct cwc_seat *seat;       /* wl_seat and the pointer, see seat.h */
+    struct cwc_input *input;     /* input devices, NULL until they are opened */
+    struct cwc_memory *memory;   /* cache eviction, see memory.h */
     
     /* Statistics */
+    struct cwc_stats *stats;     /* histograms, see stats.h */
+    volatile sig_atomic_t running;
     uint32_t client_count;
     uint32_t surface_count;
     time_t start_time;
@@ -87,7 +174,26 @@ struct cwc_client_state {
     struct wl_client *client;
     struct cwc_server *server;
     uint32_t surface_count;
+    uint32_t shm_pool_count;     /* mapped pools, including orphaned ones */
+    struct wl_list surfaces;     /* cwc_surface::client_link */
+    struct wl_list shm_pools;    /* cwc_shm_pool::client_link */
     time_t connect_time;
+    struct wl_listener destroy;  /* wl_client destroy signal */
+
+    /* Usage charged against server->client_budget */
+    uint64_t shm_bytes;
+    uint32_t buffer_count;
+    uint32_t commit_count;       /* commits since commit_window_ms */
+    uint32_t commit_window_ms;   /* start of the current one-second window */
+    uint64_t damage_area;        /* sum of cwc_surface::charged_area */
+
+    /* Oldest input event sent since the client last committed, 0 if none */
+    uint64_t input_ns;
+
+    /* Frame callbacks held back while over budget */
+    struct wl_list throttled_callbacks;
+    struct wl_event_source *throttle_timer; /* created the first time it is needed */
+    bool throttled;              /* over budget at the last frame, for logging */
 };
 
 /* Function declarations */
@@ -98,22 +204,47 @@ void cwc_server_destroy(struct cwc_server *server);
 cwc_error_t cwc_server_run(struct cwc_server *server);
 
 /* Logging functions */
-void cwc_log(struct cwc_server *server, cwc_log_level_t level, const char *format, ...);
+void cwc_log_write(struct cwc_server *server, cwc_log_level_t level, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+void cwc_log_write_document(struct cwc_server *server, char *data, size_t length);
 void cwc_log_init(struct cwc_server *server, const char *log_file);
 void cwc_log_cleanup(struct cwc_server *server);
 
+/* Arguments are not evaluated for filtered messages */
+#define cwc_log(server, level, ...) \
+    do { \
+        if ((level) <= CWC_LOG_MAX_LEVEL && (server) && (level) <= (server)->log_level) { \
+            cwc_log_write((server), (level), __VA_ARGS__); \
+        } \
+    } while (0)
+
 /* Utility functions */
 const char *cwc_error_string(cwc_error_t error);
 void cwc_print_version(void);
 void cwc_print_usage(const char *program_name);
+uint32_t cwc_time_msec(void);
+uint64_t cwc_time_nsec(void);
 
 /* Memory management helpers */
 void *cwc_malloc(size_t size);
 void *cwc_calloc(size_t nmemb, size_t size);
+void *cwc_realloc(void *ptr, size_t size);
 void cwc_free(void *ptr);
 
 /* Client management */
 void cwc_client_state_create(struct wl_client *client, struct cwc_server *server);
 void cwc_client_state_destroy(struct cwc_client_state *client_state);
+struct cwc_client_state *cwc_client_state_lookup(struct cwc_server *server, struct wl_client *client);
+void cwc_client_init(struct cwc_server *server);
+void cwc_client_finish(struct cwc_server *server);
+
+/* Budgets and throttling */
+extern const struct cwc_client_budget cwc_default_client_budget;
+bool cwc_client_budget_parse(const char *spec, struct cwc_client_budget *budget);
+bool cwc_client_state_over_budget(struct cwc_client_state *client_state);
+void cwc_client_state_note_commit(struct cwc_client_state *client_state);
+void cwc_client_buffer_created(struct cwc_server *server, struct wl_resource *resource);
+void cwc_client_buffer_destroyed(struct cwc_server *server, struct wl_resource *resource);
+void cwc_client_frame_done(struct cwc_server *server, struct wl_resource *callback, uint32_t time_ms);
 
 #endif /* CWC_H */
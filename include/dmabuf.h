@@ -0,0 +1,81 @@
+#ifndef CWC_DMABUF_H
+#define CWC_DMABUF_H
+
+#include "cwc.h"
+#include "buffer.h"
+#include <linux-dmabuf-unstable-v1-protocol.h>
+
+/* DRM fourcc codes and modifiers we deal in, as in libdrm's drm_fourcc.h */
+#ifndef DRM_FORMAT_ARGB8888
+#define DRM_FORMAT_ARGB8888 CWC_FOURCC('A', 'R', '2', '4')
+#endif
+#ifndef DRM_FORMAT_XRGB8888
+#define DRM_FORMAT_XRGB8888 CWC_FOURCC('X', 'R', '2', '4')
+#endif
+#ifndef DRM_FORMAT_MOD_LINEAR
+#define DRM_FORMAT_MOD_LINEAR 0ull
+#endif
+#ifndef DRM_FORMAT_MOD_INVALID
+#define DRM_FORMAT_MOD_INVALID 0x00ffffffffffffffull
+#endif
+
+/* Configuration constants */
+#define CWC_DMABUF_MAX_PLANES 4
+#define CWC_DMABUF_MAX_DIMENSION 16384
+
+struct cwc_dmabuf_plane {
+    int fd;                         /* -1 if not set */
+    uint32_t offset;
+    uint32_t stride;
+};
+
+/* Everything a client states about a dma-buf; owns the plane fds */
+struct cwc_dmabuf_attributes {
+    int32_t width, height;
+    uint32_t format;                /* DRM fourcc */
+    uint32_t flags;                 /* zwp_linux_buffer_params_v1 flags */
+    uint64_t modifier;
+    uint32_t n_planes;
+    struct cwc_dmabuf_plane planes[CWC_DMABUF_MAX_PLANES];
+};
+
+/* zwp_linux_buffer_params_v1, collects planes until create */
+struct cwc_dmabuf_params {
+    struct wl_resource *resource;
+    struct cwc_server *server;
+    struct cwc_dmabuf_attributes attributes;
+    bool modifier_set;
+    bool used;                      /* create or create_immed was called */
+};
+
+/*
+ * Imported dma-buf. Linear buffers are also mapped read-only so the
+ * software renderer can sample them; reads are bracketed with
+ * DMA_BUF_IOCTL_SYNC so the exporter flushes GPU caches first.
+ */
+struct cwc_dmabuf_buffer {
+    struct cwc_buffer base;         /* type CWC_BUFFER_DMABUF */
+    struct cwc_server *server;
+    struct cwc_dmabuf_attributes attributes;
+
+    const uchar *map_data;          /* plane 0 mapping, NULL if not CPU readable */
+    size_t map_size;
+
+    void *render_data;              /* renderer import, e.g. an EGLImage */
+};
+
+/* Function declarations */
+
+/* linux-dmabuf interface */
+cwc_error_t cwc_dmabuf_init(struct cwc_server *server);
+void cwc_dmabuf_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id);
+
+/* Buffers */
+struct cwc_dmabuf_buffer *cwc_dmabuf_buffer_from_resource(struct wl_resource *resource);
+const uchar *cwc_dmabuf_buffer_get_data(struct cwc_dmabuf_buffer *buffer);
+void cwc_dmabuf_sync(int fd, bool begin);
+
+/* Attributes */
+void cwc_dmabuf_attributes_finish(struct cwc_dmabuf_attributes *attributes);
+
+#endif /* CWC_DMABUF_H */
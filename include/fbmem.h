@@ -0,0 +1,39 @@
+#ifndef CWC_FBMEM_H
+#define CWC_FBMEM_H
+
+#include "cwc.h"
+
+/* Used when /proc/meminfo does not say otherwise */
+#define CWC_FBMEM_DEFAULT_HUGE_PAGE (2 * 1024 * 1024)
+
+/* How an allocation ended up backed, best first */
+enum cwc_fbmem_backing {
+    CWC_FBMEM_HUGETLB,              /* reserved huge pages, MAP_HUGETLB */
+    CWC_FBMEM_THP,                  /* transparent huge pages, MADV_HUGEPAGE */
+    CWC_FBMEM_PAGES,                /* ordinary pages */
+};
+
+/*
+ * Large, long-lived pixel memory such as output framebuffers. Always
+ * zero-filled and populated up front, so the first composite after a
+ * mode change does not fault in every page, and backed by huge pages
+ * when the system has any, which keeps a framebuffer walk from missing
+ * the TLB every 4K.
+ */
+struct cwc_fbmem {
+    void *data;                     /* NULL when nothing is allocated */
+    size_t size;                    /* bytes asked for */
+    size_t mapped;                  /* bytes mapped, size rounded up to the page size */
+    enum cwc_fbmem_backing backing;
+    uint64_t populate_ns;           /* time spent mapping and prefaulting */
+};
+
+/* Function declarations */
+void cwc_fbmem_alloc(struct cwc_fbmem *mem, size_t size);
+void cwc_fbmem_free(struct cwc_fbmem *mem);
+
+/* Bytes actually on huge pages; reads /proc/self/smaps, not for hot paths */
+size_t cwc_fbmem_huge_bytes(const struct cwc_fbmem *mem);
+const char *cwc_fbmem_backing_name(enum cwc_fbmem_backing backing);
+
+#endif /* CWC_FBMEM_H */
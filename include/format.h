@@ -0,0 +1,55 @@
+#ifndef CWC_FORMAT_H
+#define CWC_FORMAT_H
+
+#include "cwc.h"
+
+/* DRM fourcc codes, as in libdrm's drm_fourcc.h */
+#define CWC_FOURCC(a, b, c, d) \
+    ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+/*
+ * Client pixel formats, one row each:
+ *   X(id, wl_shm code, DRM fourcc, bytes per pixel, has alpha, native)
+ * "native" formats are laid out like the XRGB8888 framebuffer (B, G, R,
+ * A bytes) and go through the SIMD blend kernels; the others get
+ * composite loops specialized on their pixel decoder in format.c, so no
+ * loop ever switches on the format. Adding a format is a row here plus
+ * its decoder.
+ */
+#define CWC_FORMATS(X) \
+    X(ARGB8888,    WL_SHM_FORMAT_ARGB8888,    CWC_FOURCC('A', 'R', '2', '4'), 4, true,  true)  \
+    X(XRGB8888,    WL_SHM_FORMAT_XRGB8888,    CWC_FOURCC('X', 'R', '2', '4'), 4, false, true)  \
+    X(ABGR2101010, WL_SHM_FORMAT_ABGR2101010, CWC_FOURCC('A', 'B', '3', '0'), 4, true,  false) \
+    X(RGB565,      WL_SHM_FORMAT_RGB565,      CWC_FOURCC('R', 'G', '1', '6'), 2, false, false)
+
+enum cwc_format_id {
+#define CWC_FORMAT_ENUM(id, shm, drm, bpp, alpha, native) CWC_FORMAT_##id,
+    CWC_FORMATS(CWC_FORMAT_ENUM)
+#undef CWC_FORMAT_ENUM
+    CWC_FORMAT_COUNT
+};
+
+/* n pixels of src, in the format's layout, into an XRGB8888 row */
+typedef void (*cwc_format_row_func_t)(uint32_t *dst, const uchar *src, size_t n);
+
+struct cwc_format {
+    const char *name;
+    uint32_t shm_format;
+    uint32_t drm_format;
+    uint32_t bytes_per_pixel;
+    bool has_alpha;
+    bool native;
+    cwc_format_row_func_t fetch;    /* decode to premultiplied ARGB8888 */
+    cwc_format_row_func_t over;     /* premultiplied src over dst; copy without alpha */
+    cwc_format_row_func_t copy;     /* opaque copy, alpha forced to 0xff */
+};
+
+extern const struct cwc_format cwc_formats[CWC_FORMAT_COUNT];
+
+/* Function declarations */
+
+/* NULL for formats we do not accept */
+const struct cwc_format *cwc_format_from_shm(uint32_t shm_format);
+const struct cwc_format *cwc_format_from_drm(uint32_t drm_format);
+
+#endif /* CWC_FORMAT_H */
@@ -0,0 +1,39 @@
+#ifndef CWC_HASH_H
+#define CWC_HASH_H
+
+#include "cwc.h"
+
+/*
+ * Open-addressing hash table from 64-bit keys to pointers. Keys are
+ * usually object addresses (wl_client, wl_resource) cast through
+ * cwc_hash_ptr(). Lookup, insert and remove are O(1) on average; the
+ * table doubles once it is 3/4 full.
+ */
+struct cwc_hash_entry {
+    uint64_t key;
+    void *value;                    /* NULL marks an empty slot */
+};
+
+struct cwc_hash {
+    struct cwc_hash_entry *entries;
+    uint32_t capacity;              /* power of two, or 0 before first insert */
+    uint32_t count;
+};
+
+static inline uint64_t cwc_hash_ptr(const void *ptr) {
+    return (uint64_t)(uintptr_t)ptr;
+}
+
+#define cwc_hash_for_each(entry, hash) \
+    for ((entry) = (hash)->entries; \
+         (entry) && (entry) < (hash)->entries + (hash)->capacity; (entry)++) \
+        if ((entry)->value)
+
+/* Function declarations */
+void cwc_hash_init(struct cwc_hash *hash);
+void cwc_hash_fini(struct cwc_hash *hash);
+void *cwc_hash_lookup(const struct cwc_hash *hash, uint64_t key);
+void cwc_hash_insert(struct cwc_hash *hash, uint64_t key, void *value);
+void *cwc_hash_remove(struct cwc_hash *hash, uint64_t key);
+
+#endif /* CWC_HASH_H */
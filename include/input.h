@@ -0,0 +1,20 @@
+#ifndef CWC_INPUT_H
+#define CWC_INPUT_H
+
+#include "cwc.h"
+
+/* udev seat whose devices are opened */
+#define CWC_INPUT_SEAT "seat0"
+
+/*
+ * Input backend: libinput on the event loop, feeding server->seat. The
+ * devices belong to whoever drives the display, so it only starts with
+ * the DRM backend; virtual outputs are headless. udev enumeration can
+ * take a while, so the context is created on a startup thread.
+ */
+
+/* Function declarations */
+void cwc_input_init(struct cwc_server *server);
+void cwc_input_finish(struct cwc_server *server);
+
+#endif /* CWC_INPUT_H */
@@ -0,0 +1,61 @@
+#ifndef CWC_LOG_H
+#define CWC_LOG_H
+
+#include "cwc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Ring size in bytes, a power of two */
+#define CWC_LOG_RING_SIZE (256 * 1024)
+
+/* How long the drain thread sleeps when nobody wakes it, in ms */
+#define CWC_LOG_DRAIN_INTERVAL_MS 100
+
+/*
+ * Asynchronous logger. The dispatch thread formats each line into a
+ * single-producer/single-consumer byte ring; a background thread writes
+ * the ring to log_fd and does the fsync() that errors ask for. Producers
+ * never block: a full ring drops the message and counts it.
+ *
+ * Other threads may log too, but they bypass the ring and write their
+ * line directly so the ring keeps exactly one producer.
+ *
+ * Documents too large for a line, like stats dumps, are handed over as
+ * blobs instead of copied: each is written once the ring has drained up
+ * to where it was queued, so it keeps its place among the lines.
+ */
+struct cwc_log_blob {
+    char *data;                     /* malloc()ed, freed once written */
+    size_t length;
+    uint64_t head;                  /* ring bytes that go before it */
+    struct cwc_log_blob *next;
+};
+
+struct cwc_logger {
+    struct cwc_server *server;
+    int fd;
+    pthread_t thread;
+    pthread_t producer;             /* thread that owns the ring */
+    int wake_fd;                    /* eventfd */
+
+    char *ring;
+    _Atomic uint64_t head;          /* bytes produced, written by the producer */
+    _Atomic uint64_t tail;          /* bytes consumed, written by the drain thread */
+
+    pthread_mutex_t blob_lock;
+    struct cwc_log_blob *blobs;     /* oldest first */
+    struct cwc_log_blob **blob_tail;
+
+    atomic_bool sleeping;           /* drain thread is about to wait on wake_fd */
+    atomic_bool fsync_pending;
+    atomic_bool running;
+    _Atomic uint64_t dropped;
+};
+
+/* Function declarations */
+struct cwc_logger *cwc_logger_create(struct cwc_server *server, int fd);
+void cwc_logger_destroy(struct cwc_logger *logger);
+bool cwc_logger_push(struct cwc_logger *logger, const char *line, size_t length, bool urgent);
+bool cwc_logger_push_blob(struct cwc_logger *logger, char *data, size_t length);
+
+#endif /* CWC_LOG_H */
@@ -0,0 +1,69 @@
+#ifndef CWC_MEMORY_H
+#define CWC_MEMORY_H
+
+#include "cwc.h"
+
+/* How often the caches are held to --memory-budget */
+#define CWC_MEMORY_CHECK_MS 1000
+
+/* Nothing used more recently than this is evicted, so visible content does not thrash */
+#define CWC_MEMORY_MIN_IDLE_MS 2000
+
+/*
+ * PSI trigger: tasks stalled on memory this long within the window. The
+ * 2s window is the shortest unprivileged processes may use.
+ */
+#define CWC_MEMORY_PSI_STALL_US 150000
+#define CWC_MEMORY_PSI_WINDOW_US 2000000
+
+/*
+ * Something held only to go faster, dropped by the memory manager and
+ * rebuilt by its owner the next time it is needed: an SHM mapping is
+ * mapped again on the next access, a texture uploaded again in full on
+ * the next repaint that shows it.
+ */
+struct cwc_memory_entry {
+    uint64_t last_used_ns;
+    uint64_t bytes;
+    void (*evict)(void *owner, void *object);
+    void *owner;
+    void *object;
+};
+
+/* Candidates offered by the caches for one trim; dispatch thread only */
+struct cwc_memory_candidates {
+    struct cwc_memory_entry *entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t bytes;                 /* all offered entries */
+};
+
+/*
+ * Memory manager. Caches stay within the optional budget, evicting the
+ * least recently used first, and are emptied of everything idle when the
+ * kernel reports memory pressure, for the compositor's own cgroup when it
+ * has one: a container is OOM-killed at its limit long before the host
+ * runs short.
+ */
+struct cwc_memory {
+    struct cwc_server *server;
+    struct wl_event_source *check_timer;    /* only with server->memory_budget */
+
+    /* PSI trigger, watched for POLLPRI through an epoll fd of its own */
+    int psi_fd;
+    int epoll_fd;
+    struct wl_event_source *psi_source;
+};
+
+/* Function declarations */
+cwc_error_t cwc_memory_init(struct cwc_server *server);
+void cwc_memory_finish(struct cwc_server *server);
+
+/* Bytes with an optional K, M or G suffix */
+bool cwc_memory_budget_parse(const char *spec, uint64_t *bytes);
+
+/* For the caches' collect functions */
+void cwc_memory_offer(struct cwc_memory_candidates *candidates,
+                      const struct cwc_memory_entry *entry);
+
+#endif /* CWC_MEMORY_H */
@@ -2,28 +2,94 @@
 #define CWC_OUTPUT_H
 
 #include "cwc.h"
+#include "fbmem.h"
+#include "region.h"
+#include "stats.h"
 
 /* Output configuration */
+struct cwc_buffer;
+struct cwc_render_worker;
+
 struct cwc_output_config {
     int32_t x, y;
     int32_t width, height;
     int32_t physical_width, physical_height;
-    int32_t refresh_rate;
+    int32_t refresh_rate;           /* mHz, as in wl_output.mode */
     enum wl_output_subpixel subpixel;
     enum wl_output_transform transform;
     const char *make;
     const char *model;
 };
 
+/* Repaint cycle; exactly one composite per refresh interval */
+enum cwc_output_repaint_state {
+    CWC_OUTPUT_REPAINT_IDLE,        /* nothing to draw until new damage arrives */
+    CWC_OUTPUT_REPAINT_SCHEDULED,   /* timer armed for the repaint deadline */
+    CWC_OUTPUT_REPAINT_RENDERING,   /* snapshot handed to the render worker */
+    CWC_OUTPUT_REPAINT_PRESENTING,  /* frame composited, waiting for vblank */
+};
+
+/* Time before vblank at which the composite starts, capped at half a frame */
+#define CWC_OUTPUT_REPAINT_WINDOW_NS (7 * 1000000ull)
+
 /* Output state */
 struct cwc_output {
-    struct wl_list link;
-    struct wl_resource *resource;
+    struct wl_list link;            /* cwc_server::outputs */
+    struct wl_global *global;
+    struct wl_list resources;       /* wl_output resources bound by clients */
     struct cwc_server *server;
-    
+
     /* Output configuration */
     struct cwc_output_config config;
-    
+    uint32_t scene_bit;             /* this output in cwc_scene_node::output_mask */
+
+    /* Framebuffer, XRGB8888; stale while a client buffer is scanned out */
+    uint32_t *pixels;               /* fb.data */
+    int32_t stride;                 /* bytes */
+    struct cwc_fbmem fb;
+
+    /* Direct scanout: client buffer on screen instead of the framebuffer */
+    struct cwc_buffer *scanout_buffer;  /* locked, NULL while compositing */
+    struct cwc_buffer *scanout_pending; /* what the frame in flight shows */
+    bool scanout_flip;              /* the frame in flight replaces scanout_buffer */
+    bool scanout_rejected;          /* the backend could not show scanout_pending */
+
+    /* Damage since the last repaint, output-local coordinates */
+    struct cwc_region damage;
+
+    /* Repaint scheduling */
+    enum cwc_output_repaint_state repaint_state;
+    bool repaint_needed;            /* work arrived while a frame was in flight */
+    int frame_timer_fd;
+    struct wl_event_source *frame_timer_source;
+    uint64_t refresh_ns;
+    uint64_t next_vblank_ns;
+    uint64_t last_present_ns;
+    uint64_t frame_seq;
+    struct wl_list frame_callbacks; /* wl_callback resources released by the next present */
+    struct wl_list feedbacks;       /* wp_presentation_feedback resources, likewise */
+    uint32_t present_flags;         /* wp_presentation feedback kind of the frame in flight */
+    struct cwc_render_worker *worker;   /* NULL composites on the dispatch thread */
+    void *render_data;              /* renderer's per-output state, e.g. a GL framebuffer */
+    void *backend_data;             /* backend's per-output state, e.g. a DRM CRTC */
+
+    /* Screencopy, served from each presented frame, see screencopy.h */
+    struct wl_list screencopy_frames;   /* cwc_screencopy_frame::link */
+    struct wl_list screencopy_clients;  /* cwc_screencopy_client::link */
+    struct wl_event_source *screencopy_timer;   /* frames held back by a capture cap */
+
+    /* Instrumentation */
+    struct cwc_histogram composite_ns;
+    struct cwc_histogram frame_bytes;
+    struct cwc_histogram present_interval_ns;  /* between back-to-back presents */
+    uint64_t scanout_frames;        /* frames shown without compositing */
+    uint64_t *pending_commits;      /* commit times of surfaces in the frame in flight */
+    uint32_t n_pending_commits;
+    uint32_t pending_commits_capacity;
+    uint64_t *pending_inputs;       /* input times those commits answered */
+    uint32_t n_pending_inputs;
+    uint32_t pending_inputs_capacity;
+
     /* State tracking */
     bool enabled;
     time_t create_time;
@@ -39,15 +105,28 @@ void cwc_output_bind(struct wl_client *client, void *data, uint32_t version, uin
 void cwc_output_release(struct wl_client *client, struct wl_resource *resource);
 
 /* Output management */
-struct cwc_output *cwc_output_create(struct wl_client *client, struct cwc_server *server, uint32_t id);
+struct cwc_output *cwc_output_create(struct cwc_server *server, const struct cwc_output_config *config);
 void cwc_output_destroy(struct cwc_output *output);
 void cwc_output_send_geometry(struct cwc_output *output);
 void cwc_output_send_mode(struct cwc_output *output);
 void cwc_output_send_done(struct cwc_output *output);
+void cwc_output_get_box(const struct cwc_output *output, struct cwc_box *box);
 
 /* Configuration */
 void cwc_output_configure(struct cwc_output *output, const struct cwc_output_config *config);
 bool cwc_output_config_validate(const struct cwc_output_config *config);
+bool cwc_output_config_parse(const char *spec, struct cwc_output_config *config);
+
+/* Damage and repaint */
+void cwc_output_damage_whole(struct cwc_output *output);
+void cwc_output_damage_region(struct cwc_output *output, const struct cwc_region *damage);
+void cwc_output_damage_layout(struct cwc_server *server, const struct cwc_region *damage);
+void cwc_output_schedule_repaint(struct cwc_output *output);
+bool cwc_output_repaint(struct cwc_output *output);
+void cwc_output_present_done(struct cwc_output *output, uint64_t present_ns);
+
+/* Backend: scanout_pending cannot be shown, composite the frame */
+void cwc_output_scanout_rejected(struct cwc_output *output);
 
 /* Resource cleanup */
 void cwc_output_resource_destroy(struct wl_resource *resource);
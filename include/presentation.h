@@ -0,0 +1,22 @@
+#ifndef CWC_PRESENTATION_H
+#define CWC_PRESENTATION_H
+
+#include "cwc.h"
+#include <presentation-time-protocol.h>
+
+struct cwc_output;
+
+/*
+ * wp_presentation_feedback resources are kept in wl_lists through their
+ * resource link, like frame callbacks: pending on the surface until the
+ * commit, then on the surface until an output repaint claims them, then
+ * on the output until the frame is presented or the output goes away.
+ */
+
+/* Function declarations */
+cwc_error_t cwc_presentation_init(struct cwc_server *server);
+void cwc_presentation_feedback_discard(struct cwc_server *server, struct wl_list *feedbacks);
+void cwc_presentation_feedback_present(struct cwc_output *output, struct wl_list *feedbacks,
+                                       uint64_t present_ns, uint32_t flags);
+
+#endif /* CWC_PRESENTATION_H */
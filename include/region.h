@@ -0,0 +1,71 @@
+#ifndef CWC_REGION_H
+#define CWC_REGION_H
+
+#include "cwc.h"
+
+/* Damage regions with more rectangles than this are collapsed to their extents */
+#define CWC_REGION_MAX_DAMAGE_RECTS 32
+
+/* Axis-aligned box, half-open: covers [x1, x2) x [y1, y2) */
+struct cwc_box {
+    int32_t x1, y1;
+    int32_t x2, y2;
+};
+
+/*
+ * Rectangle region in the spirit of pixman_region32_t: a set of
+ * non-overlapping boxes plus their bounding box. An empty region has
+ * n_rects == 0 and zero-sized extents.
+ */
+struct cwc_region {
+    struct cwc_box extents;
+    struct cwc_box *rects;
+    uint32_t n_rects;
+    uint32_t capacity;
+};
+
+/* Function declarations */
+
+/* Lifetime */
+void cwc_region_init(struct cwc_region *region);
+void cwc_region_init_rect(struct cwc_region *region, int32_t x, int32_t y,
+                          int32_t width, int32_t height);
+void cwc_region_fini(struct cwc_region *region);
+void cwc_region_clear(struct cwc_region *region);
+void cwc_region_copy(struct cwc_region *dst, const struct cwc_region *src);
+
+/* Queries */
+bool cwc_region_is_empty(const struct cwc_region *region);
+bool cwc_region_contains_box(const struct cwc_region *region, const struct cwc_box *box);
+bool cwc_region_intersects_box(const struct cwc_region *region, const struct cwc_box *box);
+uint64_t cwc_region_area(const struct cwc_region *region);
+
+/* Set operations, all in place on the first argument */
+void cwc_region_union_rect(struct cwc_region *region, int32_t x, int32_t y,
+                           int32_t width, int32_t height);
+void cwc_region_union_box(struct cwc_region *region, const struct cwc_box *box);
+void cwc_region_union(struct cwc_region *dst, const struct cwc_region *src);
+void cwc_region_subtract_rect(struct cwc_region *region, int32_t x, int32_t y,
+                              int32_t width, int32_t height);
+void cwc_region_subtract_box(struct cwc_region *region, const struct cwc_box *box);
+void cwc_region_subtract(struct cwc_region *dst, const struct cwc_region *src);
+void cwc_region_intersect_box(struct cwc_region *region, const struct cwc_box *box);
+void cwc_region_intersect(struct cwc_region *dst, const struct cwc_region *src);
+void cwc_region_translate(struct cwc_region *region, int32_t dx, int32_t dy);
+void cwc_region_simplify(struct cwc_region *region, uint32_t max_rects);
+
+/* Box helpers */
+static inline bool cwc_box_is_empty(const struct cwc_box *box) {
+    return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+static inline bool cwc_box_intersect(struct cwc_box *dst, const struct cwc_box *a,
+                                     const struct cwc_box *b) {
+    dst->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    dst->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    dst->x2 = a->x2 < b->x2 ? a->x2 : b->x2;
+    dst->y2 = a->y2 < b->y2 ? a->y2 : b->y2;
+    return !cwc_box_is_empty(dst);
+}
+
+#endif /* CWC_REGION_H */
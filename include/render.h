@@ -0,0 +1,72 @@
+#ifndef CWC_RENDER_H
+#define CWC_RENDER_H
+
+#include "cwc.h"
+#include "region.h"
+
+struct cwc_buffer;
+struct cwc_output;
+struct cwc_renderer;
+struct cwc_shm_pool;
+struct cwc_thread_pool;
+
+/* Colour of output areas not covered by any surface, XRGB8888 */
+#define CWC_BACKGROUND_COLOR 0xff1e1e1eu
+
+/* Edge of the square tiles a composite is split into for the thread pool */
+#define CWC_RENDER_TILE_SIZE 64
+
+/* One surface as it was at the repaint deadline */
+struct cwc_render_item {
+    struct cwc_buffer *buffer;      /* locked; only touched on the dispatch thread */
+    struct cwc_shm_pool *pool;      /* SHM: pinned for the lifetime of the snapshot */
+    const void *map_data;           /* SHM: pool mapping the pixels live in */
+    size_t map_size;
+    int sync_fd;                    /* dma-buf: fd to bracket reads with, else -1 */
+    const uchar *pixels;
+    int32_t stride;
+    struct cwc_box box;             /* layout coordinates */
+    struct cwc_region opaque;       /* layout coordinates */
+
+    /* Renderer cache entry and the part of it to refresh, surface-local */
+    void *render_data;
+    struct cwc_region upload;
+    uint64_t upload_seq;
+};
+
+/*
+ * Immutable copy of everything a composite needs. Taken on the dispatch
+ * thread, drawn on a render worker, released on the dispatch thread, so
+ * protocol requests arriving meanwhile never race with the renderer.
+ */
+struct cwc_render_snapshot {
+    struct cwc_output *output;
+    struct cwc_renderer *renderer;
+    struct cwc_render_item *items;  /* front to back */
+    uint32_t count;
+    struct cwc_region damage;       /* output-local */
+
+    /* Target framebuffer and its place in the layout */
+    uint32_t *pixels;
+    int32_t stride;
+    struct cwc_box box;
+
+    /* Damaged tiles are drawn in parallel here; NULL draws in one pass */
+    struct cwc_thread_pool *thread_pool;
+
+    /* Filled in by cwc_render_snapshot_draw() */
+    uint64_t bytes;
+    uint64_t render_ns;
+};
+
+/* Function declarations */
+
+/* Snapshots */
+struct cwc_render_snapshot *cwc_render_snapshot_take(struct cwc_output *output,
+                                                     struct cwc_region *damage);
+void cwc_render_snapshot_release(struct cwc_render_snapshot *snapshot);
+
+/* Composition through the snapshot's renderer, safe on any thread */
+void cwc_render_snapshot_draw(struct cwc_render_snapshot *snapshot);
+
+#endif /* CWC_RENDER_H */
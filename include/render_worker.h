@@ -0,0 +1,40 @@
+#ifndef CWC_RENDER_WORKER_H
+#define CWC_RENDER_WORKER_H
+
+#include "cwc.h"
+#include <pthread.h>
+
+struct cwc_render_snapshot;
+
+typedef void (*cwc_render_done_func_t)(struct cwc_render_snapshot *snapshot, void *data);
+
+/*
+ * A thread that draws one snapshot at a time. Completion is signalled
+ * through an eventfd on the event loop, so the done callback always runs
+ * on the dispatch thread.
+ */
+struct cwc_render_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;            /* job submitted, finished, or quit requested */
+
+    struct cwc_render_snapshot *job;    /* submitted, not picked up yet */
+    struct cwc_render_snapshot *done;   /* drawn, not collected yet */
+    bool busy;                          /* a job is queued or being drawn */
+    bool quit;
+
+    int done_fd;                    /* eventfd */
+    struct wl_event_source *done_source;
+    cwc_render_done_func_t done_func;
+    void *data;
+};
+
+/* Function declarations */
+struct cwc_render_worker *cwc_render_worker_create(struct cwc_server *server, const char *name,
+                                                   cwc_render_done_func_t done_func, void *data);
+void cwc_render_worker_destroy(struct cwc_render_worker *worker);
+void cwc_render_worker_submit(struct cwc_render_worker *worker,
+                              struct cwc_render_snapshot *snapshot);
+void cwc_render_worker_wait(struct cwc_render_worker *worker);
+
+#endif /* CWC_RENDER_WORKER_H */
@@ -0,0 +1,68 @@
+#ifndef CWC_RENDERER_H
+#define CWC_RENDERER_H
+
+#include "cwc.h"
+
+struct cwc_buffer;
+struct cwc_memory_candidates;
+struct cwc_output;
+struct cwc_render_item;
+struct cwc_render_snapshot;
+struct cwc_renderer;
+struct cwc_surface;
+
+/*
+ * Renderer backend. Every hook except draw runs on the dispatch thread;
+ * draw runs on render workers and must only touch the snapshot and the
+ * renderer's own locked state. Hooks a backend has no use for are NULL.
+ */
+struct cwc_renderer_impl {
+    const char *name;
+    void (*destroy)(struct cwc_renderer *renderer);
+
+    /* surface->current->damage holds what the commit changed, surface-local */
+    void (*surface_commit)(struct cwc_renderer *renderer, struct cwc_surface *surface);
+    void (*surface_destroy)(struct cwc_renderer *renderer, struct cwc_surface *surface);
+    void (*buffer_destroy)(struct cwc_renderer *renderer, struct cwc_buffer *buffer);
+    void (*output_destroy)(struct cwc_renderer *renderer, struct cwc_output *output);
+
+    /* Per-item state carried by a snapshot from take to release */
+    void (*item_capture)(struct cwc_renderer *renderer, struct cwc_render_item *item,
+                         struct cwc_surface *surface);
+    void (*item_release)(struct cwc_renderer *renderer, struct cwc_render_item *item);
+
+    /* Offer cached contents the memory manager may evict, see memory.h */
+    void (*memory_collect)(struct cwc_renderer *renderer,
+                           struct cwc_memory_candidates *candidates);
+
+    /* Composite snapshot->damage into the output framebuffer */
+    void (*draw)(struct cwc_renderer *renderer, struct cwc_render_snapshot *snapshot);
+};
+
+struct cwc_renderer {
+    const struct cwc_renderer_impl *impl;
+    struct cwc_server *server;
+};
+
+/* Function declarations */
+
+/*
+ * "software", "gles2", or NULL/"auto" for the best one that initializes.
+ * Sets server->renderer; GLES2 replaces it later from the event loop.
+ */
+void cwc_renderer_init(struct cwc_server *server, const char *name);
+void cwc_renderer_destroy(struct cwc_renderer *renderer);
+
+/* Backends */
+struct cwc_renderer *cwc_renderer_create_software(struct cwc_server *server);
+struct cwc_renderer *cwc_renderer_create_gles2(struct cwc_server *server);
+
+/* Hook wrappers, no-ops where the backend does not implement them */
+void cwc_renderer_surface_commit(struct cwc_renderer *renderer, struct cwc_surface *surface);
+void cwc_renderer_surface_destroy(struct cwc_renderer *renderer, struct cwc_surface *surface);
+void cwc_renderer_buffer_destroy(struct cwc_renderer *renderer, struct cwc_buffer *buffer);
+void cwc_renderer_output_destroy(struct cwc_renderer *renderer, struct cwc_output *output);
+void cwc_renderer_memory_collect(struct cwc_renderer *renderer,
+                                 struct cwc_memory_candidates *candidates);
+
+#endif /* CWC_RENDERER_H */
@@ -0,0 +1,92 @@
+#ifndef CWC_SCENE_H
+#define CWC_SCENE_H
+
+#include "cwc.h"
+#include "region.h"
+#include "spatial.h"
+
+/* Outputs get one bit each in cwc_scene_node::output_mask */
+#define CWC_SCENE_MAX_OUTPUTS 32
+
+enum cwc_scene_node_type {
+    CWC_SCENE_NODE_TREE,            /* positions and shows or hides its children */
+    CWC_SCENE_NODE_BUFFER,          /* a surface's contents */
+};
+
+enum cwc_scene_dirty {
+    CWC_SCENE_DIRTY_GEOMETRY = 1 << 0,  /* position, size or enabled changed */
+    CWC_SCENE_DIRTY_CONTENT = 1 << 1,   /* buffer node has damage to hand out */
+    CWC_SCENE_DIRTY_BOUNDS = 1 << 2,    /* tree bounds need recomputing */
+};
+
+/*
+ * Retained scene. Every node caches its world position, world-space box,
+ * visibility and the outputs it overlaps. Changes only mark the node and
+ * queue it on the scene; cwc_scene_update() then recomputes the dirty
+ * subtrees alone, so the cost of a commit does not grow with the number
+ * of surfaces. Tree bounds are only needed on demand, so their staleness
+ * just propagates upward and they are recomputed when asked for.
+ */
+struct cwc_scene_node {
+    enum cwc_scene_node_type type;
+    struct cwc_scene_node *parent;  /* NULL for the root */
+    struct wl_list link;            /* parent's children, back to front */
+    struct wl_list children;        /* trees only */
+    void *data;
+
+    /* Set by the owner */
+    int32_t x, y;                   /* relative to the parent */
+    int32_t width, height;          /* buffer nodes */
+    bool enabled;
+    struct cwc_region damage;       /* buffer nodes, node-local, since the last update */
+
+    /* Cached, valid once the node is clean */
+    int32_t world_x, world_y;
+    struct cwc_box box;             /* world space, empty when invisible; trees: bounds */
+    bool visible;                   /* enabled up to the root, and not empty */
+    uint32_t output_mask;           /* buffer nodes: scene_bit of each output overlapped */
+    struct cwc_spatial_entry spatial;   /* buffer nodes, data is the owner */
+
+    uint32_t dirty;                 /* enum cwc_scene_dirty */
+    struct wl_list dirty_link;      /* cwc_scene::dirty while geometry or content is dirty */
+};
+
+struct cwc_scene {
+    struct cwc_server *server;
+    struct cwc_scene_node root;
+    struct wl_list dirty;           /* cwc_scene_node::dirty_link */
+    uint32_t output_bits;           /* cwc_output::scene_bit values in use */
+};
+
+/* Function declarations */
+void cwc_scene_init(struct cwc_scene *scene, struct cwc_server *server);
+void cwc_scene_fini(struct cwc_scene *scene);
+
+/* Nodes start disabled, on top of their parent's children */
+void cwc_scene_node_init(struct cwc_scene *scene, struct cwc_scene_node *node,
+                         enum cwc_scene_node_type type, struct cwc_scene_node *parent,
+                         void *data);
+void cwc_scene_node_remove(struct cwc_scene *scene, struct cwc_scene_node *node);
+
+/* Mutations only mark the node; they take effect at the next update */
+void cwc_scene_node_set_position(struct cwc_scene *scene, struct cwc_scene_node *node,
+                                 int32_t x, int32_t y);
+void cwc_scene_node_set_size(struct cwc_scene *scene, struct cwc_scene_node *node,
+                             int32_t width, int32_t height);
+void cwc_scene_node_set_enabled(struct cwc_scene *scene, struct cwc_scene_node *node,
+                                bool enabled);
+void cwc_scene_node_damage(struct cwc_scene *scene, struct cwc_scene_node *node,
+                           const struct cwc_region *damage);
+
+/* Recompute dirty subtrees and damage the outputs that show the changes */
+void cwc_scene_update(struct cwc_scene *scene);
+
+/* Union of every visible box in the subtree */
+void cwc_scene_node_get_bounds(struct cwc_scene_node *node, struct cwc_box *box);
+
+/* Output membership */
+uint32_t cwc_scene_output_bit_alloc(struct cwc_scene *scene);
+void cwc_scene_output_bit_free(struct cwc_scene *scene, uint32_t bit);
+void cwc_scene_outputs_changed(struct cwc_scene *scene);
+
+#endif /* CWC_SCENE_H */
@@ -0,0 +1,59 @@
+#ifndef CWC_SCREENCOPY_H
+#define CWC_SCREENCOPY_H
+
+#include "cwc.h"
+#include "region.h"
+#include <wlr-screencopy-unstable-v1-protocol.h>
+
+/* Client buffers per capture client whose contents are tracked */
+#define CWC_SCREENCOPY_TARGETS 4
+
+/*
+ * A client buffer a copy wrote, and what changed on screen since. The
+ * next copy into it only rewrites that damage; capture tools cycle
+ * through a couple of buffers, so a few slots cover them.
+ */
+struct cwc_screencopy_target {
+    struct wl_resource *buffer;     /* NULL for a free slot */
+    struct wl_listener buffer_destroy;
+    struct cwc_box box;             /* output-local area it holds */
+    struct cwc_region damage;       /* output-local, stale part of its contents */
+    uint64_t copy_seq;              /* the oldest slot is replaced first */
+};
+
+/*
+ * One capture client on one output: the damage it has not been told
+ * about, the buffers it copies into and when it got its last frame.
+ */
+struct cwc_screencopy_client {
+    struct wl_list link;            /* cwc_output::screencopy_clients */
+    struct cwc_output *output;
+    struct wl_client *client;
+    struct wl_listener client_destroy;
+    struct cwc_region damage;       /* output-local, since its last copy */
+    uint64_t last_copy_ns;          /* for cwc_client_budget::captures_per_sec */
+    uint64_t copy_seq;
+    struct cwc_screencopy_target targets[CWC_SCREENCOPY_TARGETS];
+};
+
+/* zwlr_screencopy_frame_v1 */
+struct cwc_screencopy_frame {
+    struct wl_resource *resource;
+    struct cwc_output *output;      /* NULL once ready or failed */
+    struct wl_list link;            /* cwc_output::screencopy_frames */
+    struct cwc_box box;             /* output-local */
+    bool used;                      /* copy requested, waiting for a frame */
+    bool with_damage;               /* and for damage inside box */
+    struct wl_resource *buffer;     /* wl_shm destination */
+    struct wl_listener buffer_destroy;
+};
+
+/* Function declarations */
+cwc_error_t cwc_screencopy_init(struct cwc_server *server);
+
+/* Output hooks: framebuffer damage of the frame in flight, and its present */
+void cwc_screencopy_output_damage(struct cwc_output *output, const struct cwc_region *damage);
+void cwc_screencopy_output_flush(struct cwc_output *output, uint64_t present_ns);
+void cwc_screencopy_output_destroy(struct cwc_output *output);
+
+#endif /* CWC_SCREENCOPY_H */
@@ -0,0 +1,67 @@
+#ifndef CWC_SEAT_H
+#define CWC_SEAT_H
+
+#include "cwc.h"
+#include <relative-pointer-unstable-v1-protocol.h>
+
+/* Pointer buttons held at once that are tracked for the implicit grab */
+#define CWC_SEAT_MAX_BUTTONS 16
+
+/*
+ * The one seat, "seat0", with its pointer. Input backends feed it device
+ * events with their CLOCK_MONOTONIC timestamps; it tracks the pointer in
+ * layout coordinates, finds the surface under it through the spatial
+ * index and delivers wl_pointer and zwp_relative_pointer_v1 events.
+ *
+ * Absolute motion is coalesced: a client gets at most one wl_pointer.motion
+ * per frame of the output under the pointer, the latest position, sent
+ * with the present that releases its frame callback. Clients that bound
+ * a relative pointer, games and CAD tools that want every sample, get
+ * each one as it arrives.
+ */
+struct cwc_seat {
+    struct cwc_server *server;
+    struct wl_global *global;
+    struct wl_global *relative_pointer_global;
+    struct wl_list resources;           /* wl_seat resources */
+    struct wl_list pointers;            /* wl_pointer resources */
+    struct wl_list relative_pointers;   /* zwp_relative_pointer_v1 resources */
+    uint32_t capabilities;              /* wl_seat.capability advertised */
+
+    /* Pointer position in layout coordinates */
+    double x, y;
+
+    /* Surface under the pointer, or holding the implicit grab */
+    struct cwc_surface *focus;
+    struct wl_listener focus_destroy;
+    uint32_t buttons[CWC_SEAT_MAX_BUTTONS];
+    uint32_t n_buttons;
+
+    /* Motion not delivered yet; motion_ns is the oldest sample behind it */
+    bool motion_pending;
+    uint64_t motion_ns;
+    uint64_t time_ns;                   /* latest event */
+    uint64_t motion_frame_seq;          /* frame of the output that got the last motion */
+    struct wl_listener dispatch_done;
+};
+
+/* Function declarations */
+cwc_error_t cwc_seat_init(struct cwc_server *server);
+void cwc_seat_finish(struct cwc_server *server);
+void cwc_seat_set_capabilities(struct cwc_seat *seat, uint32_t capabilities);
+
+/* Device events from an input backend, time_ns is CLOCK_MONOTONIC */
+void cwc_seat_pointer_motion(struct cwc_seat *seat, uint64_t time_ns, double dx, double dy,
+                             double dx_unaccel, double dy_unaccel);
+/* Absolute devices: x and y in [0, 1] across the layout */
+void cwc_seat_pointer_motion_absolute(struct cwc_seat *seat, uint64_t time_ns,
+                                      double x, double y);
+void cwc_seat_pointer_button(struct cwc_seat *seat, uint64_t time_ns, uint32_t button,
+                             bool pressed);
+void cwc_seat_pointer_axis(struct cwc_seat *seat, uint64_t time_ns, uint32_t axis,
+                           double value);
+
+/* Output hook: its frame was presented, right before frame callbacks are released */
+void cwc_seat_output_presented(struct cwc_output *output);
+
+#endif /* CWC_SEAT_H */
@@ -2,21 +2,71 @@
 #define CWC_SHM_H
 
 #include "cwc.h"
+#include "buffer.h"
+#include <stdatomic.h>
 
-/* SHM pool state */
-struct cwc_shm_pool {
-    struct wl_list link;
-    struct wl_resource *resource;
-    struct cwc_server *server;
-    
-    /* Memory mapping */
+/* A superseded mapping kept alive for in-flight renders */
+struct cwc_shm_retired {
     void *data;
     size_t size;
+    struct cwc_shm_retired *next;
+};
+
+/*
+ * A mapping of one client file, keyed by (st_dev, st_ino). Pools created
+ * on the same memfd share it, and it outlives its last pool for a short
+ * while so that a client recreating the pool does not pay for mmap,
+ * munmap and the page faults again.
+ *
+ * The memory manager may unmap a live mapping that is not pinned; data
+ * is then NULL and the next access maps the fd again. Render workers
+ * must therefore only ever read a mapping they hold a pin on.
+ */
+struct cwc_shm_mapping {
+    struct wl_list link;            /* cwc_shm::mappings */
+    dev_t dev;
+    ino_t ino;
+    void *data;                     /* NULL while evicted */
+    size_t size;                    /* largest size any pool asked for */
     int fd;
-    
-    /* Reference counting */
+    uint64_t last_used_ns;          /* last access or pin, or when it went idle */
+
+    int ref_count;                  /* pools using it; idle in the cache at zero */
+    bool poisoned;                  /* SIGBUS replaced pages, never reuse */
+
+    /* Shared writable mapping of the same file, screencopy only; NULL until needed */
+    void *write_data;
+    size_t write_size;
+
+    /* Render snapshots reading the mapping; resizes must not move it meanwhile */
+    int pin_count;
+    struct cwc_shm_retired *retired;    /* old mappings, unmapped at the last unpin */
+};
+
+/*
+ * SHM pool state. The client's fd is mapped when the pool is created and
+ * stays mapped for as long as any buffer in it is alive, so the renderer
+ * can sample client pixels in place.
+ */
+struct cwc_shm_pool {
+    struct wl_list link;            /* cwc_shm::pools */
+    struct wl_resource *resource;   /* NULL once the client destroyed the pool */
+    struct cwc_server *server;
+    struct cwc_shm *shm;
+    struct wl_list buffers;         /* cwc_shm_buffer::link */
+    struct cwc_client_state *client_state;  /* NULL once the client is gone */
+    struct wl_list client_link;     /* cwc_client_state::shm_pools */
+
+    /* Memory mapping, possibly shared with other pools on the same file */
+    struct cwc_shm_mapping *map;
+    size_t size;                    /* size the client declared */
+
+    /* Reference counting: one for the resource, one per live buffer */
     int ref_count;
-    
+
+    /* Set by the SIGBUS handler when the client truncated the fd */
+    atomic_bool sigbus_hit;
+
     /* Security limits */
     size_t max_size;
     time_t create_time;
@@ -24,36 +74,43 @@ struct cwc_shm_pool {
 
 /* SHM buffer */
 struct cwc_shm_buffer {
-    struct wl_list link;
-    struct wl_resource *resource;
+    struct cwc_buffer base;         /* type CWC_BUFFER_SHM */
+    struct wl_list link;            /* cwc_shm_pool::buffers */
     struct cwc_shm_pool *pool;
-    
+
     /* Buffer properties */
     int32_t offset;
-    int32_t width, height;
     int32_t stride;
-    uint32_t format;
-    
-    /* State */
-    bool busy;
+
     time_t create_time;
 };
 
-/* SHM resource */
+/* SHM resource, kept until its last pool is gone so limits stay accurate */
 struct cwc_shm {
-    struct wl_list link;
-    struct wl_resource *resource;
+    struct wl_list link;            /* cwc_server::shms */
+    struct wl_resource *resource;   /* NULL once the client released wl_shm */
     struct cwc_server *server;
     struct wl_list pools;  /* cwc_shm_pool::link */
+    struct wl_list mappings;        /* cwc_shm_mapping::link, live and idle */
+    int idle_mappings;
+    struct wl_event_source *idle_timer;
 };
 
-/* Configuration constants */
+/* Hard limits, errors when exceeded; usage is throttled by cwc_client_budget */
 #define CWC_SHM_MAX_POOL_SIZE (64 * 1024 * 1024)  /* 64MB */
 #define CWC_SHM_MAX_POOLS_PER_CLIENT 10
 
+/* Nested pixel accesses per thread, a copy between two pools needs both */
+#define CWC_SHM_ACCESS_DEPTH 2
+
+/* Unused mappings kept per wl_shm, and for how long */
+#define CWC_SHM_IDLE_MAPPINGS 4
+#define CWC_SHM_IDLE_MAPPING_MS 1000
+
 /* Function declarations */
 
 /* SHM interface */
+cwc_error_t cwc_shm_init(struct cwc_server *server);
 void cwc_shm_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id);
 void cwc_shm_create_pool(struct wl_client *client, struct wl_resource *resource,
                         uint32_t id, int32_t fd, int32_t size);
@@ -72,7 +129,28 @@ struct cwc_shm_buffer *cwc_shm_buffer_create(struct wl_client *client, struct cw
                                             uint32_t id, int32_t offset, int32_t width, int32_t height,
                                             int32_t stride, uint32_t format);
 void cwc_shm_buffer_destroy(struct cwc_shm_buffer *buffer);
+struct cwc_shm_buffer *cwc_shm_buffer_from_resource(struct wl_resource *resource);
+/* Dispatch thread; NULL if an evicted mapping cannot be mapped again */
 void *cwc_shm_buffer_get_data(struct cwc_shm_buffer *buffer);
+void *cwc_shm_buffer_get_writable(struct cwc_shm_buffer *buffer);
+
+/* Mapping pins, dispatch thread only */
+void cwc_shm_pool_pin(struct cwc_shm_pool *pool);
+void cwc_shm_pool_unpin(struct cwc_shm_pool *pool);
+
+/*
+ * Pixel access, guards against clients truncating the fd under us. Safe
+ * on render workers, and nests up to CWC_SHM_ACCESS_DEPTH deep;
+ * cwc_shm_pool_check_access() reports a fault to the client afterwards
+ * from the dispatch thread.
+ */
+void cwc_shm_access_begin(struct cwc_shm_pool *pool, const void *data, size_t size);
+void cwc_shm_access_end(void);
+void cwc_shm_pool_check_access(struct cwc_shm_pool *pool);
+
+/* Offer mappings not pinned to the memory manager, see memory.h */
+struct cwc_memory_candidates;
+void cwc_shm_memory_collect(struct cwc_server *server, struct cwc_memory_candidates *candidates);
 
 /* Validation functions */
 bool cwc_shm_format_supported(uint32_t format);
@@ -0,0 +1,63 @@
+#ifndef CWC_SLAB_H
+#define CWC_SLAB_H
+
+#include "cwc.h"
+#include <stdatomic.h>
+
+/* Bytes per page a slab grows by; pages are kept until the slab is destroyed */
+#define CWC_SLAB_PAGE_SIZE (16 * 1024)
+
+/* Smallest and largest size class served by cwc_slab_alloc_size() */
+#define CWC_SLAB_MIN_CLASS 64
+#define CWC_SLAB_MAX_CLASS 1024
+
+/*
+ * Fixed-size object cache. Freed objects go on an intrusive free list and
+ * are handed out again before a new page is carved, so long-lived
+ * processes with heavy churn stop fragmenting the heap.
+ *
+ * Typed slabs are only used from the dispatch thread; slabs created with
+ * threadsafe set guard their free list with a spinlock.
+ */
+struct cwc_slab {
+    const char *name;
+    size_t object_size;
+    bool threadsafe;
+
+    size_t stride;                  /* object_size rounded up for alignment */
+    size_t objects_per_page;
+    void *free_list;
+    void *pages;                    /* singly linked through the page header */
+    atomic_flag lock;
+    struct cwc_slab *next;          /* registry of slabs in use */
+    bool registered;
+
+#ifdef DEBUG
+    /* Per-type accounting, exposed by cwc_slab_log_stats() */
+    size_t live;
+    size_t peak;
+    size_t page_count;
+#endif
+};
+
+#define CWC_SLAB_INIT(type_name, size) \
+    { .name = (type_name), .object_size = (size), .threadsafe = false, .lock = ATOMIC_FLAG_INIT }
+#define CWC_SLAB_INIT_THREADSAFE(type_name, size) \
+    { .name = (type_name), .object_size = (size), .threadsafe = true, .lock = ATOMIC_FLAG_INIT }
+
+/* Function declarations */
+
+/* Typed object caches */
+void *cwc_slab_alloc(struct cwc_slab *slab);
+void cwc_slab_free(struct cwc_slab *slab, void *ptr);
+void cwc_slab_destroy(struct cwc_slab *slab);
+
+/* Size classes for variable-sized arrays (damage rectangles and the like) */
+void *cwc_slab_alloc_size(size_t size);
+void cwc_slab_free_size(void *ptr, size_t size);
+
+/* Statistics */
+void cwc_slab_log_stats(struct cwc_server *server);
+void cwc_slab_destroy_all(void);
+
+#endif /* CWC_SLAB_H */
@@ -0,0 +1,34 @@
+#ifndef CWC_SOCKET_H
+#define CWC_SOCKET_H
+
+#include "cwc.h"
+#include <sys/un.h>
+
+/* Connections accepted per wakeup before other event sources get a turn */
+#define CWC_SOCKET_ACCEPT_BATCH 64
+
+/* Pending connections the kernel queues, capped by net.core.somaxconn */
+#define CWC_SOCKET_BACKLOG 4096
+
+/* Pause before accepting again once out of file descriptors */
+#define CWC_SOCKET_EMFILE_RETRY_MS 100
+
+/*
+ * The Wayland listening socket. libwayland's own accepts one connection
+ * per wakeup with a backlog of 128; this one drains the queue in batches
+ * and rejects clients over the limit before any state is created.
+ */
+struct cwc_socket {
+    int fd;
+    int lock_fd;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    char lock_path[sizeof(((struct sockaddr_un *)0)->sun_path) + 5];
+    struct wl_event_source *source;
+    struct wl_event_source *retry_timer;    /* re-enables accepting after EMFILE */
+};
+
+/* Function declarations */
+cwc_error_t cwc_socket_init(struct cwc_server *server);
+void cwc_socket_finish(struct cwc_server *server);
+
+#endif /* CWC_SOCKET_H */
@@ -0,0 +1,51 @@
+#ifndef CWC_SPATIAL_H
+#define CWC_SPATIAL_H
+
+#include "cwc.h"
+#include "hash.h"
+#include "region.h"
+
+/* Grid cell edge in layout pixels, as a shift */
+#define CWC_SPATIAL_CELL_SHIFT 9
+
+/* Entries covering more cells than this live on a list every query checks */
+#define CWC_SPATIAL_MAX_CELLS 1024
+
+/*
+ * Uniform grid over layout coordinates. Only occupied cells exist, kept
+ * in a hash keyed by cell coordinate, so the layout can be arbitrarily
+ * large and sparse. An entry is embedded in the object it indexes.
+ */
+struct cwc_spatial_entry {
+    void *data;
+    struct cwc_box box;             /* box the entry is currently indexed under */
+    bool indexed;
+    bool oversize;
+    struct wl_list oversize_link;   /* cwc_spatial_grid::oversize */
+    uint32_t query_seq;             /* last query that reported this entry */
+};
+
+struct cwc_spatial_grid {
+    struct cwc_hash cells;          /* cell key -> struct cwc_spatial_cell */
+    struct wl_list oversize;        /* cwc_spatial_entry::oversize_link */
+    uint32_t query_seq;
+};
+
+typedef void (*cwc_spatial_iter_func_t)(struct cwc_spatial_entry *entry, void *data);
+
+/* Function declarations */
+void cwc_spatial_init(struct cwc_spatial_grid *grid);
+void cwc_spatial_fini(struct cwc_spatial_grid *grid);
+
+/* Index entry under box; an empty box removes it */
+void cwc_spatial_update(struct cwc_spatial_grid *grid, struct cwc_spatial_entry *entry,
+                        const struct cwc_box *box);
+void cwc_spatial_remove(struct cwc_spatial_grid *grid, struct cwc_spatial_entry *entry);
+
+/* Queries report each entry whose box contains or intersects the argument once */
+void cwc_spatial_query_point(struct cwc_spatial_grid *grid, int32_t x, int32_t y,
+                             cwc_spatial_iter_func_t iterator, void *data);
+void cwc_spatial_query_box(struct cwc_spatial_grid *grid, const struct cwc_box *box,
+                           cwc_spatial_iter_func_t iterator, void *data);
+
+#endif /* CWC_SPATIAL_H */
@@ -0,0 +1,40 @@
+#ifndef CWC_STARTUP_H
+#define CWC_STARTUP_H
+
+#include "cwc.h"
+#include <pthread.h>
+
+typedef void *(*cwc_startup_run_func_t)(struct cwc_server *server, void *data);
+typedef void (*cwc_startup_done_func_t)(struct cwc_server *server, void *result, void *data);
+
+/*
+ * One expensive subsystem coming up off the dispatch thread, such as a
+ * GPU context. run gets a thread of its own and must not touch the
+ * display; done runs on the dispatch thread with run's result, and is
+ * where the subsystem is installed and its globals are created.
+ */
+struct cwc_startup_task {
+    struct wl_list link;            /* cwc_server::startup_tasks */
+    struct cwc_server *server;
+    const char *name;
+    pthread_t thread;
+    cwc_startup_run_func_t run;
+    cwc_startup_done_func_t done;
+    void *data;
+    void *result;
+    uint64_t start_ns;
+
+    int done_fd;                    /* eventfd */
+    struct wl_event_source *done_source;
+};
+
+/* Function declarations */
+
+/* Runs everything inline, done included, if no thread can be started */
+void cwc_startup_spawn(struct cwc_server *server, const char *name, cwc_startup_run_func_t run,
+                       cwc_startup_done_func_t done, void *data);
+
+/* Block until every task finished and its done callback ran */
+void cwc_startup_finish(struct cwc_server *server);
+
+#endif /* CWC_STARTUP_H */
@@ -0,0 +1,62 @@
+#ifndef CWC_STATS_H
+#define CWC_STATS_H
+
+#include "cwc.h"
+#include <stdatomic.h>
+
+/* Power-of-two buckets: bucket i holds values in [2^(i-1), 2^i) */
+#define CWC_HISTOGRAM_BUCKETS 64
+
+/* Appended to the Wayland socket path for the stats socket */
+#define CWC_STATS_SOCKET_SUFFIX ".stats"
+
+/*
+ * Lock-free histogram. Recording is a handful of relaxed atomic adds, so
+ * it is cheap enough for every dispatch and every frame and may be called
+ * from any thread. Readers get a slightly torn but consistent-enough view.
+ */
+struct cwc_histogram {
+    _Atomic uint64_t buckets[CWC_HISTOGRAM_BUCKETS];
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+};
+
+/* Server-wide instrumentation */
+struct cwc_stats {
+    struct cwc_histogram dispatch_ns;           /* one event loop iteration */
+    struct cwc_histogram commit_to_present_ns;  /* per presented surface commit */
+    struct cwc_histogram connect_bytes;         /* heap growth per accepted connection */
+    struct cwc_histogram input_to_present_ns;   /* input event to the commit answering it on screen */
+    uint64_t throttled_callbacks;   /* frame callbacks held back by client budgets */
+    uint64_t presented_feedbacks;   /* wp_presentation_feedback.presented sent */
+    uint64_t discarded_feedbacks;   /* wp_presentation_feedback.discarded sent */
+    uint64_t shm_mappings_created;  /* wl_shm pools that needed an mmap */
+    uint64_t shm_mappings_reused;   /* wl_shm pools that found their file mapped */
+    uint64_t scene_nodes_updated;   /* scene nodes recomputed by cwc_scene_update() */
+    uint64_t screencopy_frames;     /* zwlr_screencopy_frame_v1.ready sent */
+    uint64_t screencopy_bytes;      /* copied into capture buffers, damage only */
+    uint64_t rejected_clients;      /* connections turned away at max_clients */
+    uint64_t coalesced_motions;     /* pointer samples folded into a later wl_pointer.motion */
+    uint64_t memory_evictions;      /* cached mappings and textures dropped */
+    uint64_t memory_evicted_bytes;
+    uint64_t memory_pressure_events;    /* PSI triggers that emptied the caches */
+
+    int listen_fd;
+    char *socket_path;
+    struct wl_event_source *listen_source;
+    struct wl_event_source *sigusr1_source;
+};
+
+/* Function declarations */
+
+/* Histograms */
+void cwc_histogram_record(struct cwc_histogram *histogram, uint64_t value);
+uint64_t cwc_histogram_percentile(const struct cwc_histogram *histogram, double fraction);
+
+/* Stats socket and dumps */
+cwc_error_t cwc_stats_init(struct cwc_server *server);
+void cwc_stats_finish(struct cwc_server *server);
+char *cwc_stats_format(struct cwc_server *server, size_t *length);
+
+#endif /* CWC_STATS_H */
@@ -0,0 +1,64 @@
+#ifndef CWC_THREADPOOL_H
+#define CWC_THREADPOOL_H
+
+#include "cwc.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* Upper bound on pool threads, whatever the machine reports */
+#define CWC_THREAD_POOL_MAX_THREADS 64
+
+typedef void (*cwc_task_func_t)(uint32_t index, void *data);
+
+/*
+ * Task range owned by one participant. Owners take tasks from the front
+ * of their range; once it runs dry they steal from the other ranges, so
+ * an uneven split (one tile full of translucent windows, one empty)
+ * still keeps every core busy.
+ */
+struct cwc_task_range {
+    _Atomic uint32_t next;
+    uint32_t end;
+    uchar pad[64 - sizeof(_Atomic uint32_t) - sizeof(uint32_t)];  /* one cache line each */
+};
+
+/*
+ * Fork/join pool for data-parallel work such as tile rasterization. One
+ * batch runs at a time; the submitting thread works on it too.
+ */
+struct cwc_thread_pool {
+    pthread_t threads[CWC_THREAD_POOL_MAX_THREADS];
+    uint32_t n_threads;
+
+    pthread_mutex_t batch_lock;     /* held by the thread running a batch */
+    pthread_mutex_t lock;
+    pthread_cond_t start;           /* new batch or shutdown */
+    pthread_cond_t finish;          /* last task of the batch done */
+    uint64_t generation;
+    bool quit;
+
+    /* Current batch */
+    cwc_task_func_t func;
+    void *data;
+    struct cwc_task_range ranges[CWC_THREAD_POOL_MAX_THREADS + 1];
+    uint32_t n_ranges;
+    uint32_t active;                /* pool threads still inside the batch */
+};
+
+/* Function declarations */
+
+/*
+ * Start a named thread with signals blocked, so they all stay with the
+ * dispatch thread. Threads that read client SHM pass shm_access, which
+ * leaves SIGBUS open: a truncated pool faults on the reading thread and
+ * the shm handler must run there. Returns pthread_create()'s error.
+ */
+int cwc_thread_create(pthread_t *thread, const char *name, void *(*run)(void *), void *data,
+                      bool shm_access);
+
+struct cwc_thread_pool *cwc_thread_pool_create(uint32_t n_threads);
+void cwc_thread_pool_destroy(struct cwc_thread_pool *pool);
+void cwc_thread_pool_run(struct cwc_thread_pool *pool, uint32_t n_tasks,
+                         cwc_task_func_t func, void *data);
+
+#endif /* CWC_THREADPOOL_H */
@@ -0,0 +1,99 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Display backends. The virtual backend has no hardware, which makes it
+ * the headless mode: its outputs, one per --output mode side by side or
+ * a single default one, are paced by their vblank timers and a frame is
+ * on screen as soon as its vblank passes. Its one "plane" takes any buffer the
+ * compositor offers, so direct scanout behaves on it exactly as it would
+ * on real hardware.
+ */
+
+#include "../include/backend.h"
+#include "../include/output.h"
+
+static void virtual_destroy(struct cwc_backend *backend) {
+    cwc_free(backend);
+}
+
+static bool virtual_scanout(struct cwc_backend *backend, struct cwc_output *output,
+                            struct cwc_buffer *buffer) {
+    (void)backend;
+    (void)output;
+    (void)buffer;
+    return true;
+}
+
+static const struct cwc_backend_impl virtual_impl = {
+    .name = "virtual",
+    .destroy = virtual_destroy,
+    .scanout = virtual_scanout,
+};
+
+struct cwc_backend *cwc_backend_create_virtual(struct cwc_server *server) {
+    struct cwc_backend *backend = cwc_calloc(1, sizeof(*backend));
+    backend->impl = &virtual_impl;
+    backend->server = server;
+
+    uint32_t n_outputs = server->n_output_configs ? server->n_output_configs : 1;
+    int32_t x = 0;
+    for (uint32_t i = 0; i < n_outputs; i++) {
+        struct cwc_output_config config = server->n_output_configs ?
+                                          server->output_configs[i] : cwc_default_output_config;
+        config.x = x;
+        config.y = 0;
+        if (!cwc_output_create(server, &config)) {
+            cwc_free(backend);
+            return NULL;
+        }
+        x += config.width;
+    }
+    return backend;
+}
+
+struct cwc_backend *cwc_backend_create(struct cwc_server *server, const char *name) {
+    bool automatic = !name || strcmp(name, "auto") == 0;
+    struct cwc_backend *backend = NULL;
+
+    if (automatic || strcmp(name, "drm") == 0) {
+        backend = cwc_backend_create_drm(server);
+        if (!backend && !automatic) {
+            cwc_log(server, CWC_LOG_WARN, "DRM backend unavailable, using virtual outputs");
+        }
+    } else if (strcmp(name, "virtual") != 0) {
+        cwc_log(server, CWC_LOG_WARN, "Unknown backend '%s', using virtual outputs", name);
+    }
+
+    if (!backend) {
+        backend = cwc_backend_create_virtual(server);
+        if (!backend) {
+            return NULL;
+        }
+    }
+
+    cwc_log(server, CWC_LOG_INFO, "Using %s backend", backend->impl->name);
+    return backend;
+}
+
+void cwc_backend_destroy(struct cwc_backend *backend) {
+    if (!backend) return;
+    backend->impl->destroy(backend);
+}
+
+void cwc_backend_output_destroy(struct cwc_backend *backend, struct cwc_output *output) {
+    if (backend && backend->impl->output_destroy) {
+        backend->impl->output_destroy(backend, output);
+    }
+}
+
+bool cwc_backend_present(struct cwc_backend *backend, struct cwc_output *output,
+                         const struct cwc_region *damage) {
+    return backend && backend->impl->present &&
+           backend->impl->present(backend, output, damage);
+}
+
+bool cwc_backend_scanout(struct cwc_backend *backend, struct cwc_output *output,
+                         struct cwc_buffer *buffer) {
+    return backend && backend->impl->scanout &&
+           backend->impl->scanout(backend, output, buffer);
+}
@@ -0,0 +1,685 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * DRM/KMS backend. Every connected connector becomes a cwc_output driven
+ * through atomic modesetting on its own CRTC and primary plane. Frames
+ * are copied from the output framebuffer into double-buffered dumb
+ * buffers, only where they differ from the buffer being reused, and the
+ * page-flip event on the event loop reports the vblank that paces the
+ * output's repaint scheduler. Direct scanout puts linear dma-bufs on the
+ * primary plane after a test-only commit.
+ *
+ * The device is opened directly, so the compositor has to be DRM master
+ * (a free VT, no session manager).
+ */
+
+#include "../include/backend.h"
+
+#ifdef CWC_HAVE_DRM
+
+#include <drm_fourcc.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include "../include/buffer.h"
+#include "../include/dmabuf.h"
+#include "../include/output.h"
+
+/* One frame in flight at a time, so one buffer on screen and one to fill */
+#ifndef CWC_DRM_BUFFERS
+#define CWC_DRM_BUFFERS 2
+#endif
+
+/* Longest wait for a page flip when an output goes away */
+#define CWC_DRM_FLIP_TIMEOUT_MS 1000
+
+struct drm_buffer {
+    uint32_t handle;
+    uint32_t fb_id;
+    uint32_t pitch;
+    uint64_t size;
+    uchar *map;
+    struct cwc_region damage;       /* framebuffer changes not copied here yet */
+};
+
+/* Atomic property ids */
+struct drm_props {
+    uint32_t connector_crtc_id;
+    uint32_t crtc_mode_id;
+    uint32_t crtc_active;
+    uint32_t plane_fb_id;
+    uint32_t plane_crtc_id;
+    uint32_t plane_src_x, plane_src_y, plane_src_w, plane_src_h;
+    uint32_t plane_crtc_x, plane_crtc_y, plane_crtc_w, plane_crtc_h;
+};
+
+struct drm_backend;
+
+struct drm_output {
+    struct wl_list link;            /* drm_backend::outputs */
+    struct drm_backend *backend;
+    struct cwc_output *output;
+
+    uint32_t connector_id;
+    uint32_t crtc_id;
+    uint32_t crtc_index;
+    uint32_t plane_id;
+    drmModeModeInfo mode;
+    uint32_t mode_blob;
+    struct drm_props props;
+    bool modeset;                   /* next commit has to set the mode */
+
+    struct drm_buffer buffers[CWC_DRM_BUFFERS];
+    int front;                      /* buffer on screen, -1 for none or scanout */
+    int queued;                     /* buffer of the flip in flight */
+    bool flip_pending;
+
+    /* Framebuffers wrapping client dma-bufs */
+    uint32_t scanout_fb;            /* on screen */
+    uint32_t scanout_fb_queued;     /* in the flip in flight */
+    uint32_t scanout_fb_pending;    /* tested, waiting for present */
+
+    char name[32];                  /* connector name, the wl_output model */
+};
+
+struct drm_backend {
+    struct cwc_backend base;
+    int fd;
+    struct wl_event_source *source;
+    struct wl_list outputs;         /* drm_output::link */
+    uint32_t crtcs_used;            /* bit per CRTC index */
+};
+
+static uint32_t drm_prop_id(int fd, uint32_t object, uint32_t type, const char *name) {
+    drmModeObjectProperties *props = drmModeObjectGetProperties(fd, object, type);
+    uint32_t id = 0;
+    for (uint32_t i = 0; props && i < props->count_props && !id; i++) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (prop && strcmp(prop->name, name) == 0) {
+            id = prop->prop_id;
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+    return id;
+}
+
+static bool drm_prop_value(int fd, uint32_t object, uint32_t type, const char *name,
+                           uint64_t *value) {
+    drmModeObjectProperties *props = drmModeObjectGetProperties(fd, object, type);
+    bool found = false;
+    for (uint32_t i = 0; props && i < props->count_props && !found; i++) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (prop && strcmp(prop->name, name) == 0) {
+            *value = props->prop_values[i];
+            found = true;
+        }
+        drmModeFreeProperty(prop);
+    }
+    drmModeFreeObjectProperties(props);
+    return found;
+}
+
+static bool drm_props_init(int fd, struct drm_output *d) {
+    struct drm_props *p = &d->props;
+    p->connector_crtc_id = drm_prop_id(fd, d->connector_id, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
+    p->crtc_mode_id = drm_prop_id(fd, d->crtc_id, DRM_MODE_OBJECT_CRTC, "MODE_ID");
+    p->crtc_active = drm_prop_id(fd, d->crtc_id, DRM_MODE_OBJECT_CRTC, "ACTIVE");
+    p->plane_fb_id = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "FB_ID");
+    p->plane_crtc_id = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
+    p->plane_src_x = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_X");
+    p->plane_src_y = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_Y");
+    p->plane_src_w = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_W");
+    p->plane_src_h = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "SRC_H");
+    p->plane_crtc_x = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_X");
+    p->plane_crtc_y = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
+    p->plane_crtc_w = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_W");
+    p->plane_crtc_h = drm_prop_id(fd, d->plane_id, DRM_MODE_OBJECT_PLANE, "CRTC_H");
+
+    return p->connector_crtc_id && p->crtc_mode_id && p->crtc_active &&
+           p->plane_fb_id && p->plane_crtc_id &&
+           p->plane_src_x && p->plane_src_y && p->plane_src_w && p->plane_src_h &&
+           p->plane_crtc_x && p->plane_crtc_y && p->plane_crtc_w && p->plane_crtc_h;
+}
+
+/*
+ * Dumb buffers
+ */
+static bool drm_buffer_init(int fd, struct drm_buffer *buffer, uint32_t width, uint32_t height) {
+    struct drm_mode_create_dumb create = { .width = width, .height = height, .bpp = 32 };
+    if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create) != 0) {
+        return false;
+    }
+    buffer->handle = create.handle;
+    buffer->pitch = create.pitch;
+    buffer->size = create.size;
+
+    uint32_t handles[4] = { buffer->handle };
+    uint32_t pitches[4] = { buffer->pitch };
+    uint32_t offsets[4] = { 0 };
+    struct drm_mode_map_dumb map = { .handle = buffer->handle };
+    if (drmModeAddFB2(fd, width, height, DRM_FORMAT_XRGB8888, handles, pitches, offsets,
+                      &buffer->fb_id, 0) != 0 ||
+        drmIoctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &map) != 0) {
+        return false;
+    }
+
+    void *data = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, (off_t)map.offset);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    buffer->map = data;
+
+    /* Nothing of the framebuffer is in it yet */
+    cwc_region_init_rect(&buffer->damage, 0, 0, (int32_t)width, (int32_t)height);
+    return true;
+}
+
+static void drm_buffer_finish(int fd, struct drm_buffer *buffer) {
+    if (buffer->map) {
+        munmap(buffer->map, buffer->size);
+    }
+    if (buffer->fb_id) {
+        drmModeRmFB(fd, buffer->fb_id);
+    }
+    if (buffer->handle) {
+        struct drm_mode_destroy_dumb destroy = { .handle = buffer->handle };
+        drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+    }
+    cwc_region_fini(&buffer->damage);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+/* Bring a dumb buffer up to date with the output framebuffer */
+static void drm_buffer_fill(struct drm_output *d, int index, const struct cwc_region *damage) {
+    struct cwc_output *output = d->output;
+    struct drm_buffer *buffer = &d->buffers[index];
+
+    /* Everything that changed since this buffer was last filled */
+    cwc_region_union(&buffer->damage, damage);
+    struct cwc_box bounds = { 0, 0, output->config.width, output->config.height };
+    cwc_region_intersect_box(&buffer->damage, &bounds);
+
+    for (uint32_t i = 0; i < buffer->damage.n_rects; i++) {
+        const struct cwc_box *box = &buffer->damage.rects[i];
+        size_t bytes = (size_t)(box->x2 - box->x1) * 4;
+        for (int32_t y = box->y1; y < box->y2; y++) {
+            memcpy(buffer->map + (size_t)y * buffer->pitch + (size_t)box->x1 * 4,
+                   (const uchar *)output->pixels + (size_t)y * (size_t)output->stride +
+                   (size_t)box->x1 * 4, bytes);
+        }
+    }
+    cwc_region_clear(&buffer->damage);
+
+    for (int i = 0; i < CWC_DRM_BUFFERS; i++) {
+        if (i != index) {
+            cwc_region_union(&d->buffers[i].damage, damage);
+        }
+    }
+}
+
+/*
+ * Atomic commits
+ */
+static void drm_add(drmModeAtomicReq *req, uint32_t object, uint32_t prop, uint64_t value) {
+    drmModeAtomicAddProperty(req, object, prop, value);
+}
+
+static int drm_commit(struct drm_output *d, uint32_t fb_id, uint32_t flags) {
+    struct drm_props *p = &d->props;
+    drmModeAtomicReq *req = drmModeAtomicAlloc();
+    if (!req) {
+        return -ENOMEM;
+    }
+
+    if (d->modeset) {
+        drm_add(req, d->connector_id, p->connector_crtc_id, d->crtc_id);
+        drm_add(req, d->crtc_id, p->crtc_mode_id, d->mode_blob);
+        drm_add(req, d->crtc_id, p->crtc_active, 1);
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+    }
+
+    uint64_t width = d->mode.hdisplay, height = d->mode.vdisplay;
+    drm_add(req, d->plane_id, p->plane_fb_id, fb_id);
+    drm_add(req, d->plane_id, p->plane_crtc_id, d->crtc_id);
+    drm_add(req, d->plane_id, p->plane_src_x, 0);
+    drm_add(req, d->plane_id, p->plane_src_y, 0);
+    drm_add(req, d->plane_id, p->plane_src_w, width << 16);
+    drm_add(req, d->plane_id, p->plane_src_h, height << 16);
+    drm_add(req, d->plane_id, p->plane_crtc_x, 0);
+    drm_add(req, d->plane_id, p->plane_crtc_y, 0);
+    drm_add(req, d->plane_id, p->plane_crtc_w, width);
+    drm_add(req, d->plane_id, p->plane_crtc_h, height);
+
+    int ret = drmModeAtomicCommit(d->backend->fd, req, flags, d);
+    drmModeAtomicFree(req);
+    return ret;
+}
+
+static bool drm_present(struct cwc_backend *backend, struct cwc_output *output,
+                        const struct cwc_region *damage) {
+    struct drm_backend *drm = (struct drm_backend *)backend;
+    struct drm_output *d = output->backend_data;
+    if (!d || d->flip_pending) {
+        return false;
+    }
+
+    uint32_t fb_id;
+    int index = -1;
+    if (output->scanout_flip && output->scanout_pending) {
+        fb_id = d->scanout_fb_pending;
+        if (!fb_id) {
+            cwc_output_scanout_rejected(output);
+            return false;
+        }
+    } else if (damage && !cwc_region_is_empty(damage)) {
+        index = d->front >= 0 ? (d->front + 1) % CWC_DRM_BUFFERS : 0;
+        drm_buffer_fill(d, index, damage);
+        fb_id = d->buffers[index].fb_id;
+    } else {
+        return false;
+    }
+
+    int ret = drm_commit(d, fb_id, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_NONBLOCK);
+    if (index < 0) {
+        d->scanout_fb_pending = 0;
+    }
+    if (ret != 0) {
+        cwc_log(backend->server, CWC_LOG_WARN, "Atomic commit on %s failed: %s",
+                d->name, strerror(-ret));
+        if (index < 0) {
+            drmModeRmFB(drm->fd, fb_id);
+            cwc_output_scanout_rejected(output);
+        }
+        return false;
+    }
+
+    d->modeset = false;
+    d->queued = index;
+    d->scanout_fb_queued = index < 0 ? fb_id : 0;
+    d->flip_pending = true;
+    return true;
+}
+
+static void drm_page_flip(int fd, unsigned int sequence, unsigned int tv_sec,
+                          unsigned int tv_usec, unsigned int crtc_id, void *data) {
+    (void)sequence;
+    (void)crtc_id;
+    struct drm_output *d = data;
+
+    /* Whatever was on screen before has been replaced */
+    if (d->scanout_fb && d->scanout_fb != d->scanout_fb_queued) {
+        drmModeRmFB(fd, d->scanout_fb);
+    }
+    d->scanout_fb = d->scanout_fb_queued;
+    d->scanout_fb_queued = 0;
+    d->front = d->queued;
+    d->flip_pending = false;
+
+    if (d->output) {
+        cwc_output_present_done(d->output, (uint64_t)tv_sec * 1000000000ull +
+                                           (uint64_t)tv_usec * 1000ull);
+    }
+}
+
+static void drm_handle_events(int fd) {
+    drmEventContext context = {
+        .version = 3,
+        .page_flip_handler2 = drm_page_flip,
+    };
+    drmHandleEvent(fd, &context);
+}
+
+static int drm_dispatch(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    (void)data;
+    drm_handle_events(fd);
+    return 0;
+}
+
+/*
+ * Direct scanout: wrap a linear single-plane dma-buf in a framebuffer
+ * and check with a test-only commit that the primary plane takes it.
+ */
+static bool drm_scanout(struct cwc_backend *backend, struct cwc_output *output,
+                        struct cwc_buffer *buffer) {
+    struct drm_backend *drm = (struct drm_backend *)backend;
+    struct drm_output *d = output->backend_data;
+    if (!d || d->modeset || d->flip_pending || buffer->type != CWC_BUFFER_DMABUF) {
+        return false;
+    }
+
+    const struct cwc_dmabuf_attributes *attributes =
+        &((struct cwc_dmabuf_buffer *)buffer)->attributes;
+    if (attributes->n_planes != 1 ||
+        (attributes->modifier != DRM_FORMAT_MOD_LINEAR &&
+         attributes->modifier != DRM_FORMAT_MOD_INVALID) ||
+        (attributes->format != DRM_FORMAT_XRGB8888 &&
+         attributes->format != DRM_FORMAT_ARGB8888)) {
+        return false;
+    }
+
+    uint32_t handle;
+    if (drmPrimeFDToHandle(drm->fd, attributes->planes[0].fd, &handle) != 0) {
+        return false;
+    }
+
+    /* The buffer is known to be opaque, so scan it out ignoring alpha */
+    uint32_t handles[4] = { handle };
+    uint32_t pitches[4] = { attributes->planes[0].stride };
+    uint32_t offsets[4] = { attributes->planes[0].offset };
+    uint32_t fb_id = 0;
+    int ret = drmModeAddFB2(drm->fd, (uint32_t)attributes->width, (uint32_t)attributes->height,
+                            DRM_FORMAT_XRGB8888, handles, pitches, offsets, &fb_id, 0);
+
+    /* The framebuffer holds its own reference to the buffer object */
+    struct drm_gem_close gem_close = { .handle = handle };
+    drmIoctl(drm->fd, DRM_IOCTL_GEM_CLOSE, &gem_close);
+    if (ret != 0) {
+        return false;
+    }
+
+    if (drm_commit(d, fb_id, DRM_MODE_ATOMIC_TEST_ONLY) != 0) {
+        drmModeRmFB(drm->fd, fb_id);
+        return false;
+    }
+
+    if (d->scanout_fb_pending) {
+        drmModeRmFB(drm->fd, d->scanout_fb_pending);
+    }
+    d->scanout_fb_pending = fb_id;
+    return true;
+}
+
+/*
+ * Outputs
+ */
+static void drm_output_free(struct drm_backend *drm, struct drm_output *d) {
+    /* The flip event refers to d, so let it arrive first */
+    struct pollfd pfd = { .fd = drm->fd, .events = POLLIN };
+    while (d->flip_pending && poll(&pfd, 1, CWC_DRM_FLIP_TIMEOUT_MS) > 0) {
+        drm_handle_events(drm->fd);
+    }
+
+    /* Removing the framebuffer on screen turns the plane off */
+    uint32_t fbs[] = { d->scanout_fb, d->scanout_fb_queued, d->scanout_fb_pending };
+    for (size_t i = 0; i < sizeof(fbs) / sizeof(fbs[0]); i++) {
+        if (fbs[i]) {
+            drmModeRmFB(drm->fd, fbs[i]);
+        }
+    }
+    for (int i = 0; i < CWC_DRM_BUFFERS; i++) {
+        drm_buffer_finish(drm->fd, &d->buffers[i]);
+    }
+    if (d->mode_blob) {
+        drmModeDestroyPropertyBlob(drm->fd, d->mode_blob);
+    }
+
+    drm->crtcs_used &= ~(1u << d->crtc_index);
+    wl_list_remove(&d->link);
+    cwc_free(d);
+}
+
+static void drm_output_destroy(struct cwc_backend *backend, struct cwc_output *output) {
+    struct drm_output *d = output->backend_data;
+    if (!d) {
+        return;
+    }
+    output->backend_data = NULL;
+    d->output = NULL;
+    drm_output_free((struct drm_backend *)backend, d);
+}
+
+static enum wl_output_subpixel drm_subpixel(drmModeSubPixel subpixel) {
+    switch (subpixel) {
+        case DRM_MODE_SUBPIXEL_NONE: return WL_OUTPUT_SUBPIXEL_NONE;
+        case DRM_MODE_SUBPIXEL_HORIZONTAL_RGB: return WL_OUTPUT_SUBPIXEL_HORIZONTAL_RGB;
+        case DRM_MODE_SUBPIXEL_HORIZONTAL_BGR: return WL_OUTPUT_SUBPIXEL_HORIZONTAL_BGR;
+        case DRM_MODE_SUBPIXEL_VERTICAL_RGB: return WL_OUTPUT_SUBPIXEL_VERTICAL_RGB;
+        case DRM_MODE_SUBPIXEL_VERTICAL_BGR: return WL_OUTPUT_SUBPIXEL_VERTICAL_BGR;
+        case DRM_MODE_SUBPIXEL_UNKNOWN:
+        default: return WL_OUTPUT_SUBPIXEL_UNKNOWN;
+    }
+}
+
+static const char *drm_connector_type_name(uint32_t type) {
+    switch (type) {
+        case DRM_MODE_CONNECTOR_VGA: return "VGA";
+        case DRM_MODE_CONNECTOR_DVII: return "DVI-I";
+        case DRM_MODE_CONNECTOR_DVID: return "DVI-D";
+        case DRM_MODE_CONNECTOR_DVIA: return "DVI-A";
+        case DRM_MODE_CONNECTOR_LVDS: return "LVDS";
+        case DRM_MODE_CONNECTOR_DisplayPort: return "DP";
+        case DRM_MODE_CONNECTOR_HDMIA: return "HDMI-A";
+        case DRM_MODE_CONNECTOR_HDMIB: return "HDMI-B";
+        case DRM_MODE_CONNECTOR_eDP: return "eDP";
+        case DRM_MODE_CONNECTOR_VIRTUAL: return "Virtual";
+        case DRM_MODE_CONNECTOR_DSI: return "DSI";
+        default: return "Unknown";
+    }
+}
+
+/* Primary plane usable on a CRTC, 0 if there is none */
+static uint32_t drm_find_primary_plane(int fd, uint32_t crtc_index) {
+    drmModePlaneRes *planes = drmModeGetPlaneResources(fd);
+    uint32_t plane_id = 0;
+    for (uint32_t i = 0; planes && i < planes->count_planes && !plane_id; i++) {
+        drmModePlane *plane = drmModeGetPlane(fd, planes->planes[i]);
+        uint64_t type;
+        if (plane && (plane->possible_crtcs & (1u << crtc_index)) &&
+            drm_prop_value(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", &type) &&
+            type == DRM_PLANE_TYPE_PRIMARY) {
+            plane_id = plane->plane_id;
+        }
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(planes);
+    return plane_id;
+}
+
+/* Free CRTC for a connector, preferring the one it is already driven by */
+static int drm_find_crtc(struct drm_backend *drm, drmModeRes *resources,
+                         drmModeConnector *connector) {
+    for (int pass = 0; pass < 2; pass++) {
+        for (int e = 0; e < connector->count_encoders; e++) {
+            if (pass == 0 && connector->encoders[e] != connector->encoder_id) {
+                continue;
+            }
+            drmModeEncoder *encoder = drmModeGetEncoder(drm->fd, connector->encoders[e]);
+            if (!encoder) {
+                continue;
+            }
+            for (int c = 0; c < resources->count_crtcs && c < 32; c++) {
+                bool current = pass > 0 || resources->crtcs[c] == encoder->crtc_id;
+                if (current && (encoder->possible_crtcs & (1u << c)) &&
+                    !(drm->crtcs_used & (1u << c))) {
+                    drmModeFreeEncoder(encoder);
+                    return c;
+                }
+            }
+            drmModeFreeEncoder(encoder);
+        }
+    }
+    return -1;
+}
+
+static void drm_output_create(struct drm_backend *drm, drmModeRes *resources,
+                              drmModeConnector *connector, int32_t *x) {
+    struct cwc_server *server = drm->base.server;
+    if (connector->connection != DRM_MODE_CONNECTED || connector->count_modes == 0) {
+        return;
+    }
+
+    int crtc_index = drm_find_crtc(drm, resources, connector);
+    if (crtc_index < 0) {
+        return;
+    }
+
+    struct drm_output *d = cwc_calloc(1, sizeof(*d));
+    d->backend = drm;
+    d->connector_id = connector->connector_id;
+    d->crtc_index = (uint32_t)crtc_index;
+    d->crtc_id = resources->crtcs[crtc_index];
+    d->plane_id = drm_find_primary_plane(drm->fd, d->crtc_index);
+    d->front = -1;
+    d->queued = -1;
+    d->modeset = true;
+    snprintf(d->name, sizeof(d->name), "%s-%u",
+             drm_connector_type_name(connector->connector_type), connector->connector_type_id);
+    wl_list_insert(drm->outputs.prev, &d->link);
+    drm->crtcs_used |= 1u << d->crtc_index;
+
+    d->mode = connector->modes[0];
+    for (int i = 0; i < connector->count_modes; i++) {
+        if (connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            d->mode = connector->modes[i];
+            break;
+        }
+    }
+
+    if (!d->plane_id || !drm_props_init(drm->fd, d) ||
+        drmModeCreatePropertyBlob(drm->fd, &d->mode, sizeof(d->mode), &d->mode_blob) != 0) {
+        cwc_log(server, CWC_LOG_WARN, "Cannot drive %s", d->name);
+        drm_output_free(drm, d);
+        return;
+    }
+
+    for (int i = 0; i < CWC_DRM_BUFFERS; i++) {
+        if (!drm_buffer_init(drm->fd, &d->buffers[i], d->mode.hdisplay, d->mode.vdisplay)) {
+            cwc_log(server, CWC_LOG_WARN, "No scanout buffers for %s: %s", d->name,
+                    strerror(errno));
+            drm_output_free(drm, d);
+            return;
+        }
+    }
+
+    /* Refresh in mHz from the pixel clock in kHz */
+    uint64_t pixels = (uint64_t)d->mode.htotal * d->mode.vtotal;
+    struct cwc_output_config config = {
+        .x = *x,
+        .y = 0,
+        .width = d->mode.hdisplay,
+        .height = d->mode.vdisplay,
+        .physical_width = (int32_t)connector->mmWidth,
+        .physical_height = (int32_t)connector->mmHeight,
+        .refresh_rate = pixels ? (int32_t)(((uint64_t)d->mode.clock * 1000000 + pixels / 2) / pixels) : 0,
+        .subpixel = drm_subpixel(connector->subpixel),
+        .transform = WL_OUTPUT_TRANSFORM_NORMAL,
+        .make = "DRM",
+        .model = d->name,
+    };
+
+    d->output = cwc_output_create(server, &config);
+    if (!d->output) {
+        drm_output_free(drm, d);
+        return;
+    }
+    d->output->backend_data = d;
+    *x += config.width;
+}
+
+static void drm_destroy(struct cwc_backend *backend) {
+    struct drm_backend *drm = (struct drm_backend *)backend;
+
+    /* Outputs normally went first; these never became one */
+    struct drm_output *d, *tmp;
+    wl_list_for_each_safe(d, tmp, &drm->outputs, link) {
+        if (d->output) {
+            d->output->backend_data = NULL;
+        }
+        drm_output_free(drm, d);
+    }
+
+    if (drm->source) {
+        wl_event_source_remove(drm->source);
+    }
+    close(drm->fd);
+    cwc_free(drm);
+}
+
+static const struct cwc_backend_impl drm_impl = {
+    .name = "drm",
+    .destroy = drm_destroy,
+    .output_destroy = drm_output_destroy,
+    .present = drm_present,
+    .scanout = drm_scanout,
+};
+
+/* Open a KMS device we can be master of with atomic modesetting */
+static int drm_open_device(struct cwc_server *server) {
+    const char *path = getenv("CWC_DRM_DEVICE");
+    for (int i = 0; i < 16; i++) {
+        char name[32];
+        if (!path) {
+            snprintf(name, sizeof(name), "/dev/dri/card%d", i);
+        }
+
+        int fd = open(path ? path : name, O_RDWR | O_CLOEXEC);
+        uint64_t dumb = 0;
+        if (fd >= 0 &&
+            drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) == 0 &&
+            drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0 &&
+            drmGetCap(fd, DRM_CAP_DUMB_BUFFER, &dumb) == 0 && dumb &&
+            drmSetMaster(fd) == 0) {
+            cwc_log(server, CWC_LOG_DEBUG, "Using DRM device %s", path ? path : name);
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (path) {
+            break;
+        }
+    }
+    return -1;
+}
+
+struct cwc_backend *cwc_backend_create_drm(struct cwc_server *server) {
+    int fd = drm_open_device(server);
+    if (fd < 0) {
+        cwc_log(server, CWC_LOG_DEBUG, "No DRM device with atomic modesetting");
+        return NULL;
+    }
+
+    struct drm_backend *drm = cwc_calloc(1, sizeof(*drm));
+    drm->base.impl = &drm_impl;
+    drm->base.server = server;
+    drm->fd = fd;
+    wl_list_init(&drm->outputs);
+
+    drm->source = wl_event_loop_add_fd(server->event_loop, fd, WL_EVENT_READABLE,
+                                       drm_dispatch, drm);
+    drmModeRes *resources = drmModeGetResources(fd);
+    if (!drm->source || !resources) {
+        drmModeFreeResources(resources);
+        drm_destroy(&drm->base);
+        return NULL;
+    }
+
+    int32_t x = 0;
+    for (int i = 0; i < resources->count_connectors; i++) {
+        drmModeConnector *connector = drmModeGetConnector(fd, resources->connectors[i]);
+        if (connector) {
+            drm_output_create(drm, resources, connector, &x);
+            drmModeFreeConnector(connector);
+        }
+    }
+    drmModeFreeResources(resources);
+
+    if (wl_list_empty(&drm->outputs)) {
+        cwc_log(server, CWC_LOG_DEBUG, "No connected DRM outputs");
+        drm_destroy(&drm->base);
+        return NULL;
+    }
+    return &drm->base;
+}
+
+#else /* !CWC_HAVE_DRM */
+
+struct cwc_backend *cwc_backend_create_drm(struct cwc_server *server) {
+    cwc_log(server, CWC_LOG_DEBUG, "Built without the DRM backend");
+    return NULL;
+}
+
+#endif /* CWC_HAVE_DRM */
@@ -0,0 +1,323 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Pixel kernels for the software renderer: premultiplied "over", opaque
+ * XRGB copy and solid fill, in scalar, SSE2, AVX2 and NEON flavours. The
+ * x86 variants are compiled with target attributes so one binary carries
+ * all of them; cwc_blend_init() picks one from the running CPU.
+ *
+ * Every variant rounds dst * (255 - alpha) / 255 the same way, so output
+ * is bit-identical across kernels for valid premultiplied input.
+ */
+
+#include "../include/blend.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CWC_BLEND_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CWC_BLEND_NEON 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Scalar kernels
+ */
+static void over_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = cwc_blend_over_pixel(src[i], dst[i]);
+    }
+}
+
+static void copy_xrgb_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = src[i] | 0xff000000u;
+    }
+}
+
+static void fill_scalar(uint32_t *dst, uint32_t color, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = color;
+    }
+}
+
+static const struct cwc_blend_kernels kernels_scalar = {
+    .name = "scalar",
+    .over = over_scalar,
+    .copy_xrgb = copy_xrgb_scalar,
+    .fill = fill_scalar,
+};
+
+#ifdef CWC_BLEND_X86
+/*
+ * SSE2 kernels, 4 pixels per iteration
+ */
+
+/* dst * ia / 255 on eight 16-bit channels, rounded like the scalar path */
+__attribute__((target("sse2")))
+static inline __m128i mul_div255_sse2(__m128i x, __m128i ia) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(x, ia), _mm_set1_epi16(0x80));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void over_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m128i amask = _mm_set1_epi32((int)0xff000000u);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i a = _mm_and_si128(s, amask);
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, amask)) == 0xffff) {
+            _mm_storeu_si128((__m128i *)(dst + i), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xffff) {
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i ia = _mm_sub_epi32(_mm_set1_epi32(255), _mm_srli_epi32(s, 24));
+        ia = _mm_or_si128(ia, _mm_slli_epi32(ia, 16));
+
+        __m128i lo = mul_div255_sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(ia, ia));
+        __m128i hi = mul_div255_sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(ia, ia));
+
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epu8(s, _mm_packus_epi16(lo, hi)));
+    }
+
+    over_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void copy_xrgb_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m128i amask = _mm_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(s, amask));
+    }
+
+    copy_xrgb_scalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(uint32_t *dst, uint32_t color, size_t n) {
+    const __m128i c = _mm_set1_epi32((int)color);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    }
+
+    fill_scalar(dst + i, color, n - i);
+}
+
+static const struct cwc_blend_kernels kernels_sse2 = {
+    .name = "sse2",
+    .over = over_sse2,
+    .copy_xrgb = copy_xrgb_sse2,
+    .fill = fill_sse2,
+};
+
+/*
+ * AVX2 kernels, 8 pixels per iteration. Unpack and pack both work within
+ * 128-bit lanes, so pixel order is preserved without extra permutes.
+ */
+__attribute__((target("avx2")))
+static inline __m256i mul_div255_avx2(__m256i x, __m256i ia) {
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(x, ia), _mm256_set1_epi16(0x80));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void over_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m256i amask = _mm256_set1_epi32((int)0xff000000u);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i a = _mm256_and_si256(s, amask);
+
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, amask)) == -1) {
+            _mm256_storeu_si256((__m256i *)(dst + i), s);
+            continue;
+        }
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, zero)) == -1) {
+            continue;
+        }
+
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i ia = _mm256_sub_epi32(_mm256_set1_epi32(255), _mm256_srli_epi32(s, 24));
+        ia = _mm256_or_si256(ia, _mm256_slli_epi32(ia, 16));
+
+        __m256i lo = mul_div255_avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi32(ia, ia));
+        __m256i hi = mul_div255_avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi32(ia, ia));
+
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+
+    over_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void copy_xrgb_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+    const __m256i amask = _mm256_set1_epi32((int)0xff000000u);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(s, amask));
+    }
+
+    copy_xrgb_sse2(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(uint32_t *dst, uint32_t color, size_t n) {
+    const __m256i c = _mm256_set1_epi32((int)color);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_si256((__m256i *)(dst + i), c);
+    }
+
+    fill_sse2(dst + i, color, n - i);
+}
+
+static const struct cwc_blend_kernels kernels_avx2 = {
+    .name = "avx2",
+    .over = over_avx2,
+    .copy_xrgb = copy_xrgb_avx2,
+    .fill = fill_avx2,
+};
+#endif /* CWC_BLEND_X86 */
+
+#ifdef CWC_BLEND_NEON
+/*
+ * NEON kernels, 8 pixels per iteration with channels deinterleaved by
+ * vld4. vraddhn(t, vrshr(t, 8)) is the same rounding as the scalar path.
+ */
+static inline uint8x8_t mul_div255_neon(uint8x8_t x, uint8x8_t ia) {
+    uint16x8_t t = vmull_u8(x, ia);
+    return vraddhn_u16(t, vrshrq_n_u16(t, 8));
+}
+
+static void over_neon(uint32_t *dst, const uint32_t *src, size_t n) {
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t *)(src + i));
+        uint64_t alpha = vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0);
+
+        if (alpha == UINT64_MAX) {
+            vst4_u8((uint8_t *)(dst + i), s);
+            continue;
+        }
+        if (alpha == 0) {
+            continue;
+        }
+
+        uint8x8x4_t d = vld4_u8((const uint8_t *)(dst + i));
+        uint8x8_t ia = vmvn_u8(s.val[3]);
+        for (int c = 0; c < 4; c++) {
+            d.val[c] = vqadd_u8(s.val[c], mul_div255_neon(d.val[c], ia));
+        }
+        vst4_u8((uint8_t *)(dst + i), d);
+    }
+
+    over_scalar(dst + i, src + i, n - i);
+}
+
+static void copy_xrgb_neon(uint32_t *dst, const uint32_t *src, size_t n) {
+    const uint32x4_t amask = vdupq_n_u32(0xff000000u);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, vorrq_u32(vld1q_u32(src + i), amask));
+    }
+
+    copy_xrgb_scalar(dst + i, src + i, n - i);
+}
+
+static void fill_neon(uint32_t *dst, uint32_t color, size_t n) {
+    const uint32x4_t c = vdupq_n_u32(color);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, c);
+    }
+
+    fill_scalar(dst + i, color, n - i);
+}
+
+static const struct cwc_blend_kernels kernels_neon = {
+    .name = "neon",
+    .over = over_neon,
+    .copy_xrgb = copy_xrgb_neon,
+    .fill = fill_neon,
+};
+#endif /* CWC_BLEND_NEON */
+
+const struct cwc_blend_kernels *cwc_blend = &kernels_scalar;
+
+/* Kernels in order of preference, each with its CPU check */
+static bool blend_supported(const struct cwc_blend_kernels *kernels) {
+#ifdef CWC_BLEND_X86
+    __builtin_cpu_init();
+    if (kernels == &kernels_avx2) return __builtin_cpu_supports("avx2");
+    if (kernels == &kernels_sse2) return __builtin_cpu_supports("sse2");
+#endif
+    (void)kernels;
+    return true;
+}
+
+static const struct cwc_blend_kernels *const blend_candidates[] = {
+#ifdef CWC_BLEND_X86
+    &kernels_avx2,
+    &kernels_sse2,
+#endif
+#ifdef CWC_BLEND_NEON
+    &kernels_neon,
+#endif
+    &kernels_scalar,
+};
+
+/* Look up kernels by name; NULL if unknown or unsupported on this CPU */
+const struct cwc_blend_kernels *cwc_blend_find(const char *name) {
+    for (size_t i = 0; i < sizeof(blend_candidates) / sizeof(blend_candidates[0]); i++) {
+        if (strcmp(blend_candidates[i]->name, name) == 0) {
+            return blend_supported(blend_candidates[i]) ? blend_candidates[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+void cwc_blend_init(struct cwc_server *server) {
+    const char *forced = getenv("CWC_BLEND");
+    if (forced) {
+        const struct cwc_blend_kernels *kernels = cwc_blend_find(forced);
+        if (kernels) {
+            cwc_blend = kernels;
+            cwc_log(server, CWC_LOG_INFO, "Using %s composite kernels (CWC_BLEND)", cwc_blend->name);
+            return;
+        }
+        cwc_log(server, CWC_LOG_WARN, "CWC_BLEND=%s is not available, autodetecting", forced);
+    }
+
+    for (size_t i = 0; i < sizeof(blend_candidates) / sizeof(blend_candidates[0]); i++) {
+        if (blend_supported(blend_candidates[i])) {
+            cwc_blend = blend_candidates[i];
+            break;
+        }
+    }
+
+    cwc_log(server, CWC_LOG_INFO, "Using %s composite kernels", cwc_blend->name);
+}
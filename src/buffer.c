@@ -0,0 +1,76 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Buffer base shared by wl_shm and linux-dmabuf buffers. Lifetime is
+ * reference counted so a buffer the client destroyed stays readable for
+ * as long as a surface or render snapshot still shows it.
+ */
+
+#include "../include/buffer.h"
+#include "../include/dmabuf.h"
+#include "../include/shm.h"
+
+void cwc_buffer_init(struct cwc_buffer *buffer, enum cwc_buffer_type type,
+                     const struct cwc_buffer_impl *impl, struct wl_resource *resource,
+                     int32_t width, int32_t height, uint32_t format) {
+    buffer->type = type;
+    buffer->impl = impl;
+    buffer->resource = resource;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->format = format;
+    buffer->pixel_format = cwc_format_from_shm(format);
+    buffer->ref_count = 1;
+    buffer->busy_count = 0;
+    buffer->release_pending = false;
+}
+
+/* NULL for anything that is not one of our wl_buffer implementations */
+struct cwc_buffer *cwc_buffer_from_resource(struct wl_resource *resource) {
+    struct cwc_shm_buffer *shm_buffer = cwc_shm_buffer_from_resource(resource);
+    if (shm_buffer) {
+        return &shm_buffer->base;
+    }
+
+    struct cwc_dmabuf_buffer *dmabuf_buffer = cwc_dmabuf_buffer_from_resource(resource);
+    if (dmabuf_buffer) {
+        return &dmabuf_buffer->base;
+    }
+    return NULL;
+}
+
+struct cwc_buffer *cwc_buffer_ref(struct cwc_buffer *buffer) {
+    buffer->ref_count++;
+    return buffer;
+}
+
+void cwc_buffer_unref(struct cwc_buffer *buffer) {
+    if (buffer && --buffer->ref_count == 0) {
+        buffer->impl->destroy(buffer);
+    }
+}
+
+/* Keep the pixels from being handed back to the client; implies a reference */
+struct cwc_buffer *cwc_buffer_lock(struct cwc_buffer *buffer) {
+    buffer->busy_count++;
+    return cwc_buffer_ref(buffer);
+}
+
+/* Release is sent once per commit, by whichever reader finishes last */
+void cwc_buffer_unlock(struct cwc_buffer *buffer) {
+    if (!buffer) return;
+
+    if (--buffer->busy_count == 0 && buffer->release_pending) {
+        buffer->release_pending = false;
+        if (buffer->resource) {
+            wl_buffer_send_release(buffer->resource);
+        }
+    }
+    cwc_buffer_unref(buffer);
+}
+
+/* The wl_buffer resource is gone; drop the reference it held */
+void cwc_buffer_resource_destroyed(struct cwc_buffer *buffer) {
+    buffer->resource = NULL;
+    cwc_buffer_unref(buffer);
+}
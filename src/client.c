@@ -0,0 +1,285 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Per-client bookkeeping. A cwc_client_state is attached to every
+ * connecting wl_client and lives until the client is destroyed. It is
+ * found through a hash on the wl_client pointer and keeps lists of the
+ * client's surfaces and pools, so per-client limits and cleanup never
+ * walk the server-wide lists.
+ *
+ * It also charges the client's usage against server->client_budget. Going
+ * over budget never fails a request; the client's frame callbacks are held
+ * back and released every CWC_CLIENT_THROTTLE_MS instead, so a runaway
+ * client slows itself down without stealing frames from the others.
+ *
+ * States come from a slab and own no event sources until a client first
+ * goes over budget, so idle connections cost a few hundred bytes here
+ * and nothing per frame. Clients over the limit are turned away by the
+ * listening socket before a state is ever created.
+ */
+
+#include "../include/cwc.h"
+#include "../include/compositor.h"
+#include "../include/hash.h"
+#include "../include/shm.h"
+#include "../include/slab.h"
+#include "../include/stats.h"
+
+static struct cwc_slab client_slab = CWC_SLAB_INIT("client", sizeof(struct cwc_client_state));
+
+const struct cwc_client_budget cwc_default_client_budget = {
+    .shm_bytes = CWC_CLIENT_BUDGET_SHM_BYTES,
+    .buffers = CWC_CLIENT_BUDGET_BUFFERS,
+    .commits_per_sec = CWC_CLIENT_BUDGET_COMMITS,
+    .damage_area = CWC_CLIENT_BUDGET_DAMAGE_AREA,
+    .captures_per_sec = CWC_CLIENT_BUDGET_CAPTURES,
+};
+
+static void client_handle_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_client_state *client_state = wl_container_of(listener, client_state, destroy);
+    cwc_client_state_destroy(client_state);
+}
+
+/* Release everything held back; the client gets another frame */
+static int client_throttle_timer(void *data) {
+    struct cwc_client_state *client_state = data;
+    uint32_t time_ms = cwc_time_msec();
+
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, &client_state->throttled_callbacks) {
+        wl_callback_send_done(cb, time_ms);
+        wl_resource_destroy(cb);
+    }
+    return 0;
+}
+
+static void client_handle_created(struct wl_listener *listener, void *data) {
+    struct cwc_server *server = wl_container_of(listener, server, client_created);
+    cwc_client_state_create(data, server);
+}
+
+void cwc_client_init(struct cwc_server *server) {
+    server->client_index = cwc_calloc(1, sizeof(*server->client_index));
+    cwc_hash_init(server->client_index);
+
+    server->client_created.notify = client_handle_created;
+    wl_display_add_client_created_listener(server->display, &server->client_created);
+}
+
+void cwc_client_state_create(struct wl_client *client, struct cwc_server *server) {
+    struct cwc_client_state *client_state = cwc_slab_alloc(&client_slab);
+    client_state->client = client;
+    client_state->server = server;
+    client_state->connect_time = time(NULL);
+    wl_list_init(&client_state->surfaces);
+    wl_list_init(&client_state->shm_pools);
+    wl_list_init(&client_state->throttled_callbacks);
+    client_state->commit_window_ms = cwc_time_msec();
+
+    client_state->destroy.notify = client_handle_destroy;
+    wl_client_add_destroy_listener(client, &client_state->destroy);
+    wl_list_insert(&server->clients, &client_state->link);
+    cwc_hash_insert(server->client_index, cwc_hash_ptr(client), client_state);
+
+    server->client_count++;
+    cwc_log(server, CWC_LOG_DEBUG, "Client connected (%u total)", server->client_count);
+}
+
+void cwc_client_state_destroy(struct cwc_client_state *client_state) {
+    if (!client_state) return;
+
+    struct cwc_server *server = client_state->server;
+    if (client_state->throttle_timer) {
+        wl_event_source_remove(client_state->throttle_timer);
+    }
+
+    /* The destroy signal fires before the client's resources go away */
+    struct cwc_surface *surface, *stmp;
+    wl_list_for_each_safe(surface, stmp, &client_state->surfaces, client_link) {
+        surface->client_state = NULL;
+        wl_list_init(&surface->client_link);
+    }
+    struct cwc_shm_pool *pool, *ptmp;
+    wl_list_for_each_safe(pool, ptmp, &client_state->shm_pools, client_link) {
+        pool->client_state = NULL;
+        wl_list_init(&pool->client_link);
+    }
+    struct wl_resource *cb, *ctmp;
+    wl_resource_for_each_safe(cb, ctmp, &client_state->throttled_callbacks) {
+        wl_list_init(wl_resource_get_link(cb));
+    }
+
+    cwc_hash_remove(server->client_index, cwc_hash_ptr(client_state->client));
+    wl_list_remove(&client_state->destroy.link);
+    wl_list_remove(&client_state->link);
+    server->client_count--;
+
+    cwc_log(server, CWC_LOG_DEBUG, "Client disconnected (%u total)", server->client_count);
+    cwc_slab_free(&client_slab, client_state);
+}
+
+struct cwc_client_state *cwc_client_state_lookup(struct cwc_server *server, struct wl_client *client) {
+    return cwc_hash_lookup(server->client_index, cwc_hash_ptr(client));
+}
+
+void cwc_client_finish(struct cwc_server *server) {
+    if (!server->client_index) return;
+
+    cwc_hash_fini(server->client_index);
+    cwc_free(server->client_index);
+    server->client_index = NULL;
+}
+
+/*
+ * Budget from a comma-separated list of KEY=VALUE on top of the defaults,
+ * e.g. "shm=128M,buffers=64,commits=240,damage=0". Keys are shm (bytes,
+ * with an optional K, M or G suffix), buffers, commits (per second),
+ * damage (pixels) and captures (screencopy frames per second and output).
+ * A value of 0 lifts that limit.
+ */
+bool cwc_client_budget_parse(const char *spec, struct cwc_client_budget *budget) {
+    *budget = cwc_default_client_budget;
+
+    const char *p = spec;
+    while (*p) {
+        const char *eq = strchr(p, '=');
+        if (!eq || eq == p) {
+            return false;
+        }
+        size_t key_len = (size_t)(eq - p);
+
+        char *end;
+        errno = 0;
+        unsigned long long value = strtoull(eq + 1, &end, 10);
+        if (errno || end == eq + 1 || eq[1] == '-') {
+            return false;
+        }
+
+        if (key_len == 3 && strncmp(p, "shm", 3) == 0) {
+            unsigned shift = 0;
+            switch (*end) {
+                case 'K': shift = 10; end++; break;
+                case 'M': shift = 20; end++; break;
+                case 'G': shift = 30; end++; break;
+            }
+            if (value > (UINT64_MAX >> shift)) {
+                return false;
+            }
+            budget->shm_bytes = (uint64_t)value << shift;
+        } else if (key_len == 7 && strncmp(p, "buffers", 7) == 0) {
+            if (value > UINT32_MAX) return false;
+            budget->buffers = (uint32_t)value;
+        } else if (key_len == 7 && strncmp(p, "commits", 7) == 0) {
+            if (value > UINT32_MAX) return false;
+            budget->commits_per_sec = (uint32_t)value;
+        } else if (key_len == 6 && strncmp(p, "damage", 6) == 0) {
+            budget->damage_area = value;
+        } else if (key_len == 8 && strncmp(p, "captures", 8) == 0) {
+            if (value > UINT32_MAX) return false;
+            budget->captures_per_sec = (uint32_t)value;
+        } else {
+            return false;
+        }
+
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return false;
+        }
+        p = end;
+    }
+    return true;
+}
+
+/* Commits are counted in fixed one-second windows */
+static uint32_t client_commit_rate(const struct cwc_client_state *client_state, uint32_t now) {
+    return now - client_state->commit_window_ms < 1000 ? client_state->commit_count : 0;
+}
+
+bool cwc_client_state_over_budget(struct cwc_client_state *client_state) {
+    const struct cwc_client_budget *budget = &client_state->server->client_budget;
+
+    return (budget->shm_bytes && client_state->shm_bytes > budget->shm_bytes) ||
+           (budget->buffers && client_state->buffer_count > budget->buffers) ||
+           (budget->commits_per_sec &&
+            client_commit_rate(client_state, cwc_time_msec()) > budget->commits_per_sec) ||
+           (budget->damage_area && client_state->damage_area > budget->damage_area);
+}
+
+void cwc_client_state_note_commit(struct cwc_client_state *client_state) {
+    uint32_t now = cwc_time_msec();
+    if (now - client_state->commit_window_ms >= 1000) {
+        client_state->commit_window_ms = now;
+        client_state->commit_count = 0;
+    }
+    client_state->commit_count++;
+}
+
+/*
+ * Buffers are counted while their wl_buffer exists. A client's resources
+ * are destroyed after its state, so the lookup fails for those and
+ * nothing is charged to a freed state.
+ */
+void cwc_client_buffer_created(struct cwc_server *server, struct wl_resource *resource) {
+    struct cwc_client_state *client_state =
+        cwc_client_state_lookup(server, wl_resource_get_client(resource));
+    if (client_state) {
+        client_state->buffer_count++;
+    }
+}
+
+void cwc_client_buffer_destroyed(struct cwc_server *server, struct wl_resource *resource) {
+    struct cwc_client_state *client_state =
+        cwc_client_state_lookup(server, wl_resource_get_client(resource));
+    if (client_state && client_state->buffer_count) {
+        client_state->buffer_count--;
+    }
+}
+
+/* The throttle timer, created the first time the client goes over budget */
+static struct wl_event_source *client_throttle_timer_get(struct cwc_client_state *client_state) {
+    if (!client_state->throttle_timer) {
+        client_state->throttle_timer = wl_event_loop_add_timer(client_state->server->event_loop,
+                                                               client_throttle_timer,
+                                                               client_state);
+    }
+    return client_state->throttle_timer;
+}
+
+/*
+ * Send a frame callback, or hold it back if its client is over budget.
+ * Held callbacks are flushed together by the client's throttle timer,
+ * which is armed once per throttled frame.
+ */
+void cwc_client_frame_done(struct cwc_server *server, struct wl_resource *callback, uint32_t time_ms) {
+    struct cwc_client_state *client_state =
+        cwc_client_state_lookup(server, wl_resource_get_client(callback));
+
+    bool over = client_state && cwc_client_state_over_budget(client_state) &&
+                client_throttle_timer_get(client_state);
+    if (client_state && over != client_state->throttled) {
+        client_state->throttled = over;
+        cwc_log(server, CWC_LOG_DEBUG, "Client %p %s its budget (shm %llu, buffers %u, "
+                "commits %u/s, damage %llu)", (void *)client_state->client,
+                over ? "exceeded" : "is back within",
+                (unsigned long long)client_state->shm_bytes, client_state->buffer_count,
+                client_commit_rate(client_state, cwc_time_msec()),
+                (unsigned long long)client_state->damage_area);
+    }
+
+    if (!over) {
+        wl_callback_send_done(callback, time_ms);
+        wl_resource_destroy(callback);
+        return;
+    }
+
+    if (wl_list_empty(&client_state->throttled_callbacks)) {
+        wl_event_source_timer_update(client_state->throttle_timer, CWC_CLIENT_THROTTLE_MS);
+    }
+    wl_list_remove(wl_resource_get_link(callback));
+    wl_list_insert(client_state->throttled_callbacks.prev, wl_resource_get_link(callback));
+    if (server->stats) {
+        server->stats->throttled_callbacks++;
+    }
+}
@@ -0,0 +1,675 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * wl_compositor, wl_surface and wl_region. Surface damage is collected in
+ * surface-local regions, merged on commit and handed to the surface's
+ * scene node, whose update forwards it to every output the surface
+ * overlaps, so repaint only recomposites what changed.
+ * Committed SHM and dma-buf buffers are referenced, never copied.
+ */
+
+#include "../include/compositor.h"
+#include "../include/buffer.h"
+#include "../include/output.h"
+#include "../include/presentation.h"
+#include "../include/renderer.h"
+#include "../include/shm.h"
+#include "../include/slab.h"
+
+#define CWC_COMPOSITOR_VERSION 6
+
+static struct cwc_slab surface_slab = CWC_SLAB_INIT("surface", sizeof(struct cwc_surface));
+static struct cwc_slab region_slab = CWC_SLAB_INIT("region", sizeof(struct cwc_region_resource));
+
+static const struct wl_compositor_interface compositor_implementation = {
+    .create_surface = cwc_compositor_create_surface,
+    .create_region = cwc_compositor_create_region,
+};
+
+/*
+ * wl_region implementation
+ */
+static void region_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+                       int32_t x, int32_t y, int32_t width, int32_t height) {
+    (void)client;
+    cwc_region_union_rect(cwc_region_from_resource(resource), x, y, width, height);
+}
+
+static void region_subtract(struct wl_client *client, struct wl_resource *resource,
+                            int32_t x, int32_t y, int32_t width, int32_t height) {
+    (void)client;
+    cwc_region_subtract_rect(cwc_region_from_resource(resource), x, y, width, height);
+}
+
+static const struct wl_region_interface region_implementation = {
+    .destroy = region_destroy,
+    .add = region_add,
+    .subtract = region_subtract,
+};
+
+struct cwc_region *cwc_region_from_resource(struct wl_resource *resource) {
+    struct cwc_region_resource *region = wl_resource_get_user_data(resource);
+    return &region->region;
+}
+
+void cwc_region_resource_destroy(struct wl_resource *resource) {
+    struct cwc_region_resource *region = wl_resource_get_user_data(resource);
+    cwc_region_fini(&region->region);
+    cwc_slab_free(&region_slab, region);
+}
+
+/*
+ * wl_surface implementation
+ */
+static void surface_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *resource,
+                           int32_t x, int32_t y, int32_t width, int32_t height) {
+    (void)client;
+    struct cwc_surface *surface = wl_resource_get_user_data(resource);
+    cwc_region_union_rect(&surface->pending->damage, x, y, width, height);
+    cwc_region_simplify(&surface->pending->damage, CWC_REGION_MAX_DAMAGE_RECTS);
+    surface->pending->committed |= CWC_SURFACE_STATE_DAMAGE;
+}
+
+/* Without buffer scale or transform, buffer and surface coordinates coincide */
+static void surface_damage_buffer(struct wl_client *client, struct wl_resource *resource,
+                                  int32_t x, int32_t y, int32_t width, int32_t height) {
+    surface_damage(client, resource, x, y, width, height);
+}
+
+static void frame_callback_destroy(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback) {
+    struct cwc_surface *surface = wl_resource_get_user_data(resource);
+
+    struct wl_resource *cb = wl_resource_create(client, &wl_callback_interface, 1, callback);
+    if (!cb) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(cb, NULL, NULL, frame_callback_destroy);
+    wl_list_insert(surface->pending->frame_callbacks.prev, wl_resource_get_link(cb));
+    surface->pending->committed |= CWC_SURFACE_STATE_FRAME;
+}
+
+/* The region is copied now; the client may destroy it before committing */
+static void surface_set_opaque_region(struct wl_client *client, struct wl_resource *resource,
+                                      struct wl_resource *region) {
+    (void)client;
+    struct cwc_surface *surface = wl_resource_get_user_data(resource);
+
+    if (region) {
+        cwc_region_copy(&surface->pending->opaque, cwc_region_from_resource(region));
+    } else {
+        cwc_region_clear(&surface->pending->opaque);
+    }
+    surface->pending->committed |= CWC_SURFACE_STATE_OPAQUE;
+}
+
+/* Input regions are accepted but not used yet */
+static void surface_set_input_region(struct wl_client *client, struct wl_resource *resource,
+                                     struct wl_resource *region) {
+    (void)client;
+    (void)resource;
+    (void)region;
+}
+
+static void surface_set_buffer_transform(struct wl_client *client, struct wl_resource *resource,
+                                         int32_t transform) {
+    (void)client;
+    if (transform < WL_OUTPUT_TRANSFORM_NORMAL || transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+        wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_TRANSFORM,
+                               "Invalid buffer transform %d", transform);
+    }
+}
+
+static void surface_set_buffer_scale(struct wl_client *client, struct wl_resource *resource,
+                                     int32_t scale) {
+    (void)client;
+    if (scale < 1) {
+        wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_SCALE,
+                               "Invalid buffer scale %d", scale);
+    }
+}
+
+static void surface_offset(struct wl_client *client, struct wl_resource *resource,
+                           int32_t x, int32_t y) {
+    (void)client;
+    struct cwc_surface *surface = wl_resource_get_user_data(resource);
+    surface->pending->dx = x;
+    surface->pending->dy = y;
+    surface->pending->committed |= CWC_SURFACE_STATE_OFFSET;
+}
+
+static const struct wl_surface_interface surface_implementation = {
+    .destroy = surface_handle_destroy,
+    .attach = cwc_surface_attach,
+    .damage = surface_damage,
+    .frame = surface_frame,
+    .set_opaque_region = surface_set_opaque_region,
+    .set_input_region = surface_set_input_region,
+    .commit = cwc_surface_commit,
+    .set_buffer_transform = surface_set_buffer_transform,
+    .set_buffer_scale = surface_set_buffer_scale,
+    .damage_buffer = surface_damage_buffer,
+    .offset = surface_offset,
+};
+
+static void surface_state_buffer_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_surface_state *state = wl_container_of(listener, state, buffer_destroy);
+    wl_list_remove(&state->buffer_destroy.link);
+    wl_list_init(&state->buffer_destroy.link);
+    state->buffer = NULL;
+}
+
+static void surface_state_set_buffer(struct cwc_surface_state *state, struct wl_resource *buffer) {
+    wl_list_remove(&state->buffer_destroy.link);
+    wl_list_init(&state->buffer_destroy.link);
+
+    state->buffer = buffer;
+    if (buffer) {
+        wl_resource_add_destroy_listener(buffer, &state->buffer_destroy);
+    }
+}
+
+static void surface_state_init(struct cwc_surface_state *state) {
+    state->committed = 0;
+    state->buffer = NULL;
+    wl_list_init(&state->buffer_destroy.link);
+    state->buffer_destroy.notify = surface_state_buffer_destroy;
+    state->dx = 0;
+    state->dy = 0;
+    cwc_region_init(&state->damage);
+    cwc_region_init(&state->opaque);
+    wl_list_init(&state->frame_callbacks);
+    wl_list_init(&state->feedbacks);
+}
+
+static void surface_state_fini(struct cwc_surface *surface, struct cwc_surface_state *state) {
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, &state->frame_callbacks) {
+        wl_resource_destroy(cb);
+    }
+    cwc_presentation_feedback_discard(surface->server, &state->feedbacks);
+
+    wl_list_remove(&state->buffer_destroy.link);
+    cwc_region_fini(&state->damage);
+    cwc_region_fini(&state->opaque);
+}
+
+void cwc_surface_attach(struct wl_client *client, struct wl_resource *resource,
+                        struct wl_resource *buffer, int32_t x, int32_t y) {
+    (void)client;
+    struct cwc_surface *surface = wl_resource_get_user_data(resource);
+
+    if (wl_resource_get_version(resource) >= WL_SURFACE_OFFSET_SINCE_VERSION) {
+        if (x != 0 || y != 0) {
+            wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_OFFSET,
+                                   "Non-zero attach offset, use wl_surface.offset");
+            return;
+        }
+    } else {
+        surface->pending->dx = x;
+        surface->pending->dy = y;
+        surface->pending->committed |= CWC_SURFACE_STATE_OFFSET;
+    }
+
+    surface_state_set_buffer(surface->pending, buffer);
+    surface->pending->committed |= CWC_SURFACE_STATE_BUFFER;
+}
+
+/*
+ * Make buffer the surface's committed contents. The software renderer
+ * samples it straight out of the client's pool mapping, so the surface
+ * keeps it busy until a later commit replaces it, unless the renderer
+ * reports a copy first. Snapshots and scanout lock it on their own, so
+ * the release waits for the last composite or flip that reads it.
+ */
+static void surface_set_buffer(struct cwc_surface *surface, struct cwc_buffer *buffer) {
+    struct cwc_buffer *old = surface->buffer;
+    bool old_locked = surface->buffer_locked;
+
+    if (buffer) {
+        cwc_buffer_lock(buffer);
+        buffer->release_pending = true;
+        surface->width = buffer->width;
+        surface->height = buffer->height;
+    } else {
+        surface->width = 0;
+        surface->height = 0;
+    }
+    surface->buffer = buffer;
+    surface->buffer_locked = buffer != NULL;
+    surface->mapped = buffer != NULL;
+
+    if (old_locked) {
+        cwc_buffer_unlock(old);
+    } else {
+        cwc_buffer_unref(old);
+    }
+}
+
+/*
+ * The renderer's cache now holds everything committed, so the buffer
+ * can go back to the client before the next commit replaces it. The
+ * surface keeps its reference for the size and format.
+ */
+void cwc_surface_buffer_copied(struct cwc_surface *surface) {
+    if (!surface->buffer_locked) {
+        return;
+    }
+
+    surface->buffer_locked = false;
+    cwc_buffer_ref(surface->buffer);
+    cwc_buffer_unlock(surface->buffer);
+}
+
+/* A resize invalidates everything the old buffer covered */
+static void surface_apply_buffer(struct cwc_surface *surface, struct cwc_buffer *buffer) {
+    if (!surface->buffer || buffer->width != surface->width || buffer->height != surface->height) {
+        cwc_region_clear(&surface->current->damage);
+        cwc_region_union_rect(&surface->current->damage, 0, 0, buffer->width, buffer->height);
+    }
+
+    surface_set_buffer(surface, buffer);
+}
+
+/*
+ * Swap surface->pending and surface->current, keeping whatever the client
+ * left alone out of pending. Regions and lists move by value, so a commit
+ * allocates nothing; the previous current block is reset as the new
+ * pending one, its damage storage ready for the next frame.
+ */
+static void surface_state_swap(struct cwc_surface *surface) {
+    struct cwc_surface_state *next = surface->pending;
+    struct cwc_surface_state *prev = surface->current;
+    surface->current = next;
+    surface->pending = prev;
+
+    if (!(next->committed & CWC_SURFACE_STATE_OPAQUE)) {
+        struct cwc_region opaque = next->opaque;
+        next->opaque = prev->opaque;
+        prev->opaque = opaque;
+    }
+
+    /* Callbacks still waiting for a repaint keep their place in front */
+    wl_list_insert_list(&next->frame_callbacks, &prev->frame_callbacks);
+    wl_list_init(&prev->frame_callbacks);
+
+    /* Contents no repaint picked up are replaced before they were shown */
+    cwc_presentation_feedback_discard(surface->server, &prev->feedbacks);
+
+    cwc_region_clear(&prev->damage);
+    prev->dx = 0;
+    prev->dy = 0;
+    prev->committed = 0;
+}
+
+void cwc_surface_commit(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    struct cwc_surface *surface = wl_resource_get_user_data(resource);
+    struct cwc_scene *scene = surface->server->scene;
+
+    struct cwc_box old_box = surface->node.box;
+
+    surface_state_swap(surface);
+    struct cwc_surface_state *state = surface->current;
+    uint32_t committed = state->committed;
+
+    /* Validated once here; an unsupported buffer leaves the old one in place */
+    struct cwc_buffer *buffer = NULL;
+    if ((committed & CWC_SURFACE_STATE_BUFFER) && state->buffer) {
+        if (cwc_buffer_validate(state->buffer)) {
+            buffer = cwc_buffer_from_resource(state->buffer);
+        } else {
+            cwc_log(surface->server, CWC_LOG_WARN, "Ignoring unsupported buffer on surface %u",
+                    wl_resource_get_id(surface->resource));
+        }
+    }
+
+    if (committed & CWC_SURFACE_STATE_OFFSET) {
+        surface->x += state->dx;
+        surface->y += state->dy;
+    }
+
+    /* Clip damage to the size the surface will have after this commit */
+    if (committed & CWC_SURFACE_STATE_DAMAGE) {
+        struct cwc_box bounds = { 0, 0, surface->width, surface->height };
+        if (buffer) {
+            bounds.x2 = buffer->width;
+            bounds.y2 = buffer->height;
+        }
+        cwc_region_intersect_box(&state->damage, &bounds);
+    }
+
+    if (committed & CWC_SURFACE_STATE_BUFFER) {
+        if (buffer) {
+            surface_apply_buffer(surface, buffer);
+        } else if (!state->buffer) {
+            surface_set_buffer(surface, NULL);
+        }
+        surface_state_set_buffer(state, NULL);
+    }
+    if (committed & (CWC_SURFACE_STATE_BUFFER | CWC_SURFACE_STATE_DAMAGE)) {
+        cwc_renderer_surface_commit(surface->server->renderer, surface);
+    }
+
+    /* The scene turns this into layout damage; a move or resize exposes the old area too */
+    if (committed & CWC_SURFACE_STATE_OFFSET) {
+        cwc_scene_node_set_position(scene, &surface->node, surface->x, surface->y);
+    }
+    if (committed & CWC_SURFACE_STATE_BUFFER) {
+        cwc_scene_node_set_size(scene, &surface->node, surface->width, surface->height);
+        cwc_scene_node_set_enabled(scene, &surface->node, surface->mapped);
+    }
+    cwc_scene_node_damage(scene, &surface->node, &state->damage);
+    cwc_scene_update(scene);
+
+    struct cwc_box new_box = surface->node.box;
+    bool changed = memcmp(&old_box, &new_box, sizeof(old_box)) != 0 ||
+                   !cwc_region_is_empty(&state->damage);
+    if (!surface->mapped) {
+        surface->commit_ns = 0;
+        surface->input_ns = 0;
+    } else if (changed) {
+        if (!surface->commit_ns) {
+            surface->commit_ns = cwc_time_nsec();
+        }
+
+        /* The first visible commit after input is taken as its answer */
+        struct cwc_client_state *client_state = surface->client_state;
+        if (client_state && client_state->input_ns) {
+            if (!surface->input_ns) {
+                surface->input_ns = client_state->input_ns;
+            }
+            client_state->input_ns = 0;
+        }
+    }
+
+    if (surface->client_state) {
+        cwc_client_state_note_commit(surface->client_state);
+    }
+
+    /* Throttle frame callbacks to the outputs the surface is shown on */
+    if (!surface->mapped) {
+        cwc_surface_send_frame_done(surface, cwc_time_msec());
+        cwc_presentation_feedback_discard(surface->server, &state->feedbacks);
+        return;
+    }
+
+    uint32_t outputs = surface->node.output_mask;
+    if (outputs && (!wl_list_empty(&state->frame_callbacks) ||
+                    !wl_list_empty(&state->feedbacks))) {
+        struct cwc_output *output;
+        wl_list_for_each(output, &surface->server->outputs, link) {
+            if (outputs & output->scene_bit) {
+                cwc_output_schedule_repaint(output);
+            }
+        }
+    }
+
+    /* Only damage some output will repaint can be discharged again */
+    if (outputs && surface->client_state) {
+        uint64_t area = cwc_region_area(&state->damage);
+        surface->charged_area += area;
+        surface->client_state->damage_area += area;
+    }
+}
+
+/* The surface's damage has been handed to a repaint */
+void cwc_surface_discharge_damage(struct cwc_surface *surface) {
+    if (surface->client_state) {
+        surface->client_state->damage_area -= surface->charged_area;
+    }
+    surface->charged_area = 0;
+}
+
+/* Surface rectangle in layout coordinates, empty while unmapped */
+void cwc_surface_get_box(const struct cwc_surface *surface, struct cwc_box *box) {
+    *box = surface->node.box;
+}
+
+/*
+ * Region of the surface, in layout coordinates, known to cover whatever
+ * is below it: the whole surface for XRGB buffers, otherwise the client's
+ * opaque region clipped to the buffer.
+ */
+void cwc_surface_get_opaque_region(const struct cwc_surface *surface, struct cwc_region *opaque) {
+    cwc_region_clear(opaque);
+    if (!surface->mapped || !surface->buffer) {
+        return;
+    }
+
+    struct cwc_box box;
+    cwc_surface_get_box(surface, &box);
+
+    if (!surface->buffer->pixel_format->has_alpha) {
+        cwc_region_union_box(opaque, &box);
+        return;
+    }
+
+    cwc_region_copy(opaque, &surface->current->opaque);
+    cwc_region_translate(opaque, box.x1, box.y1);
+    cwc_region_intersect_box(opaque, &box);
+}
+
+struct surface_pick {
+    struct cwc_surface *surface;
+    struct cwc_surface **surfaces;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static void surface_pick_top(struct cwc_spatial_entry *entry, void *data) {
+    struct surface_pick *pick = data;
+    struct cwc_surface *surface = entry->data;
+    if (surface->buffer && (!pick->surface || surface->stack_order > pick->surface->stack_order)) {
+        pick->surface = surface;
+    }
+}
+
+/* Topmost surface under a layout point, with surface-local coordinates */
+struct cwc_surface *cwc_surface_at(struct cwc_server *server, int32_t x, int32_t y,
+                                   int32_t *sx, int32_t *sy) {
+    struct surface_pick pick = { 0 };
+    cwc_spatial_query_point(server->surface_grid, x, y, surface_pick_top, &pick);
+
+    if (pick.surface) {
+        if (sx) *sx = x - pick.surface->node.box.x1;
+        if (sy) *sy = y - pick.surface->node.box.y1;
+    }
+    return pick.surface;
+}
+
+static void surface_pick_append(struct cwc_spatial_entry *entry, void *data) {
+    struct surface_pick *pick = data;
+    if (pick->count == pick->capacity) {
+        pick->capacity = pick->capacity ? pick->capacity * 2 : 16;
+        pick->surfaces = cwc_realloc(pick->surfaces, pick->capacity * sizeof(*pick->surfaces));
+    }
+    pick->surfaces[pick->count++] = entry->data;
+}
+
+static int surface_compare_front_to_back(const void *a, const void *b) {
+    const struct cwc_surface *sa = *(struct cwc_surface *const *)a;
+    const struct cwc_surface *sb = *(struct cwc_surface *const *)b;
+    return (sa->stack_order < sb->stack_order) - (sa->stack_order > sb->stack_order);
+}
+
+/*
+ * Mapped surfaces overlapping a layout box, front to back. The array is
+ * returned in *surfaces and must be released with cwc_free().
+ */
+uint32_t cwc_surface_collect_box(struct cwc_server *server, const struct cwc_box *box,
+                                 struct cwc_surface ***surfaces) {
+    struct surface_pick pick = { 0 };
+    cwc_spatial_query_box(server->surface_grid, box, surface_pick_append, &pick);
+
+    if (pick.count > 1) {
+        qsort(pick.surfaces, pick.count, sizeof(*pick.surfaces), surface_compare_front_to_back);
+    }
+    *surfaces = pick.surfaces;
+    return pick.count;
+}
+
+void cwc_surface_send_frame_done(struct cwc_surface *surface, uint32_t time_ms) {
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, &surface->current->frame_callbacks) {
+        cwc_client_frame_done(surface->server, cb, time_ms);
+    }
+}
+
+struct cwc_surface *cwc_surface_create(struct wl_client *client, struct cwc_server *server,
+                                       uint32_t version, uint32_t id) {
+    if (server->surface_count >= server->max_surfaces) {
+        cwc_log(server, CWC_LOG_WARN, "Surface limit (%u) reached", server->max_surfaces);
+        return NULL;
+    }
+
+    struct cwc_surface *surface = cwc_slab_alloc(&surface_slab);
+    surface->resource = wl_resource_create(client, &wl_surface_interface, (int)version, id);
+    if (!surface->resource) {
+        cwc_slab_free(&surface_slab, surface);
+        return NULL;
+    }
+
+    surface->server = server;
+    surface->client_state = cwc_client_state_lookup(server, client);
+    if (surface->client_state) {
+        surface->client_state->surface_count++;
+        wl_list_insert(&surface->client_state->surfaces, &surface->client_link);
+    } else {
+        wl_list_init(&surface->client_link);
+    }
+    surface->create_time = time(NULL);
+    surface_state_init(&surface->states[0]);
+    surface_state_init(&surface->states[1]);
+    surface->pending = &surface->states[0];
+    surface->current = &surface->states[1];
+
+    wl_resource_set_implementation(surface->resource, &surface_implementation, surface,
+                                   cwc_surface_resource_destroy);
+
+    /* New surfaces stack on top */
+    cwc_scene_node_init(server->scene, &surface->node, CWC_SCENE_NODE_BUFFER,
+                        &server->scene->root, surface);
+    surface->stack_order = ++server->stack_seq;
+    server->surface_count++;
+
+    cwc_log(server, CWC_LOG_DEBUG, "Surface %u created", id);
+    return surface;
+}
+
+void cwc_surface_destroy(struct cwc_surface *surface) {
+    if (!surface) return;
+
+    surface_state_fini(surface, surface->pending);
+    surface_state_fini(surface, surface->current);
+
+    wl_list_remove(&surface->client_link);
+    cwc_scene_node_remove(surface->server->scene, &surface->node);
+    surface->server->surface_count--;
+    cwc_surface_discharge_damage(surface);
+    if (surface->client_state) {
+        surface->client_state->surface_count--;
+    }
+
+    cwc_renderer_surface_destroy(surface->server->renderer, surface);
+
+    surface_set_buffer(surface, NULL);
+    cwc_slab_free(&surface_slab, surface);
+}
+
+void cwc_surface_resource_destroy(struct wl_resource *resource) {
+    cwc_surface_destroy(wl_resource_get_user_data(resource));
+}
+
+/*
+ * wl_compositor implementation
+ */
+void cwc_compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct cwc_compositor *compositor = wl_resource_get_user_data(resource);
+
+    if (!cwc_surface_create(client, compositor->server,
+                            (uint32_t)wl_resource_get_version(resource), id)) {
+        wl_client_post_no_memory(client);
+    }
+}
+
+void cwc_compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct cwc_region_resource *region = cwc_slab_alloc(&region_slab);
+    cwc_region_init(&region->region);
+
+    region->resource = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!region->resource) {
+        cwc_slab_free(&region_slab, region);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(region->resource, &region_implementation, region,
+                                   cwc_region_resource_destroy);
+}
+
+void cwc_compositor_resource_destroy(struct wl_resource *resource) {
+    struct cwc_compositor *compositor = wl_resource_get_user_data(resource);
+    cwc_free(compositor);
+}
+
+void cwc_compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct cwc_server *server = data;
+    uint32_t bound_version = version < CWC_COMPOSITOR_VERSION ? version : CWC_COMPOSITOR_VERSION;
+
+    struct cwc_compositor *compositor = cwc_calloc(1, sizeof(*compositor));
+    compositor->server = server;
+    wl_list_init(&compositor->link);
+
+    compositor->resource = wl_resource_create(client, &wl_compositor_interface,
+                                              (int)bound_version, id);
+    if (!compositor->resource) {
+        cwc_free(compositor);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(compositor->resource, &compositor_implementation,
+                                   compositor, cwc_compositor_resource_destroy);
+}
+
+/*
+ * Validation
+ */
+bool cwc_surface_validate(struct cwc_surface *surface) {
+    return surface && surface->resource && surface->server &&
+           (!surface->mapped || surface->buffer);
+}
+
+bool cwc_buffer_validate(struct wl_resource *buffer) {
+    struct cwc_buffer *base = cwc_buffer_from_resource(buffer);
+    if (!base) {
+        return false;
+    }
+
+    /* dma-buf attributes are immutable and were checked at import */
+    if (base->type == CWC_BUFFER_DMABUF) {
+        return true;
+    }
+
+    struct cwc_shm_buffer *shm_buffer = (struct cwc_shm_buffer *)base;
+    return cwc_shm_buffer_validate(shm_buffer->offset, base->width, base->height,
+                                   shm_buffer->stride, base->format,
+                                   shm_buffer->pool->size);
+}
@@ -0,0 +1,388 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * zwp_linux_dmabuf_v1. GPU clients hand over dma-buf fds instead of
+ * reading frames back into a wl_shm pool. Only layouts we can consume
+ * are advertised: every single-plane format in format.h, 16 bpp RGB565
+ * included, with the linear modifier. The software renderer maps and
+ * samples those in place; a GPU renderer imports the same fds without
+ * any copy.
+ */
+
+#include "../include/dmabuf.h"
+#include "../include/renderer.h"
+#include "../include/slab.h"
+#include <linux/dma-buf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#define CWC_DMABUF_VERSION 3
+
+static struct cwc_slab params_slab = CWC_SLAB_INIT("dmabuf-params", sizeof(struct cwc_dmabuf_params));
+static struct cwc_slab buffer_slab = CWC_SLAB_INIT("dmabuf-buffer", sizeof(struct cwc_dmabuf_buffer));
+
+
+void cwc_dmabuf_attributes_finish(struct cwc_dmabuf_attributes *attributes) {
+    for (uint32_t i = 0; i < CWC_DMABUF_MAX_PLANES; i++) {
+        if (attributes->planes[i].fd >= 0) {
+            close(attributes->planes[i].fd);
+            attributes->planes[i].fd = -1;
+        }
+    }
+    attributes->n_planes = 0;
+}
+
+/* Bracket CPU reads; safe on any thread */
+void cwc_dmabuf_sync(int fd, bool begin) {
+    struct dma_buf_sync sync = {
+        .flags = (begin ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) | DMA_BUF_SYNC_READ,
+    };
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) == -1 && (errno == EINTR || errno == EAGAIN)) {
+        /* retry */
+    }
+}
+
+/*
+ * wl_buffer implementation
+ */
+static void dmabuf_buffer_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface dmabuf_buffer_implementation = {
+    .destroy = dmabuf_buffer_handle_destroy,
+};
+
+static void dmabuf_buffer_destroy(struct cwc_buffer *base) {
+    struct cwc_dmabuf_buffer *buffer = (struct cwc_dmabuf_buffer *)base;
+    if (buffer->render_data) {
+        cwc_renderer_buffer_destroy(buffer->server->renderer, base);
+    }
+    if (buffer->map_data) {
+        munmap((void *)buffer->map_data, buffer->map_size);
+    }
+    cwc_dmabuf_attributes_finish(&buffer->attributes);
+    cwc_slab_free(&buffer_slab, buffer);
+}
+
+static const struct cwc_buffer_impl dmabuf_buffer_impl = {
+    .destroy = dmabuf_buffer_destroy,
+};
+
+static void dmabuf_buffer_resource_destroy(struct wl_resource *resource) {
+    struct cwc_dmabuf_buffer *buffer = wl_resource_get_user_data(resource);
+    cwc_client_buffer_destroyed(buffer->server, resource);
+    cwc_buffer_resource_destroyed(&buffer->base);
+}
+
+struct cwc_dmabuf_buffer *cwc_dmabuf_buffer_from_resource(struct wl_resource *resource) {
+    if (!resource || !wl_resource_instance_of(resource, &wl_buffer_interface,
+                                              &dmabuf_buffer_implementation)) {
+        return NULL;
+    }
+    return wl_resource_get_user_data(resource);
+}
+
+/* Plane 0 pixels for the software renderer, NULL if the buffer is GPU only */
+const uchar *cwc_dmabuf_buffer_get_data(struct cwc_dmabuf_buffer *buffer) {
+    if (!buffer->map_data) {
+        return NULL;
+    }
+    return buffer->map_data + buffer->attributes.planes[0].offset;
+}
+
+/*
+ * zwp_linux_buffer_params_v1 implementation
+ */
+static void params_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void params_handle_add(struct wl_client *client, struct wl_resource *resource,
+                              int32_t fd, uint32_t plane_idx, uint32_t offset, uint32_t stride,
+                              uint32_t modifier_hi, uint32_t modifier_lo) {
+    (void)client;
+    struct cwc_dmabuf_params *params = wl_resource_get_user_data(resource);
+    uint64_t modifier = ((uint64_t)modifier_hi << 32) | modifier_lo;
+
+    if (params->used) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                               "Params already used to create a buffer");
+        close(fd);
+        return;
+    }
+    if (plane_idx >= CWC_DMABUF_MAX_PLANES) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+                               "Plane index %u out of bounds", plane_idx);
+        close(fd);
+        return;
+    }
+
+    struct cwc_dmabuf_plane *plane = &params->attributes.planes[plane_idx];
+    if (plane->fd >= 0) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+                               "Plane %u already set", plane_idx);
+        close(fd);
+        return;
+    }
+    if (params->modifier_set && params->attributes.modifier != modifier) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+                               "Modifier mismatch between planes");
+        close(fd);
+        return;
+    }
+
+    params->attributes.modifier = modifier;
+    params->modifier_set = true;
+    plane->fd = fd;
+    plane->offset = offset;
+    plane->stride = stride;
+    if (plane_idx + 1 > params->attributes.n_planes) {
+        params->attributes.n_planes = plane_idx + 1;
+    }
+}
+
+/*
+ * Protocol checks shared by create and create_immed. Posts the error on
+ * the params object and returns false if the client got something wrong.
+ */
+static bool params_validate(struct cwc_dmabuf_params *params, int32_t width, int32_t height,
+                            uint32_t format) {
+    struct wl_resource *resource = params->resource;
+    struct cwc_dmabuf_attributes *attributes = &params->attributes;
+
+    if (params->used) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                               "Params already used to create a buffer");
+        return false;
+    }
+
+    if (attributes->n_planes == 0) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                               "No dma-buf planes added");
+        return false;
+    }
+    for (uint32_t i = 0; i < attributes->n_planes; i++) {
+        if (attributes->planes[i].fd < 0) {
+            wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                                   "Plane %u missing", i);
+            return false;
+        }
+    }
+
+    const struct cwc_format *pixel_format = cwc_format_from_drm(format);
+    if (!pixel_format ||
+        attributes->modifier != DRM_FORMAT_MOD_LINEAR) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+                               "Unsupported format 0x%08x, modifier 0x%016llx", format,
+                               (unsigned long long)attributes->modifier);
+        return false;
+    }
+    if (attributes->n_planes != 1) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                               "Format 0x%08x takes 1 plane, got %u", format,
+                               attributes->n_planes);
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || width > CWC_DMABUF_MAX_DIMENSION ||
+        height > CWC_DMABUF_MAX_DIMENSION) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+                               "Invalid dimensions %dx%d", width, height);
+        return false;
+    }
+
+    /* The fd size is only known for exporters that support lseek */
+    const struct cwc_dmabuf_plane *plane = &attributes->planes[0];
+    uint64_t end = (uint64_t)plane->offset + (uint64_t)plane->stride * (uint64_t)height;
+    off_t size = lseek(plane->fd, 0, SEEK_END);
+    if (plane->stride < (uint32_t)width * pixel_format->bytes_per_pixel ||
+        plane->stride > INT32_MAX ||
+        (size >= 0 && end > (uint64_t)size)) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+                               "Plane 0 (offset %u, stride %u) exceeds the dma-buf",
+                               plane->offset, plane->stride);
+        return false;
+    }
+
+    attributes->width = width;
+    attributes->height = height;
+    attributes->format = format;
+    return true;
+}
+
+/*
+ * Import validated attributes. Failures here are the kernel's or the
+ * exporter's, not a protocol violation, and are reported as 'failed'.
+ */
+static struct cwc_dmabuf_buffer *params_import(struct cwc_dmabuf_params *params, uint32_t flags) {
+    struct cwc_dmabuf_attributes *attributes = &params->attributes;
+    if (flags != 0) {
+        cwc_log(params->server, CWC_LOG_DEBUG, "dma-buf flags 0x%x not supported", flags);
+        return NULL;
+    }
+
+    const struct cwc_dmabuf_plane *plane = &attributes->planes[0];
+    size_t map_size = (size_t)plane->offset + (size_t)plane->stride * (size_t)attributes->height;
+    void *map_data = mmap(NULL, map_size, PROT_READ, MAP_SHARED, plane->fd, 0);
+    if (map_data == MAP_FAILED) {
+        cwc_log(params->server, CWC_LOG_DEBUG, "Failed to map dma-buf: %s", strerror(errno));
+        return NULL;
+    }
+
+    struct cwc_dmabuf_buffer *buffer = cwc_slab_alloc(&buffer_slab);
+    buffer->server = params->server;
+    buffer->attributes = *attributes;
+    buffer->attributes.flags = flags;
+    buffer->map_data = map_data;
+    buffer->map_size = map_size;
+    buffer->render_data = NULL;
+
+    /* The buffer owns the fds now */
+    for (uint32_t i = 0; i < CWC_DMABUF_MAX_PLANES; i++) {
+        attributes->planes[i].fd = -1;
+    }
+    attributes->n_planes = 0;
+    return buffer;
+}
+
+static struct wl_resource *dmabuf_buffer_publish(struct wl_client *client,
+                                                 struct cwc_dmabuf_buffer *buffer, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    if (!resource) {
+        dmabuf_buffer_destroy(&buffer->base);
+        wl_client_post_no_memory(client);
+        return NULL;
+    }
+
+    /* Validated against the format table when the params were created */
+    const struct cwc_format *pixel_format = cwc_format_from_drm(buffer->attributes.format);
+    cwc_buffer_init(&buffer->base, CWC_BUFFER_DMABUF, &dmabuf_buffer_impl, resource,
+                    buffer->attributes.width, buffer->attributes.height,
+                    pixel_format->shm_format);
+    wl_resource_set_implementation(resource, &dmabuf_buffer_implementation, buffer,
+                                   dmabuf_buffer_resource_destroy);
+    cwc_client_buffer_created(buffer->server, resource);
+    return resource;
+}
+
+static void params_handle_create(struct wl_client *client, struct wl_resource *resource,
+                                 int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+    struct cwc_dmabuf_params *params = wl_resource_get_user_data(resource);
+    if (!params_validate(params, width, height, format)) {
+        return;
+    }
+    params->used = true;
+
+    struct cwc_dmabuf_buffer *buffer = params_import(params, flags);
+    if (!buffer) {
+        zwp_linux_buffer_params_v1_send_failed(resource);
+        return;
+    }
+
+    struct wl_resource *buffer_resource = dmabuf_buffer_publish(client, buffer, 0);
+    if (buffer_resource) {
+        zwp_linux_buffer_params_v1_send_created(resource, buffer_resource);
+    }
+}
+
+static void params_handle_create_immed(struct wl_client *client, struct wl_resource *resource,
+                                       uint32_t buffer_id, int32_t width, int32_t height,
+                                       uint32_t format, uint32_t flags) {
+    struct cwc_dmabuf_params *params = wl_resource_get_user_data(resource);
+    if (!params_validate(params, width, height, format)) {
+        return;
+    }
+    params->used = true;
+
+    struct cwc_dmabuf_buffer *buffer = params_import(params, flags);
+    if (!buffer) {
+        /* The id is taken either way; a buffer that failed is never attachable */
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+                               "Failed to import dma-buf");
+        return;
+    }
+
+    dmabuf_buffer_publish(client, buffer, buffer_id);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface params_implementation = {
+    .destroy = params_handle_destroy,
+    .add = params_handle_add,
+    .create = params_handle_create,
+    .create_immed = params_handle_create_immed,
+};
+
+static void params_resource_destroy(struct wl_resource *resource) {
+    struct cwc_dmabuf_params *params = wl_resource_get_user_data(resource);
+    cwc_dmabuf_attributes_finish(&params->attributes);
+    cwc_slab_free(&params_slab, params);
+}
+
+/*
+ * zwp_linux_dmabuf_v1 implementation
+ */
+static void dmabuf_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void dmabuf_handle_create_params(struct wl_client *client, struct wl_resource *resource,
+                                        uint32_t id) {
+    struct cwc_server *server = wl_resource_get_user_data(resource);
+
+    struct wl_resource *params_resource = wl_resource_create(
+        client, &zwp_linux_buffer_params_v1_interface, wl_resource_get_version(resource), id);
+    if (!params_resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    struct cwc_dmabuf_params *params = cwc_slab_alloc(&params_slab);
+    params->resource = params_resource;
+    params->server = server;
+    for (uint32_t i = 0; i < CWC_DMABUF_MAX_PLANES; i++) {
+        params->attributes.planes[i].fd = -1;
+    }
+
+    wl_resource_set_implementation(params_resource, &params_implementation, params,
+                                   params_resource_destroy);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface dmabuf_implementation = {
+    .destroy = dmabuf_handle_destroy,
+    .create_params = dmabuf_handle_create_params,
+};
+
+void cwc_dmabuf_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct cwc_server *server = data;
+    uint32_t bound_version = version < CWC_DMABUF_VERSION ? version : CWC_DMABUF_VERSION;
+
+    struct wl_resource *resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface,
+                                                      (int)bound_version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &dmabuf_implementation, server, NULL);
+
+    /* Version 3 replaced the format event with format + modifier pairs */
+    for (size_t i = 0; i < CWC_FORMAT_COUNT; i++) {
+        uint32_t format = cwc_formats[i].drm_format;
+        if (bound_version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION) {
+            zwp_linux_dmabuf_v1_send_modifier(resource, format,
+                                              (uint32_t)(DRM_FORMAT_MOD_LINEAR >> 32),
+                                              (uint32_t)(DRM_FORMAT_MOD_LINEAR & 0xffffffffu));
+        } else {
+            zwp_linux_dmabuf_v1_send_format(resource, format);
+        }
+    }
+}
+
+cwc_error_t cwc_dmabuf_init(struct cwc_server *server) {
+    server->dmabuf_global = wl_global_create(server->display, &zwp_linux_dmabuf_v1_interface,
+                                             CWC_DMABUF_VERSION, server, cwc_dmabuf_bind);
+    return server->dmabuf_global ? CWC_SUCCESS : CWC_ERROR_RESOURCE;
+}
@@ -0,0 +1,168 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Framebuffer memory. Tries reserved huge pages first, then transparent
+ * huge pages on a huge-page-aligned anonymous mapping, and settles for
+ * ordinary pages when neither is there. Every allocation is prefaulted,
+ * so the cost is paid once at configure time instead of as page faults
+ * spread over the first frame.
+ */
+
+#include "../include/fbmem.h"
+#include <inttypes.h>
+
+static size_t align_up(size_t size, size_t alignment) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+/* The default huge page size, Hugepagesize in /proc/meminfo */
+static size_t huge_page_size(void) {
+    static size_t cached = 0;
+    if (cached) {
+        return cached;
+    }
+
+    cached = CWC_FBMEM_DEFAULT_HUGE_PAGE;
+    FILE *meminfo = fopen("/proc/meminfo", "r");
+    if (!meminfo) {
+        return cached;
+    }
+
+    char line[128];
+    unsigned long kib;
+    while (fgets(line, sizeof(line), meminfo)) {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kib) == 1 && kib > 0) {
+            cached = (size_t)kib * 1024;
+            break;
+        }
+    }
+    fclose(meminfo);
+    return cached;
+}
+
+/* MADV_POPULATE_WRITE needs Linux 5.14; touch each page before that */
+static void prefault(void *data, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(data, size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < size; offset += page) {
+        ((volatile uchar *)data)[offset] = 0;
+    }
+}
+
+/* Fails unless the administrator reserved enough huge pages */
+static bool alloc_hugetlb(struct cwc_fbmem *mem, size_t size) {
+#ifdef MAP_HUGETLB
+    size_t mapped = align_up(size, huge_page_size());
+    void *data = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    mem->data = data;
+    mem->mapped = mapped;
+    mem->backing = CWC_FBMEM_HUGETLB;
+    return true;
+#else
+    (void)mem;
+    (void)size;
+    return false;
+#endif
+}
+
+/*
+ * Over-map by one huge page and trim, so the range starts on a huge page
+ * boundary and khugepaged is not needed to collapse it later.
+ */
+static void alloc_pages(struct cwc_fbmem *mem, size_t size) {
+    size_t huge = huge_page_size();
+    size_t mapped = align_up(size, huge);
+    uchar *raw = mmap(NULL, mapped + huge, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        fprintf(stderr, "Fatal: Framebuffer allocation failed for %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+
+    uchar *data = (uchar *)align_up((size_t)(uintptr_t)raw, huge);
+    if (data > raw) {
+        munmap(raw, (size_t)(data - raw));
+    }
+    munmap(data + mapped, (size_t)(raw + huge - data));
+
+    mem->data = data;
+    mem->mapped = mapped;
+    mem->backing = CWC_FBMEM_PAGES;
+#ifdef MADV_HUGEPAGE
+    if (madvise(data, mapped, MADV_HUGEPAGE) == 0) {
+        mem->backing = CWC_FBMEM_THP;
+    }
+#endif
+    prefault(data, mapped);
+}
+
+/* Zero-filled like cwc_calloc, and like it exits when memory runs out */
+void cwc_fbmem_alloc(struct cwc_fbmem *mem, size_t size) {
+    uint64_t start = cwc_time_nsec();
+
+    mem->size = size;
+    if (!alloc_hugetlb(mem, size)) {
+        alloc_pages(mem, size);
+    }
+    mem->populate_ns = cwc_time_nsec() - start;
+}
+
+void cwc_fbmem_free(struct cwc_fbmem *mem) {
+    if (mem->data) {
+        munmap(mem->data, mem->mapped);
+    }
+    memset(mem, 0, sizeof(*mem));
+}
+
+/* AnonHugePages of the mapping, all of it for MAP_HUGETLB */
+size_t cwc_fbmem_huge_bytes(const struct cwc_fbmem *mem) {
+    if (!mem->data || mem->backing == CWC_FBMEM_PAGES) {
+        return 0;
+    }
+    if (mem->backing == CWC_FBMEM_HUGETLB) {
+        return mem->mapped;
+    }
+
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (!smaps) {
+        return 0;
+    }
+
+    /* THP may merge the range with a neighbour; only look in the VMA holding it */
+    uintptr_t address = (uintptr_t)mem->data;
+    bool inside = false;
+    size_t huge = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps)) {
+        uintptr_t start, end;
+        unsigned long kib;
+        if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+            if (inside) {
+                break;
+            }
+            inside = address >= start && address < end;
+        } else if (inside && sscanf(line, "AnonHugePages: %lu kB", &kib) == 1) {
+            huge = (size_t)kib * 1024;
+        }
+    }
+    fclose(smaps);
+    return huge < mem->mapped ? huge : mem->mapped;
+}
+
+const char *cwc_fbmem_backing_name(enum cwc_fbmem_backing backing) {
+    switch (backing) {
+        case CWC_FBMEM_HUGETLB: return "hugetlb";
+        case CWC_FBMEM_THP: return "thp";
+        case CWC_FBMEM_PAGES: return "pages";
+        default: return "unknown";
+    }
+}
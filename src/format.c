@@ -0,0 +1,119 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Pixel format descriptors. The table and the composite loops are both
+ * expanded from CWC_FORMATS, so each (format, opaque or blended) pair
+ * gets its own loop with the decoder inlined, and the renderer only
+ * picks a function pointer once per row. The destination is always the
+ * XRGB8888 framebuffer.
+ */
+
+#include "../include/format.h"
+#include "../include/blend.h"
+
+/*
+ * Decoders, one per format: a pixel at p to premultiplied ARGB8888.
+ * Loads go through memcpy since client strides need not be aligned.
+ */
+static inline uint32_t load32(const uchar *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t pixel_ARGB8888(const uchar *p) {
+    return load32(p);
+}
+
+static inline uint32_t pixel_XRGB8888(const uchar *p) {
+    return load32(p) | 0xff000000u;
+}
+
+/* Ten bits per channel, already premultiplied; the top eight are kept */
+static inline uint32_t pixel_ABGR2101010(const uchar *p) {
+    uint32_t v = load32(p);
+    uint32_t r = (v >> 2) & 0xff;
+    uint32_t g = (v >> 12) & 0xff;
+    uint32_t b = (v >> 22) & 0xff;
+    uint32_t a = (v >> 30) * 0x55;
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+/* Channels widened by replicating their top bits */
+static inline uint32_t pixel_RGB565(const uchar *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    uint32_t r = (v >> 11) & 0x1f;
+    uint32_t g = (v >> 5) & 0x3f;
+    uint32_t b = v & 0x1f;
+    return 0xff000000u | ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+}
+
+/*
+ * Row loops. native and bpp are constants in each expansion, so the
+ * compiler keeps exactly one of the two paths.
+ */
+#define CWC_FORMAT_LOOPS(id, shm, drm, bpp, alpha, native)                              \
+    static void fetch_##id(uint32_t *dst, const uchar *src, size_t n) {                 \
+        for (size_t i = 0; i < n; i++) {                                                \
+            dst[i] = pixel_##id(src + i * (bpp));                                       \
+        }                                                                               \
+    }                                                                                   \
+    static void over_##id(uint32_t *dst, const uchar *src, size_t n) {                  \
+        if (native) {                                                                   \
+            cwc_blend->over(dst, (const uint32_t *)(const void *)src, n);               \
+            return;                                                                     \
+        }                                                                               \
+        for (size_t i = 0; i < n; i++) {                                                \
+            dst[i] = cwc_blend_over_pixel(pixel_##id(src + i * (bpp)), dst[i]);         \
+        }                                                                               \
+    }                                                                                   \
+    static void copy_##id(uint32_t *dst, const uchar *src, size_t n) {                  \
+        if (native) {                                                                   \
+            cwc_blend->copy_xrgb(dst, (const uint32_t *)(const void *)src, n);          \
+            return;                                                                     \
+        }                                                                               \
+        for (size_t i = 0; i < n; i++) {                                                \
+            dst[i] = pixel_##id(src + i * (bpp)) | 0xff000000u;                         \
+        }                                                                               \
+    }
+
+CWC_FORMATS(CWC_FORMAT_LOOPS)
+#undef CWC_FORMAT_LOOPS
+
+/* Without alpha, blending is a copy */
+#define CWC_FORMAT_ENTRY(id, shm, drm, bpp, alpha, is_native)                           \
+    [CWC_FORMAT_##id] = {                                                               \
+        .name = #id,                                                                    \
+        .shm_format = (shm),                                                            \
+        .drm_format = (drm),                                                            \
+        .bytes_per_pixel = (bpp),                                                       \
+        .has_alpha = (alpha),                                                           \
+        .native = (is_native),                                                          \
+        .fetch = fetch_##id,                                                            \
+        .over = (alpha) ? over_##id : copy_##id,                                        \
+        .copy = copy_##id,                                                              \
+    },
+
+const struct cwc_format cwc_formats[CWC_FORMAT_COUNT] = {
+    CWC_FORMATS(CWC_FORMAT_ENTRY)
+};
+#undef CWC_FORMAT_ENTRY
+
+const struct cwc_format *cwc_format_from_shm(uint32_t shm_format) {
+    for (size_t i = 0; i < CWC_FORMAT_COUNT; i++) {
+        if (cwc_formats[i].shm_format == shm_format) {
+            return &cwc_formats[i];
+        }
+    }
+    return NULL;
+}
+
+const struct cwc_format *cwc_format_from_drm(uint32_t drm_format) {
+    for (size_t i = 0; i < CWC_FORMAT_COUNT; i++) {
+        if (cwc_formats[i].drm_format == drm_format) {
+            return &cwc_formats[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,119 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Linear-probing hash table. Removal shifts later entries of the probe
+ * run back instead of leaving tombstones, so lookups never degrade after
+ * heavy client churn.
+ */
+
+#include "../include/hash.h"
+
+#define CWC_HASH_MIN_CAPACITY 16
+
+/* splitmix64 finalizer; object addresses have their low bits all zero */
+static uint64_t hash_mix(uint64_t key) {
+    key ^= key >> 30;
+    key *= UINT64_C(0xbf58476d1ce4e5b9);
+    key ^= key >> 27;
+    key *= UINT64_C(0x94d049bb133111eb);
+    key ^= key >> 31;
+    return key;
+}
+
+static uint32_t hash_slot(const struct cwc_hash *hash, uint64_t key) {
+    return (uint32_t)hash_mix(key) & (hash->capacity - 1);
+}
+
+static void hash_resize(struct cwc_hash *hash, uint32_t capacity) {
+    struct cwc_hash_entry *old = hash->entries;
+    uint32_t old_capacity = hash->capacity;
+
+    hash->entries = cwc_calloc(capacity, sizeof(*hash->entries));
+    hash->capacity = capacity;
+    hash->count = 0;
+
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i].value) {
+            cwc_hash_insert(hash, old[i].key, old[i].value);
+        }
+    }
+    cwc_free(old);
+}
+
+void cwc_hash_init(struct cwc_hash *hash) {
+    memset(hash, 0, sizeof(*hash));
+}
+
+void cwc_hash_fini(struct cwc_hash *hash) {
+    cwc_free(hash->entries);
+    cwc_hash_init(hash);
+}
+
+void *cwc_hash_lookup(const struct cwc_hash *hash, uint64_t key) {
+    if (hash->count == 0) {
+        return NULL;
+    }
+
+    for (uint32_t i = hash_slot(hash, key);; i = (i + 1) & (hash->capacity - 1)) {
+        const struct cwc_hash_entry *entry = &hash->entries[i];
+        if (!entry->value) {
+            return NULL;
+        }
+        if (entry->key == key) {
+            return entry->value;
+        }
+    }
+}
+
+/* Insert or replace; value must not be NULL */
+void cwc_hash_insert(struct cwc_hash *hash, uint64_t key, void *value) {
+    if ((hash->count + 1) * 4 > hash->capacity * 3) {
+        hash_resize(hash, hash->capacity ? hash->capacity * 2 : CWC_HASH_MIN_CAPACITY);
+    }
+
+    for (uint32_t i = hash_slot(hash, key);; i = (i + 1) & (hash->capacity - 1)) {
+        struct cwc_hash_entry *entry = &hash->entries[i];
+        if (!entry->value) {
+            entry->key = key;
+            entry->value = value;
+            hash->count++;
+            return;
+        }
+        if (entry->key == key) {
+            entry->value = value;
+            return;
+        }
+    }
+}
+
+/* Returns the removed value, or NULL if the key was not present */
+void *cwc_hash_remove(struct cwc_hash *hash, uint64_t key) {
+    if (hash->count == 0) {
+        return NULL;
+    }
+
+    uint32_t mask = hash->capacity - 1;
+    uint32_t i = hash_slot(hash, key);
+    while (hash->entries[i].value && hash->entries[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    if (!hash->entries[i].value) {
+        return NULL;
+    }
+
+    void *value = hash->entries[i].value;
+    hash->entries[i].value = NULL;
+    hash->count--;
+
+    /* Pull back entries whose probe run passed through the freed slot */
+    for (uint32_t j = (i + 1) & mask; hash->entries[j].value; j = (j + 1) & mask) {
+        uint32_t home = hash_slot(hash, hash->entries[j].key);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            hash->entries[i] = hash->entries[j];
+            hash->entries[j].value = NULL;
+            i = j;
+        }
+    }
+
+    return value;
+}
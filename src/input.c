@@ -0,0 +1,221 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * libinput backend. Devices of the udev seat are opened directly, like
+ * the DRM device, and their events are read on the event loop and handed
+ * to the seat with libinput's microsecond CLOCK_MONOTONIC timestamps.
+ * Only pointer devices are used so far; keyboards stay with the VT.
+ */
+
+#include "../include/input.h"
+
+#ifdef CWC_HAVE_LIBINPUT
+
+#include <libinput.h>
+#include <libudev.h>
+#include "../include/backend.h"
+#include "../include/seat.h"
+#include "../include/startup.h"
+
+struct cwc_input {
+    struct cwc_server *server;
+    struct udev *udev;
+    struct libinput *libinput;
+    struct wl_event_source *source;
+    uint32_t pointer_devices;
+};
+
+static int input_open_restricted(const char *path, int flags, void *data) {
+    (void)data;
+    int fd = open(path, flags | O_CLOEXEC);
+    return fd == -1 ? -errno : fd;
+}
+
+static void input_close_restricted(int fd, void *data) {
+    (void)data;
+    close(fd);
+}
+
+static const struct libinput_interface input_interface = {
+    .open_restricted = input_open_restricted,
+    .close_restricted = input_close_restricted,
+};
+
+static void input_device_changed(struct cwc_input *input, struct libinput_device *device,
+                                 bool added) {
+    if (!libinput_device_has_capability(device, LIBINPUT_DEVICE_CAP_POINTER)) {
+        return;
+    }
+
+    input->pointer_devices += added ? 1 : (uint32_t)-1;
+    cwc_log(input->server, CWC_LOG_DEBUG, "Pointer %s %s", libinput_device_get_name(device),
+            added ? "added" : "removed");
+    cwc_seat_set_capabilities(input->server->seat,
+                              input->pointer_devices ? WL_SEAT_CAPABILITY_POINTER : 0);
+}
+
+static void input_handle_scroll(struct cwc_seat *seat, struct libinput_event_pointer *pointer,
+                                uint64_t time_ns) {
+    if (libinput_event_pointer_has_axis(pointer, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL)) {
+        cwc_seat_pointer_axis(seat, time_ns, WL_POINTER_AXIS_VERTICAL_SCROLL,
+                              libinput_event_pointer_get_scroll_value(
+                                  pointer, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL));
+    }
+    if (libinput_event_pointer_has_axis(pointer, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL)) {
+        cwc_seat_pointer_axis(seat, time_ns, WL_POINTER_AXIS_HORIZONTAL_SCROLL,
+                              libinput_event_pointer_get_scroll_value(
+                                  pointer, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL));
+    }
+}
+
+static void input_handle_event(struct cwc_input *input, struct libinput_event *event) {
+    struct cwc_seat *seat = input->server->seat;
+    struct libinput_event_pointer *pointer;
+    uint64_t time_ns;
+
+    switch (libinput_event_get_type(event)) {
+        case LIBINPUT_EVENT_DEVICE_ADDED:
+            input_device_changed(input, libinput_event_get_device(event), true);
+            break;
+        case LIBINPUT_EVENT_DEVICE_REMOVED:
+            input_device_changed(input, libinput_event_get_device(event), false);
+            break;
+        case LIBINPUT_EVENT_POINTER_MOTION:
+            pointer = libinput_event_get_pointer_event(event);
+            time_ns = libinput_event_pointer_get_time_usec(pointer) * 1000;
+            cwc_seat_pointer_motion(seat, time_ns,
+                                    libinput_event_pointer_get_dx(pointer),
+                                    libinput_event_pointer_get_dy(pointer),
+                                    libinput_event_pointer_get_dx_unaccelerated(pointer),
+                                    libinput_event_pointer_get_dy_unaccelerated(pointer));
+            break;
+        case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE: {
+            pointer = libinput_event_get_pointer_event(event);
+            time_ns = libinput_event_pointer_get_time_usec(pointer) * 1000;
+            double x = libinput_event_pointer_get_absolute_x_transformed(pointer, 1);
+            double y = libinput_event_pointer_get_absolute_y_transformed(pointer, 1);
+            cwc_seat_pointer_motion_absolute(seat, time_ns, x, y);
+            break;
+        }
+        case LIBINPUT_EVENT_POINTER_BUTTON:
+            pointer = libinput_event_get_pointer_event(event);
+            time_ns = libinput_event_pointer_get_time_usec(pointer) * 1000;
+            cwc_seat_pointer_button(seat, time_ns, libinput_event_pointer_get_button(pointer),
+                                    libinput_event_pointer_get_button_state(pointer) ==
+                                    LIBINPUT_BUTTON_STATE_PRESSED);
+            break;
+        case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+        case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+        case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+            pointer = libinput_event_get_pointer_event(event);
+            time_ns = libinput_event_pointer_get_time_usec(pointer) * 1000;
+            input_handle_scroll(seat, pointer, time_ns);
+            break;
+        default:
+            break;
+    }
+}
+
+/* One read drains everything the kernel queued, relative motion included */
+static int input_handle_readable(int fd, uint32_t mask, void *data) {
+    (void)fd;
+    (void)mask;
+    struct cwc_input *input = data;
+
+    if (libinput_dispatch(input->libinput) != 0) {
+        cwc_log(input->server, CWC_LOG_WARN, "libinput dispatch failed");
+    }
+
+    struct libinput_event *event;
+    while ((event = libinput_get_event(input->libinput))) {
+        input_handle_event(input, event);
+        libinput_event_destroy(event);
+    }
+    return 0;
+}
+
+static void input_destroy(struct cwc_input *input) {
+    if (input->source) {
+        wl_event_source_remove(input->source);
+    }
+    if (input->libinput) {
+        libinput_unref(input->libinput);
+    }
+    if (input->udev) {
+        udev_unref(input->udev);
+    }
+    cwc_free(input);
+}
+
+/* Startup thread: enumerating and opening the devices is the slow part */
+static void *input_run(struct cwc_server *server, void *data) {
+    (void)data;
+    struct cwc_input *input = cwc_calloc(1, sizeof(*input));
+    input->server = server;
+
+    input->udev = udev_new();
+    if (!input->udev) {
+        cwc_log(server, CWC_LOG_WARN, "No udev context, running without input devices");
+        input_destroy(input);
+        return NULL;
+    }
+
+    input->libinput = libinput_udev_create_context(&input_interface, input, input->udev);
+    if (!input->libinput || libinput_udev_assign_seat(input->libinput, CWC_INPUT_SEAT) != 0) {
+        cwc_log(server, CWC_LOG_WARN, "Cannot open the input devices of %s", CWC_INPUT_SEAT);
+        input_destroy(input);
+        return NULL;
+    }
+    return input;
+}
+
+/* The devices found so far are queued as added events, handled right away */
+static void input_done(struct cwc_server *server, void *result, void *data) {
+    (void)data;
+    struct cwc_input *input = result;
+    if (!input) {
+        return;
+    }
+
+    input->source = wl_event_loop_add_fd(server->event_loop, libinput_get_fd(input->libinput),
+                                         WL_EVENT_READABLE, input_handle_readable, input);
+    if (!input->source) {
+        cwc_log(server, CWC_LOG_WARN, "Cannot watch the input devices");
+        input_destroy(input);
+        return;
+    }
+
+    server->input = input;
+    input_handle_readable(libinput_get_fd(input->libinput), WL_EVENT_READABLE, input);
+}
+
+void cwc_input_init(struct cwc_server *server) {
+    if (!server->backend || strcmp(server->backend->impl->name, "drm") != 0) {
+        cwc_log(server, CWC_LOG_DEBUG, "No input devices on the %s backend",
+                server->backend ? server->backend->impl->name : "missing");
+        return;
+    }
+    cwc_startup_spawn(server, "libinput", input_run, input_done, NULL);
+}
+
+void cwc_input_finish(struct cwc_server *server) {
+    if (!server->input) return;
+
+    input_destroy(server->input);
+    server->input = NULL;
+    if (server->seat) {
+        cwc_seat_set_capabilities(server->seat, 0);
+    }
+}
+
+#else /* !CWC_HAVE_LIBINPUT */
+
+void cwc_input_init(struct cwc_server *server) {
+    cwc_log(server, CWC_LOG_DEBUG, "Built without the libinput backend");
+}
+
+void cwc_input_finish(struct cwc_server *server) {
+    (void)server;
+}
+
+#endif /* CWC_HAVE_LIBINPUT */
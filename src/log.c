@@ -0,0 +1,330 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Logging. Every message becomes one preformatted line. By default the
+ * line is written on the spot; with --async-log it is copied into a ring
+ * and a background thread does the disk I/O, so the dispatch thread never
+ * waits on write() or fsync().
+ */
+
+#include "../include/log.h"
+#include "../include/threadpool.h"
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/eventfd.h>
+
+static const char *const level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+/* Formatted once per second per thread; localtime_r() is not cheap */
+static _Thread_local char cached_timestamp[32];
+static _Thread_local time_t cached_second = (time_t)-1;
+
+static const char *log_timestamp(void) {
+    time_t now = time(NULL);
+    if (now != cached_second) {
+        struct tm tm_info;
+        localtime_r(&now, &tm_info);
+        strftime(cached_timestamp, sizeof(cached_timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
+        cached_second = now;
+    }
+    return cached_timestamp;
+}
+
+static void log_write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+}
+
+/*
+ * Drain thread
+ */
+static void logger_drain_ring(struct cwc_logger *logger, uint64_t head) {
+    uint64_t tail = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+
+    while (tail < head) {
+        size_t offset = (size_t)(tail & (CWC_LOG_RING_SIZE - 1));
+        size_t chunk = (size_t)(head - tail);
+        if (chunk > CWC_LOG_RING_SIZE - offset) {
+            chunk = CWC_LOG_RING_SIZE - offset;
+        }
+
+        log_write_all(logger->fd, logger->ring + offset, chunk);
+        tail += chunk;
+        atomic_store_explicit(&logger->tail, tail, memory_order_release);
+    }
+}
+
+/* Lines and blobs in the order they were queued */
+static void logger_drain(struct cwc_logger *logger) {
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&logger->head, memory_order_acquire);
+
+        pthread_mutex_lock(&logger->blob_lock);
+        struct cwc_log_blob *blob = logger->blobs;
+        if (blob) {
+            logger->blobs = blob->next;
+            if (!logger->blobs) {
+                logger->blob_tail = &logger->blobs;
+            }
+        }
+        pthread_mutex_unlock(&logger->blob_lock);
+
+        logger_drain_ring(logger, blob ? blob->head : head);
+        if (!blob) {
+            break;
+        }
+        log_write_all(logger->fd, blob->data, blob->length);
+        free(blob->data);
+        cwc_free(blob);
+    }
+
+    uint64_t dropped = atomic_exchange(&logger->dropped, 0);
+    if (dropped) {
+        char line[96];
+        int length = snprintf(line, sizeof(line), "[%s] WARN: %llu log messages dropped\n",
+                              log_timestamp(), (unsigned long long)dropped);
+        log_write_all(logger->fd, line, (size_t)length);
+    }
+
+    if (atomic_exchange(&logger->fsync_pending, false)) {
+        fsync(logger->fd);
+    }
+}
+
+static void *logger_thread(void *data) {
+    struct cwc_logger *logger = data;
+
+    for (;;) {
+        bool running = atomic_load(&logger->running);
+        logger_drain(logger);
+        if (!running) {
+            break;
+        }
+
+        /* Re-check after announcing the sleep so a racing push is not missed */
+        atomic_store(&logger->sleeping, true);
+        if (atomic_load(&logger->head) != atomic_load(&logger->tail)) {
+            atomic_store(&logger->sleeping, false);
+            continue;
+        }
+
+        struct pollfd pfd = { .fd = logger->wake_fd, .events = POLLIN };
+        if (poll(&pfd, 1, CWC_LOG_DRAIN_INTERVAL_MS) > 0) {
+            uint64_t count;
+            if (read(logger->wake_fd, &count, sizeof(count)) < 0) {
+                /* nothing to do; the counter is only a doorbell */
+            }
+        }
+        atomic_store(&logger->sleeping, false);
+    }
+
+    return NULL;
+}
+
+static void logger_wake(struct cwc_logger *logger) {
+    uint64_t one = 1;
+    if (write(logger->wake_fd, &one, sizeof(one)) < 0) {
+        /* the drain thread polls with a timeout anyway */
+    }
+}
+
+/*
+ * Ring
+ */
+struct cwc_logger *cwc_logger_create(struct cwc_server *server, int fd) {
+    struct cwc_logger *logger = cwc_calloc(1, sizeof(*logger));
+    logger->server = server;
+    logger->fd = fd;
+    logger->producer = pthread_self();
+    logger->ring = cwc_malloc(CWC_LOG_RING_SIZE);
+    atomic_init(&logger->head, 0);
+    atomic_init(&logger->tail, 0);
+    atomic_init(&logger->sleeping, false);
+    atomic_init(&logger->fsync_pending, false);
+    atomic_init(&logger->running, true);
+    atomic_init(&logger->dropped, 0);
+    logger->blob_tail = &logger->blobs;
+
+    logger->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (logger->wake_fd == -1) {
+        cwc_free(logger->ring);
+        cwc_free(logger);
+        return NULL;
+    }
+    pthread_mutex_init(&logger->blob_lock, NULL);
+
+    if (cwc_thread_create(&logger->thread, "cwc-log", logger_thread, logger, false) != 0) {
+        close(logger->wake_fd);
+        pthread_mutex_destroy(&logger->blob_lock);
+        cwc_free(logger->ring);
+        cwc_free(logger);
+        return NULL;
+    }
+
+    return logger;
+}
+
+/* Stop the drain thread after it has written everything still queued */
+void cwc_logger_destroy(struct cwc_logger *logger) {
+    if (!logger) return;
+
+    atomic_store(&logger->running, false);
+    logger_wake(logger);
+    pthread_join(logger->thread, NULL);
+
+    close(logger->wake_fd);
+    pthread_mutex_destroy(&logger->blob_lock);
+    cwc_free(logger->ring);
+    cwc_free(logger);
+}
+
+/*
+ * Queue a finished line. Returns false if the caller has to write it
+ * itself: it is not the producer thread, or the line is urgent and the
+ * ring is full. Non-urgent lines that do not fit are dropped.
+ */
+bool cwc_logger_push(struct cwc_logger *logger, const char *line, size_t length, bool urgent) {
+    if (!pthread_equal(pthread_self(), logger->producer)) {
+        return false;
+    }
+
+    uint64_t head = atomic_load_explicit(&logger->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&logger->tail, memory_order_acquire);
+    if (length > CWC_LOG_RING_SIZE - (size_t)(head - tail)) {
+        if (urgent) {
+            return false;
+        }
+        atomic_fetch_add_explicit(&logger->dropped, 1, memory_order_relaxed);
+        return true;
+    }
+
+    size_t offset = (size_t)(head & (CWC_LOG_RING_SIZE - 1));
+    size_t first = CWC_LOG_RING_SIZE - offset;
+    if (first > length) {
+        first = length;
+    }
+    memcpy(logger->ring + offset, line, first);
+    memcpy(logger->ring, line + first, length - first);
+
+    atomic_store(&logger->head, head + length);
+    if (urgent) {
+        atomic_store(&logger->fsync_pending, true);
+    }
+
+    /* Only pay for the wakeup syscall when the drain thread is idle */
+    if (atomic_load(&logger->sleeping) && atomic_exchange(&logger->sleeping, false)) {
+        logger_wake(logger);
+    }
+    return true;
+}
+
+/*
+ * Queue a malloc()ed document behind the lines queued so far, taking
+ * ownership of data. Returns false, data still the caller's, when not
+ * called from the producer thread.
+ */
+bool cwc_logger_push_blob(struct cwc_logger *logger, char *data, size_t length) {
+    if (!pthread_equal(pthread_self(), logger->producer)) {
+        return false;
+    }
+
+    struct cwc_log_blob *blob = cwc_malloc(sizeof(*blob));
+    blob->data = data;
+    blob->length = length;
+    blob->head = atomic_load_explicit(&logger->head, memory_order_relaxed);
+    blob->next = NULL;
+
+    pthread_mutex_lock(&logger->blob_lock);
+    *logger->blob_tail = blob;
+    logger->blob_tail = &blob->next;
+    pthread_mutex_unlock(&logger->blob_lock);
+
+    /* Rare, so always ring; the eventfd keeps the wakeup if the thread is not asleep yet */
+    logger_wake(logger);
+    return true;
+}
+
+/*
+ * Public logging interface
+ */
+
+/* Called through cwc_log(), which has already filtered on level */
+void cwc_log_write(struct cwc_server *server, cwc_log_level_t level, const char *format, ...) {
+    if (!server || level > server->log_level) {
+        return;
+    }
+
+    char line[CWC_LOG_BUFFER_SIZE + 64];
+    int prefix = snprintf(line, sizeof(line), "[%s] %s: ", log_timestamp(), level_names[level]);
+    size_t length = prefix > 0 ? (size_t)prefix : 0;
+
+    va_list args;
+    va_start(args, format);
+    int message = vsnprintf(line + length, CWC_LOG_BUFFER_SIZE, format, args);
+    va_end(args);
+
+    if (message > 0) {
+        length += (size_t)message < CWC_LOG_BUFFER_SIZE ? (size_t)message : CWC_LOG_BUFFER_SIZE - 1;
+    }
+    line[length++] = '\n';
+
+    bool urgent = level == CWC_LOG_ERROR;
+    if (server->logger && cwc_logger_push(server->logger, line, length, urgent)) {
+        return;
+    }
+
+    log_write_all(server->log_fd, line, length);
+
+    /* Flush immediately for errors */
+    if (urgent) {
+        fsync(server->log_fd);
+    }
+}
+
+/* A whole document, e.g. a stats dump, after the lines logged before it; frees data */
+void cwc_log_write_document(struct cwc_server *server, char *data, size_t length) {
+    if (server->logger && cwc_logger_push_blob(server->logger, data, length)) {
+        return;
+    }
+    log_write_all(server->log_fd, data, length);
+    free(data);
+}
+
+/* Initialize logging */
+void cwc_log_init(struct cwc_server *server, const char *log_file) {
+    if (log_file) {
+        server->log_fd = open(log_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (server->log_fd == -1) {
+            fprintf(stderr, "Failed to open log file %s: %s\n", log_file, strerror(errno));
+            server->log_fd = STDOUT_FILENO;
+        }
+    } else {
+        server->log_fd = STDOUT_FILENO;
+    }
+
+    server->log_level = server->debug_mode ? CWC_LOG_DEBUG : CWC_LOG_INFO;
+
+    if (server->log_async) {
+        server->logger = cwc_logger_create(server, server->log_fd);
+        if (!server->logger) {
+            fprintf(stderr, "Failed to start log thread, logging synchronously\n");
+        }
+    }
+}
+
+/* Cleanup logging */
+void cwc_log_cleanup(struct cwc_server *server) {
+    cwc_logger_destroy(server->logger);
+    server->logger = NULL;
+
+    if (server->log_fd != STDOUT_FILENO && server->log_fd != STDERR_FILENO) {
+        close(server->log_fd);
+    }
+}
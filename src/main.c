@@ -13,9 +13,28 @@
  */
 
 #include "../include/cwc.h"
+#include "../include/backend.h"
+#include "../include/blend.h"
+#include "../include/compositor.h"
+#include "../include/dmabuf.h"
+#include "../include/input.h"
+#include "../include/memory.h"
+#include "../include/output.h"
+#include "../include/presentation.h"
+#include "../include/renderer.h"
+#include "../include/scene.h"
+#include "../include/screencopy.h"
+#include "../include/seat.h"
+#include "../include/shm.h"
+#include "../include/slab.h"
+#include "../include/socket.h"
+#include "../include/spatial.h"
+#include "../include/startup.h"
+#include "../include/stats.h"
+#include "../include/threadpool.h"
+#include <poll.h>
 #include <signal.h>
 #include <getopt.h>
-#include <stdarg.h>
 
 /* Global server instance for signal handling */
 static struct cwc_server *g_server = NULL;
@@ -24,6 +43,7 @@ static struct cwc_server *g_server = NULL;
 static void signal_handler(int signal) {
     if (g_server && g_server->display) {
         printf("Received signal %d, shutting down gracefully\n", signal);
+        g_server->running = 0;
         wl_display_terminate(g_server->display);
     }
 }
@@ -59,6 +79,21 @@ void cwc_print_usage(const char *program_name) {
     printf("  -l, --log-file FILE  Log to file instead of stdout\n");
     printf("  -d, --debug          Enable debug mode\n");
     printf("  -q, --quiet          Reduce log output\n");
+    printf("  -a, --async-log      Write log output from a background thread\n");
+    printf("  -m, --max-surfaces N Surface limit (default: %d)\n", CWC_MAX_SURFACES);
+    printf("  -c, --max-clients N  Client limit (default: %d)\n", CWC_MAX_CLIENTS);
+    printf("  -r, --renderer NAME  software, gles2 or auto (default: auto)\n");
+    printf("  -b, --backend NAME   drm, virtual or auto (default: auto)\n");
+    printf("  -H, --headless       Virtual outputs only, same as --backend virtual\n");
+    printf("  -o, --output MODE    Add a virtual output WIDTHxHEIGHT[@HZ], repeatable\n");
+    printf("  -B, --client-budget LIST\n");
+    printf("                       Per-client limits before frame callbacks are throttled,\n");
+    printf("                       e.g. shm=256M,buffers=%d,commits=%d,damage=%llu (0: none)\n",
+           CWC_CLIENT_BUDGET_BUFFERS, CWC_CLIENT_BUDGET_COMMITS,
+           (unsigned long long)CWC_CLIENT_BUDGET_DAMAGE_AREA);
+    printf("                       captures=N caps screencopy frames per second and output\n");
+    printf("  -M, --memory-budget SIZE\n");
+    printf("                       Cached SHM mappings and textures kept, e.g. 512M (default: none)\n");
 }
 
 /* Convert error code to string */
@@ -74,53 +109,16 @@ const char *cwc_error_string(cwc_error_t error) {
     }
 }
 
-/* Logging function with levels */
-void cwc_log(struct cwc_server *server, cwc_log_level_t level, const char *format, ...) {
-    if (!server || level > server->log_level) {
-        return;
-    }
-    
-    const char *level_str[] = {"ERROR", "WARN", "INFO", "DEBUG"};
-    char timestamp[32];
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    
-    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    char buffer[CWC_LOG_BUFFER_SIZE];
-    va_list args;
-    va_start(args, format);
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    va_end(args);
-    
-    dprintf(server->log_fd, "[%s] %s: %s\n", timestamp, level_str[level], buffer);
-    
-    /* Flush immediately for errors */
-    if (level == CWC_LOG_ERROR) {
-        fsync(server->log_fd);
-    }
+/* Monotonic clock in nanoseconds, the time base of all frame scheduling */
+uint64_t cwc_time_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-/* Initialize logging */
-void cwc_log_init(struct cwc_server *server, const char *log_file) {
-    if (log_file) {
-        server->log_fd = open(log_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
-        if (server->log_fd == -1) {
-            fprintf(stderr, "Failed to open log file %s: %s\n", log_file, strerror(errno));
-            server->log_fd = STDOUT_FILENO;
-        }
-    } else {
-        server->log_fd = STDOUT_FILENO;
-    }
-    
-    server->log_level = server->debug_mode ? CWC_LOG_DEBUG : CWC_LOG_INFO;
-}
-
-/* Cleanup logging */
-void cwc_log_cleanup(struct cwc_server *server) {
-    if (server->log_fd != STDOUT_FILENO && server->log_fd != STDERR_FILENO) {
-        close(server->log_fd);
-    }
+/* Monotonic clock in milliseconds, as used by wl_callback.done */
+uint32_t cwc_time_msec(void) {
+    return (uint32_t)(cwc_time_nsec() / 1000000);
 }
 
 /* Safe memory allocation with error checking */
@@ -142,24 +140,89 @@ void *cwc_calloc(size_t nmemb, size_t size) {
     return ptr;
 }
 
+void *cwc_realloc(void *ptr, size_t size) {
+    void *new_ptr = realloc(ptr, size);
+    if (!new_ptr && size > 0) {
+        fprintf(stderr, "Fatal: Memory reallocation failed for %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return new_ptr;
+}
+
 void cwc_free(void *ptr) {
     if (ptr) {
         free(ptr);
     }
 }
 
+/*
+ * Tile rasterizer threads besides the render workers: one per extra core
+ * unless CWC_RENDER_THREADS says otherwise; 0 disables tiling.
+ */
+static uint32_t render_thread_count(void) {
+    const char *env = getenv("CWC_RENDER_THREADS");
+    if (env) {
+        char *end;
+        unsigned long value = strtoul(env, &end, 10);
+        if (*env && !*end) {
+            return value > CWC_THREAD_POOL_MAX_THREADS ? CWC_THREAD_POOL_MAX_THREADS
+                                                       : (uint32_t)value;
+        }
+    }
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return cores > 1 ? (uint32_t)(cores - 1) : 0;
+}
+
 /* Basic server initialization for demo */
 cwc_error_t cwc_server_init(struct cwc_server *server, const char *socket_name) {
+    /* Keep the logging setup done by cwc_log_init() */
+    bool debug_mode = server->debug_mode;
+    int log_fd = server->log_fd;
+    cwc_log_level_t log_level = server->log_level;
+    uint32_t max_surfaces = server->max_surfaces;
+    uint32_t max_clients = server->max_clients;
+    uint64_t memory_budget = server->memory_budget;
+    bool log_async = server->log_async;
+    struct cwc_logger *logger = server->logger;
+    const char *renderer_name = server->renderer_name;
+    const char *backend_name = server->backend_name;
+    const struct cwc_output_config *output_configs = server->output_configs;
+    uint32_t n_output_configs = server->n_output_configs;
+    struct cwc_client_budget client_budget = server->client_budget;
+    
     memset(server, 0, sizeof(*server));
+    server->debug_mode = debug_mode;
+    server->log_fd = log_fd;
+    server->log_level = log_level;
+    server->log_async = log_async;
+    server->logger = logger;
+    server->max_surfaces = max_surfaces ? max_surfaces : CWC_MAX_SURFACES;
+    server->max_clients = max_clients ? max_clients : CWC_MAX_CLIENTS;
+    server->memory_budget = memory_budget;
+    server->renderer_name = renderer_name;
+    server->backend_name = backend_name;
+    server->output_configs = output_configs;
+    server->n_output_configs = n_output_configs;
+    server->client_budget = client_budget;
     
     /* Initialize lists */
     wl_list_init(&server->outputs);
-    wl_list_init(&server->surfaces);
     wl_list_init(&server->clients);
+    wl_list_init(&server->shms);
+    wl_list_init(&server->startup_tasks);
+    wl_signal_init(&server->dispatch_done);
+    
+    server->surface_grid = cwc_calloc(1, sizeof(*server->surface_grid));
+    cwc_spatial_init(server->surface_grid);
+    server->scene = cwc_calloc(1, sizeof(*server->scene));
+    cwc_scene_init(server->scene, server);
+    server->thread_pool = cwc_thread_pool_create(render_thread_count());
     
     /* Set socket name */
     server->socket_name = socket_name ? socket_name : CWC_DEFAULT_SOCKET;
     server->start_time = time(NULL);
+    server->running = 1;
     
     /* Create display */
     server->display = wl_display_create();
@@ -167,12 +230,70 @@ cwc_error_t cwc_server_init(struct cwc_server *server, const char *socket_name)
         return CWC_ERROR_DISPLAY;
     }
     
-    /* Add socket */
-    if (wl_display_add_socket(server->display, server->socket_name) == -1) {
+    server->event_loop = wl_display_get_event_loop(server->display);
+#if WAYLAND_VERSION_MAJOR > 1 || WAYLAND_VERSION_MINOR >= 23
+    /* Wire buffers start small and grow on demand, so only busy clients pay */
+    wl_display_set_default_max_buffer_size(server->display, CWC_CLIENT_MAX_BUFFER_SIZE);
+#endif
+    cwc_client_init(server);
+    cwc_blend_init(server);
+    
+    /*
+     * Listen first: clients can connect and bind the core globals while
+     * the renderer and the backend are still coming up.
+     */
+    if (cwc_socket_init(server) != CWC_SUCCESS) {
+        cwc_socket_finish(server);
         wl_display_destroy(server->display);
         return CWC_ERROR_SOCKET;
     }
     
+    if (cwc_stats_init(server) != CWC_SUCCESS) {
+        cwc_log(server, CWC_LOG_WARN, "SIGUSR1 stats dumps unavailable");
+    }
+    
+    /* Create global objects */
+    if (cwc_shm_init(server) != CWC_SUCCESS) {
+        wl_display_destroy(server->display);
+        return CWC_ERROR_RESOURCE;
+    }
+    if (cwc_dmabuf_init(server) != CWC_SUCCESS) {
+        cwc_log(server, CWC_LOG_WARN, "linux-dmabuf unavailable, clients fall back to wl_shm");
+    }
+    if (cwc_presentation_init(server) != CWC_SUCCESS) {
+        cwc_log(server, CWC_LOG_WARN, "wp_presentation unavailable");
+    }
+    if (cwc_screencopy_init(server) != CWC_SUCCESS) {
+        cwc_log(server, CWC_LOG_WARN, "wlr-screencopy unavailable");
+    }
+    if (cwc_seat_init(server) != CWC_SUCCESS) {
+        cwc_log(server, CWC_LOG_WARN, "wl_seat unavailable, clients get no input");
+    }
+    
+    server->compositor_global = wl_global_create(server->display, &wl_compositor_interface, 6,
+                                                 server, cwc_compositor_bind);
+    if (!server->compositor_global) {
+        wl_display_destroy(server->display);
+        return CWC_ERROR_RESOURCE;
+    }
+    
+    /*
+     * GLES2 initializes on a startup thread while the backend probes the
+     * display hardware here; the backend creates the outputs, and with
+     * them their wl_output globals, as it finds them.
+     */
+    cwc_renderer_init(server, server->renderer_name);
+    server->backend = cwc_backend_create(server, server->backend_name);
+    if (!server->backend) {
+        cwc_startup_finish(server);
+        wl_display_destroy(server->display);
+        return CWC_ERROR_RESOURCE;
+    }
+    cwc_input_init(server);
+    if (cwc_memory_init(server) != CWC_SUCCESS) {
+        cwc_log(server, CWC_LOG_WARN, "Memory budget unavailable, caches are not trimmed");
+    }
+    
     /* Set environment variable */
     if (setenv("WAYLAND_DISPLAY", server->socket_name, 1) != 0) {
         printf("Warning: Failed to set WAYLAND_DISPLAY environment variable\n");
@@ -191,8 +312,33 @@ cwc_error_t cwc_server_run(struct cwc_server *server) {
     printf("Debug mode: %s\n", server->debug_mode ? "enabled" : "disabled");
     printf("Press Ctrl+C to stop\n");
     
-    /* Run the event loop */
-    wl_display_run(server->display);
+    /*
+     * Run the event loop. Waiting happens in poll() so that the dispatch
+     * histogram only measures the work done once events are ready. Each
+     * iteration drains whatever became ready while dispatching, up to
+     * CWC_DISPATCH_MAX_ROUNDS batches, so a burst of requests and input
+     * events costs one round of client flushes instead of one per event.
+     */
+    struct wl_event_loop *loop = server->event_loop;
+    struct pollfd pfd = { .fd = wl_event_loop_get_fd(loop), .events = POLLIN };
+    while (server->running) {
+        if (poll(&pfd, 1, -1) == -1 && errno != EINTR) {
+            cwc_log(server, CWC_LOG_ERROR, "Event loop poll failed: %s", strerror(errno));
+            break;
+        }
+        
+        uint64_t start_ns = cwc_time_nsec();
+        for (int round = 0; round < CWC_DISPATCH_MAX_ROUNDS && server->running; round++) {
+            wl_event_loop_dispatch(loop, 0);
+            if (poll(&pfd, 1, 0) <= 0) {
+                break;
+            }
+        }
+        wl_signal_emit(&server->dispatch_done, server);
+        cwc_histogram_record(&server->stats->dispatch_ns, cwc_time_nsec() - start_ns);
+        
+        wl_display_flush_clients(server->display);
+    }
     
     printf("Compositor shutting down\n");
     return CWC_SUCCESS;
@@ -202,11 +348,55 @@ cwc_error_t cwc_server_run(struct cwc_server *server) {
 void cwc_server_destroy(struct cwc_server *server) {
     if (!server) return;
     
+    /* Stop accepting, then clients go so their surfaces unlink from live outputs */
+    cwc_socket_finish(server);
+    if (server->display) {
+        wl_display_destroy_clients(server->display);
+    }
+    
+    /* A renderer or input still initializing is installed, then torn down as usual */
+    cwc_startup_finish(server);
+    cwc_input_finish(server);
+    cwc_seat_finish(server);
+    cwc_memory_finish(server);
+    
+    struct cwc_output *output, *tmp;
+    wl_list_for_each_safe(output, tmp, &server->outputs, link) {
+        cwc_output_destroy(output);
+    }
+    
+    cwc_backend_destroy(server->backend);
+    server->backend = NULL;
+    
+    /* No render worker can be drawing any more */
+    cwc_renderer_destroy(server->renderer);
+    server->renderer = NULL;
+    cwc_thread_pool_destroy(server->thread_pool);
+    server->thread_pool = NULL;
+    
+    cwc_stats_finish(server);
+    
     /* Destroy display */
     if (server->display) {
         wl_display_destroy(server->display);
     }
     
+    cwc_client_finish(server);
+    if (server->surface_grid) {
+        cwc_spatial_fini(server->surface_grid);
+        cwc_free(server->surface_grid);
+        server->surface_grid = NULL;
+    }
+    if (server->scene) {
+        cwc_scene_fini(server->scene);
+        cwc_free(server->scene);
+        server->scene = NULL;
+    }
+    
+    /* Every object is gone by now; report and release the slab pages */
+    cwc_slab_log_stats(server);
+    cwc_slab_destroy_all();
+    
     cwc_log_cleanup(server);
 }
 
@@ -217,6 +407,16 @@ int main(int argc, char *argv[]) {
     const char *log_file = NULL;
     bool debug_mode = false;
     bool quiet_mode = false;
+    bool async_log = false;
+    uint32_t max_surfaces = 0;
+    uint32_t max_clients = 0;
+    uint64_t memory_budget = 0;
+    const char *renderer_name = NULL;
+    const char *backend_name = NULL;
+    bool headless = false;
+    static struct cwc_output_config output_configs[CWC_MAX_VIRTUAL_OUTPUTS];
+    uint32_t n_output_configs = 0;
+    struct cwc_client_budget client_budget = cwc_default_client_budget;
     
     /* Parse command line arguments */
     static struct option long_options[] = {
@@ -226,11 +426,20 @@ int main(int argc, char *argv[]) {
         {"log-file", required_argument, 0, 'l'},
         {"debug", no_argument, 0, 'd'},
         {"quiet", no_argument, 0, 'q'},
+        {"async-log", no_argument, 0, 'a'},
+        {"max-surfaces", required_argument, 0, 'm'},
+        {"max-clients", required_argument, 0, 'c'},
+        {"renderer", required_argument, 0, 'r'},
+        {"backend", required_argument, 0, 'b'},
+        {"headless", no_argument, 0, 'H'},
+        {"output", required_argument, 0, 'o'},
+        {"client-budget", required_argument, 0, 'B'},
+        {"memory-budget", required_argument, 0, 'M'},
         {0, 0, 0, 0}
     };
     
     int c;
-    while ((c = getopt_long(argc, argv, "hvs:l:dq", long_options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "hvs:l:dqam:c:r:b:Ho:B:M:", long_options, NULL)) != -1) {
         switch (c) {
             case 'h':
                 cwc_print_usage(argv[0]);
@@ -250,6 +459,58 @@ int main(int argc, char *argv[]) {
             case 'q':
                 quiet_mode = true;
                 break;
+            case 'a':
+                async_log = true;
+                break;
+            case 'm': {
+                char *end;
+                unsigned long value = strtoul(optarg, &end, 10);
+                if (*end || value == 0 || value > UINT32_MAX) {
+                    fprintf(stderr, "Invalid surface limit '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                max_surfaces = (uint32_t)value;
+                break;
+            }
+            case 'c': {
+                char *end;
+                unsigned long value = strtoul(optarg, &end, 10);
+                if (*end || value == 0 || value > UINT32_MAX) {
+                    fprintf(stderr, "Invalid client limit '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                max_clients = (uint32_t)value;
+                break;
+            }
+            case 'r':
+                renderer_name = optarg;
+                break;
+            case 'b':
+                backend_name = optarg;
+                break;
+            case 'H':
+                headless = true;
+                break;
+            case 'o':
+                if (n_output_configs == CWC_MAX_VIRTUAL_OUTPUTS ||
+                    !cwc_output_config_parse(optarg, &output_configs[n_output_configs])) {
+                    fprintf(stderr, "Invalid or too many outputs at '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                n_output_configs++;
+                break;
+            case 'B':
+                if (!cwc_client_budget_parse(optarg, &client_budget)) {
+                    fprintf(stderr, "Invalid client budget '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'M':
+                if (!cwc_memory_budget_parse(optarg, &memory_budget)) {
+                    fprintf(stderr, "Invalid memory budget '%s'\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
             case '?':
                 cwc_print_usage(argv[0]);
                 return EXIT_FAILURE;
@@ -263,9 +524,30 @@ int main(int argc, char *argv[]) {
     if (!debug_mode && getenv("CWC_DEBUG")) {
         debug_mode = true;
     }
+    if (!async_log && getenv("CWC_LOG_ASYNC")) {
+        async_log = true;
+    }
+    if (!renderer_name) {
+        renderer_name = getenv("CWC_RENDERER");
+    }
+    if (!backend_name && headless) {
+        backend_name = "virtual";
+    }
+    if (!backend_name) {
+        backend_name = getenv("CWC_BACKEND");
+    }
     
-    /* Set debug mode */
+    /* Set debug mode and limits */
     server.debug_mode = debug_mode;
+    server.max_surfaces = max_surfaces;
+    server.max_clients = max_clients;
+    server.memory_budget = memory_budget;
+    server.log_async = async_log;
+    server.renderer_name = renderer_name;
+    server.backend_name = backend_name;
+    server.output_configs = output_configs;
+    server.n_output_configs = n_output_configs;
+    server.client_budget = client_budget;
     
     /* Initialize logging */
     cwc_log_init(&server, log_file);
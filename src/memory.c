@@ -0,0 +1,252 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Memory manager. The SHM mappings and renderer textures are caches: a
+ * mapping can be made again from the client's fd, a texture uploaded
+ * again from the buffer. Both are offered to one LRU here, which keeps
+ * them within --memory-budget and drops everything idle when PSI reports
+ * stalls on memory, before the OOM killer picks the compositor.
+ */
+
+#include "../include/memory.h"
+#include "../include/renderer.h"
+#include "../include/shm.h"
+#include "../include/stats.h"
+#include <sys/epoll.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define CWC_MEMORY_PATH_SIZE 512
+
+void cwc_memory_offer(struct cwc_memory_candidates *candidates,
+                      const struct cwc_memory_entry *entry) {
+    if (candidates->count == candidates->capacity) {
+        candidates->capacity = candidates->capacity ? candidates->capacity * 2 : 64;
+        candidates->entries = cwc_realloc(candidates->entries,
+                                          candidates->capacity * sizeof(*candidates->entries));
+    }
+    candidates->entries[candidates->count++] = *entry;
+    candidates->bytes += entry->bytes;
+}
+
+static int memory_entry_compare(const void *a, const void *b) {
+    const struct cwc_memory_entry *ea = a, *eb = b;
+    return (ea->last_used_ns > eb->last_used_ns) - (ea->last_used_ns < eb->last_used_ns);
+}
+
+/*
+ * Evict idle entries, least recently used first, until at most target
+ * bytes are held. Evicting one entry never frees another, so all are
+ * collected up front.
+ */
+static void memory_trim(struct cwc_server *server, uint64_t target) {
+    struct cwc_memory_candidates candidates = { 0 };
+    cwc_shm_memory_collect(server, &candidates);
+    cwc_renderer_memory_collect(server->renderer, &candidates);
+    if (candidates.bytes <= target) {
+        cwc_free(candidates.entries);
+        return;
+    }
+
+    qsort(candidates.entries, candidates.count, sizeof(*candidates.entries),
+          memory_entry_compare);
+
+    uint64_t now = cwc_time_nsec();
+    uint64_t held = candidates.bytes, evicted = 0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < candidates.count && held > target; i++) {
+        struct cwc_memory_entry *entry = &candidates.entries[i];
+        if (entry->last_used_ns + (uint64_t)CWC_MEMORY_MIN_IDLE_MS * 1000000 > now) {
+            break;
+        }
+        entry->evict(entry->owner, entry->object);
+        held -= entry->bytes;
+        evicted += entry->bytes;
+        n++;
+    }
+    cwc_free(candidates.entries);
+
+    if (n == 0) {
+        return;
+    }
+    if (server->stats) {
+        server->stats->memory_evictions += n;
+        server->stats->memory_evicted_bytes += evicted;
+    }
+    cwc_log(server, CWC_LOG_DEBUG, "Evicted %u cached objects, %llu KiB, %llu KiB left",
+            n, (unsigned long long)(evicted >> 10), (unsigned long long)(held >> 10));
+}
+
+static int memory_check_timer(void *data) {
+    struct cwc_memory *memory = data;
+    memory_trim(memory->server, memory->server->memory_budget);
+    wl_event_source_timer_update(memory->check_timer, CWC_MEMORY_CHECK_MS);
+    return 0;
+}
+
+/* Everything idle goes, and so does the heap's free memory */
+static int memory_handle_pressure(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct cwc_memory *memory = data;
+    struct cwc_server *server = memory->server;
+
+    struct epoll_event event;
+    if (epoll_wait(fd, &event, 1, 0) != 1) {
+        return 0;
+    }
+    if (event.events & EPOLLERR) {
+        /* The cgroup went away under us */
+        cwc_log(server, CWC_LOG_WARN, "Memory pressure notifications stopped");
+        wl_event_source_remove(memory->psi_source);
+        memory->psi_source = NULL;
+        return 0;
+    }
+
+    cwc_log(server, CWC_LOG_DEBUG, "Memory pressure, dropping idle caches");
+    if (server->stats) {
+        server->stats->memory_pressure_events++;
+    }
+    memory_trim(server, 0);
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    return 0;
+}
+
+/* memory.pressure of our cgroup v2, empty if there is none */
+static void memory_cgroup_pressure_path(char *path, size_t size) {
+    path[0] = '\0';
+    FILE *file = fopen("/proc/self/cgroup", "re");
+    if (!file) {
+        return;
+    }
+
+    char line[CWC_MEMORY_PATH_SIZE];
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "0::", 3) != 0) {
+            continue;
+        }
+        line[strcspn(line, "\n")] = '\0';
+        const char *cgroup = strcmp(line + 3, "/") == 0 ? "" : line + 3;
+        int n = snprintf(path, size, "/sys/fs/cgroup%s/memory.pressure", cgroup);
+        if (n < 0 || (size_t)n >= size) {
+            path[0] = '\0';
+        }
+        break;
+    }
+    fclose(file);
+}
+
+static int memory_open_trigger(const char *path) {
+    int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    char trigger[64];
+    int n = snprintf(trigger, sizeof(trigger), "some %d %d",
+                     CWC_MEMORY_PSI_STALL_US, CWC_MEMORY_PSI_WINDOW_US);
+    if (write(fd, trigger, (size_t)n + 1) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * The trigger fd signals POLLPRI, which the event loop does not watch,
+ * so it sits in an epoll set of its own that becomes readable instead.
+ * The cgroup's file comes first; the system-wide one is the fallback.
+ */
+static void memory_watch_pressure(struct cwc_memory *memory) {
+    struct cwc_server *server = memory->server;
+    char path[CWC_MEMORY_PATH_SIZE];
+
+    memory_cgroup_pressure_path(path, sizeof(path));
+    if (!path[0] || (memory->psi_fd = memory_open_trigger(path)) == -1) {
+        snprintf(path, sizeof(path), "/proc/pressure/memory");
+        memory->psi_fd = memory_open_trigger(path);
+    }
+    if (memory->psi_fd == -1) {
+        cwc_log(server, CWC_LOG_DEBUG, "No memory pressure notifications: %s", strerror(errno));
+        return;
+    }
+
+    struct epoll_event event = { .events = EPOLLPRI };
+    memory->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (memory->epoll_fd == -1 ||
+        epoll_ctl(memory->epoll_fd, EPOLL_CTL_ADD, memory->psi_fd, &event) == -1) {
+        cwc_log(server, CWC_LOG_WARN, "Cannot watch %s: %s", path, strerror(errno));
+        return;
+    }
+
+    memory->psi_source = wl_event_loop_add_fd(server->event_loop, memory->epoll_fd,
+                                              WL_EVENT_READABLE, memory_handle_pressure, memory);
+    if (memory->psi_source) {
+        cwc_log(server, CWC_LOG_DEBUG, "Watching memory pressure through %s", path);
+    }
+}
+
+cwc_error_t cwc_memory_init(struct cwc_server *server) {
+    struct cwc_memory *memory = cwc_calloc(1, sizeof(*memory));
+    memory->server = server;
+    memory->psi_fd = -1;
+    memory->epoll_fd = -1;
+    server->memory = memory;
+
+    if (server->memory_budget) {
+        memory->check_timer = wl_event_loop_add_timer(server->event_loop, memory_check_timer,
+                                                      memory);
+        if (!memory->check_timer) {
+            return CWC_ERROR_RESOURCE;
+        }
+        wl_event_source_timer_update(memory->check_timer, CWC_MEMORY_CHECK_MS);
+    }
+
+    memory_watch_pressure(memory);
+    return CWC_SUCCESS;
+}
+
+/* Also undoes a partial cwc_memory_init() */
+void cwc_memory_finish(struct cwc_server *server) {
+    struct cwc_memory *memory = server->memory;
+    if (!memory) return;
+
+    if (memory->check_timer) {
+        wl_event_source_remove(memory->check_timer);
+    }
+    if (memory->psi_source) {
+        wl_event_source_remove(memory->psi_source);
+    }
+    if (memory->epoll_fd != -1) {
+        close(memory->epoll_fd);
+    }
+    if (memory->psi_fd != -1) {
+        close(memory->psi_fd);
+    }
+
+    cwc_free(memory);
+    server->memory = NULL;
+}
+
+bool cwc_memory_budget_parse(const char *spec, uint64_t *bytes) {
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(spec, &end, 10);
+    if (errno || end == spec || spec[0] == '-') {
+        return false;
+    }
+
+    unsigned shift = 0;
+    switch (*end) {
+        case 'K': shift = 10; end++; break;
+        case 'M': shift = 20; end++; break;
+        case 'G': shift = 30; end++; break;
+    }
+    if (*end || value > (UINT64_MAX >> shift)) {
+        return false;
+    }
+    *bytes = (uint64_t)value << shift;
+    return true;
+}
@@ -0,0 +1,707 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Output management: one cwc_output per display head, each exposed to
+ * clients as its own wl_output global. Outputs own a framebuffer and the
+ * damage accumulated since their last repaint.
+ *
+ * Repaints are paced per output by a timerfd on the event loop: commits
+ * arriving before the repaint deadline are batched into one composite,
+ * and frame callbacks are only released once that frame is presented.
+ * Screencopy clients are served from the presented frame, too.
+ * The composite itself runs on a per-output render worker, and is skipped
+ * altogether when a single opaque fullscreen surface can be handed to the
+ * backend for direct scanout.
+ */
+
+#include "../include/output.h"
+#include "../include/backend.h"
+#include "../include/buffer.h"
+#include "../include/compositor.h"
+#include "../include/presentation.h"
+#include "../include/render.h"
+#include "../include/render_worker.h"
+#include "../include/renderer.h"
+#include "../include/scene.h"
+#include "../include/screencopy.h"
+#include "../include/seat.h"
+#include <sys/timerfd.h>
+
+#define CWC_OUTPUT_VERSION 3
+#define CWC_OUTPUT_MAX_SIZE 16384
+#define CWC_OUTPUT_DEFAULT_REFRESH 60000
+
+const struct cwc_output_config cwc_default_output_config = {
+    .x = 0,
+    .y = 0,
+    .width = 1920,
+    .height = 1080,
+    .physical_width = 527,
+    .physical_height = 296,
+    .refresh_rate = 60000,
+    .subpixel = WL_OUTPUT_SUBPIXEL_UNKNOWN,
+    .transform = WL_OUTPUT_TRANSFORM_NORMAL,
+    .make = "CWC",
+    .model = "Virtual Output",
+};
+
+static int output_frame_timer(int fd, uint32_t mask, void *data);
+static void output_frame_rendered(struct cwc_render_snapshot *snapshot, void *data);
+
+static const struct wl_output_interface output_implementation = {
+    .release = cwc_output_release,
+};
+
+static void output_send_geometry_to(struct cwc_output *output, struct wl_resource *resource) {
+    const struct cwc_output_config *c = &output->config;
+    wl_output_send_geometry(resource, c->x, c->y, c->physical_width, c->physical_height,
+                            c->subpixel, c->make, c->model, c->transform);
+}
+
+static void output_send_mode_to(struct cwc_output *output, struct wl_resource *resource) {
+    const struct cwc_output_config *c = &output->config;
+    wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+                        c->width, c->height, c->refresh_rate);
+}
+
+static void output_send_done_to(struct wl_resource *resource) {
+    if (wl_resource_get_version(resource) >= WL_OUTPUT_DONE_SINCE_VERSION) {
+        wl_output_send_done(resource);
+    }
+}
+
+void cwc_output_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct cwc_output *output = data;
+    uint32_t bound_version = version < CWC_OUTPUT_VERSION ? version : CWC_OUTPUT_VERSION;
+
+    struct wl_resource *resource = wl_resource_create(client, &wl_output_interface,
+                                                      (int)bound_version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &output_implementation, output,
+                                   cwc_output_resource_destroy);
+    wl_list_insert(&output->resources, wl_resource_get_link(resource));
+
+    output_send_geometry_to(output, resource);
+    output_send_mode_to(output, resource);
+    if (bound_version >= WL_OUTPUT_SCALE_SINCE_VERSION) {
+        wl_output_send_scale(resource, 1);
+    }
+    output_send_done_to(resource);
+}
+
+void cwc_output_release(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+void cwc_output_resource_destroy(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+struct cwc_output *cwc_output_create(struct cwc_server *server, const struct cwc_output_config *config) {
+    if (!server || !cwc_output_config_validate(config)) {
+        return NULL;
+    }
+
+    uint32_t scene_bit = cwc_scene_output_bit_alloc(server->scene);
+    if (!scene_bit) {
+        cwc_log(server, CWC_LOG_WARN, "More than %d outputs, ignoring the rest",
+                CWC_SCENE_MAX_OUTPUTS);
+        return NULL;
+    }
+
+    struct cwc_output *output = cwc_calloc(1, sizeof(*output));
+    output->server = server;
+    output->scene_bit = scene_bit;
+    output->create_time = time(NULL);
+    wl_list_init(&output->resources);
+    wl_list_init(&output->frame_callbacks);
+    wl_list_init(&output->feedbacks);
+    wl_list_init(&output->screencopy_frames);
+    wl_list_init(&output->screencopy_clients);
+    cwc_region_init(&output->damage);
+
+    output->frame_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (output->frame_timer_fd == -1) {
+        cwc_scene_output_bit_free(server->scene, scene_bit);
+        cwc_free(output);
+        return NULL;
+    }
+    output->frame_timer_source = wl_event_loop_add_fd(server->event_loop, output->frame_timer_fd,
+                                                      WL_EVENT_READABLE, output_frame_timer,
+                                                      output);
+    if (!output->frame_timer_source) {
+        close(output->frame_timer_fd);
+        cwc_scene_output_bit_free(server->scene, scene_bit);
+        cwc_free(output);
+        return NULL;
+    }
+
+    output->global = wl_global_create(server->display, &wl_output_interface,
+                                      CWC_OUTPUT_VERSION, output, cwc_output_bind);
+    if (!output->global) {
+        wl_event_source_remove(output->frame_timer_source);
+        close(output->frame_timer_fd);
+        cwc_scene_output_bit_free(server->scene, scene_bit);
+        cwc_free(output);
+        return NULL;
+    }
+
+    wl_list_insert(server->outputs.prev, &output->link);
+    cwc_output_configure(output, config);
+    output->enabled = true;
+
+    /* Without a worker the output composites on the dispatch thread */
+    if (!getenv("CWC_RENDER_SYNC")) {
+        char name[16];
+        snprintf(name, sizeof(name), "cwc-render-%u", server->output_seq++);
+        output->worker = cwc_render_worker_create(server, name, output_frame_rendered, output);
+        if (!output->worker) {
+            cwc_log(server, CWC_LOG_WARN, "No render worker, compositing on the main thread");
+        }
+    }
+
+    cwc_log(server, CWC_LOG_INFO, "Output %dx%d@%d.%03dHz at %d,%d created",
+            config->width, config->height, config->refresh_rate / 1000,
+            config->refresh_rate % 1000, config->x, config->y);
+    return output;
+}
+
+void cwc_output_destroy(struct cwc_output *output) {
+    if (!output) return;
+
+    /* Orphan bound resources; their destroy handler just unlinks them */
+    struct wl_resource *resource, *tmp;
+    wl_resource_for_each_safe(resource, tmp, &output->resources) {
+        wl_list_remove(wl_resource_get_link(resource));
+        wl_list_init(wl_resource_get_link(resource));
+        wl_resource_set_user_data(resource, NULL);
+    }
+
+    /* Delivers the frame in flight, which releases its buffers */
+    cwc_render_worker_destroy(output->worker);
+    cwc_renderer_output_destroy(output->server->renderer, output);
+    cwc_backend_output_destroy(output->server->backend, output);
+
+    wl_resource_for_each_safe(resource, tmp, &output->frame_callbacks) {
+        wl_resource_destroy(resource);
+    }
+    cwc_presentation_feedback_discard(output->server, &output->feedbacks);
+    cwc_screencopy_output_destroy(output);
+
+    wl_event_source_remove(output->frame_timer_source);
+    close(output->frame_timer_fd);
+    if (output->global) {
+        wl_global_destroy(output->global);
+    }
+
+    cwc_buffer_unlock(output->scanout_pending);
+    cwc_buffer_unlock(output->scanout_buffer);
+
+    wl_list_remove(&output->link);
+    cwc_scene_output_bit_free(output->server->scene, output->scene_bit);
+    cwc_scene_outputs_changed(output->server->scene);
+    cwc_region_fini(&output->damage);
+    cwc_free(output->pending_commits);
+    cwc_free(output->pending_inputs);
+    cwc_fbmem_free(&output->fb);
+    cwc_free(output);
+}
+
+void cwc_output_send_geometry(struct cwc_output *output) {
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &output->resources) {
+        output_send_geometry_to(output, resource);
+    }
+}
+
+void cwc_output_send_mode(struct cwc_output *output) {
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &output->resources) {
+        output_send_mode_to(output, resource);
+    }
+}
+
+void cwc_output_send_done(struct cwc_output *output) {
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &output->resources) {
+        output_send_done_to(resource);
+    }
+}
+
+/* Output rectangle in layout coordinates */
+void cwc_output_get_box(const struct cwc_output *output, struct cwc_box *box) {
+    box->x1 = output->config.x;
+    box->y1 = output->config.y;
+    box->x2 = output->config.x + output->config.width;
+    box->y2 = output->config.y + output->config.height;
+}
+
+bool cwc_output_config_validate(const struct cwc_output_config *config) {
+    if (!config) {
+        return false;
+    }
+
+    return config->width > 0 && config->width <= CWC_OUTPUT_MAX_SIZE &&
+           config->height > 0 && config->height <= CWC_OUTPUT_MAX_SIZE &&
+           config->physical_width >= 0 && config->physical_height >= 0 &&
+           config->refresh_rate >= 0 &&
+           config->transform >= WL_OUTPUT_TRANSFORM_NORMAL &&
+           config->transform <= WL_OUTPUT_TRANSFORM_FLIPPED_270;
+}
+
+/*
+ * Mode from a WIDTHxHEIGHT[@HZ] string, e.g. "2560x1440@143.912", on top
+ * of the default configuration.
+ */
+bool cwc_output_config_parse(const char *spec, struct cwc_output_config *config) {
+    *config = cwc_default_output_config;
+
+    char *end;
+    long width = strtol(spec, &end, 10);
+    if (*end != 'x') {
+        return false;
+    }
+    long height = strtol(end + 1, &end, 10);
+    double refresh = (double)CWC_OUTPUT_DEFAULT_REFRESH / 1000.0;
+    if (*end == '@') {
+        refresh = strtod(end + 1, &end);
+    }
+    if (*end || width <= 0 || width > CWC_OUTPUT_MAX_SIZE ||
+        height <= 0 || height > CWC_OUTPUT_MAX_SIZE || !(refresh > 0.0 && refresh <= 1000.0)) {
+        return false;
+    }
+
+    config->width = (int32_t)width;
+    config->height = (int32_t)height;
+    config->refresh_rate = (int32_t)(refresh * 1000.0 + 0.5);
+    return true;
+}
+
+/*
+ * A mode that fits the current framebuffer, and uses at least half of
+ * it, keeps it: the pages are already faulted in and on huge pages. The
+ * whole output is damaged afterwards, so stale contents never show.
+ */
+static void output_alloc_framebuffer(struct cwc_output *output, size_t size) {
+    if (output->fb.data && size <= output->fb.mapped && size > output->fb.mapped / 2) {
+        output->fb.size = size;
+        return;
+    }
+
+    cwc_fbmem_free(&output->fb);
+    cwc_fbmem_alloc(&output->fb, size);
+    output->pixels = output->fb.data;
+    cwc_log(output->server, CWC_LOG_DEBUG, "Framebuffer of %zu bytes on %s, prefaulted in %llu us",
+            size, cwc_fbmem_backing_name(output->fb.backing),
+            (unsigned long long)(output->fb.populate_ns / 1000));
+}
+
+void cwc_output_configure(struct cwc_output *output, const struct cwc_output_config *config) {
+    if (!output || !cwc_output_config_validate(config)) {
+        return;
+    }
+
+    bool resized = !output->pixels || config->width != output->config.width ||
+                   config->height != output->config.height;
+    output->config = *config;
+
+    int32_t refresh = config->refresh_rate > 0 ? config->refresh_rate : CWC_OUTPUT_DEFAULT_REFRESH;
+    output->refresh_ns = UINT64_C(1000000000000) / (uint64_t)refresh;
+
+    if (resized) {
+        /* The worker may still be drawing into the old framebuffer */
+        if (output->worker) {
+            cwc_render_worker_wait(output->worker);
+        }
+        output->stride = config->width * 4;
+        output_alloc_framebuffer(output, (size_t)config->height * (size_t)output->stride);
+    }
+
+    cwc_output_send_geometry(output);
+    cwc_output_send_mode(output);
+    cwc_output_send_done(output);
+    cwc_scene_outputs_changed(output->server->scene);
+    cwc_output_damage_whole(output);
+}
+
+void cwc_output_damage_whole(struct cwc_output *output) {
+    cwc_region_clear(&output->damage);
+    cwc_region_union_rect(&output->damage, 0, 0, output->config.width, output->config.height);
+    cwc_output_schedule_repaint(output);
+}
+
+/* Add layout-coordinate damage to one output */
+void cwc_output_damage_region(struct cwc_output *output, const struct cwc_region *damage) {
+    struct cwc_box box;
+    cwc_output_get_box(output, &box);
+    if (!cwc_region_intersects_box(damage, &box)) {
+        return;
+    }
+
+    struct cwc_region local;
+    cwc_region_init(&local);
+    cwc_region_copy(&local, damage);
+    cwc_region_intersect_box(&local, &box);
+    cwc_region_translate(&local, -output->config.x, -output->config.y);
+
+    cwc_region_union(&output->damage, &local);
+    cwc_region_simplify(&output->damage, CWC_REGION_MAX_DAMAGE_RECTS);
+    cwc_region_fini(&local);
+
+    cwc_output_schedule_repaint(output);
+}
+
+/* Add layout-coordinate damage to every output it touches */
+void cwc_output_damage_layout(struct cwc_server *server, const struct cwc_region *damage) {
+    if (cwc_region_is_empty(damage)) {
+        return;
+    }
+
+    struct cwc_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        cwc_output_damage_region(output, damage);
+    }
+}
+
+static void output_arm_timer(struct cwc_output *output, uint64_t when_ns) {
+    struct itimerspec its = {
+        .it_interval = { 0, 0 },
+        .it_value = {
+            .tv_sec = (time_t)(when_ns / 1000000000ull),
+            .tv_nsec = (long)(when_ns % 1000000000ull),
+        },
+    };
+
+    /* A zero it_value would disarm the timer instead of firing it */
+    if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+        its.it_value.tv_nsec = 1;
+    }
+    timerfd_settime(output->frame_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* First vblank strictly after now, extrapolated from the last presentation */
+static uint64_t output_next_vblank(const struct cwc_output *output, uint64_t now) {
+    if (!output->last_present_ns) {
+        return now;
+    }
+
+    uint64_t next = output->last_present_ns + output->refresh_ns;
+    if (next <= now) {
+        next += ((now - next) / output->refresh_ns + 1) * output->refresh_ns;
+    }
+    return next;
+}
+
+static int output_frame_timer(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct cwc_output *output = data;
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return 0;
+    }
+
+    switch (output->repaint_state) {
+        case CWC_OUTPUT_REPAINT_SCHEDULED:
+            /* Virtual vblank: the frame is on screen at the deadline's vblank */
+            if (!cwc_output_repaint(output)) {
+                output->repaint_state = CWC_OUTPUT_REPAINT_IDLE;
+                cwc_screencopy_output_flush(output, 0);
+            }
+            break;
+        case CWC_OUTPUT_REPAINT_PRESENTING:
+            cwc_output_present_done(output, output->next_vblank_ns);
+            break;
+        case CWC_OUTPUT_REPAINT_RENDERING:
+        case CWC_OUTPUT_REPAINT_IDLE:
+            break;
+    }
+    return 0;
+}
+
+/*
+ * Ask for a frame. Everything committed until the repaint deadline lands
+ * in the same composite; requests during a frame in flight are deferred
+ * to the following vblank.
+ */
+void cwc_output_schedule_repaint(struct cwc_output *output) {
+    if (output->repaint_state == CWC_OUTPUT_REPAINT_SCHEDULED) {
+        return;
+    }
+    if (output->repaint_state == CWC_OUTPUT_REPAINT_RENDERING ||
+        output->repaint_state == CWC_OUTPUT_REPAINT_PRESENTING) {
+        output->repaint_needed = true;
+        return;
+    }
+
+    uint64_t now = cwc_time_nsec();
+    uint64_t window = CWC_OUTPUT_REPAINT_WINDOW_NS;
+    if (window > output->refresh_ns / 2) {
+        window = output->refresh_ns / 2;
+    }
+
+    output->next_vblank_ns = output_next_vblank(output, now);
+    uint64_t deadline = output->next_vblank_ns > now + window ?
+                        output->next_vblank_ns - window : now;
+
+    output->repaint_state = CWC_OUTPUT_REPAINT_SCHEDULED;
+    output_arm_timer(output, deadline);
+}
+
+/* Claim frame callbacks, unpresented commits and charged damage of a surface */
+static void output_collect_surface(struct cwc_spatial_entry *entry, void *data) {
+    struct cwc_output *output = data;
+    struct cwc_surface *surface = entry->data;
+    wl_list_insert_list(output->frame_callbacks.prev, &surface->current->frame_callbacks);
+    wl_list_init(&surface->current->frame_callbacks);
+    wl_list_insert_list(output->feedbacks.prev, &surface->current->feedbacks);
+    wl_list_init(&surface->current->feedbacks);
+    cwc_surface_discharge_damage(surface);
+
+    if (surface->commit_ns) {
+        if (output->n_pending_commits == output->pending_commits_capacity) {
+            output->pending_commits_capacity = output->pending_commits_capacity ?
+                                               output->pending_commits_capacity * 2 : 16;
+            output->pending_commits = cwc_realloc(output->pending_commits,
+                                                  output->pending_commits_capacity *
+                                                  sizeof(*output->pending_commits));
+        }
+        output->pending_commits[output->n_pending_commits++] = surface->commit_ns;
+        surface->commit_ns = 0;
+    }
+
+    if (surface->input_ns) {
+        if (output->n_pending_inputs == output->pending_inputs_capacity) {
+            output->pending_inputs_capacity = output->pending_inputs_capacity ?
+                                              output->pending_inputs_capacity * 2 : 4;
+            output->pending_inputs = cwc_realloc(output->pending_inputs,
+                                                 output->pending_inputs_capacity *
+                                                 sizeof(*output->pending_inputs));
+        }
+        output->pending_inputs[output->n_pending_inputs++] = surface->input_ns;
+        surface->input_ns = 0;
+    }
+}
+
+/*
+ * Frame is drawn (or there was nothing to draw): hand it to the backend
+ * and wait for its vblank. damage is what changed in the framebuffer.
+ */
+static void output_begin_present(struct cwc_output *output, const struct cwc_region *damage) {
+    /* A composite that overran its deadline lands on a later vblank */
+    uint64_t now = cwc_time_nsec();
+    if (output->next_vblank_ns < now) {
+        output->next_vblank_ns = output_next_vblank(output, now);
+    }
+
+    output->repaint_state = CWC_OUTPUT_REPAINT_PRESENTING;
+    output->present_flags = output->scanout_flip && output->scanout_pending ?
+                            WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY : 0;
+
+    /* A queued page flip reports the vblank itself, with a kernel timestamp */
+    if (cwc_backend_present(output->server->backend, output, damage)) {
+        output->present_flags |= WP_PRESENTATION_FEEDBACK_KIND_VSYNC |
+                                 WP_PRESENTATION_FEEDBACK_KIND_HW_CLOCK |
+                                 WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+        return;
+    }
+    if (output->scanout_rejected) {
+        /* cwc_output_repaint() composites the frame instead */
+        return;
+    }
+    output_arm_timer(output, output->next_vblank_ns);
+}
+
+static void output_frame_rendered(struct cwc_render_snapshot *snapshot, void *data) {
+    struct cwc_output *output = data;
+
+    cwc_histogram_record(&output->composite_ns, snapshot->render_ns);
+    cwc_histogram_record(&output->frame_bytes, snapshot->bytes);
+    cwc_screencopy_output_damage(output, &snapshot->damage);
+
+    if (output->repaint_state == CWC_OUTPUT_REPAINT_RENDERING) {
+        output_begin_present(output, &snapshot->damage);
+    }
+    cwc_render_snapshot_release(snapshot);
+}
+
+/*
+ * The topmost surface on the output, if it covers it exactly with an
+ * opaque buffer in the output's native mode and framebuffer layout.
+ * Anything else needs to be composited: the backends and screencopy
+ * read a scanout buffer as 32 bpp XRGB8888.
+ */
+static struct cwc_buffer *output_scanout_candidate(struct cwc_output *output,
+                                                   const struct cwc_box *output_box) {
+    if (output->config.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+        return NULL;
+    }
+
+    struct cwc_surface **surfaces = NULL;
+    uint32_t n_surfaces = cwc_surface_collect_box(output->server, output_box, &surfaces);
+    struct cwc_buffer *buffer = NULL;
+    struct cwc_region opaque;
+    cwc_region_init(&opaque);
+
+    for (uint32_t i = 0; i < n_surfaces; i++) {
+        struct cwc_surface *surface = surfaces[i];
+        if (!surface->mapped || !surface->buffer) {
+            continue;
+        }
+
+        /* A buffer already released after a copy may be rewritten any time */
+        if (!surface->buffer_locked) {
+            break;
+        }
+
+        struct cwc_box box;
+        cwc_surface_get_box(surface, &box);
+        cwc_surface_get_opaque_region(surface, &opaque);
+        if (box.x1 == output_box->x1 && box.y1 == output_box->y1 &&
+            box.x2 == output_box->x2 && box.y2 == output_box->y2 &&
+            surface->buffer->width == output->config.width &&
+            surface->buffer->height == output->config.height &&
+            surface->buffer->pixel_format->native &&
+            cwc_region_contains_box(&opaque, output_box)) {
+            buffer = surface->buffer;
+        }
+        break;
+    }
+
+    cwc_region_fini(&opaque);
+    cwc_free(surfaces);
+    return buffer;
+}
+
+/*
+ * Snapshot the damaged part of the scene, start compositing it and
+ * collect the frame callbacks of surfaces shown on the output. The
+ * composite runs on the output's render worker when it has one. Returns
+ * false if there was nothing to produce a frame for.
+ */
+bool cwc_output_repaint(struct cwc_output *output) {
+    /* Settle the scene first so damage and membership are current */
+    cwc_scene_update(output->server->scene);
+
+    if (!output->enabled || !output->pixels) {
+        cwc_region_clear(&output->damage);
+        return false;
+    }
+
+    struct cwc_box output_box;
+    cwc_output_get_box(output, &output_box);
+    cwc_spatial_query_box(output->server->surface_grid, &output_box,
+                          output_collect_surface, output);
+
+    if (cwc_region_is_empty(&output->damage)) {
+        if (wl_list_empty(&output->frame_callbacks) && wl_list_empty(&output->feedbacks)) {
+            return false;
+        }
+        output_begin_present(output, NULL);
+        return true;
+    }
+
+    struct cwc_buffer *scanout = output_scanout_candidate(output, &output_box);
+    if (scanout && cwc_backend_scanout(output->server->backend, output, scanout)) {
+        output->scanout_pending = cwc_buffer_lock(scanout);
+        output->scanout_flip = true;
+        output->scanout_rejected = false;
+        output_begin_present(output, NULL);
+        if (!output->scanout_rejected) {
+            output->scanout_frames++;
+            cwc_screencopy_output_damage(output, &output->damage);
+            cwc_region_clear(&output->damage);
+            cwc_histogram_record(&output->frame_bytes, 0);
+            return true;
+        }
+
+        /* The flip to it failed: composite this frame in full instead */
+        cwc_buffer_unlock(output->scanout_pending);
+        output->scanout_pending = NULL;
+        output->scanout_rejected = false;
+        output->present_flags &= ~(uint32_t)WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY;
+        cwc_region_clear(&output->damage);
+        cwc_region_union_rect(&output->damage, 0, 0, output->config.width, output->config.height);
+    }
+
+    /* Back from scanout: the framebuffer missed everything since */
+    if (output->scanout_buffer) {
+        cwc_region_clear(&output->damage);
+        cwc_region_union_rect(&output->damage, 0, 0, output->config.width, output->config.height);
+    }
+    output->scanout_flip = true;
+
+    struct cwc_render_snapshot *snapshot = cwc_render_snapshot_take(output, &output->damage);
+    if (output->worker) {
+        output->repaint_state = CWC_OUTPUT_REPAINT_RENDERING;
+        cwc_render_worker_submit(output->worker, snapshot);
+        return true;
+    }
+
+    cwc_render_snapshot_draw(snapshot);
+    output->repaint_state = CWC_OUTPUT_REPAINT_RENDERING;
+    output_frame_rendered(snapshot, output);
+    return true;
+}
+
+void cwc_output_scanout_rejected(struct cwc_output *output) {
+    output->scanout_rejected = true;
+}
+
+/* The composited frame reached the screen: release clients and go again */
+void cwc_output_present_done(struct cwc_output *output, uint64_t present_ns) {
+    /* Only frames one refresh apart say anything about pacing */
+    uint64_t interval = present_ns - output->last_present_ns;
+    if (output->last_present_ns && present_ns > output->last_present_ns &&
+        interval < 2 * output->refresh_ns) {
+        cwc_histogram_record(&output->present_interval_ns, interval);
+    }
+    output->last_present_ns = present_ns;
+    output->frame_seq++;
+    output->repaint_state = CWC_OUTPUT_REPAINT_IDLE;
+
+    /* The previous scanout buffer has left the screen */
+    if (output->scanout_flip) {
+        cwc_buffer_unlock(output->scanout_buffer);
+        output->scanout_buffer = output->scanout_pending;
+        output->scanout_pending = NULL;
+        output->scanout_flip = false;
+    }
+
+    struct cwc_stats *stats = output->server->stats;
+    for (uint32_t i = 0; stats && i < output->n_pending_commits; i++) {
+        uint64_t commit_ns = output->pending_commits[i];
+        cwc_histogram_record(&stats->commit_to_present_ns,
+                             present_ns > commit_ns ? present_ns - commit_ns : 0);
+    }
+    output->n_pending_commits = 0;
+    for (uint32_t i = 0; stats && i < output->n_pending_inputs; i++) {
+        uint64_t input_ns = output->pending_inputs[i];
+        cwc_histogram_record(&stats->input_to_present_ns,
+                             present_ns > input_ns ? present_ns - input_ns : 0);
+    }
+    output->n_pending_inputs = 0;
+
+    cwc_presentation_feedback_present(output, &output->feedbacks, present_ns,
+                                      output->present_flags);
+
+    /* Coalesced pointer motion goes out with the frame callbacks it was held for */
+    cwc_seat_output_presented(output);
+
+    uint32_t time_ms = (uint32_t)(present_ns / 1000000);
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, &output->frame_callbacks) {
+        cwc_client_frame_done(output->server, cb, time_ms);
+    }
+    cwc_screencopy_output_flush(output, present_ns);
+
+    if (output->repaint_needed) {
+        output->repaint_needed = false;
+        cwc_output_schedule_repaint(output);
+    }
+}
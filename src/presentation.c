@@ -0,0 +1,107 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * wp_presentation. Clients ask for feedback on a commit and learn when
+ * its contents reached the screen, on which outputs, the refresh
+ * interval and the output's frame counter, which is what media players
+ * and games need to pace themselves. Timestamps are CLOCK_MONOTONIC,
+ * the clock both the vblank timer and DRM page-flip events use.
+ */
+
+#include "../include/presentation.h"
+#include "../include/compositor.h"
+#include "../include/output.h"
+#include "../include/stats.h"
+
+#define CWC_PRESENTATION_VERSION 1
+
+static void feedback_resource_destroy(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void presentation_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void presentation_handle_feedback(struct wl_client *client, struct wl_resource *resource,
+                                         struct wl_resource *surface_resource, uint32_t id) {
+    struct cwc_surface *surface = wl_resource_get_user_data(surface_resource);
+
+    struct wl_resource *feedback = wl_resource_create(client, &wp_presentation_feedback_interface,
+                                                      1, id);
+    if (!feedback) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(feedback, NULL, NULL, feedback_resource_destroy);
+    wl_list_insert(surface->pending->feedbacks.prev, wl_resource_get_link(feedback));
+    surface->pending->committed |= CWC_SURFACE_STATE_FEEDBACK;
+}
+
+static const struct wp_presentation_interface presentation_implementation = {
+    .destroy = presentation_handle_destroy,
+    .feedback = presentation_handle_feedback,
+};
+
+static void presentation_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    uint32_t bound_version = version < CWC_PRESENTATION_VERSION ? version : CWC_PRESENTATION_VERSION;
+
+    struct wl_resource *resource = wl_resource_create(client, &wp_presentation_interface,
+                                                      (int)bound_version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &presentation_implementation, data, NULL);
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+cwc_error_t cwc_presentation_init(struct cwc_server *server) {
+    server->presentation_global = wl_global_create(server->display, &wp_presentation_interface,
+                                                   CWC_PRESENTATION_VERSION, server,
+                                                   presentation_bind);
+    return server->presentation_global ? CWC_SUCCESS : CWC_ERROR_RESOURCE;
+}
+
+/* The contents were superseded or will never be shown */
+void cwc_presentation_feedback_discard(struct cwc_server *server, struct wl_list *feedbacks) {
+    struct wl_resource *feedback, *tmp;
+    wl_resource_for_each_safe(feedback, tmp, feedbacks) {
+        wp_presentation_feedback_send_discarded(feedback);
+        wl_resource_destroy(feedback);
+        if (server->stats) {
+            server->stats->discarded_feedbacks++;
+        }
+    }
+}
+
+/* Every feedback is told about the wl_outputs its client bound for output */
+void cwc_presentation_feedback_present(struct cwc_output *output, struct wl_list *feedbacks,
+                                       uint64_t present_ns, uint32_t flags) {
+    uint64_t sec = present_ns / 1000000000ull;
+    uint32_t nsec = (uint32_t)(present_ns % 1000000000ull);
+    uint32_t refresh = output->refresh_ns > UINT32_MAX ? 0 : (uint32_t)output->refresh_ns;
+    uint64_t seq = output->frame_seq;
+
+    struct wl_resource *feedback, *tmp;
+    wl_resource_for_each_safe(feedback, tmp, feedbacks) {
+        struct wl_client *client = wl_resource_get_client(feedback);
+        struct wl_resource *output_resource;
+        wl_resource_for_each(output_resource, &output->resources) {
+            if (wl_resource_get_client(output_resource) == client) {
+                wp_presentation_feedback_send_sync_output(feedback, output_resource);
+            }
+        }
+
+        wp_presentation_feedback_send_presented(feedback, (uint32_t)(sec >> 32), (uint32_t)sec,
+                                                nsec, refresh, (uint32_t)(seq >> 32),
+                                                (uint32_t)seq, flags);
+        wl_resource_destroy(feedback);
+        if (output->server->stats) {
+            output->server->stats->presented_feedbacks++;
+        }
+    }
+}
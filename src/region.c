@@ -0,0 +1,357 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Rectangle regions used for damage, opaque and input regions. The
+ * representation is a flat array of non-overlapping boxes, which keeps
+ * area accounting exact and lets the renderer walk each box exactly once.
+ */
+
+#include "../include/region.h"
+#include "../include/slab.h"
+
+/* Convert x/y/width/height into a box, clamping the far edge to int32 range */
+static bool box_from_rect(struct cwc_box *box, int32_t x, int32_t y,
+                          int32_t width, int32_t height) {
+    if (width <= 0 || height <= 0) {
+        return false;
+    }
+
+    int64_t x2 = (int64_t)x + width;
+    int64_t y2 = (int64_t)y + height;
+
+    box->x1 = x;
+    box->y1 = y;
+    box->x2 = x2 > INT32_MAX ? INT32_MAX : (int32_t)x2;
+    box->y2 = y2 > INT32_MAX ? INT32_MAX : (int32_t)y2;
+    return true;
+}
+
+static bool box_contains(const struct cwc_box *outer, const struct cwc_box *inner) {
+    return outer->x1 <= inner->x1 && outer->y1 <= inner->y1 &&
+           outer->x2 >= inner->x2 && outer->y2 >= inner->y2;
+}
+
+static void region_free_rects(struct cwc_region *region) {
+    if (region->rects) {
+        cwc_slab_free_size(region->rects, region->capacity * sizeof(*region->rects));
+    }
+}
+
+static void region_reserve(struct cwc_region *region, uint32_t count) {
+    if (count <= region->capacity) {
+        return;
+    }
+
+    uint32_t capacity = region->capacity ? region->capacity : 4;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+
+    /* Small rectangle arrays come from the slab size classes */
+    struct cwc_box *rects = cwc_slab_alloc_size(capacity * sizeof(*rects));
+    if (region->n_rects) {
+        memcpy(rects, region->rects, region->n_rects * sizeof(*rects));
+    }
+    region_free_rects(region);
+
+    region->rects = rects;
+    region->capacity = capacity;
+}
+
+static void region_update_extents(struct cwc_region *region) {
+    if (region->n_rects == 0) {
+        memset(&region->extents, 0, sizeof(region->extents));
+        return;
+    }
+
+    struct cwc_box extents = region->rects[0];
+    for (uint32_t i = 1; i < region->n_rects; i++) {
+        const struct cwc_box *r = &region->rects[i];
+        if (r->x1 < extents.x1) extents.x1 = r->x1;
+        if (r->y1 < extents.y1) extents.y1 = r->y1;
+        if (r->x2 > extents.x2) extents.x2 = r->x2;
+        if (r->y2 > extents.y2) extents.y2 = r->y2;
+    }
+    region->extents = extents;
+}
+
+/* Append a box that is known not to overlap any existing rectangle */
+static void region_append(struct cwc_region *region, const struct cwc_box *box) {
+    region_reserve(region, region->n_rects + 1);
+
+    if (region->n_rects == 0) {
+        region->extents = *box;
+    } else {
+        struct cwc_box *e = &region->extents;
+        if (box->x1 < e->x1) e->x1 = box->x1;
+        if (box->y1 < e->y1) e->y1 = box->y1;
+        if (box->x2 > e->x2) e->x2 = box->x2;
+        if (box->y2 > e->y2) e->y2 = box->y2;
+    }
+
+    region->rects[region->n_rects++] = *box;
+}
+
+/* Append the (up to four) pieces of a that lie outside b */
+static void region_append_difference(struct cwc_region *region, const struct cwc_box *a,
+                                     const struct cwc_box *b) {
+    struct cwc_box o;
+    if (!cwc_box_intersect(&o, a, b)) {
+        region_append(region, a);
+        return;
+    }
+
+    struct cwc_box piece;
+    if (a->y1 < o.y1) {
+        piece = (struct cwc_box){ a->x1, a->y1, a->x2, o.y1 };
+        region_append(region, &piece);
+    }
+    if (a->x1 < o.x1) {
+        piece = (struct cwc_box){ a->x1, o.y1, o.x1, o.y2 };
+        region_append(region, &piece);
+    }
+    if (o.x2 < a->x2) {
+        piece = (struct cwc_box){ o.x2, o.y1, a->x2, o.y2 };
+        region_append(region, &piece);
+    }
+    if (o.y2 < a->y2) {
+        piece = (struct cwc_box){ a->x1, o.y2, a->x2, a->y2 };
+        region_append(region, &piece);
+    }
+}
+
+/* Replace the contents of dst with tmp, taking ownership of its storage */
+static void region_take(struct cwc_region *dst, struct cwc_region *tmp) {
+    region_free_rects(dst);
+    *dst = *tmp;
+    cwc_region_init(tmp);
+}
+
+void cwc_region_init(struct cwc_region *region) {
+    memset(region, 0, sizeof(*region));
+}
+
+void cwc_region_init_rect(struct cwc_region *region, int32_t x, int32_t y,
+                          int32_t width, int32_t height) {
+    cwc_region_init(region);
+    cwc_region_union_rect(region, x, y, width, height);
+}
+
+void cwc_region_fini(struct cwc_region *region) {
+    region_free_rects(region);
+    cwc_region_init(region);
+}
+
+/* Empty the region but keep its storage for reuse */
+void cwc_region_clear(struct cwc_region *region) {
+    region->n_rects = 0;
+    memset(&region->extents, 0, sizeof(region->extents));
+}
+
+void cwc_region_copy(struct cwc_region *dst, const struct cwc_region *src) {
+    if (dst == src) {
+        return;
+    }
+
+    region_reserve(dst, src->n_rects);
+    if (src->n_rects) {
+        memcpy(dst->rects, src->rects, src->n_rects * sizeof(*src->rects));
+    }
+    dst->n_rects = src->n_rects;
+    dst->extents = src->extents;
+}
+
+bool cwc_region_is_empty(const struct cwc_region *region) {
+    return region->n_rects == 0;
+}
+
+/* True if every pixel of box is inside the region */
+bool cwc_region_contains_box(const struct cwc_region *region, const struct cwc_box *box) {
+    if (cwc_box_is_empty(box)) {
+        return true;
+    }
+    if (!box_contains(&region->extents, box)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        if (box_contains(&region->rects[i], box)) {
+            return true;
+        }
+    }
+
+    /* Box is split across several rectangles: subtract and see what is left */
+    struct cwc_region rest;
+    cwc_region_init(&rest);
+    region_append(&rest, box);
+    cwc_region_subtract(&rest, region);
+    bool covered = cwc_region_is_empty(&rest);
+    cwc_region_fini(&rest);
+    return covered;
+}
+
+bool cwc_region_intersects_box(const struct cwc_region *region, const struct cwc_box *box) {
+    struct cwc_box tmp;
+    if (!cwc_box_intersect(&tmp, &region->extents, box)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        if (cwc_box_intersect(&tmp, &region->rects[i], box)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint64_t cwc_region_area(const struct cwc_region *region) {
+    uint64_t area = 0;
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        const struct cwc_box *r = &region->rects[i];
+        area += (uint64_t)(r->x2 - r->x1) * (uint64_t)(r->y2 - r->y1);
+    }
+    return area;
+}
+
+void cwc_region_union_rect(struct cwc_region *region, int32_t x, int32_t y,
+                           int32_t width, int32_t height) {
+    struct cwc_box box;
+    if (box_from_rect(&box, x, y, width, height)) {
+        cwc_region_union_box(region, &box);
+    }
+}
+
+void cwc_region_union_box(struct cwc_region *region, const struct cwc_box *box) {
+    if (cwc_box_is_empty(box)) {
+        return;
+    }
+
+    if (region->n_rects == 0 || box_contains(box, &region->extents)) {
+        cwc_region_clear(region);
+        region_append(region, box);
+        return;
+    }
+
+    struct cwc_box overlap;
+    if (!cwc_box_intersect(&overlap, &region->extents, box)) {
+        region_append(region, box);
+        return;
+    }
+
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        if (box_contains(&region->rects[i], box)) {
+            return;
+        }
+    }
+
+    /* Cut the new box out of the existing rectangles, then add it whole */
+    cwc_region_subtract_box(region, box);
+    region_append(region, box);
+}
+
+void cwc_region_union(struct cwc_region *dst, const struct cwc_region *src) {
+    if (dst == src) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < src->n_rects; i++) {
+        cwc_region_union_box(dst, &src->rects[i]);
+    }
+}
+
+void cwc_region_subtract_rect(struct cwc_region *region, int32_t x, int32_t y,
+                              int32_t width, int32_t height) {
+    struct cwc_box box;
+    if (box_from_rect(&box, x, y, width, height)) {
+        cwc_region_subtract_box(region, &box);
+    }
+}
+
+void cwc_region_subtract_box(struct cwc_region *region, const struct cwc_box *box) {
+    struct cwc_box overlap;
+    if (region->n_rects == 0 || !cwc_box_intersect(&overlap, &region->extents, box)) {
+        return;
+    }
+
+    struct cwc_region tmp;
+    cwc_region_init(&tmp);
+    region_reserve(&tmp, region->n_rects + 4);
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        region_append_difference(&tmp, &region->rects[i], box);
+    }
+    region_take(region, &tmp);
+}
+
+void cwc_region_subtract(struct cwc_region *dst, const struct cwc_region *src) {
+    if (dst == src) {
+        cwc_region_clear(dst);
+        return;
+    }
+
+    for (uint32_t i = 0; i < src->n_rects && dst->n_rects; i++) {
+        cwc_region_subtract_box(dst, &src->rects[i]);
+    }
+}
+
+void cwc_region_intersect_box(struct cwc_region *region, const struct cwc_box *box) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        struct cwc_box r;
+        if (cwc_box_intersect(&r, &region->rects[i], box)) {
+            region->rects[kept++] = r;
+        }
+    }
+    region->n_rects = kept;
+    region_update_extents(region);
+}
+
+void cwc_region_intersect(struct cwc_region *dst, const struct cwc_region *src) {
+    if (dst == src) {
+        return;
+    }
+
+    /* src rectangles are disjoint, so the clipped pieces are too */
+    struct cwc_region tmp;
+    cwc_region_init(&tmp);
+    for (uint32_t i = 0; i < src->n_rects; i++) {
+        for (uint32_t j = 0; j < dst->n_rects; j++) {
+            struct cwc_box r;
+            if (cwc_box_intersect(&r, &dst->rects[j], &src->rects[i])) {
+                region_append(&tmp, &r);
+            }
+        }
+    }
+    region_take(dst, &tmp);
+}
+
+void cwc_region_translate(struct cwc_region *region, int32_t dx, int32_t dy) {
+    if (region->n_rects == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        region->rects[i].x1 += dx;
+        region->rects[i].x2 += dx;
+        region->rects[i].y1 += dy;
+        region->rects[i].y2 += dy;
+    }
+    region->extents.x1 += dx;
+    region->extents.x2 += dx;
+    region->extents.y1 += dy;
+    region->extents.y2 += dy;
+}
+
+/*
+ * Bound the cost of walking a damage region: past max_rects, repainting
+ * the bounding box is cheaper than iterating many slivers. Only use this
+ * on damage, never on opaque regions, since it grows the region.
+ */
+void cwc_region_simplify(struct cwc_region *region, uint32_t max_rects) {
+    if (region->n_rects <= max_rects) {
+        return;
+    }
+
+    struct cwc_box extents = region->extents;
+    cwc_region_clear(region);
+    region_append(region, &extents);
+}
@@ -0,0 +1,492 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Software renderer. Composites surfaces back to front into an output's
+ * framebuffer, touching only the pixels inside the damage region. Client
+ * pixels are read directly from their SHM pool or dma-buf mapping, and
+ * anything hidden behind an opaque surface is culled before blending. Candidate
+ * surfaces come from the spatial index rather than the whole stack.
+ *
+ * Drawing works on a snapshot of the scene so it can run on a render
+ * worker while the dispatch thread keeps serving clients. With a thread
+ * pool the output is cut into tiles and each damaged tile is drawn as a
+ * separate task that only considers the surfaces overlapping it.
+ *
+ * This is the software renderer backend; other backends reuse the
+ * snapshot code and supply their own draw hook.
+ */
+
+#include "../include/render.h"
+#include "../include/blend.h"
+#include "../include/compositor.h"
+#include "../include/dmabuf.h"
+#include "../include/output.h"
+#include "../include/renderer.h"
+#include "../include/shm.h"
+#include "../include/threadpool.h"
+
+/* Returns framebuffer bytes written */
+static uint64_t fill_box(struct cwc_render_snapshot *snapshot, const struct cwc_box *box,
+                         uint32_t color) {
+    size_t width = (size_t)(box->x2 - box->x1);
+    for (int32_t y = box->y1; y < box->y2; y++) {
+        uint32_t *dst = (uint32_t *)((uchar *)snapshot->pixels +
+                        (size_t)y * (size_t)snapshot->stride);
+        cwc_blend->fill(dst + box->x1, color, width);
+    }
+    return (uint64_t)width * (uint64_t)(box->y2 - box->y1) * 4;
+}
+
+/* A snapshot item that survived culling, and the part of it left to draw */
+struct render_visible {
+    const struct cwc_render_item *item;
+    struct cwc_region visible;      /* output-local */
+    struct cwc_region opaque;       /* output-local, subset of visible */
+};
+
+static void box_to_output(const struct cwc_render_snapshot *snapshot, struct cwc_box *box) {
+    box->x1 -= snapshot->box.x1;
+    box->x2 -= snapshot->box.x1;
+    box->y1 -= snapshot->box.y1;
+    box->y2 -= snapshot->box.y1;
+}
+
+/*
+ * Composite the part of an item inside clip (output-local coordinates).
+ * Returns bytes touched: client reads plus framebuffer reads and writes.
+ */
+static uint64_t composite_item(struct cwc_render_snapshot *snapshot,
+                               const struct cwc_render_item *item,
+                               const struct cwc_box *clip, bool opaque) {
+    struct cwc_box box = item->box, area;
+    box_to_output(snapshot, &box);
+    if (!cwc_box_intersect(&area, &box, clip)) {
+        return 0;
+    }
+
+    size_t width = (size_t)(area.x2 - area.x1);
+    const struct cwc_format *format = item->buffer->pixel_format;
+    cwc_format_row_func_t row = opaque ? format->copy : format->over;
+
+    if (item->pool) {
+        cwc_shm_access_begin(item->pool, item->map_data, item->map_size);
+    } else {
+        cwc_dmabuf_sync(item->sync_fd, true);
+    }
+
+    for (int32_t y = area.y1; y < area.y2; y++) {
+        const uchar *src = item->pixels + (size_t)(y - box.y1) * (size_t)item->stride +
+                           (size_t)(area.x1 - box.x1) * format->bytes_per_pixel;
+        uint32_t *dst = (uint32_t *)((uchar *)snapshot->pixels +
+                        (size_t)y * (size_t)snapshot->stride) + area.x1;
+        row(dst, src, width);
+    }
+
+    if (item->pool) {
+        cwc_shm_access_end();
+    } else {
+        cwc_dmabuf_sync(item->sync_fd, false);
+    }
+
+    /* copy: read source, write destination; over also reads the destination */
+    return (uint64_t)width * (uint64_t)(area.y2 - area.y1) *
+           (format->bytes_per_pixel + (opaque ? 4 : 8));
+}
+
+/*
+ * Walk the snapshot front to back, clipping each item's share of the
+ * damage by the opaque area of everything above it. Items with nothing
+ * left are never touched. Only the items listed in indices (front to
+ * back) are considered. Returns the number of entries filled in.
+ */
+static uint32_t render_cull(struct cwc_render_snapshot *snapshot, const struct cwc_region *damage,
+                            const uint32_t *indices, uint32_t n_indices,
+                            struct render_visible *visible, struct cwc_region *covered) {
+    uint32_t count = 0;
+    struct cwc_region opaque;
+    cwc_region_init(&opaque);
+
+    for (uint32_t i = 0; i < n_indices; i++) {
+        const struct cwc_render_item *item = &snapshot->items[indices ? indices[i] : i];
+
+        struct cwc_box box = item->box;
+        box_to_output(snapshot, &box);
+        if (!cwc_region_intersects_box(damage, &box)) {
+            continue;
+        }
+
+        struct render_visible *v = &visible[count];
+        cwc_region_init(&v->visible);
+        cwc_region_copy(&v->visible, damage);
+        cwc_region_intersect_box(&v->visible, &box);
+        cwc_region_subtract(&v->visible, covered);
+        if (cwc_region_is_empty(&v->visible)) {
+            cwc_region_fini(&v->visible);
+            continue;
+        }
+
+        cwc_region_copy(&opaque, &item->opaque);
+        cwc_region_translate(&opaque, -snapshot->box.x1, -snapshot->box.y1);
+        cwc_region_intersect(&opaque, &v->visible);
+        cwc_region_union(covered, &opaque);
+
+        v->item = item;
+        v->opaque = opaque;
+        cwc_region_init(&opaque);
+        count++;
+
+        /* Nothing further down can show through */
+        if (cwc_region_contains_box(covered, &damage->extents)) {
+            break;
+        }
+    }
+
+    cwc_region_fini(&opaque);
+    return count;
+}
+
+/*
+ * Reference a buffer's pixels for the renderer. Returns false for
+ * buffers the CPU cannot read, which are left out of the composite.
+ */
+static bool render_item_map(struct cwc_render_item *item, struct cwc_buffer *buffer) {
+    if (buffer->type == CWC_BUFFER_DMABUF) {
+        struct cwc_dmabuf_buffer *dmabuf = (struct cwc_dmabuf_buffer *)buffer;
+        item->pixels = cwc_dmabuf_buffer_get_data(dmabuf);
+        if (!item->pixels) {
+            return false;
+        }
+        item->pool = NULL;
+        item->stride = (int32_t)dmabuf->attributes.planes[0].stride;
+        item->sync_fd = dmabuf->attributes.planes[0].fd;
+    } else {
+        struct cwc_shm_buffer *shm_buffer = (struct cwc_shm_buffer *)buffer;
+        item->pixels = cwc_shm_buffer_get_data(shm_buffer);
+        if (!item->pixels) {
+            return false;
+        }
+        item->pool = shm_buffer->pool;
+        cwc_shm_pool_pin(item->pool);
+        item->map_data = item->pool->map->data;
+        item->map_size = item->pool->map->size;
+        item->stride = shm_buffer->stride;
+        item->sync_fd = -1;
+    }
+
+    item->buffer = cwc_buffer_lock(buffer);
+    return true;
+}
+
+/*
+ * Capture the surfaces under the damage. Takes over the contents of
+ * damage (output-local) and leaves it empty.
+ */
+struct cwc_render_snapshot *cwc_render_snapshot_take(struct cwc_output *output,
+                                                     struct cwc_region *damage) {
+    struct cwc_render_snapshot *snapshot = cwc_calloc(1, sizeof(*snapshot));
+    snapshot->output = output;
+    snapshot->renderer = output->server->renderer;
+    snapshot->pixels = output->pixels;
+    snapshot->stride = output->stride;
+    cwc_output_get_box(output, &snapshot->box);
+    snapshot->thread_pool = output->server->thread_pool;
+
+    struct cwc_box output_box = { 0, 0, output->config.width, output->config.height };
+    snapshot->damage = *damage;
+    cwc_region_init(damage);
+    cwc_region_intersect_box(&snapshot->damage, &output_box);
+
+    /* Only surfaces the spatial index places on the damaged area */
+    struct cwc_box layout_box = snapshot->damage.extents;
+    layout_box.x1 += snapshot->box.x1;
+    layout_box.x2 += snapshot->box.x1;
+    layout_box.y1 += snapshot->box.y1;
+    layout_box.y2 += snapshot->box.y1;
+
+    struct cwc_surface **surfaces = NULL;
+    uint32_t n_surfaces = cwc_surface_collect_box(output->server, &layout_box, &surfaces);
+    if (n_surfaces) {
+        snapshot->items = cwc_calloc(n_surfaces, sizeof(*snapshot->items));
+    }
+
+    for (uint32_t i = 0; i < n_surfaces; i++) {
+        struct cwc_surface *surface = surfaces[i];
+        if (!surface->mapped || !surface->buffer) {
+            continue;
+        }
+
+        struct cwc_render_item *item = &snapshot->items[snapshot->count];
+        if (!render_item_map(item, surface->buffer)) {
+            continue;
+        }
+        snapshot->count++;
+
+        cwc_surface_get_box(surface, &item->box);
+        cwc_region_init(&item->opaque);
+        cwc_surface_get_opaque_region(surface, &item->opaque);
+
+        item->render_data = NULL;
+        cwc_region_init(&item->upload);
+        if (snapshot->renderer->impl->item_capture) {
+            snapshot->renderer->impl->item_capture(snapshot->renderer, item, surface);
+        }
+    }
+    cwc_free(surfaces);
+
+    return snapshot;
+}
+
+/* Unlock the buffers, which may release them; must run on the dispatch thread */
+void cwc_render_snapshot_release(struct cwc_render_snapshot *snapshot) {
+    if (!snapshot) return;
+
+    for (uint32_t i = 0; i < snapshot->count; i++) {
+        struct cwc_render_item *item = &snapshot->items[i];
+        if (snapshot->renderer->impl->item_release) {
+            snapshot->renderer->impl->item_release(snapshot->renderer, item);
+        }
+        cwc_region_fini(&item->upload);
+        if (item->pool) {
+            cwc_shm_pool_check_access(item->pool);
+            cwc_shm_pool_unpin(item->pool);
+        }
+        cwc_region_fini(&item->opaque);
+        cwc_buffer_unlock(item->buffer);
+    }
+
+    cwc_free(snapshot->items);
+    cwc_region_fini(&snapshot->damage);
+    cwc_free(snapshot);
+}
+
+/*
+ * Draw damage (output-local) from the listed items, or from every item
+ * when indices is NULL. Returns framebuffer and client bytes touched.
+ */
+static uint64_t render_region(struct cwc_render_snapshot *snapshot,
+                              const struct cwc_region *damage,
+                              const uint32_t *indices, uint32_t n_indices) {
+    uint64_t bytes = 0;
+    struct cwc_region covered, translucent;
+    cwc_region_init(&covered);
+    cwc_region_init(&translucent);
+
+    struct render_visible *visible = NULL;
+    uint32_t count = 0;
+    if (n_indices) {
+        visible = cwc_calloc(n_indices, sizeof(*visible));
+        count = render_cull(snapshot, damage, indices, n_indices, visible, &covered);
+    }
+
+    /* Background only where no opaque surface will be drawn */
+    struct cwc_region background;
+    cwc_region_init(&background);
+    cwc_region_copy(&background, damage);
+    cwc_region_subtract(&background, &covered);
+    for (uint32_t i = 0; i < background.n_rects; i++) {
+        bytes += fill_box(snapshot, &background.rects[i], CWC_BACKGROUND_COLOR);
+    }
+    cwc_region_fini(&background);
+
+    /* Back to front; opaque parts are plain copies */
+    for (uint32_t i = count; i-- > 0;) {
+        struct render_visible *v = &visible[i];
+
+        for (uint32_t j = 0; j < v->opaque.n_rects; j++) {
+            bytes += composite_item(snapshot, v->item, &v->opaque.rects[j], true);
+        }
+
+        cwc_region_copy(&translucent, &v->visible);
+        cwc_region_subtract(&translucent, &v->opaque);
+        for (uint32_t j = 0; j < translucent.n_rects; j++) {
+            bytes += composite_item(snapshot, v->item, &translucent.rects[j], false);
+        }
+
+        cwc_region_fini(&v->visible);
+        cwc_region_fini(&v->opaque);
+    }
+
+    cwc_free(visible);
+    cwc_region_fini(&translucent);
+    cwc_region_fini(&covered);
+    return bytes;
+}
+
+/*
+ * Damaged tiles of one draw, with the items overlapping each one binned
+ * in CSR form: tile t draws items[bins[bin_start[t]] .. bins[bin_start[t + 1]]).
+ */
+struct render_tiles {
+    struct cwc_render_snapshot *snapshot;
+    int32_t width, height;          /* output size */
+    uint32_t tiles_x;
+    uint32_t *tiles;                /* damaged tile numbers, row major */
+    uint32_t n_tiles;
+    uint32_t *bin_start;            /* n_tiles + 1 offsets into bins */
+    uint32_t *bins;                 /* item indices, front to back per tile */
+    _Atomic uint64_t bytes;
+};
+
+static void render_tile_box(const struct render_tiles *t, uint32_t tile, struct cwc_box *box) {
+    box->x1 = (int32_t)(tile % t->tiles_x) * CWC_RENDER_TILE_SIZE;
+    box->y1 = (int32_t)(tile / t->tiles_x) * CWC_RENDER_TILE_SIZE;
+    box->x2 = box->x1 + CWC_RENDER_TILE_SIZE;
+    box->y2 = box->y1 + CWC_RENDER_TILE_SIZE;
+    if (box->x2 > t->width) box->x2 = t->width;
+    if (box->y2 > t->height) box->y2 = t->height;
+}
+
+/* Tile span [first, last] covered by an output-local box, clipped to the output */
+static bool render_tile_span(const struct render_tiles *t, const struct cwc_box *box,
+                             struct cwc_box *span) {
+    struct cwc_box output_box = { 0, 0, t->width, t->height }, clipped;
+    if (!cwc_box_intersect(&clipped, box, &output_box)) {
+        return false;
+    }
+    span->x1 = clipped.x1 / CWC_RENDER_TILE_SIZE;
+    span->y1 = clipped.y1 / CWC_RENDER_TILE_SIZE;
+    span->x2 = (clipped.x2 - 1) / CWC_RENDER_TILE_SIZE;
+    span->y2 = (clipped.y2 - 1) / CWC_RENDER_TILE_SIZE;
+    return true;
+}
+
+static void render_tile_task(uint32_t index, void *data) {
+    struct render_tiles *t = data;
+    struct cwc_render_snapshot *snapshot = t->snapshot;
+
+    struct cwc_box box;
+    render_tile_box(t, t->tiles[index], &box);
+
+    struct cwc_region damage;
+    cwc_region_init(&damage);
+    cwc_region_copy(&damage, &snapshot->damage);
+    cwc_region_intersect_box(&damage, &box);
+
+    uint32_t first = t->bin_start[index];
+    uint64_t bytes = render_region(snapshot, &damage, &t->bins[first],
+                                   t->bin_start[index + 1] - first);
+    cwc_region_fini(&damage);
+
+    atomic_fetch_add_explicit(&t->bytes, bytes, memory_order_relaxed);
+}
+
+/* Split the damage into tiles and draw them on the thread pool */
+static uint64_t render_tiled(struct cwc_render_snapshot *snapshot) {
+    struct render_tiles t = {
+        .snapshot = snapshot,
+        .width = snapshot->box.x2 - snapshot->box.x1,
+        .height = snapshot->box.y2 - snapshot->box.y1,
+    };
+    t.tiles_x = (uint32_t)(t.width + CWC_RENDER_TILE_SIZE - 1) / CWC_RENDER_TILE_SIZE;
+    uint32_t tiles_y = (uint32_t)(t.height + CWC_RENDER_TILE_SIZE - 1) / CWC_RENDER_TILE_SIZE;
+
+    /* slot[tile] is the damaged tile's task number plus one, 0 if clean */
+    uint32_t *slot = cwc_calloc((size_t)t.tiles_x * tiles_y, sizeof(*slot));
+    t.tiles = cwc_malloc((size_t)t.tiles_x * tiles_y * sizeof(*t.tiles));
+
+    const struct cwc_region *damage = &snapshot->damage;
+    for (uint32_t i = 0; i < damage->n_rects; i++) {
+        struct cwc_box span;
+        if (!render_tile_span(&t, &damage->rects[i], &span)) {
+            continue;
+        }
+        for (int32_t ty = span.y1; ty <= span.y2; ty++) {
+            for (int32_t tx = span.x1; tx <= span.x2; tx++) {
+                uint32_t tile = (uint32_t)ty * t.tiles_x + (uint32_t)tx;
+                if (!slot[tile]) {
+                    t.tiles[t.n_tiles++] = tile;
+                    slot[tile] = t.n_tiles;
+                }
+            }
+        }
+    }
+
+    /* Two passes over the items: count per tile, then fill in stacking order */
+    t.bin_start = cwc_calloc((size_t)t.n_tiles + 1, sizeof(*t.bin_start));
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t *fill = pass ? cwc_calloc(t.n_tiles, sizeof(*fill)) : NULL;
+
+        for (uint32_t i = 0; i < snapshot->count; i++) {
+            struct cwc_box box = snapshot->items[i].box, span;
+            box_to_output(snapshot, &box);
+            if (!render_tile_span(&t, &box, &span)) {
+                continue;
+            }
+            for (int32_t ty = span.y1; ty <= span.y2; ty++) {
+                for (int32_t tx = span.x1; tx <= span.x2; tx++) {
+                    uint32_t s = slot[(uint32_t)ty * t.tiles_x + (uint32_t)tx];
+                    if (!s) {
+                        continue;
+                    }
+                    if (pass) {
+                        t.bins[t.bin_start[s - 1] + fill[s - 1]++] = i;
+                    } else {
+                        t.bin_start[s]++;
+                    }
+                }
+            }
+        }
+
+        if (pass) {
+            cwc_free(fill);
+        } else {
+            for (uint32_t j = 0; j < t.n_tiles; j++) {
+                t.bin_start[j + 1] += t.bin_start[j];
+            }
+            t.bins = cwc_malloc(((size_t)t.bin_start[t.n_tiles] + 1) * sizeof(*t.bins));
+        }
+    }
+    cwc_free(slot);
+
+    atomic_init(&t.bytes, 0);
+    cwc_thread_pool_run(snapshot->thread_pool, t.n_tiles, render_tile_task, &t);
+
+    cwc_free(t.bins);
+    cwc_free(t.bin_start);
+    cwc_free(t.tiles);
+    return atomic_load(&t.bytes);
+}
+
+static void software_draw(struct cwc_renderer *renderer, struct cwc_render_snapshot *snapshot) {
+    (void)renderer;
+
+    /* Damage within a single tile gains nothing from the pool */
+    const struct cwc_box *extents = &snapshot->damage.extents;
+    bool one_tile = extents->x1 / CWC_RENDER_TILE_SIZE == (extents->x2 - 1) / CWC_RENDER_TILE_SIZE &&
+                    extents->y1 / CWC_RENDER_TILE_SIZE == (extents->y2 - 1) / CWC_RENDER_TILE_SIZE;
+
+    if (!snapshot->thread_pool || one_tile) {
+        snapshot->bytes = render_region(snapshot, &snapshot->damage, NULL, snapshot->count);
+    } else {
+        snapshot->bytes = render_tiled(snapshot);
+    }
+}
+
+static void software_destroy(struct cwc_renderer *renderer) {
+    cwc_free(renderer);
+}
+
+static const struct cwc_renderer_impl software_impl = {
+    .name = "software",
+    .destroy = software_destroy,
+    .draw = software_draw,
+};
+
+/* CPU compositor, always available */
+struct cwc_renderer *cwc_renderer_create_software(struct cwc_server *server) {
+    struct cwc_renderer *renderer = cwc_calloc(1, sizeof(*renderer));
+    renderer->impl = &software_impl;
+    renderer->server = server;
+    return renderer;
+}
+
+void cwc_render_snapshot_draw(struct cwc_render_snapshot *snapshot) {
+    uint64_t start_ns = cwc_time_nsec();
+
+    snapshot->bytes = 0;
+    if (!cwc_region_is_empty(&snapshot->damage)) {
+        snapshot->renderer->impl->draw(snapshot->renderer, snapshot);
+    }
+
+    snapshot->render_ns = cwc_time_nsec() - start_ns;
+}
@@ -0,0 +1,899 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * GLES2 renderer backend. Surface contents live in GL textures cached per
+ * surface: a commit only queues its damage, and the next draw uploads
+ * just those rectangles with glTexSubImage2D straight from the client's
+ * SHM mapping. Unchanged surfaces cost no upload at all; textures the
+ * memory manager evicts are uploaded again in full by the next draw that
+ * shows them. Linear dma-bufs are imported as EGLImages and never touched
+ * by the CPU.
+ *
+ * Each output renders into its own framebuffer object; only the damaged
+ * rectangles are redrawn and read back into the output's CPU framebuffer,
+ * which the present path scans out. One context is shared by all render
+ * workers and made current around each draw.
+ */
+
+#include "../include/renderer.h"
+
+#ifdef CWC_HAVE_GLES2
+
+#include "../include/compositor.h"
+#include "../include/dmabuf.h"
+#include "../include/memory.h"
+#include "../include/output.h"
+#include "../include/render.h"
+#include "../include/shm.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Texture holding a surface's contents. Pending damage is collected on
+ * the dispatch thread; each snapshot captures it, together with anything
+ * captured earlier that no draw has uploaded yet, so whichever output
+ * draws the newest capture first brings the texture fully up to date.
+ */
+struct gles2_texture {
+    /* GL state, with the context current or while no snapshot holds the texture */
+    GLuint id;                      /* 0 until the first upload, or once evicted */
+    int32_t width, height;          /* allocated size */
+
+    /* Dispatch thread */
+    struct wl_list link;            /* gles2_renderer::textures */
+    uint64_t last_used_ns;          /* last capture */
+    struct cwc_region pending;      /* committed, not captured by a snapshot */
+    struct cwc_region inflight;     /* captured, not known to be uploaded */
+    uint64_t capture_seq;
+    int ref_count;                  /* the surface plus one per snapshot item */
+    struct cwc_surface *surface;    /* NULL once the surface is gone */
+
+    _Atomic uint64_t uploaded_seq;  /* newest capture uploaded, written under the lock */
+};
+
+/* An imported dma-buf, created lazily by the first draw that shows it */
+struct gles2_image {
+    EGLImageKHR image;
+    GLuint id;
+    bool failed;
+};
+
+/* Per-output framebuffer object */
+struct gles2_target {
+    GLuint framebuffer;
+    GLuint texture;
+    int32_t width, height;
+};
+
+/* Objects dropped on the dispatch thread, deleted at the next draw */
+struct gles2_garbage {
+    GLuint texture;
+    GLuint framebuffer;
+    EGLImageKHR image;
+};
+
+struct gles2_program {
+    GLuint program;
+    GLint position;
+    GLint texcoord;
+    GLint tex;
+};
+
+struct gles2_renderer {
+    struct cwc_renderer base;
+
+    EGLDisplay display;
+    EGLContext context;
+    pthread_mutex_t lock;           /* held while the context is current */
+
+    struct gles2_program rgba;      /* premultiplied alpha, blended */
+    struct gles2_program rgbx;      /* alpha ignored, no blending */
+
+    /* Capabilities */
+    bool unpack_subimage;           /* GL_EXT_unpack_subimage */
+    bool read_bgra;                 /* GL_EXT_read_format_bgra */
+    bool dmabuf_import;
+    PFNEGLCREATEIMAGEKHRPROC create_image;
+    PFNEGLDESTROYIMAGEKHRPROC destroy_image;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture;
+
+    struct wl_list textures;        /* gles2_texture::link, dispatch thread */
+
+    pthread_mutex_t garbage_lock;
+    struct gles2_garbage *garbage;
+    uint32_t n_garbage;
+    uint32_t garbage_capacity;
+
+    /* Readback staging, under the lock */
+    uchar *readback;
+    size_t readback_size;
+
+    /* Non-native client formats decoded to BGRA before upload, under the lock */
+    uint32_t *convert;
+    size_t convert_size;
+};
+
+static const char vertex_shader[] =
+    "attribute vec2 position;\n"
+    "attribute vec2 texcoord;\n"
+    "varying vec2 v_texcoord;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(position, 0.0, 1.0);\n"
+    "    v_texcoord = texcoord;\n"
+    "}\n";
+
+static const char fragment_shader_rgba[] =
+    "precision mediump float;\n"
+    "varying vec2 v_texcoord;\n"
+    "uniform sampler2D tex;\n"
+    "void main() {\n"
+    "    gl_FragColor = texture2D(tex, v_texcoord);\n"
+    "}\n";
+
+static const char fragment_shader_rgbx[] =
+    "precision mediump float;\n"
+    "varying vec2 v_texcoord;\n"
+    "uniform sampler2D tex;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(texture2D(tex, v_texcoord).rgb, 1.0);\n"
+    "}\n";
+
+/* Whole-word match in a space separated extension list */
+static bool gles2_has_extension(const char *list, const char *name) {
+    size_t length = strlen(name);
+    while (list && *list) {
+        const char *end = strchr(list, ' ');
+        size_t token = end ? (size_t)(end - list) : strlen(list);
+        if (token == length && strncmp(list, name, length) == 0) {
+            return true;
+        }
+        list = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
+static void gles2_make_current(struct gles2_renderer *gl) {
+    pthread_mutex_lock(&gl->lock);
+    eglMakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, gl->context);
+}
+
+static void gles2_release_current(struct gles2_renderer *gl) {
+    eglMakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    pthread_mutex_unlock(&gl->lock);
+}
+
+static void gles2_discard(struct gles2_renderer *gl, struct gles2_garbage garbage) {
+    pthread_mutex_lock(&gl->garbage_lock);
+    if (gl->n_garbage == gl->garbage_capacity) {
+        gl->garbage_capacity = gl->garbage_capacity ? gl->garbage_capacity * 2 : 16;
+        gl->garbage = cwc_realloc(gl->garbage, gl->garbage_capacity * sizeof(*gl->garbage));
+    }
+    gl->garbage[gl->n_garbage++] = garbage;
+    pthread_mutex_unlock(&gl->garbage_lock);
+}
+
+/* Context must be current */
+static void gles2_collect_garbage(struct gles2_renderer *gl) {
+    pthread_mutex_lock(&gl->garbage_lock);
+    for (uint32_t i = 0; i < gl->n_garbage; i++) {
+        struct gles2_garbage *g = &gl->garbage[i];
+        if (g->framebuffer) {
+            glDeleteFramebuffers(1, &g->framebuffer);
+        }
+        if (g->texture) {
+            glDeleteTextures(1, &g->texture);
+        }
+        if (g->image != EGL_NO_IMAGE_KHR) {
+            gl->destroy_image(gl->display, g->image);
+        }
+    }
+    gl->n_garbage = 0;
+    pthread_mutex_unlock(&gl->garbage_lock);
+}
+
+static GLuint gles2_compile(struct cwc_server *server, GLenum type, const char *source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (ok != GL_TRUE) {
+        char info[512];
+        glGetShaderInfoLog(shader, sizeof(info), NULL, info);
+        cwc_log(server, CWC_LOG_ERROR, "GLES2 shader compilation failed: %s", info);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+static bool gles2_program_init(struct gles2_renderer *gl, struct gles2_program *program,
+                               const char *fragment_source) {
+    GLuint vertex = gles2_compile(gl->base.server, GL_VERTEX_SHADER, vertex_shader);
+    GLuint fragment = gles2_compile(gl->base.server, GL_FRAGMENT_SHADER, fragment_source);
+    if (!vertex || !fragment) {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return false;
+    }
+
+    program->program = glCreateProgram();
+    glAttachShader(program->program, vertex);
+    glAttachShader(program->program, fragment);
+    glLinkProgram(program->program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program->program, GL_LINK_STATUS, &ok);
+    if (ok != GL_TRUE) {
+        cwc_log(gl->base.server, CWC_LOG_ERROR, "GLES2 program link failed");
+        glDeleteProgram(program->program);
+        program->program = 0;
+        return false;
+    }
+
+    program->position = glGetAttribLocation(program->program, "position");
+    program->texcoord = glGetAttribLocation(program->program, "texcoord");
+    program->tex = glGetUniformLocation(program->program, "tex");
+    return true;
+}
+
+/*
+ * Textures
+ */
+static void gles2_texture_unref(struct gles2_renderer *gl, struct gles2_texture *texture) {
+    if (--texture->ref_count > 0) {
+        return;
+    }
+
+    /* No snapshot holds it, so no draw can be using the GL name */
+    if (texture->id) {
+        gles2_discard(gl, (struct gles2_garbage){ .texture = texture->id,
+                                                  .image = EGL_NO_IMAGE_KHR });
+    }
+    wl_list_remove(&texture->link);
+    cwc_region_fini(&texture->pending);
+    cwc_region_fini(&texture->inflight);
+    cwc_free(texture);
+}
+
+/* Memory manager hook; deleted now if no draw holds the context, else by the next draw */
+static void gles2_texture_evict(void *owner, void *object) {
+    struct gles2_renderer *gl = owner;
+    struct gles2_texture *texture = object;
+
+    if (pthread_mutex_trylock(&gl->lock) == 0) {
+        eglMakeCurrent(gl->display, EGL_NO_SURFACE, EGL_NO_SURFACE, gl->context);
+        glDeleteTextures(1, &texture->id);
+        gles2_release_current(gl);
+    } else {
+        gles2_discard(gl, (struct gles2_garbage){ .texture = texture->id,
+                                                  .image = EGL_NO_IMAGE_KHR });
+    }
+    texture->id = 0;
+    texture->width = 0;
+    texture->height = 0;
+    cwc_region_clear(&texture->inflight);
+}
+
+static void gles2_texture_params(void) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+/* Decode a rectangle the GL cannot take as is into BGRA, then upload it tightly packed */
+static uint64_t gles2_upload_converted(struct gles2_renderer *gl, const struct cwc_render_item *item,
+                                       const struct cwc_box *box) {
+    const struct cwc_format *format = item->buffer->pixel_format;
+    size_t width = (size_t)(box->x2 - box->x1);
+    size_t height = (size_t)(box->y2 - box->y1);
+
+    if (width * height > gl->convert_size) {
+        gl->convert = cwc_realloc(gl->convert, width * height * sizeof(*gl->convert));
+        gl->convert_size = width * height;
+    }
+    for (size_t y = 0; y < height; y++) {
+        format->fetch(gl->convert + y * width,
+                      item->pixels + ((size_t)box->y1 + y) * (size_t)item->stride +
+                      (size_t)box->x1 * format->bytes_per_pixel, width);
+    }
+
+    glTexSubImage2D(GL_TEXTURE_2D, 0, box->x1, box->y1, (GLsizei)width, (GLsizei)height,
+                    GL_BGRA_EXT, GL_UNSIGNED_BYTE, gl->convert);
+    return (uint64_t)width * (uint64_t)height * (format->bytes_per_pixel + 4);
+}
+
+/* Upload one surface-local rectangle of the item's pixels into the bound texture */
+static uint64_t gles2_upload_box(struct gles2_renderer *gl, const struct cwc_render_item *item,
+                                 const struct cwc_box *box) {
+    if (!item->buffer->pixel_format->native) {
+        return gles2_upload_converted(gl, item, box);
+    }
+
+    GLsizei width = box->x2 - box->x1;
+    GLsizei height = box->y2 - box->y1;
+    const uchar *origin = item->pixels + (size_t)box->y1 * (size_t)item->stride +
+                          (size_t)box->x1 * 4;
+
+    /* A row length is in whole pixels; wl_shm allows any stride of at least width * 4 */
+    if (gl->unpack_subimage && item->stride % 4 == 0) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, item->stride / 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, box->x1, box->y1, width, height,
+                        GL_BGRA_EXT, GL_UNSIGNED_BYTE, origin);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+    } else {
+        /* Otherwise every row is its own upload */
+        for (GLsizei y = 0; y < height; y++) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, box->x1, box->y1 + y, width, 1,
+                            GL_BGRA_EXT, GL_UNSIGNED_BYTE, origin + (size_t)y * (size_t)item->stride);
+        }
+    }
+    return (uint64_t)width * (uint64_t)height * 4;
+}
+
+/* Bring the surface texture up to the item's capture; returns its GL name */
+static GLuint gles2_texture_prepare(struct gles2_renderer *gl, const struct cwc_render_item *item,
+                                    uint64_t *bytes) {
+    struct gles2_texture *texture = item->render_data;
+    int32_t width = item->box.x2 - item->box.x1;
+    int32_t height = item->box.y2 - item->box.y1;
+
+    /* A newer snapshot already uploaded at least this much */
+    if (texture->id && atomic_load(&texture->uploaded_seq) >= item->upload_seq) {
+        return texture->id;
+    }
+
+    bool full = !texture->id || texture->width != width || texture->height != height;
+    if (!texture->id) {
+        glGenTextures(1, &texture->id);
+        glBindTexture(GL_TEXTURE_2D, texture->id);
+        gles2_texture_params();
+    } else {
+        glBindTexture(GL_TEXTURE_2D, texture->id);
+    }
+
+    if (item->pool) {
+        cwc_shm_access_begin(item->pool, item->map_data, item->map_size);
+    } else {
+        cwc_dmabuf_sync(item->sync_fd, true);
+    }
+    if (full) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT, width, height, 0,
+                     GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+        texture->width = width;
+        texture->height = height;
+
+        struct cwc_box box = { 0, 0, width, height };
+        *bytes += gles2_upload_box(gl, item, &box);
+    } else {
+        struct cwc_box bounds = { 0, 0, width, height }, box;
+        for (uint32_t i = 0; i < item->upload.n_rects; i++) {
+            if (cwc_box_intersect(&box, &item->upload.rects[i], &bounds)) {
+                *bytes += gles2_upload_box(gl, item, &box);
+            }
+        }
+    }
+    if (item->pool) {
+        cwc_shm_access_end();
+    } else {
+        cwc_dmabuf_sync(item->sync_fd, false);
+    }
+
+    atomic_store(&texture->uploaded_seq, item->upload_seq);
+    return texture->id;
+}
+
+/* Imported dma-bufs sample the EGLImage; without import they are uploaded like SHM */
+static bool gles2_item_is_image(const struct gles2_renderer *gl,
+                                const struct cwc_render_item *item) {
+    return gl->dmabuf_import && item->buffer->type == CWC_BUFFER_DMABUF;
+}
+
+/* Import a dma-buf on first use; 0 if the driver refuses it */
+static GLuint gles2_image_prepare(struct gles2_renderer *gl, const struct cwc_render_item *item) {
+    struct gles2_image *image = item->render_data;
+    if (image->id || image->failed) {
+        return image->id;
+    }
+
+    const struct cwc_dmabuf_attributes *attributes =
+        &((struct cwc_dmabuf_buffer *)item->buffer)->attributes;
+    const struct cwc_dmabuf_plane *plane = &attributes->planes[0];
+    EGLint attribs[] = {
+        EGL_WIDTH, attributes->width,
+        EGL_HEIGHT, attributes->height,
+        EGL_LINUX_DRM_FOURCC_EXT, (EGLint)attributes->format,
+        EGL_DMA_BUF_PLANE0_FD_EXT, plane->fd,
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, (EGLint)plane->offset,
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, (EGLint)plane->stride,
+        EGL_NONE,
+    };
+
+    image->image = gl->create_image(gl->display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT,
+                                    NULL, attribs);
+    if (image->image == EGL_NO_IMAGE_KHR) {
+        image->failed = true;
+        return 0;
+    }
+
+    glGenTextures(1, &image->id);
+    glBindTexture(GL_TEXTURE_2D, image->id);
+    gles2_texture_params();
+    gl->image_target_texture(GL_TEXTURE_2D, image->image);
+    return image->id;
+}
+
+/*
+ * Drawing
+ */
+static struct gles2_target *gles2_target_get(struct gles2_renderer *gl,
+                                             struct cwc_render_snapshot *snapshot) {
+    struct cwc_output *output = snapshot->output;
+    struct gles2_target *target = output->render_data;
+    int32_t width = snapshot->box.x2 - snapshot->box.x1;
+    int32_t height = snapshot->box.y2 - snapshot->box.y1;
+
+    if (target && target->width == width && target->height == height) {
+        return target;
+    }
+
+    /* Resizes damage the whole output, so losing the contents is fine */
+    if (target) {
+        glDeleteFramebuffers(1, &target->framebuffer);
+        glDeleteTextures(1, &target->texture);
+    } else {
+        target = cwc_calloc(1, sizeof(*target));
+        output->render_data = target;
+    }
+    target->width = width;
+    target->height = height;
+
+    glGenTextures(1, &target->texture);
+    glBindTexture(GL_TEXTURE_2D, target->texture);
+    gles2_texture_params();
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &target->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           target->texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cwc_log(gl->base.server, CWC_LOG_ERROR, "GLES2 framebuffer %dx%d incomplete",
+                width, height);
+        glDeleteFramebuffers(1, &target->framebuffer);
+        glDeleteTextures(1, &target->texture);
+        target->framebuffer = 0;
+        target->texture = 0;
+        target->width = 0;
+        target->height = 0;
+        return NULL;
+    }
+    return target;
+}
+
+/* Textured quad for an output-local box, GL y growing with framebuffer rows */
+static void gles2_draw_quad(const struct gles2_program *program, GLuint texture,
+                            const struct cwc_box *box, int32_t width, int32_t height) {
+    GLfloat x1 = 2.0f * (GLfloat)box->x1 / (GLfloat)width - 1.0f;
+    GLfloat x2 = 2.0f * (GLfloat)box->x2 / (GLfloat)width - 1.0f;
+    GLfloat y1 = 2.0f * (GLfloat)box->y1 / (GLfloat)height - 1.0f;
+    GLfloat y2 = 2.0f * (GLfloat)box->y2 / (GLfloat)height - 1.0f;
+    const GLfloat positions[] = { x1, y1, x2, y1, x1, y2, x2, y2 };
+    static const GLfloat texcoords[] = { 0, 0, 1, 0, 0, 1, 1, 1 };
+
+    glUseProgram(program->program);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glUniform1i(program->tex, 0);
+
+    glVertexAttribPointer((GLuint)program->position, 2, GL_FLOAT, GL_FALSE, 0, positions);
+    glVertexAttribPointer((GLuint)program->texcoord, 2, GL_FLOAT, GL_FALSE, 0, texcoords);
+    glEnableVertexAttribArray((GLuint)program->position);
+    glEnableVertexAttribArray((GLuint)program->texcoord);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glDisableVertexAttribArray((GLuint)program->position);
+    glDisableVertexAttribArray((GLuint)program->texcoord);
+}
+
+/* Copy one damaged rectangle back into the CPU framebuffer */
+static uint64_t gles2_read_box(struct gles2_renderer *gl, struct cwc_render_snapshot *snapshot,
+                               const struct cwc_box *box) {
+    size_t width = (size_t)(box->x2 - box->x1);
+    size_t height = (size_t)(box->y2 - box->y1);
+    size_t size = width * height * 4;
+    if (size > gl->readback_size) {
+        gl->readback = cwc_realloc(gl->readback, size);
+        gl->readback_size = size;
+    }
+
+    glReadPixels(box->x1, box->y1, (GLsizei)width, (GLsizei)height,
+                 gl->read_bgra ? GL_BGRA_EXT : GL_RGBA, GL_UNSIGNED_BYTE, gl->readback);
+
+    for (size_t y = 0; y < height; y++) {
+        const uchar *src = gl->readback + y * width * 4;
+        uchar *dst = (uchar *)snapshot->pixels + ((size_t)box->y1 + y) * (size_t)snapshot->stride +
+                     (size_t)box->x1 * 4;
+        if (gl->read_bgra) {
+            memcpy(dst, src, width * 4);
+            continue;
+        }
+        for (size_t x = 0; x < width; x++) {
+            dst[x * 4 + 0] = src[x * 4 + 2];
+            dst[x * 4 + 1] = src[x * 4 + 1];
+            dst[x * 4 + 2] = src[x * 4 + 0];
+            dst[x * 4 + 3] = 0xff;
+        }
+    }
+    return size * 2;
+}
+
+static void gles2_draw(struct cwc_renderer *renderer, struct cwc_render_snapshot *snapshot) {
+    struct gles2_renderer *gl = (struct gles2_renderer *)renderer;
+    uint64_t bytes = 0;
+
+    gles2_make_current(gl);
+    gles2_collect_garbage(gl);
+
+    struct gles2_target *target = gles2_target_get(gl, snapshot);
+    if (!target) {
+        gles2_release_current(gl);
+        return;
+    }
+
+    /* Refresh textures first so drawing never waits between quads */
+    GLuint *textures = snapshot->count ? cwc_calloc(snapshot->count, sizeof(*textures)) : NULL;
+    for (uint32_t i = 0; i < snapshot->count; i++) {
+        const struct cwc_render_item *item = &snapshot->items[i];
+        if (gles2_item_is_image(gl, item)) {
+            textures[i] = gles2_image_prepare(gl, item);
+        } else {
+            textures[i] = gles2_texture_prepare(gl, item, &bytes);
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target->framebuffer);
+    glViewport(0, 0, target->width, target->height);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glEnable(GL_SCISSOR_TEST);
+
+    const struct cwc_region *damage = &snapshot->damage;
+    for (uint32_t r = 0; r < damage->n_rects; r++) {
+        const struct cwc_box *rect = &damage->rects[r];
+        glScissor(rect->x1, rect->y1, rect->x2 - rect->x1, rect->y2 - rect->y1);
+
+        /* Start at the topmost item that hides everything under the rectangle */
+        struct cwc_box layout_rect = *rect;
+        layout_rect.x1 += snapshot->box.x1;
+        layout_rect.x2 += snapshot->box.x1;
+        layout_rect.y1 += snapshot->box.y1;
+        layout_rect.y2 += snapshot->box.y1;
+
+        uint32_t bottom = snapshot->count;
+        for (uint32_t i = 0; i < snapshot->count; i++) {
+            if (textures[i] && cwc_region_contains_box(&snapshot->items[i].opaque, &layout_rect)) {
+                bottom = i + 1;
+                break;
+            }
+        }
+        if (bottom == snapshot->count) {
+            glClearColor((GLfloat)((CWC_BACKGROUND_COLOR >> 16) & 0xff) / 255.0f,
+                         (GLfloat)((CWC_BACKGROUND_COLOR >> 8) & 0xff) / 255.0f,
+                         (GLfloat)(CWC_BACKGROUND_COLOR & 0xff) / 255.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+        }
+
+        for (uint32_t i = bottom; i-- > 0;) {
+            const struct cwc_render_item *item = &snapshot->items[i];
+            struct cwc_box box = item->box, overlap;
+            if (!textures[i] || !cwc_box_intersect(&overlap, &box, &layout_rect)) {
+                continue;
+            }
+
+            box.x1 -= snapshot->box.x1;
+            box.x2 -= snapshot->box.x1;
+            box.y1 -= snapshot->box.y1;
+            box.y2 -= snapshot->box.y1;
+
+            if (!item->buffer->pixel_format->has_alpha) {
+                glDisable(GL_BLEND);
+                gles2_draw_quad(&gl->rgbx, textures[i], &box, target->width, target->height);
+            } else {
+                glEnable(GL_BLEND);
+                gles2_draw_quad(&gl->rgba, textures[i], &box, target->width, target->height);
+            }
+        }
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_BLEND);
+
+    for (uint32_t r = 0; r < damage->n_rects; r++) {
+        bytes += gles2_read_box(gl, snapshot, &damage->rects[r]);
+    }
+
+    cwc_free(textures);
+    gles2_release_current(gl);
+    snapshot->bytes = bytes;
+}
+
+/*
+ * Dispatch thread hooks
+ */
+static void gles2_surface_commit(struct cwc_renderer *renderer, struct cwc_surface *surface) {
+    (void)renderer;
+    struct gles2_texture *texture = surface->render_data;
+    if (texture) {
+        cwc_region_union(&texture->pending, &surface->current->damage);
+    }
+}
+
+static void gles2_surface_destroy(struct cwc_renderer *renderer, struct cwc_surface *surface) {
+    struct gles2_texture *texture = surface->render_data;
+    if (texture) {
+        surface->render_data = NULL;
+        texture->surface = NULL;
+        gles2_texture_unref((struct gles2_renderer *)renderer, texture);
+    }
+}
+
+static void gles2_buffer_destroy(struct cwc_renderer *renderer, struct cwc_buffer *buffer) {
+    struct cwc_dmabuf_buffer *dmabuf = (struct cwc_dmabuf_buffer *)buffer;
+    struct gles2_image *image = dmabuf->render_data;
+    dmabuf->render_data = NULL;
+
+    if (image->id || image->image != EGL_NO_IMAGE_KHR) {
+        gles2_discard((struct gles2_renderer *)renderer,
+                      (struct gles2_garbage){ .texture = image->id, .image = image->image });
+    }
+    cwc_free(image);
+}
+
+static void gles2_output_destroy(struct cwc_renderer *renderer, struct cwc_output *output) {
+    struct gles2_target *target = output->render_data;
+    if (!target) {
+        return;
+    }
+
+    output->render_data = NULL;
+    if (target->framebuffer) {
+        gles2_discard((struct gles2_renderer *)renderer,
+                      (struct gles2_garbage){ .texture = target->texture,
+                                              .framebuffer = target->framebuffer,
+                                              .image = EGL_NO_IMAGE_KHR });
+    }
+    cwc_free(target);
+}
+
+static void gles2_item_capture(struct cwc_renderer *renderer, struct cwc_render_item *item,
+                               struct cwc_surface *surface) {
+    struct gles2_renderer *gl = (struct gles2_renderer *)renderer;
+
+    if (gles2_item_is_image(gl, item)) {
+        struct cwc_dmabuf_buffer *dmabuf = (struct cwc_dmabuf_buffer *)item->buffer;
+        if (!dmabuf->render_data) {
+            struct gles2_image *image = cwc_calloc(1, sizeof(*image));
+            image->image = EGL_NO_IMAGE_KHR;
+            dmabuf->render_data = image;
+        }
+        item->render_data = dmabuf->render_data;
+        return;
+    }
+
+    struct gles2_texture *texture = surface->render_data;
+    if (!texture) {
+        texture = cwc_calloc(1, sizeof(*texture));
+        cwc_region_init(&texture->pending);
+        cwc_region_init(&texture->inflight);
+        atomic_init(&texture->uploaded_seq, 0);
+        texture->ref_count = 1;
+        texture->surface = surface;
+        surface->render_data = texture;
+        wl_list_insert(&gl->textures, &texture->link);
+    }
+    texture->last_used_ns = cwc_time_nsec();
+
+    cwc_region_copy(&item->upload, &texture->pending);
+    cwc_region_union(&item->upload, &texture->inflight);
+    cwc_region_copy(&texture->inflight, &item->upload);
+    cwc_region_clear(&texture->pending);
+    item->upload_seq = ++texture->capture_seq;
+
+    texture->ref_count++;
+    item->render_data = texture;
+}
+
+static void gles2_item_release(struct cwc_renderer *renderer, struct cwc_render_item *item) {
+    struct gles2_renderer *gl = (struct gles2_renderer *)renderer;
+    if (!item->render_data || gles2_item_is_image(gl, item)) {
+        return;
+    }
+
+    struct gles2_texture *texture = item->render_data;
+    if (atomic_load(&texture->uploaded_seq) >= texture->capture_seq) {
+        cwc_region_clear(&texture->inflight);
+
+        /* Nothing committed since the upload: the client can have its buffer back */
+        if (texture->surface && cwc_region_is_empty(&texture->pending)) {
+            cwc_surface_buffer_copied(texture->surface);
+        }
+    }
+    gles2_texture_unref(gl, texture);
+}
+
+/*
+ * Once the buffer was released early the texture is the only copy of
+ * the surface, so only textures of unmapped surfaces, or whose buffer is
+ * still locked, can be rebuilt. Those in a snapshot are being drawn.
+ */
+static void gles2_memory_collect(struct cwc_renderer *renderer,
+                                 struct cwc_memory_candidates *candidates) {
+    struct gles2_renderer *gl = (struct gles2_renderer *)renderer;
+    struct gles2_texture *texture;
+    wl_list_for_each(texture, &gl->textures, link) {
+        struct cwc_surface *surface = texture->surface;
+        if (!texture->id || texture->ref_count > 1 || !surface ||
+            (surface->mapped && !surface->buffer_locked)) {
+            continue;
+        }
+        cwc_memory_offer(candidates, &(struct cwc_memory_entry){
+            .last_used_ns = texture->last_used_ns,
+            .bytes = (uint64_t)texture->width * (uint64_t)texture->height * 4,
+            .evict = gles2_texture_evict,
+            .owner = gl,
+            .object = texture,
+        });
+    }
+}
+
+static void gles2_destroy(struct cwc_renderer *renderer) {
+    struct gles2_renderer *gl = (struct gles2_renderer *)renderer;
+
+    gles2_make_current(gl);
+    gles2_collect_garbage(gl);
+    glDeleteProgram(gl->rgba.program);
+    glDeleteProgram(gl->rgbx.program);
+    gles2_release_current(gl);
+
+    eglDestroyContext(gl->display, gl->context);
+    eglTerminate(gl->display);
+    pthread_mutex_destroy(&gl->garbage_lock);
+    pthread_mutex_destroy(&gl->lock);
+    cwc_free(gl->garbage);
+    cwc_free(gl->readback);
+    cwc_free(gl->convert);
+    cwc_free(gl);
+}
+
+static const struct cwc_renderer_impl gles2_impl = {
+    .name = "gles2",
+    .destroy = gles2_destroy,
+    .surface_commit = gles2_surface_commit,
+    .surface_destroy = gles2_surface_destroy,
+    .buffer_destroy = gles2_buffer_destroy,
+    .output_destroy = gles2_output_destroy,
+    .item_capture = gles2_item_capture,
+    .item_release = gles2_item_release,
+    .memory_collect = gles2_memory_collect,
+    .draw = gles2_draw,
+};
+
+/* Headless device: surfaceless Mesa if available, else the default display */
+static EGLDisplay gles2_get_display(void) {
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (gles2_has_extension(client_extensions, "EGL_MESA_platform_surfaceless") &&
+        gles2_has_extension(client_extensions, "EGL_EXT_platform_base")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+struct cwc_renderer *cwc_renderer_create_gles2(struct cwc_server *server) {
+    EGLDisplay display = gles2_get_display();
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        cwc_log(server, CWC_LOG_DEBUG, "No EGL display for the GLES2 renderer");
+        return NULL;
+    }
+
+    const char *egl_extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!gles2_has_extension(egl_extensions, "EGL_KHR_surfaceless_context") ||
+        !eglBindAPI(EGL_OPENGL_ES_API)) {
+        cwc_log(server, CWC_LOG_DEBUG, "EGL lacks surfaceless GLES contexts");
+        eglTerminate(display);
+        return NULL;
+    }
+
+    /* No surface type: the context only ever renders into FBOs */
+    static const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE,
+    };
+    static const EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint n_configs = 0;
+    EGLContext context = EGL_NO_CONTEXT;
+    if (eglChooseConfig(display, config_attribs, &config, 1, &n_configs) && n_configs > 0) {
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    }
+    if (context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        cwc_log(server, CWC_LOG_DEBUG, "Failed to create a GLES2 context");
+        if (context != EGL_NO_CONTEXT) {
+            eglDestroyContext(display, context);
+        }
+        eglTerminate(display);
+        return NULL;
+    }
+
+    const char *gl_extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!gles2_has_extension(gl_extensions, "GL_EXT_texture_format_BGRA8888")) {
+        cwc_log(server, CWC_LOG_DEBUG, "GLES2 lacks BGRA textures");
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        return NULL;
+    }
+
+    struct gles2_renderer *gl = cwc_calloc(1, sizeof(*gl));
+    gl->base.impl = &gles2_impl;
+    gl->base.server = server;
+    gl->display = display;
+    gl->context = context;
+    pthread_mutex_init(&gl->lock, NULL);
+    pthread_mutex_init(&gl->garbage_lock, NULL);
+    wl_list_init(&gl->textures);
+
+    gl->unpack_subimage = gles2_has_extension(gl_extensions, "GL_EXT_unpack_subimage");
+    gl->read_bgra = gles2_has_extension(gl_extensions, "GL_EXT_read_format_bgra");
+    gl->create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+    gl->destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    gl->image_target_texture = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+        eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    gl->dmabuf_import = gles2_has_extension(egl_extensions, "EGL_EXT_image_dma_buf_import") &&
+                        gles2_has_extension(gl_extensions, "GL_OES_EGL_image") &&
+                        gl->create_image && gl->destroy_image && gl->image_target_texture;
+
+    if (!gles2_program_init(gl, &gl->rgba, fragment_shader_rgba) ||
+        !gles2_program_init(gl, &gl->rgbx, fragment_shader_rgbx)) {
+        glDeleteProgram(gl->rgba.program);
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+        eglTerminate(display);
+        pthread_mutex_destroy(&gl->garbage_lock);
+        pthread_mutex_destroy(&gl->lock);
+        cwc_free(gl);
+        return NULL;
+    }
+
+    /* Uploads are whole BGRA pixels, rows a multiple of 4 bytes apart */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    cwc_log(server, CWC_LOG_INFO, "GLES2 renderer on %s (%s)",
+            (const char *)glGetString(GL_RENDERER), (const char *)glGetString(GL_VERSION));
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return &gl->base;
+}
+
+#else /* !CWC_HAVE_GLES2 */
+
+struct cwc_renderer *cwc_renderer_create_gles2(struct cwc_server *server) {
+    cwc_log(server, CWC_LOG_DEBUG, "Built without the GLES2 renderer");
+    return NULL;
+}
+
+#endif /* CWC_HAVE_GLES2 */
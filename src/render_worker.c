@@ -0,0 +1,151 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Render workers. Each output owns one; the output hands it a snapshot at
+ * the repaint deadline and gets it back on the event loop once drawn, so
+ * several outputs composite in parallel and none of them stall dispatch.
+ */
+
+#include "../include/render_worker.h"
+#include "../include/render.h"
+#include "../include/threadpool.h"
+#include <sys/eventfd.h>
+
+static void *render_worker_thread(void *data) {
+    struct cwc_render_worker *worker = data;
+
+    pthread_mutex_lock(&worker->lock);
+    for (;;) {
+        while (!worker->job && !worker->quit) {
+            pthread_cond_wait(&worker->cond, &worker->lock);
+        }
+        if (worker->quit) {
+            break;
+        }
+
+        struct cwc_render_snapshot *snapshot = worker->job;
+        worker->job = NULL;
+        pthread_mutex_unlock(&worker->lock);
+
+        cwc_render_snapshot_draw(snapshot);
+
+        pthread_mutex_lock(&worker->lock);
+        worker->done = snapshot;
+        pthread_cond_broadcast(&worker->cond);
+
+        uint64_t one = 1;
+        if (write(worker->done_fd, &one, sizeof(one)) < 0) {
+            /* counter overflow is impossible with one job in flight */
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return NULL;
+}
+
+/* Hand a finished snapshot to the owner; dispatch thread only */
+static void render_worker_collect(struct cwc_render_worker *worker) {
+    pthread_mutex_lock(&worker->lock);
+    struct cwc_render_snapshot *snapshot = worker->done;
+    worker->done = NULL;
+    if (snapshot) {
+        worker->busy = false;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (snapshot) {
+        worker->done_func(snapshot, worker->data);
+    }
+}
+
+static int render_worker_handle_done(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct cwc_render_worker *worker = data;
+
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    render_worker_collect(worker);
+    return 0;
+}
+
+struct cwc_render_worker *cwc_render_worker_create(struct cwc_server *server, const char *name,
+                                                   cwc_render_done_func_t done_func, void *data) {
+    struct cwc_render_worker *worker = cwc_calloc(1, sizeof(*worker));
+    worker->done_func = done_func;
+    worker->data = data;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->cond, NULL);
+
+    worker->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (worker->done_fd == -1) {
+        goto error_sync;
+    }
+
+    worker->done_source = wl_event_loop_add_fd(server->event_loop, worker->done_fd,
+                                               WL_EVENT_READABLE, render_worker_handle_done,
+                                               worker);
+    if (!worker->done_source) {
+        goto error_fd;
+    }
+
+    if (cwc_thread_create(&worker->thread, name, render_worker_thread, worker, true) != 0) {
+        goto error_source;
+    }
+
+    return worker;
+
+error_source:
+    wl_event_source_remove(worker->done_source);
+error_fd:
+    close(worker->done_fd);
+error_sync:
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->lock);
+    cwc_free(worker);
+    return NULL;
+}
+
+/* Finishes and delivers the frame in flight before stopping the thread */
+void cwc_render_worker_destroy(struct cwc_render_worker *worker) {
+    if (!worker) return;
+
+    cwc_render_worker_wait(worker);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->quit = true;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+    pthread_join(worker->thread, NULL);
+
+    wl_event_source_remove(worker->done_source);
+    close(worker->done_fd);
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->lock);
+    cwc_free(worker);
+}
+
+/* One job at a time; the output's repaint state machine guarantees that */
+void cwc_render_worker_submit(struct cwc_render_worker *worker,
+                              struct cwc_render_snapshot *snapshot) {
+    pthread_mutex_lock(&worker->lock);
+    worker->job = snapshot;
+    worker->busy = true;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+/*
+ * Block until the worker is idle, delivering its result right away. Only
+ * for rare events that must touch the framebuffer, such as a mode change.
+ */
+void cwc_render_worker_wait(struct cwc_render_worker *worker) {
+    pthread_mutex_lock(&worker->lock);
+    while (worker->busy && !worker->done) {
+        pthread_cond_wait(&worker->cond, &worker->lock);
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    render_worker_collect(worker);
+}
@@ -0,0 +1,102 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Renderer selection. The GLES2 backend is preferred where it builds and
+ * finds a usable EGL device; the software compositor is always there to
+ * fall back on, and fills in while GLES2 initializes.
+ */
+
+#include "../include/renderer.h"
+#include "../include/output.h"
+#include "../include/render_worker.h"
+#include "../include/startup.h"
+
+static void *renderer_gles2_run(struct cwc_server *server, void *data) {
+    (void)data;
+    return cwc_renderer_create_gles2(server);
+}
+
+/*
+ * The software renderer keeps no state of its own, so swapping it out
+ * only has to wait for the frames in flight. Surfaces get their textures
+ * on first capture; the full repaint fills them in.
+ */
+static void renderer_gles2_done(struct cwc_server *server, void *result, void *data) {
+    (void)data;
+    struct cwc_renderer *renderer = result;
+    if (!renderer) {
+        if (server->renderer_name && strcmp(server->renderer_name, "gles2") == 0) {
+            cwc_log(server, CWC_LOG_WARN, "GLES2 renderer unavailable, staying on software");
+        }
+        return;
+    }
+
+    struct cwc_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->worker) {
+            cwc_render_worker_wait(output->worker);
+        }
+    }
+
+    cwc_renderer_destroy(server->renderer);
+    server->renderer = renderer;
+    cwc_log(server, CWC_LOG_INFO, "Using %s renderer", renderer->impl->name);
+
+    wl_list_for_each(output, &server->outputs, link) {
+        cwc_output_damage_whole(output);
+    }
+}
+
+/*
+ * The software renderer is installed right away so outputs can show
+ * frames from the first vblank; GLES2, whose EGL and shader setup takes
+ * a while, comes up on a startup thread and replaces it once ready.
+ */
+void cwc_renderer_init(struct cwc_server *server, const char *name) {
+    bool automatic = !name || strcmp(name, "auto") == 0;
+
+    server->renderer = cwc_renderer_create_software(server);
+    cwc_log(server, CWC_LOG_INFO, "Using %s renderer", server->renderer->impl->name);
+
+    if (automatic || strcmp(name, "gles2") == 0) {
+        cwc_startup_spawn(server, "gles2", renderer_gles2_run, renderer_gles2_done, NULL);
+    } else if (strcmp(name, "software") != 0) {
+        cwc_log(server, CWC_LOG_WARN, "Unknown renderer '%s', using software", name);
+    }
+}
+
+void cwc_renderer_destroy(struct cwc_renderer *renderer) {
+    if (!renderer) return;
+    renderer->impl->destroy(renderer);
+}
+
+void cwc_renderer_surface_commit(struct cwc_renderer *renderer, struct cwc_surface *surface) {
+    if (renderer && renderer->impl->surface_commit) {
+        renderer->impl->surface_commit(renderer, surface);
+    }
+}
+
+void cwc_renderer_surface_destroy(struct cwc_renderer *renderer, struct cwc_surface *surface) {
+    if (renderer && renderer->impl->surface_destroy) {
+        renderer->impl->surface_destroy(renderer, surface);
+    }
+}
+
+void cwc_renderer_buffer_destroy(struct cwc_renderer *renderer, struct cwc_buffer *buffer) {
+    if (renderer && renderer->impl->buffer_destroy) {
+        renderer->impl->buffer_destroy(renderer, buffer);
+    }
+}
+
+void cwc_renderer_output_destroy(struct cwc_renderer *renderer, struct cwc_output *output) {
+    if (renderer && renderer->impl->output_destroy) {
+        renderer->impl->output_destroy(renderer, output);
+    }
+}
+
+void cwc_renderer_memory_collect(struct cwc_renderer *renderer,
+                                 struct cwc_memory_candidates *candidates) {
+    if (renderer && renderer->impl->memory_collect) {
+        renderer->impl->memory_collect(renderer, candidates);
+    }
+}
@@ -0,0 +1,259 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Scene graph between wl_surface state and the renderer. Surfaces own a
+ * buffer node under the root tree; their commits mark it and the update
+ * walks up only far enough to find the highest moved ancestor, then
+ * recomputes that subtree: world boxes, visibility, spatial index entries
+ * and output membership, plus the damage the changes leave behind.
+ */
+
+#include "../include/scene.h"
+#include "../include/output.h"
+#include "../include/stats.h"
+
+static bool box_equal(const struct cwc_box *a, const struct cwc_box *b) {
+    return a->x1 == b->x1 && a->y1 == b->y1 && a->x2 == b->x2 && a->y2 == b->y2;
+}
+
+static void box_union(struct cwc_box *dst, const struct cwc_box *box) {
+    if (cwc_box_is_empty(box)) {
+        return;
+    }
+    if (cwc_box_is_empty(dst)) {
+        *dst = *box;
+        return;
+    }
+    if (box->x1 < dst->x1) dst->x1 = box->x1;
+    if (box->y1 < dst->y1) dst->y1 = box->y1;
+    if (box->x2 > dst->x2) dst->x2 = box->x2;
+    if (box->y2 > dst->y2) dst->y2 = box->y2;
+}
+
+static void scene_mark(struct cwc_scene *scene, struct cwc_scene_node *node, uint32_t flags) {
+    node->dirty |= flags;
+    if (wl_list_empty(&node->dirty_link)) {
+        wl_list_insert(scene->dirty.prev, &node->dirty_link);
+    }
+}
+
+/* Stops at the first ancestor already stale, which has stale ancestors too */
+static void scene_mark_bounds(struct cwc_scene_node *node) {
+    for (struct cwc_scene_node *parent = node->parent;
+         parent && !(parent->dirty & CWC_SCENE_DIRTY_BOUNDS); parent = parent->parent) {
+        parent->dirty |= CWC_SCENE_DIRTY_BOUNDS;
+    }
+}
+
+static uint32_t scene_output_mask(struct cwc_scene *scene, const struct cwc_box *box) {
+    uint32_t mask = 0;
+    if (cwc_box_is_empty(box)) {
+        return mask;
+    }
+
+    struct cwc_output *output;
+    wl_list_for_each(output, &scene->server->outputs, link) {
+        struct cwc_box output_box, overlap;
+        cwc_output_get_box(output, &output_box);
+        if (cwc_box_intersect(&overlap, box, &output_box)) {
+            mask |= output->scene_bit;
+        }
+    }
+    return mask;
+}
+
+void cwc_scene_init(struct cwc_scene *scene, struct cwc_server *server) {
+    memset(scene, 0, sizeof(*scene));
+    scene->server = server;
+    wl_list_init(&scene->dirty);
+    cwc_scene_node_init(scene, &scene->root, CWC_SCENE_NODE_TREE, NULL, NULL);
+    scene->root.enabled = true;
+    scene->root.visible = true;
+}
+
+/* Owners have removed their nodes by now */
+void cwc_scene_fini(struct cwc_scene *scene) {
+    wl_list_remove(&scene->root.dirty_link);
+    cwc_region_fini(&scene->root.damage);
+}
+
+void cwc_scene_node_init(struct cwc_scene *scene, struct cwc_scene_node *node,
+                         enum cwc_scene_node_type type, struct cwc_scene_node *parent,
+                         void *data) {
+    (void)scene;
+    memset(node, 0, sizeof(*node));
+    node->type = type;
+    node->parent = parent;
+    node->data = data;
+    node->spatial.data = data;
+    wl_list_init(&node->children);
+    wl_list_init(&node->dirty_link);
+    cwc_region_init(&node->damage);
+
+    if (parent) {
+        wl_list_insert(parent->children.prev, &node->link);
+    } else {
+        wl_list_init(&node->link);
+    }
+}
+
+/* A tree's children go first; whatever the node showed is exposed */
+void cwc_scene_node_remove(struct cwc_scene *scene, struct cwc_scene_node *node) {
+    if (node->type == CWC_SCENE_NODE_BUFFER && !cwc_box_is_empty(&node->box)) {
+        struct cwc_region exposed;
+        cwc_region_init(&exposed);
+        cwc_region_union_box(&exposed, &node->box);
+        cwc_output_damage_layout(scene->server, &exposed);
+        cwc_region_fini(&exposed);
+        scene_mark_bounds(node);
+    }
+
+    cwc_spatial_remove(scene->server->surface_grid, &node->spatial);
+    wl_list_remove(&node->link);
+    wl_list_init(&node->link);
+    wl_list_remove(&node->dirty_link);
+    wl_list_init(&node->dirty_link);
+    cwc_region_fini(&node->damage);
+}
+
+void cwc_scene_node_set_position(struct cwc_scene *scene, struct cwc_scene_node *node,
+                                 int32_t x, int32_t y) {
+    if (node->x != x || node->y != y) {
+        node->x = x;
+        node->y = y;
+        scene_mark(scene, node, CWC_SCENE_DIRTY_GEOMETRY);
+    }
+}
+
+void cwc_scene_node_set_size(struct cwc_scene *scene, struct cwc_scene_node *node,
+                             int32_t width, int32_t height) {
+    if (node->width != width || node->height != height) {
+        node->width = width;
+        node->height = height;
+        scene_mark(scene, node, CWC_SCENE_DIRTY_GEOMETRY);
+    }
+}
+
+void cwc_scene_node_set_enabled(struct cwc_scene *scene, struct cwc_scene_node *node,
+                                bool enabled) {
+    if (node->enabled != enabled) {
+        node->enabled = enabled;
+        scene_mark(scene, node, CWC_SCENE_DIRTY_GEOMETRY);
+    }
+}
+
+void cwc_scene_node_damage(struct cwc_scene *scene, struct cwc_scene_node *node,
+                           const struct cwc_region *damage) {
+    if (!cwc_region_is_empty(damage)) {
+        cwc_region_union(&node->damage, damage);
+        scene_mark(scene, node, CWC_SCENE_DIRTY_CONTENT);
+    }
+}
+
+/* Everything below node inherits its new position and visibility */
+static void scene_update_subtree(struct cwc_scene *scene, struct cwc_scene_node *node,
+                                 struct cwc_region *damage) {
+    struct cwc_scene_node *parent = node->parent;
+    node->world_x = (parent ? parent->world_x : 0) + node->x;
+    node->world_y = (parent ? parent->world_y : 0) + node->y;
+    node->visible = (!parent || parent->visible) && node->enabled;
+    node->dirty &= ~(uint32_t)(CWC_SCENE_DIRTY_GEOMETRY | CWC_SCENE_DIRTY_CONTENT);
+    wl_list_remove(&node->dirty_link);
+    wl_list_init(&node->dirty_link);
+    if (scene->server->stats) {
+        scene->server->stats->scene_nodes_updated++;
+    }
+
+    if (node->type == CWC_SCENE_NODE_TREE) {
+        struct cwc_scene_node *child;
+        wl_list_for_each(child, &node->children, link) {
+            scene_update_subtree(scene, child, damage);
+        }
+        return;
+    }
+
+    struct cwc_box box = { 0 };
+    if (node->visible && node->width > 0 && node->height > 0) {
+        box = (struct cwc_box){ node->world_x, node->world_y,
+                                node->world_x + node->width, node->world_y + node->height };
+    } else {
+        node->visible = false;
+    }
+
+    if (!box_equal(&box, &node->box)) {
+        cwc_region_union_box(damage, &node->box);
+        cwc_region_union_box(damage, &box);
+        node->box = box;
+        cwc_spatial_update(scene->server->surface_grid, &node->spatial, &box);
+        scene_mark_bounds(node);
+    } else if (node->visible && !cwc_region_is_empty(&node->damage)) {
+        cwc_region_translate(&node->damage, node->world_x, node->world_y);
+        cwc_region_union(damage, &node->damage);
+    }
+    cwc_region_clear(&node->damage);
+    node->output_mask = scene_output_mask(scene, &box);
+}
+
+/*
+ * Each queued node is recomputed from its highest ancestor with dirty
+ * geometry, whose new position all of its descendants depend on. Clean
+ * ancestors already hold valid world positions to start from.
+ */
+void cwc_scene_update(struct cwc_scene *scene) {
+    if (wl_list_empty(&scene->dirty)) {
+        return;
+    }
+
+    struct cwc_region damage;
+    cwc_region_init(&damage);
+    while (!wl_list_empty(&scene->dirty)) {
+        struct cwc_scene_node *node = wl_container_of(scene->dirty.next, node, dirty_link);
+        struct cwc_scene_node *top = node;
+        for (struct cwc_scene_node *ancestor = node->parent; ancestor;
+             ancestor = ancestor->parent) {
+            if (ancestor->dirty & CWC_SCENE_DIRTY_GEOMETRY) {
+                top = ancestor;
+            }
+        }
+        scene_update_subtree(scene, top, &damage);
+    }
+
+    cwc_output_damage_layout(scene->server, &damage);
+    cwc_region_fini(&damage);
+}
+
+void cwc_scene_node_get_bounds(struct cwc_scene_node *node, struct cwc_box *box) {
+    if (node->type == CWC_SCENE_NODE_TREE && (node->dirty & CWC_SCENE_DIRTY_BOUNDS)) {
+        struct cwc_box bounds = { 0 };
+        struct cwc_scene_node *child;
+        wl_list_for_each(child, &node->children, link) {
+            struct cwc_box child_box;
+            cwc_scene_node_get_bounds(child, &child_box);
+            box_union(&bounds, &child_box);
+        }
+        node->box = bounds;
+        node->dirty &= ~(uint32_t)CWC_SCENE_DIRTY_BOUNDS;
+    }
+    *box = node->box;
+}
+
+/* 0 once every bit is taken */
+uint32_t cwc_scene_output_bit_alloc(struct cwc_scene *scene) {
+    for (uint32_t i = 0; i < CWC_SCENE_MAX_OUTPUTS; i++) {
+        uint32_t bit = UINT32_C(1) << i;
+        if (!(scene->output_bits & bit)) {
+            scene->output_bits |= bit;
+            return bit;
+        }
+    }
+    return 0;
+}
+
+void cwc_scene_output_bit_free(struct cwc_scene *scene, uint32_t bit) {
+    scene->output_bits &= ~bit;
+}
+
+/* Output boxes moved: every node's membership is recomputed once */
+void cwc_scene_outputs_changed(struct cwc_scene *scene) {
+    scene_mark(scene, &scene->root, CWC_SCENE_DIRTY_GEOMETRY);
+}
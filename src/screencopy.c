@@ -0,0 +1,546 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * wlr-screencopy. Capture clients are served from the frame the output
+ * just presented: the framebuffer the composite wrote, or the client
+ * buffer on screen during direct scanout. Nothing is rendered again for
+ * a capture, and each copy only rewrites what changed on screen since
+ * the same client buffer was last written. copy_with_damage waits for
+ * damage inside the captured area, and the captures key of the client
+ * budget caps how many frames per second each client gets.
+ */
+
+#include "../include/screencopy.h"
+#include "../include/buffer.h"
+#include "../include/dmabuf.h"
+#include "../include/output.h"
+#include "../include/shm.h"
+#include "../include/stats.h"
+
+#define CWC_SCREENCOPY_VERSION 3
+
+static bool box_equal(const struct cwc_box *a, const struct cwc_box *b) {
+    return a->x1 == b->x1 && a->y1 == b->y1 && a->x2 == b->x2 && a->y2 == b->y2;
+}
+
+static void target_reset(struct cwc_screencopy_target *target) {
+    if (target->buffer) {
+        wl_list_remove(&target->buffer_destroy.link);
+        target->buffer = NULL;
+    }
+    target->copy_seq = 0;
+    cwc_region_clear(&target->damage);
+}
+
+static void target_handle_buffer_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_screencopy_target *target = wl_container_of(listener, target, buffer_destroy);
+    target_reset(target);
+}
+
+static void screencopy_client_destroy(struct cwc_screencopy_client *sc) {
+    for (int i = 0; i < CWC_SCREENCOPY_TARGETS; i++) {
+        target_reset(&sc->targets[i]);
+        cwc_region_fini(&sc->targets[i].damage);
+    }
+    cwc_region_fini(&sc->damage);
+    wl_list_remove(&sc->client_destroy.link);
+    wl_list_remove(&sc->link);
+    cwc_free(sc);
+}
+
+static void screencopy_client_handle_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_screencopy_client *sc = wl_container_of(listener, sc, client_destroy);
+    screencopy_client_destroy(sc);
+}
+
+/* Damage is tracked per client rather than per manager; everything is new at first */
+static struct cwc_screencopy_client *screencopy_client_get(struct cwc_output *output,
+                                                           struct wl_client *client) {
+    struct cwc_screencopy_client *sc;
+    wl_list_for_each(sc, &output->screencopy_clients, link) {
+        if (sc->client == client) {
+            return sc;
+        }
+    }
+
+    sc = cwc_calloc(1, sizeof(*sc));
+    sc->output = output;
+    sc->client = client;
+    cwc_region_init_rect(&sc->damage, 0, 0, output->config.width, output->config.height);
+    for (int i = 0; i < CWC_SCREENCOPY_TARGETS; i++) {
+        cwc_region_init(&sc->targets[i].damage);
+    }
+    sc->client_destroy.notify = screencopy_client_handle_destroy;
+    wl_client_add_destroy_listener(client, &sc->client_destroy);
+    wl_list_insert(&output->screencopy_clients, &sc->link);
+    return sc;
+}
+
+/*
+ * The slot already holding buffer, or else the least recently written
+ * one, whose buffer then needs a full copy. Free slots come first.
+ */
+static struct cwc_screencopy_target *screencopy_client_target(struct cwc_screencopy_client *sc,
+                                                              struct wl_resource *buffer,
+                                                              const struct cwc_box *box) {
+    struct cwc_screencopy_target *oldest = &sc->targets[0];
+    for (int i = 0; i < CWC_SCREENCOPY_TARGETS; i++) {
+        struct cwc_screencopy_target *target = &sc->targets[i];
+        if (target->buffer == buffer) {
+            if (!box_equal(&target->box, box)) {
+                target->box = *box;
+                cwc_region_clear(&target->damage);
+                cwc_region_union_box(&target->damage, box);
+            }
+            return target;
+        }
+        if (target->copy_seq < oldest->copy_seq) {
+            oldest = target;
+        }
+    }
+
+    target_reset(oldest);
+    oldest->buffer = buffer;
+    oldest->buffer_destroy.notify = target_handle_buffer_destroy;
+    wl_resource_add_destroy_listener(buffer, &oldest->buffer_destroy);
+    oldest->box = *box;
+    cwc_region_union_box(&oldest->damage, box);
+    return oldest;
+}
+
+/* Ready or failed; the resource lives on until the client destroys it */
+static void frame_finish(struct cwc_screencopy_frame *frame) {
+    wl_list_remove(&frame->link);
+    wl_list_init(&frame->link);
+    wl_list_remove(&frame->buffer_destroy.link);
+    wl_list_init(&frame->buffer_destroy.link);
+    frame->buffer = NULL;
+    frame->output = NULL;
+}
+
+static void frame_fail(struct cwc_screencopy_frame *frame) {
+    zwlr_screencopy_frame_v1_send_failed(frame->resource);
+    frame_finish(frame);
+}
+
+static void frame_handle_buffer_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_screencopy_frame *frame = wl_container_of(listener, frame, buffer_destroy);
+    frame_fail(frame);
+}
+
+static void frame_resource_destroy(struct wl_resource *resource) {
+    struct cwc_screencopy_frame *frame = wl_resource_get_user_data(resource);
+    frame_finish(frame);
+    cwc_free(frame);
+}
+
+/*
+ * What is on screen: the framebuffer, or the client buffer scanned out
+ * instead. Both are 32 bpp XRGB8888 or ARGB8888, which is all that
+ * output_scanout_candidate() lets through, so rows are copied as is.
+ */
+struct screencopy_source {
+    const uchar *data;
+    int32_t stride;
+    struct cwc_shm_pool *pool;      /* wl_shm scanout buffer, guarded while read */
+    int sync_fd;                    /* dma-buf scanout buffer, else -1 */
+};
+
+static bool screencopy_source_get(struct cwc_output *output, struct screencopy_source *source) {
+    struct cwc_buffer *buffer = output->scanout_buffer;
+    source->pool = NULL;
+    source->sync_fd = -1;
+
+    if (!buffer) {
+        source->data = (const uchar *)output->pixels;
+        source->stride = output->stride;
+    } else if (buffer->type == CWC_BUFFER_DMABUF) {
+        struct cwc_dmabuf_buffer *dmabuf = (struct cwc_dmabuf_buffer *)buffer;
+        source->data = cwc_dmabuf_buffer_get_data(dmabuf);
+        source->stride = (int32_t)dmabuf->attributes.planes[0].stride;
+        source->sync_fd = dmabuf->attributes.planes[0].fd;
+    } else {
+        struct cwc_shm_buffer *shm_buffer = (struct cwc_shm_buffer *)buffer;
+        source->data = cwc_shm_buffer_get_data(shm_buffer);
+        source->stride = shm_buffer->stride;
+        source->pool = shm_buffer->pool;
+    }
+    return source->data != NULL;
+}
+
+/* The part of region inside box, from the screen into a buffer holding box */
+static uint64_t screencopy_copy_region(uchar *dst, int32_t dst_stride, const struct cwc_box *box,
+                                       const struct screencopy_source *source,
+                                       const struct cwc_region *region) {
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        struct cwc_box rect;
+        if (!cwc_box_intersect(&rect, &region->rects[i], box)) {
+            continue;
+        }
+
+        size_t row = (size_t)(rect.x2 - rect.x1) * 4;
+        for (int32_t y = rect.y1; y < rect.y2; y++) {
+            memcpy(dst + (size_t)(y - box->y1) * (size_t)dst_stride + (size_t)(rect.x1 - box->x1) * 4,
+                   source->data + (size_t)y * (size_t)source->stride + (size_t)rect.x1 * 4, row);
+        }
+        bytes += row * (size_t)(rect.y2 - rect.y1);
+    }
+    return bytes;
+}
+
+/* copy_with_damage is told what changed inside its box, in buffer coordinates */
+static void frame_send_damage(struct cwc_screencopy_frame *frame, const struct cwc_region *damage) {
+    struct cwc_region local;
+    cwc_region_init(&local);
+    cwc_region_copy(&local, damage);
+    cwc_region_intersect_box(&local, &frame->box);
+    for (uint32_t i = 0; i < local.n_rects; i++) {
+        const struct cwc_box *rect = &local.rects[i];
+        zwlr_screencopy_frame_v1_send_damage(frame->resource, (uint32_t)(rect->x1 - frame->box.x1),
+                                             (uint32_t)(rect->y1 - frame->box.y1),
+                                             (uint32_t)(rect->x2 - rect->x1),
+                                             (uint32_t)(rect->y2 - rect->y1));
+    }
+    cwc_region_fini(&local);
+}
+
+static void frame_deliver(struct cwc_screencopy_frame *frame, struct cwc_screencopy_client *sc,
+                          const struct screencopy_source *source, uint64_t present_ns,
+                          uint64_t now) {
+    struct cwc_shm_buffer *buffer = cwc_shm_buffer_from_resource(frame->buffer);
+    uchar *dst = cwc_shm_buffer_get_writable(buffer);
+    if (!dst) {
+        cwc_log(frame->output->server, CWC_LOG_DEBUG, "Screencopy buffer %p not writable",
+                (void *)frame->buffer);
+        frame_fail(frame);
+        return;
+    }
+
+    /* Both sides may be client memory that can be truncated under us */
+    struct cwc_shm_pool *pool = buffer->pool;
+    struct cwc_screencopy_target *target = screencopy_client_target(sc, frame->buffer, &frame->box);
+    cwc_shm_access_begin(pool, pool->map->write_data, pool->map->write_size);
+    if (source->pool) {
+        cwc_shm_access_begin(source->pool, source->pool->map->data, source->pool->map->size);
+    } else if (source->sync_fd >= 0) {
+        cwc_dmabuf_sync(source->sync_fd, true);
+    }
+
+    uint64_t bytes = screencopy_copy_region(dst, buffer->stride, &frame->box, source,
+                                            &target->damage);
+
+    if (source->pool) {
+        cwc_shm_access_end();
+    } else if (source->sync_fd >= 0) {
+        cwc_dmabuf_sync(source->sync_fd, false);
+    }
+    cwc_shm_access_end();
+    cwc_shm_pool_check_access(pool);
+    if (source->pool) {
+        cwc_shm_pool_check_access(source->pool);
+    }
+
+    if (frame->with_damage &&
+        wl_resource_get_version(frame->resource) >= ZWLR_SCREENCOPY_FRAME_V1_DAMAGE_SINCE_VERSION) {
+        frame_send_damage(frame, &sc->damage);
+    }
+    cwc_region_clear(&target->damage);
+    target->copy_seq = ++sc->copy_seq;
+    cwc_region_subtract_box(&sc->damage, &frame->box);
+    sc->last_copy_ns = now;
+
+    uint64_t sec = present_ns / 1000000000ull;
+    zwlr_screencopy_frame_v1_send_flags(frame->resource, 0);
+    zwlr_screencopy_frame_v1_send_ready(frame->resource, (uint32_t)(sec >> 32), (uint32_t)sec,
+                                        (uint32_t)(present_ns % 1000000000ull));
+
+    struct cwc_stats *stats = frame->output->server->stats;
+    if (stats) {
+        stats->screencopy_frames++;
+        stats->screencopy_bytes += bytes;
+    }
+    frame_finish(frame);
+}
+
+static int screencopy_handle_timer(void *data) {
+    struct cwc_output *output = data;
+    if (output->repaint_state == CWC_OUTPUT_REPAINT_IDLE) {
+        cwc_screencopy_output_flush(output, 0);
+    }
+    return 0;
+}
+
+/* A capped frame is due; outputs already busy flush it at their present */
+static void screencopy_arm_timer(struct cwc_output *output, uint64_t delay_ns) {
+    if (!output->screencopy_timer) {
+        output->screencopy_timer = wl_event_loop_add_timer(output->server->event_loop,
+                                                           screencopy_handle_timer, output);
+    }
+    if (output->screencopy_timer) {
+        wl_event_source_timer_update(output->screencopy_timer, (int)(delay_ns / 1000000) + 1);
+    }
+}
+
+/*
+ * Serve every waiting frame the screen holds contents for. present_ns is
+ * the presentation time of what is on screen, 0 for the last present.
+ */
+void cwc_screencopy_output_flush(struct cwc_output *output, uint64_t present_ns) {
+    if (wl_list_empty(&output->screencopy_frames)) {
+        return;
+    }
+
+    uint64_t now = cwc_time_nsec();
+    if (!present_ns) {
+        present_ns = output->last_present_ns ? output->last_present_ns : now;
+    }
+
+    struct screencopy_source source;
+    bool have_source = screencopy_source_get(output, &source);
+    uint32_t cap = output->server->client_budget.captures_per_sec;
+    uint64_t interval = cap ? 1000000000ull / cap : 0;
+    uint64_t wake_ns = 0;
+    struct cwc_box output_box = { 0, 0, output->config.width, output->config.height };
+
+    struct cwc_screencopy_frame *frame, *tmp;
+    wl_list_for_each_safe(frame, tmp, &output->screencopy_frames, link) {
+        if (!frame->used) {
+            continue;
+        }
+
+        /* The output may have shrunk since the frame was created */
+        struct cwc_box area;
+        if (!have_source || !cwc_box_intersect(&area, &frame->box, &output_box) ||
+            !box_equal(&area, &frame->box)) {
+            frame_fail(frame);
+            continue;
+        }
+
+        struct cwc_screencopy_client *sc =
+            screencopy_client_get(output, wl_resource_get_client(frame->resource));
+        if (frame->with_damage && !cwc_region_intersects_box(&sc->damage, &frame->box)) {
+            continue;
+        }
+
+        /* An eighth of the interval early still counts, so vblank jitter does not halve the rate */
+        uint64_t slack = interval / 8;
+        if (interval && sc->last_copy_ns && now - sc->last_copy_ns + slack < interval) {
+            uint64_t due = sc->last_copy_ns + interval - slack;
+            if (!wake_ns || due < wake_ns) {
+                wake_ns = due;
+            }
+            continue;
+        }
+        frame_deliver(frame, sc, &source, present_ns, now);
+    }
+
+    if (wake_ns) {
+        screencopy_arm_timer(output, wake_ns - now);
+    }
+}
+
+/* Framebuffer or scanout damage of the frame about to be presented, output-local */
+void cwc_screencopy_output_damage(struct cwc_output *output, const struct cwc_region *damage) {
+    if (cwc_region_is_empty(damage)) {
+        return;
+    }
+
+    struct cwc_screencopy_client *sc;
+    wl_list_for_each(sc, &output->screencopy_clients, link) {
+        cwc_region_union(&sc->damage, damage);
+        cwc_region_simplify(&sc->damage, CWC_REGION_MAX_DAMAGE_RECTS);
+        for (int i = 0; i < CWC_SCREENCOPY_TARGETS; i++) {
+            struct cwc_screencopy_target *target = &sc->targets[i];
+            if (target->buffer) {
+                cwc_region_union(&target->damage, damage);
+                cwc_region_simplify(&target->damage, CWC_REGION_MAX_DAMAGE_RECTS);
+            }
+        }
+    }
+}
+
+void cwc_screencopy_output_destroy(struct cwc_output *output) {
+    struct cwc_screencopy_frame *frame, *frame_tmp;
+    wl_list_for_each_safe(frame, frame_tmp, &output->screencopy_frames, link) {
+        frame_fail(frame);
+    }
+
+    struct cwc_screencopy_client *sc, *sc_tmp;
+    wl_list_for_each_safe(sc, sc_tmp, &output->screencopy_clients, link) {
+        screencopy_client_destroy(sc);
+    }
+
+    if (output->screencopy_timer) {
+        wl_event_source_remove(output->screencopy_timer);
+        output->screencopy_timer = NULL;
+    }
+}
+
+/*
+ * zwlr_screencopy_frame_v1 implementation
+ */
+static void frame_copy(struct wl_resource *resource, struct wl_resource *buffer_resource,
+                       bool with_damage) {
+    struct cwc_screencopy_frame *frame = wl_resource_get_user_data(resource);
+    if (frame->used) {
+        wl_resource_post_error(resource, ZWLR_SCREENCOPY_FRAME_V1_ERROR_ALREADY_USED,
+                               "Frame already used");
+        return;
+    }
+    frame->used = true;
+
+    /* Already failed */
+    struct cwc_output *output = frame->output;
+    if (!output) {
+        return;
+    }
+
+    struct cwc_shm_buffer *buffer = cwc_shm_buffer_from_resource(buffer_resource);
+    int32_t width = frame->box.x2 - frame->box.x1;
+    int32_t height = frame->box.y2 - frame->box.y1;
+    if (!buffer || buffer->base.format != WL_SHM_FORMAT_XRGB8888 ||
+        buffer->base.width != width || buffer->base.height != height ||
+        buffer->stride < width * 4) {
+        wl_resource_post_error(resource, ZWLR_SCREENCOPY_FRAME_V1_ERROR_INVALID_BUFFER,
+                               "Buffer must be a %dx%d XRGB8888 wl_shm buffer", width, height);
+        return;
+    }
+
+    frame->with_damage = with_damage;
+    frame->buffer = buffer_resource;
+    frame->buffer_destroy.notify = frame_handle_buffer_destroy;
+    wl_resource_add_destroy_listener(buffer_resource, &frame->buffer_destroy);
+
+    /* An idle output still shows its last frame; serve it right away */
+    if (output->repaint_state == CWC_OUTPUT_REPAINT_IDLE) {
+        cwc_screencopy_output_flush(output, 0);
+    }
+}
+
+static void frame_handle_copy(struct wl_client *client, struct wl_resource *resource,
+                              struct wl_resource *buffer) {
+    (void)client;
+    frame_copy(resource, buffer, false);
+}
+
+static void frame_handle_copy_with_damage(struct wl_client *client, struct wl_resource *resource,
+                                          struct wl_resource *buffer) {
+    (void)client;
+    frame_copy(resource, buffer, true);
+}
+
+static void frame_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct zwlr_screencopy_frame_v1_interface frame_implementation = {
+    .copy = frame_handle_copy,
+    .destroy = frame_handle_destroy,
+    .copy_with_damage = frame_handle_copy_with_damage,
+};
+
+/*
+ * zwlr_screencopy_manager_v1 implementation
+ */
+
+/* region is output-local, NULL for the whole output; cursors are never drawn */
+static void manager_capture(struct wl_resource *manager, uint32_t id,
+                            struct wl_resource *output_resource, const struct cwc_box *region) {
+    struct wl_client *client = wl_resource_get_client(manager);
+    struct cwc_screencopy_frame *frame = cwc_calloc(1, sizeof(*frame));
+    frame->resource = wl_resource_create(client, &zwlr_screencopy_frame_v1_interface,
+                                         wl_resource_get_version(manager), id);
+    if (!frame->resource) {
+        cwc_free(frame);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_list_init(&frame->link);
+    wl_list_init(&frame->buffer_destroy.link);
+    wl_resource_set_implementation(frame->resource, &frame_implementation, frame,
+                                   frame_resource_destroy);
+
+    struct cwc_output *output = wl_resource_get_user_data(output_resource);
+    if (!output || !output->enabled) {
+        zwlr_screencopy_frame_v1_send_failed(frame->resource);
+        return;
+    }
+
+    struct cwc_box output_box = { 0, 0, output->config.width, output->config.height };
+    if (!cwc_box_intersect(&frame->box, region ? region : &output_box, &output_box)) {
+        zwlr_screencopy_frame_v1_send_failed(frame->resource);
+        return;
+    }
+    frame->output = output;
+    wl_list_insert(output->screencopy_frames.prev, &frame->link);
+
+    /* No linux_dmabuf: client dma-bufs are only ever mapped for reading */
+    uint32_t width = (uint32_t)(frame->box.x2 - frame->box.x1);
+    uint32_t height = (uint32_t)(frame->box.y2 - frame->box.y1);
+    zwlr_screencopy_frame_v1_send_buffer(frame->resource, WL_SHM_FORMAT_XRGB8888, width, height,
+                                         width * 4);
+    if (wl_resource_get_version(frame->resource) >=
+        ZWLR_SCREENCOPY_FRAME_V1_BUFFER_DONE_SINCE_VERSION) {
+        zwlr_screencopy_frame_v1_send_buffer_done(frame->resource);
+    }
+}
+
+static void manager_handle_capture_output(struct wl_client *client, struct wl_resource *resource,
+                                          uint32_t id, int32_t overlay_cursor,
+                                          struct wl_resource *output) {
+    (void)client;
+    (void)overlay_cursor;
+    manager_capture(resource, id, output, NULL);
+}
+
+static void manager_handle_capture_output_region(struct wl_client *client,
+                                                 struct wl_resource *resource, uint32_t id,
+                                                 int32_t overlay_cursor,
+                                                 struct wl_resource *output, int32_t x, int32_t y,
+                                                 int32_t width, int32_t height) {
+    (void)client;
+    (void)overlay_cursor;
+    struct cwc_box region = { 0 };
+    if (width > 0 && height > 0) {
+        int64_t x2 = (int64_t)x + width;
+        int64_t y2 = (int64_t)y + height;
+        region = (struct cwc_box){ x, y, x2 > INT32_MAX ? INT32_MAX : (int32_t)x2,
+                                   y2 > INT32_MAX ? INT32_MAX : (int32_t)y2 };
+    }
+    manager_capture(resource, id, output, &region);
+}
+
+static void manager_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct zwlr_screencopy_manager_v1_interface manager_implementation = {
+    .capture_output = manager_handle_capture_output,
+    .capture_output_region = manager_handle_capture_output_region,
+    .destroy = manager_handle_destroy,
+};
+
+static void screencopy_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    uint32_t bound_version = version < CWC_SCREENCOPY_VERSION ? version : CWC_SCREENCOPY_VERSION;
+
+    struct wl_resource *resource = wl_resource_create(client, &zwlr_screencopy_manager_v1_interface,
+                                                      (int)bound_version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &manager_implementation, data, NULL);
+}
+
+cwc_error_t cwc_screencopy_init(struct cwc_server *server) {
+    server->screencopy_global = wl_global_create(server->display,
+                                                 &zwlr_screencopy_manager_v1_interface,
+                                                 CWC_SCREENCOPY_VERSION, server, screencopy_bind);
+    return server->screencopy_global ? CWC_SUCCESS : CWC_ERROR_RESOURCE;
+}
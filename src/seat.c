@@ -0,0 +1,560 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * wl_seat with a pointer, and zwp_relative_pointer_manager_v1. Device
+ * events come from the input backend with their kernel timestamps; the
+ * surface under the pointer is found through the spatial index. How
+ * absolute motion is coalesced is described in seat.h. The time of the
+ * oldest event a client was sent is kept on its state, so the commit it
+ * answers with can be followed to the screen for the input-to-present
+ * histogram.
+ */
+
+#include "../include/seat.h"
+#include "../include/compositor.h"
+#include "../include/output.h"
+#include "../include/stats.h"
+
+#define CWC_SEAT_VERSION 7
+#define CWC_RELATIVE_POINTER_VERSION 1
+
+static void resource_unlink(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void resource_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static struct wl_client *seat_focus_client(struct cwc_seat *seat) {
+    return seat->focus ? wl_resource_get_client(seat->focus->resource) : NULL;
+}
+
+static void seat_note_input(struct cwc_seat *seat, struct wl_client *client, uint64_t time_ns) {
+    struct cwc_client_state *client_state = cwc_client_state_lookup(seat->server, client);
+    if (client_state && !client_state->input_ns) {
+        client_state->input_ns = time_ns;
+    }
+}
+
+static bool seat_client_has_relative(struct cwc_seat *seat, struct wl_client *client) {
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &seat->relative_pointers) {
+        if (wl_resource_get_client(resource) == client) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Ends the event group for the client's pointers */
+static void seat_send_frame(struct cwc_seat *seat, struct wl_client *client) {
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &seat->pointers) {
+        if (wl_resource_get_client(resource) == client &&
+            wl_resource_get_version(resource) >= WL_POINTER_FRAME_SINCE_VERSION) {
+            wl_pointer_send_frame(resource);
+        }
+    }
+}
+
+/* Layout extents of all outputs, where the pointer is confined */
+static bool seat_layout_box(struct cwc_seat *seat, struct cwc_box *box) {
+    bool found = false;
+    struct cwc_output *output;
+    wl_list_for_each(output, &seat->server->outputs, link) {
+        struct cwc_box output_box = {
+            output->config.x, output->config.y,
+            output->config.x + output->config.width, output->config.y + output->config.height,
+        };
+        if (!found) {
+            *box = output_box;
+            found = true;
+            continue;
+        }
+        if (output_box.x1 < box->x1) box->x1 = output_box.x1;
+        if (output_box.y1 < box->y1) box->y1 = output_box.y1;
+        if (output_box.x2 > box->x2) box->x2 = output_box.x2;
+        if (output_box.y2 > box->y2) box->y2 = output_box.y2;
+    }
+    return found;
+}
+
+static void seat_move_to(struct cwc_seat *seat, double x, double y) {
+    struct cwc_box box;
+    if (seat_layout_box(seat, &box)) {
+        /* Stay inside the last pixel, surfaces are hit-tested half-open */
+        double max_x = (double)box.x2 - 1.0 / 256;
+        double max_y = (double)box.y2 - 1.0 / 256;
+        x = x < box.x1 ? box.x1 : x > max_x ? max_x : x;
+        y = y < box.y1 ? box.y1 : y > max_y ? max_y : y;
+    }
+    seat->x = x;
+    seat->y = y;
+}
+
+static struct cwc_output *seat_output_at_pointer(struct cwc_seat *seat) {
+    struct cwc_output *output;
+    wl_list_for_each(output, &seat->server->outputs, link) {
+        if (seat->x >= output->config.x && seat->y >= output->config.y &&
+            seat->x < output->config.x + output->config.width &&
+            seat->y < output->config.y + output->config.height) {
+            return output;
+        }
+    }
+    return NULL;
+}
+
+static int32_t floor_to_int(double value) {
+    int32_t i = (int32_t)value;
+    return (double)i > value ? i - 1 : i;
+}
+
+static void seat_surface_coords(struct cwc_seat *seat, struct cwc_surface *surface,
+                                wl_fixed_t *sx, wl_fixed_t *sy) {
+    *sx = wl_fixed_from_double(seat->x - surface->node.box.x1);
+    *sy = wl_fixed_from_double(seat->y - surface->node.box.y1);
+}
+
+static void seat_focus_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_seat *seat = wl_container_of(listener, seat, focus_destroy);
+    wl_list_remove(&seat->focus_destroy.link);
+    wl_list_init(&seat->focus_destroy.link);
+    seat->focus = NULL;
+    seat->n_buttons = 0;
+}
+
+/* Leave the old focus and enter the new one; frames are up to the caller */
+static void seat_set_focus(struct cwc_seat *seat, struct cwc_surface *surface) {
+    if (seat->focus == surface) {
+        return;
+    }
+
+    struct wl_display *display = seat->server->display;
+    struct wl_resource *resource;
+    if (seat->focus) {
+        struct wl_client *client = seat_focus_client(seat);
+        uint32_t serial = wl_display_next_serial(display);
+        wl_resource_for_each(resource, &seat->pointers) {
+            if (wl_resource_get_client(resource) == client) {
+                wl_pointer_send_leave(resource, serial, seat->focus->resource);
+            }
+        }
+        seat_send_frame(seat, client);
+        wl_list_remove(&seat->focus_destroy.link);
+        wl_list_init(&seat->focus_destroy.link);
+    }
+
+    seat->focus = surface;
+    if (!surface) {
+        return;
+    }
+
+    wl_resource_add_destroy_listener(surface->resource, &seat->focus_destroy);
+    struct wl_client *client = seat_focus_client(seat);
+    uint32_t serial = wl_display_next_serial(display);
+    wl_fixed_t sx, sy;
+    seat_surface_coords(seat, surface, &sx, &sy);
+    wl_resource_for_each(resource, &seat->pointers) {
+        if (wl_resource_get_client(resource) == client) {
+            wl_pointer_send_enter(resource, serial, surface->resource, sx, sy);
+        }
+    }
+}
+
+/*
+ * Send the pointer position to whatever is under it, or to the surface
+ * holding the implicit grab. The caller ends the group with a frame.
+ */
+static void seat_deliver_motion(struct cwc_seat *seat) {
+    seat->motion_pending = false;
+
+    struct cwc_surface *surface = seat->focus;
+    if (!seat->n_buttons || !surface) {
+        surface = cwc_surface_at(seat->server, floor_to_int(seat->x), floor_to_int(seat->y),
+                                 NULL, NULL);
+    }
+
+    bool entered = surface != seat->focus;
+    seat_set_focus(seat, surface);
+    if (!surface) {
+        return;
+    }
+
+    struct wl_client *client = seat_focus_client(seat);
+    seat_note_input(seat, client, seat->motion_ns);
+    if (entered) {
+        return;
+    }
+
+    uint32_t time_ms = (uint32_t)(seat->time_ns / 1000000);
+    wl_fixed_t sx, sy;
+    seat_surface_coords(seat, surface, &sx, &sy);
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &seat->pointers) {
+        if (wl_resource_get_client(resource) == client) {
+            wl_pointer_send_motion(resource, time_ms, sx, sy);
+        }
+    }
+}
+
+/* Whatever happens next must not overtake the motion before it */
+static void seat_flush_motion(struct cwc_seat *seat) {
+    if (seat->motion_pending) {
+        seat_deliver_motion(seat);
+        seat_send_frame(seat, seat_focus_client(seat));
+    }
+}
+
+/*
+ * Held motion waits for the present of the output under the pointer if
+ * that output already delivered one this frame and a frame is in flight;
+ * an idle output presents nothing, so then it goes out right away.
+ */
+static bool seat_motion_held(struct cwc_seat *seat) {
+    struct cwc_output *output = seat_output_at_pointer(seat);
+    if (!output || output->repaint_state == CWC_OUTPUT_REPAINT_IDLE) {
+        return false;
+    }
+    return output->frame_seq == seat->motion_frame_seq;
+}
+
+static void seat_handle_dispatch_done(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct cwc_seat *seat = wl_container_of(listener, seat, dispatch_done);
+    if (!seat->motion_pending || seat_motion_held(seat)) {
+        return;
+    }
+
+    struct cwc_output *output = seat_output_at_pointer(seat);
+    if (output) {
+        seat->motion_frame_seq = output->frame_seq;
+    }
+    seat_flush_motion(seat);
+}
+
+void cwc_seat_output_presented(struct cwc_output *output) {
+    struct cwc_seat *seat = output->server->seat;
+    if (!seat || !seat->motion_pending || seat_output_at_pointer(seat) != output) {
+        return;
+    }
+
+    seat->motion_frame_seq = output->frame_seq;
+    seat_flush_motion(seat);
+}
+
+/* Queue a sample; the focused client gets it now if it asked for every one */
+static void seat_queue_motion(struct cwc_seat *seat, uint64_t time_ns) {
+    if (seat->motion_pending) {
+        if (seat->server->stats) {
+            seat->server->stats->coalesced_motions++;
+        }
+    } else {
+        seat->motion_pending = true;
+        seat->motion_ns = time_ns;
+    }
+    seat->time_ns = time_ns;
+}
+
+void cwc_seat_pointer_motion(struct cwc_seat *seat, uint64_t time_ns, double dx, double dy,
+                             double dx_unaccel, double dy_unaccel) {
+    seat_move_to(seat, seat->x + dx, seat->y + dy);
+    seat_queue_motion(seat, time_ns);
+
+    struct wl_client *client = seat_focus_client(seat);
+    if (!client || !seat_client_has_relative(seat, client)) {
+        return;
+    }
+
+    /* The relative pointer's client keeps the focus only while it is under the pointer */
+    seat_deliver_motion(seat);
+    if (seat_focus_client(seat) != client) {
+        seat_send_frame(seat, seat_focus_client(seat));
+        return;
+    }
+
+    uint64_t time_us = time_ns / 1000;
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &seat->relative_pointers) {
+        if (wl_resource_get_client(resource) == client) {
+            zwp_relative_pointer_v1_send_relative_motion(resource, (uint32_t)(time_us >> 32),
+                                                         (uint32_t)time_us,
+                                                         wl_fixed_from_double(dx),
+                                                         wl_fixed_from_double(dy),
+                                                         wl_fixed_from_double(dx_unaccel),
+                                                         wl_fixed_from_double(dy_unaccel));
+        }
+    }
+    seat_send_frame(seat, client);
+}
+
+void cwc_seat_pointer_motion_absolute(struct cwc_seat *seat, uint64_t time_ns,
+                                      double x, double y) {
+    struct cwc_box box;
+    if (!seat_layout_box(seat, &box)) {
+        return;
+    }
+
+    seat_move_to(seat, box.x1 + x * (box.x2 - box.x1), box.y1 + y * (box.y2 - box.y1));
+    seat_queue_motion(seat, time_ns);
+}
+
+void cwc_seat_pointer_button(struct cwc_seat *seat, uint64_t time_ns, uint32_t button,
+                             bool pressed) {
+    seat_flush_motion(seat);
+    seat->time_ns = time_ns;
+
+    /* The implicit grab lasts from the first press to the last release */
+    uint32_t i;
+    for (i = 0; i < seat->n_buttons && seat->buttons[i] != button; i++) {
+        /* find the button */
+    }
+    if (pressed && i == seat->n_buttons && seat->n_buttons < CWC_SEAT_MAX_BUTTONS) {
+        seat->buttons[seat->n_buttons++] = button;
+    } else if (!pressed && i < seat->n_buttons) {
+        seat->buttons[i] = seat->buttons[--seat->n_buttons];
+    }
+
+    struct wl_client *client = seat_focus_client(seat);
+    if (client) {
+        uint32_t serial = wl_display_next_serial(seat->server->display);
+        uint32_t time_ms = (uint32_t)(time_ns / 1000000);
+        struct wl_resource *resource;
+        wl_resource_for_each(resource, &seat->pointers) {
+            if (wl_resource_get_client(resource) == client) {
+                wl_pointer_send_button(resource, serial, time_ms, button,
+                                       pressed ? WL_POINTER_BUTTON_STATE_PRESSED
+                                               : WL_POINTER_BUTTON_STATE_RELEASED);
+            }
+        }
+        seat_note_input(seat, client, time_ns);
+        seat_send_frame(seat, client);
+    }
+
+    /* Released from a grab, the pointer may be over something else by now */
+    if (!pressed && !seat->n_buttons) {
+        seat->motion_ns = time_ns;
+        seat_deliver_motion(seat);
+        seat_send_frame(seat, seat_focus_client(seat));
+    }
+}
+
+void cwc_seat_pointer_axis(struct cwc_seat *seat, uint64_t time_ns, uint32_t axis,
+                           double value) {
+    seat_flush_motion(seat);
+    seat->time_ns = time_ns;
+
+    struct wl_client *client = seat_focus_client(seat);
+    if (!client) {
+        return;
+    }
+
+    uint32_t time_ms = (uint32_t)(time_ns / 1000000);
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &seat->pointers) {
+        if (wl_resource_get_client(resource) == client) {
+            wl_pointer_send_axis(resource, time_ms, axis, wl_fixed_from_double(value));
+        }
+    }
+    seat_note_input(seat, client, time_ns);
+    seat_send_frame(seat, client);
+}
+
+/*
+ * wl_pointer. Cursor surfaces are accepted but not drawn yet; there is
+ * no cursor plane or cursor layer to put them on.
+ */
+static void pointer_set_cursor(struct wl_client *client, struct wl_resource *resource,
+                               uint32_t serial, struct wl_resource *surface,
+                               int32_t hotspot_x, int32_t hotspot_y) {
+    (void)client;
+    (void)resource;
+    (void)serial;
+    (void)surface;
+    (void)hotspot_x;
+    (void)hotspot_y;
+}
+
+static const struct wl_pointer_interface pointer_implementation = {
+    .set_cursor = pointer_set_cursor,
+    .release = resource_handle_destroy,
+};
+
+/* Keyboards and touch are never advertised; these exist only to be released */
+static const struct wl_keyboard_interface keyboard_implementation = {
+    .release = resource_handle_destroy,
+};
+
+static const struct wl_touch_interface touch_implementation = {
+    .release = resource_handle_destroy,
+};
+
+static void seat_get_pointer(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct cwc_seat *seat = wl_resource_get_user_data(resource);
+
+    struct wl_resource *pointer = wl_resource_create(client, &wl_pointer_interface,
+                                                     wl_resource_get_version(resource), id);
+    if (!pointer) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(pointer, &pointer_implementation, seat, resource_unlink);
+    wl_list_insert(&seat->pointers, wl_resource_get_link(pointer));
+
+    /* The surface under the pointer may belong to this client already */
+    if (seat->focus && seat_focus_client(seat) == client) {
+        wl_fixed_t sx, sy;
+        seat_surface_coords(seat, seat->focus, &sx, &sy);
+        wl_pointer_send_enter(pointer, wl_display_next_serial(seat->server->display),
+                              seat->focus->resource, sx, sy);
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION) {
+            wl_pointer_send_frame(pointer);
+        }
+    }
+}
+
+static void seat_get_keyboard(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct wl_resource *keyboard = wl_resource_create(client, &wl_keyboard_interface,
+                                                      wl_resource_get_version(resource), id);
+    if (!keyboard) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(keyboard, &keyboard_implementation, NULL, NULL);
+}
+
+static void seat_get_touch(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct wl_resource *touch = wl_resource_create(client, &wl_touch_interface,
+                                                   wl_resource_get_version(resource), id);
+    if (!touch) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    wl_resource_set_implementation(touch, &touch_implementation, NULL, NULL);
+}
+
+static const struct wl_seat_interface seat_implementation = {
+    .get_pointer = seat_get_pointer,
+    .get_keyboard = seat_get_keyboard,
+    .get_touch = seat_get_touch,
+    .release = resource_handle_destroy,
+};
+
+static void seat_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct cwc_seat *seat = data;
+    uint32_t bound_version = version < CWC_SEAT_VERSION ? version : CWC_SEAT_VERSION;
+
+    struct wl_resource *resource = wl_resource_create(client, &wl_seat_interface,
+                                                      (int)bound_version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &seat_implementation, seat, resource_unlink);
+    wl_list_insert(&seat->resources, wl_resource_get_link(resource));
+
+    wl_seat_send_capabilities(resource, seat->capabilities);
+    if (bound_version >= WL_SEAT_NAME_SINCE_VERSION) {
+        wl_seat_send_name(resource, "seat0");
+    }
+}
+
+void cwc_seat_set_capabilities(struct cwc_seat *seat, uint32_t capabilities) {
+    if (seat->capabilities == capabilities) {
+        return;
+    }
+
+    seat->capabilities = capabilities;
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &seat->resources) {
+        wl_seat_send_capabilities(resource, capabilities);
+    }
+}
+
+/*
+ * zwp_relative_pointer_manager_v1
+ */
+static const struct zwp_relative_pointer_v1_interface relative_pointer_implementation = {
+    .destroy = resource_handle_destroy,
+};
+
+static void relative_pointer_manager_get(struct wl_client *client, struct wl_resource *resource,
+                                         uint32_t id, struct wl_resource *pointer) {
+    (void)pointer;
+    struct cwc_seat *seat = wl_resource_get_user_data(resource);
+
+    struct wl_resource *relative = wl_resource_create(client, &zwp_relative_pointer_v1_interface,
+                                                      wl_resource_get_version(resource), id);
+    if (!relative) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    wl_resource_set_implementation(relative, &relative_pointer_implementation, seat,
+                                   resource_unlink);
+    wl_list_insert(&seat->relative_pointers, wl_resource_get_link(relative));
+}
+
+static const struct zwp_relative_pointer_manager_v1_interface relative_manager_implementation = {
+    .destroy = resource_handle_destroy,
+    .get_relative_pointer = relative_pointer_manager_get,
+};
+
+static void relative_pointer_manager_bind(struct wl_client *client, void *data,
+                                          uint32_t version, uint32_t id) {
+    uint32_t bound_version = version < CWC_RELATIVE_POINTER_VERSION ? version
+                                                                     : CWC_RELATIVE_POINTER_VERSION;
+
+    struct wl_resource *resource = wl_resource_create(client,
+                                                      &zwp_relative_pointer_manager_v1_interface,
+                                                      (int)bound_version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &relative_manager_implementation, data, NULL);
+}
+
+cwc_error_t cwc_seat_init(struct cwc_server *server) {
+    struct cwc_seat *seat = cwc_calloc(1, sizeof(*seat));
+    seat->server = server;
+    wl_list_init(&seat->resources);
+    wl_list_init(&seat->pointers);
+    wl_list_init(&seat->relative_pointers);
+    wl_list_init(&seat->focus_destroy.link);
+    seat->focus_destroy.notify = seat_focus_destroy;
+    seat->dispatch_done.notify = seat_handle_dispatch_done;
+    wl_signal_add(&server->dispatch_done, &seat->dispatch_done);
+    server->seat = seat;
+
+    seat->global = wl_global_create(server->display, &wl_seat_interface, CWC_SEAT_VERSION,
+                                    seat, seat_bind);
+    seat->relative_pointer_global = wl_global_create(server->display,
+                                                     &zwp_relative_pointer_manager_v1_interface,
+                                                     CWC_RELATIVE_POINTER_VERSION, seat,
+                                                     relative_pointer_manager_bind);
+    return seat->global && seat->relative_pointer_global ? CWC_SUCCESS : CWC_ERROR_RESOURCE;
+}
+
+/* After the clients are gone, so no resource points at the seat any more */
+void cwc_seat_finish(struct cwc_server *server) {
+    struct cwc_seat *seat = server->seat;
+    if (!seat) return;
+
+    if (seat->global) {
+        wl_global_destroy(seat->global);
+    }
+    if (seat->relative_pointer_global) {
+        wl_global_destroy(seat->relative_pointer_global);
+    }
+    wl_list_remove(&seat->focus_destroy.link);
+    wl_list_remove(&seat->dispatch_done.link);
+
+    cwc_free(seat);
+    server->seat = NULL;
+}
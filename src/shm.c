@@ -0,0 +1,685 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * wl_shm implementation. Each client file is mmap()ed once, shared by
+ * every pool created on it and grown in place with mremap() on resize.
+ * Buffers hold a reference on their pool and resolve their pixels through
+ * the mapping on every access, so a resize that moves the mapping never
+ * invalidates a surface.
+ */
+
+#include "../include/shm.h"
+#include "../include/memory.h"
+#include "../include/slab.h"
+#include "../include/stats.h"
+#include <assert.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+#define CWC_SHM_VERSION 2
+
+static struct cwc_slab shm_slab = CWC_SLAB_INIT("shm", sizeof(struct cwc_shm));
+static struct cwc_slab pool_slab = CWC_SLAB_INIT("shm-pool", sizeof(struct cwc_shm_pool));
+static struct cwc_slab buffer_slab = CWC_SLAB_INIT("shm-buffer", sizeof(struct cwc_shm_buffer));
+
+/* Mappings the current thread is accessing, set around every pixel access */
+struct shm_access {
+    struct cwc_shm_pool *pool;
+    void *data;
+    size_t size;
+};
+
+static _Thread_local struct shm_access sigbus_access[CWC_SHM_ACCESS_DEPTH];
+static _Thread_local int sigbus_depth = 0;
+static struct sigaction old_sigbus_action;
+
+/*
+ * SIGBUS protection: a client may shrink its fd after we mapped it.
+ * Accesses past the new end fault; replace the mapping with zero pages so
+ * the composite or copy completes, and disconnect the client afterwards.
+ */
+static void shm_sigbus_handler(int signum, siginfo_t *info, void *context) {
+    (void)context;
+    struct shm_access *access = NULL;
+    for (int i = 0; i < sigbus_depth; i++) {
+        if ((uchar *)info->si_addr >= (uchar *)sigbus_access[i].data &&
+            (uchar *)info->si_addr < (uchar *)sigbus_access[i].data + sigbus_access[i].size) {
+            access = &sigbus_access[i];
+        }
+    }
+
+    if (!access) {
+        sigaction(signum, &old_sigbus_action, NULL);
+        raise(signum);
+        return;
+    }
+
+    /* Writable, since screencopy writes into client buffers */
+    atomic_store(&access->pool->sigbus_hit, true);
+    if (mmap(access->data, access->size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+        sigaction(signum, &old_sigbus_action, NULL);
+        raise(signum);
+    }
+}
+
+static void shm_release(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_shm_interface shm_implementation = {
+    .create_pool = cwc_shm_create_pool,
+    .release = shm_release,
+};
+
+static void pool_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_shm_pool_interface pool_implementation = {
+    .create_buffer = cwc_shm_pool_create_buffer,
+    .destroy = pool_handle_destroy,
+    .resize = cwc_shm_pool_resize,
+};
+
+static void buffer_handle_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface buffer_implementation = {
+    .destroy = buffer_handle_destroy,
+};
+
+cwc_error_t cwc_shm_init(struct cwc_server *server) {
+    static bool sigbus_installed = false;
+
+    if (!sigbus_installed) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = shm_sigbus_handler;
+        sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGBUS, &sa, &old_sigbus_action) == -1) {
+            return CWC_ERROR_RESOURCE;
+        }
+        sigbus_installed = true;
+    }
+
+    server->shm_global = wl_global_create(server->display, &wl_shm_interface, CWC_SHM_VERSION,
+                                          server, cwc_shm_bind);
+    return server->shm_global ? CWC_SUCCESS : CWC_ERROR_RESOURCE;
+}
+
+void cwc_shm_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct cwc_server *server = data;
+    uint32_t bound_version = version < CWC_SHM_VERSION ? version : CWC_SHM_VERSION;
+
+    struct cwc_shm *shm = cwc_slab_alloc(&shm_slab);
+    shm->server = server;
+    wl_list_init(&shm->pools);
+    wl_list_init(&shm->mappings);
+
+    shm->resource = wl_resource_create(client, &wl_shm_interface, (int)bound_version, id);
+    if (!shm->resource) {
+        cwc_slab_free(&shm_slab, shm);
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(shm->resource, &shm_implementation, shm,
+                                   cwc_shm_resource_destroy);
+    wl_list_insert(&server->shms, &shm->link);
+
+    for (size_t i = 0; i < CWC_FORMAT_COUNT; i++) {
+        wl_shm_send_format(shm->resource, cwc_formats[i].shm_format);
+    }
+}
+
+/* Only idle mappings; pins hold a pool reference, so none is pinned here */
+static void shm_mapping_free(struct cwc_shm *shm, struct cwc_shm_mapping *map) {
+    if (map->ref_count == 0) {
+        shm->idle_mappings--;
+    }
+    wl_list_remove(&map->link);
+    if (map->data) {
+        munmap(map->data, map->size);
+    }
+    if (map->write_data) {
+        munmap(map->write_data, map->write_size);
+    }
+    close(map->fd);
+    cwc_free(map);
+}
+
+static void shm_drop_idle_mappings(struct cwc_shm *shm) {
+    struct cwc_shm_mapping *map, *tmp;
+    wl_list_for_each_safe(map, tmp, &shm->mappings, link) {
+        if (map->ref_count == 0) {
+            shm_mapping_free(shm, map);
+        }
+    }
+}
+
+static int shm_idle_timer(void *data) {
+    shm_drop_idle_mappings(data);
+    return 0;
+}
+
+/*
+ * Grow a mapping to size. A pinned mapping is still being read by a
+ * render worker: map the fd again and keep the old mapping until the
+ * last pin goes away.
+ */
+static bool shm_mapping_grow(struct cwc_shm_mapping *map, size_t size) {
+    void *data;
+    if (!map->data) {
+        /* Evicted: the next access maps the new size */
+        map->size = size;
+        return true;
+    }
+    if (map->pin_count) {
+        data = mmap(NULL, size, PROT_READ, MAP_SHARED, map->fd, 0);
+        if (data != MAP_FAILED) {
+            struct cwc_shm_retired *old = cwc_malloc(sizeof(*old));
+            old->data = map->data;
+            old->size = map->size;
+            old->next = map->retired;
+            map->retired = old;
+        }
+    } else {
+        data = mremap(map->data, map->size, size, MREMAP_MAYMOVE);
+    }
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    map->data = data;
+    map->size = size;
+    return true;
+}
+
+/*
+ * Find or create the mapping of fd's file, taking ownership of fd on
+ * success. The mapping keeps its own fd open, so the inode cannot be
+ * freed and its number reused while it is cached.
+ */
+static struct cwc_shm_mapping *shm_mapping_get(struct cwc_shm *shm, int fd, size_t size) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return NULL;
+    }
+
+    struct cwc_shm_mapping *map;
+    wl_list_for_each(map, &shm->mappings, link) {
+        if (map->poisoned || map->dev != st.st_dev || map->ino != st.st_ino) {
+            continue;
+        }
+        if (size > map->size && !shm_mapping_grow(map, size)) {
+            return NULL;
+        }
+        if (map->ref_count++ == 0) {
+            shm->idle_mappings--;
+        }
+        close(fd);
+        if (shm->server->stats) {
+            shm->server->stats->shm_mappings_reused++;
+        }
+        return map;
+    }
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    map = cwc_calloc(1, sizeof(*map));
+    map->dev = st.st_dev;
+    map->ino = st.st_ino;
+    map->data = data;
+    map->size = size;
+    map->fd = fd;
+    map->ref_count = 1;
+    map->last_used_ns = cwc_time_nsec();
+    wl_list_insert(&shm->mappings, &map->link);
+    if (shm->server->stats) {
+        shm->server->stats->shm_mappings_created++;
+    }
+    return map;
+}
+
+/* The last pool gone, keep the mapping around for a recreate */
+static void shm_mapping_put(struct cwc_shm *shm, struct cwc_shm_mapping *map) {
+    if (--map->ref_count > 0) {
+        return;
+    }
+
+    shm->idle_mappings++;
+    map->last_used_ns = cwc_time_nsec();
+    if (map->poisoned || !shm->resource || shm->idle_mappings > CWC_SHM_IDLE_MAPPINGS) {
+        shm_mapping_free(shm, map);
+        return;
+    }
+
+    if (!shm->idle_timer) {
+        shm->idle_timer = wl_event_loop_add_timer(shm->server->event_loop, shm_idle_timer, shm);
+    }
+    if (shm->idle_timer) {
+        wl_event_source_timer_update(shm->idle_timer, CWC_SHM_IDLE_MAPPING_MS);
+    } else {
+        shm_mapping_free(shm, map);
+    }
+}
+
+static void shm_maybe_free(struct cwc_shm *shm) {
+    if (shm->resource || !wl_list_empty(&shm->pools)) {
+        return;
+    }
+
+    shm_drop_idle_mappings(shm);
+    if (shm->idle_timer) {
+        wl_event_source_remove(shm->idle_timer);
+    }
+    wl_list_remove(&shm->link);
+    cwc_slab_free(&shm_slab, shm);
+}
+
+/* No more pools can be created, so nothing idle is worth keeping */
+void cwc_shm_resource_destroy(struct wl_resource *resource) {
+    struct cwc_shm *shm = wl_resource_get_user_data(resource);
+    shm->resource = NULL;
+    shm_drop_idle_mappings(shm);
+    shm_maybe_free(shm);
+}
+
+void cwc_shm_create_pool(struct wl_client *client, struct wl_resource *resource,
+                         uint32_t id, int32_t fd, int32_t size) {
+    struct cwc_shm *shm = wl_resource_get_user_data(resource);
+
+    if (!cwc_shm_pool_validate_size(size)) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+                               "Invalid pool size %d", size);
+        close(fd);
+        return;
+    }
+
+    if (!cwc_shm_check_client_limits(client, shm->server)) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+                               "Too many SHM pools (limit %d)", CWC_SHM_MAX_POOLS_PER_CLIENT);
+        close(fd);
+        return;
+    }
+
+    if (!cwc_shm_pool_create(client, shm, id, fd, size)) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+                               "Failed to map SHM pool: %s", strerror(errno));
+        close(fd);
+    }
+}
+
+/*
+ * Map the pool, or reuse the mapping of another pool on the same file;
+ * the mapping lives until the last buffer goes away. fd is consumed on
+ * success and left to the caller on failure.
+ */
+struct cwc_shm_pool *cwc_shm_pool_create(struct wl_client *client, struct cwc_shm *shm,
+                                         uint32_t id, int fd, int32_t size) {
+    struct cwc_shm_pool *pool = cwc_slab_alloc(&pool_slab);
+    pool->resource = wl_resource_create(client, &wl_shm_pool_interface,
+                                        wl_resource_get_version(shm->resource), id);
+    if (!pool->resource) {
+        cwc_slab_free(&pool_slab, pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    pool->map = shm_mapping_get(shm, fd, (size_t)size);
+    if (!pool->map) {
+        int saved_errno = errno;
+        wl_resource_destroy(pool->resource);
+        cwc_slab_free(&pool_slab, pool);
+        errno = saved_errno;
+        return NULL;
+    }
+
+    pool->server = shm->server;
+    pool->shm = shm;
+    pool->size = (size_t)size;
+    pool->ref_count = 1;
+    pool->max_size = CWC_SHM_MAX_POOL_SIZE;
+    pool->create_time = time(NULL);
+    wl_list_init(&pool->buffers);
+    wl_list_insert(&shm->pools, &pool->link);
+
+    pool->client_state = cwc_client_state_lookup(shm->server, client);
+    if (pool->client_state) {
+        pool->client_state->shm_pool_count++;
+        pool->client_state->shm_bytes += pool->size;
+        wl_list_insert(&pool->client_state->shm_pools, &pool->client_link);
+    } else {
+        wl_list_init(&pool->client_link);
+    }
+
+    wl_resource_set_implementation(pool->resource, &pool_implementation, pool,
+                                   cwc_shm_pool_resource_destroy);
+
+    return pool;
+}
+
+/* Final teardown, called once the last reference is dropped */
+void cwc_shm_pool_destroy(struct cwc_shm_pool *pool) {
+    if (!pool) return;
+
+    wl_list_remove(&pool->link);
+    wl_list_remove(&pool->client_link);
+    if (pool->client_state) {
+        pool->client_state->shm_pool_count--;
+        pool->client_state->shm_bytes -= pool->size;
+    }
+
+    struct cwc_shm *shm = pool->shm;
+    shm_mapping_put(shm, pool->map);
+    cwc_slab_free(&pool_slab, pool);
+    shm_maybe_free(shm);
+}
+
+static void shm_pool_unref(struct cwc_shm_pool *pool) {
+    if (--pool->ref_count == 0) {
+        cwc_shm_pool_destroy(pool);
+    }
+}
+
+void cwc_shm_pool_resource_destroy(struct wl_resource *resource) {
+    struct cwc_shm_pool *pool = wl_resource_get_user_data(resource);
+    pool->resource = NULL;
+    shm_pool_unref(pool);
+}
+
+/*
+ * Grow the pool. Nothing is remapped while the size stays within what the
+ * shared mapping already covers. Buffers address pixels via the mapping,
+ * so letting the kernel move it is safe even while surfaces show them.
+ */
+void cwc_shm_pool_resize(struct wl_client *client, struct wl_resource *resource, int32_t size) {
+    (void)client;
+    struct cwc_shm_pool *pool = wl_resource_get_user_data(resource);
+
+    if (!cwc_shm_pool_validate_size(size) || (size_t)size < pool->size) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+                               "Invalid pool resize to %d bytes", size);
+        return;
+    }
+    if ((size_t)size == pool->size) {
+        return;
+    }
+
+    if ((size_t)size > pool->map->size && !shm_mapping_grow(pool->map, (size_t)size)) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FD,
+                               "Failed to remap SHM pool: %s", strerror(errno));
+        return;
+    }
+
+    if (pool->client_state) {
+        pool->client_state->shm_bytes += (size_t)size - pool->size;
+    }
+    pool->size = (size_t)size;
+}
+
+void cwc_shm_pool_create_buffer(struct wl_client *client, struct wl_resource *resource,
+                                uint32_t id, int32_t offset, int32_t width, int32_t height,
+                                int32_t stride, uint32_t format) {
+    struct cwc_shm_pool *pool = wl_resource_get_user_data(resource);
+
+    if (!cwc_shm_format_supported(format)) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_FORMAT,
+                               "Unsupported SHM format 0x%08x", format);
+        return;
+    }
+
+    if (!cwc_shm_buffer_validate(offset, width, height, stride, format, pool->size)) {
+        wl_resource_post_error(resource, WL_SHM_ERROR_INVALID_STRIDE,
+                               "Invalid buffer: offset %d, %dx%d, stride %d, pool %zu bytes",
+                               offset, width, height, stride, pool->size);
+        return;
+    }
+
+    if (!cwc_shm_buffer_create(client, pool, id, offset, width, height, stride, format)) {
+        wl_client_post_no_memory(client);
+    }
+}
+
+static void shm_buffer_destroy(struct cwc_buffer *buffer) {
+    cwc_shm_buffer_destroy((struct cwc_shm_buffer *)buffer);
+}
+
+static const struct cwc_buffer_impl shm_buffer_impl = {
+    .destroy = shm_buffer_destroy,
+};
+
+struct cwc_shm_buffer *cwc_shm_buffer_create(struct wl_client *client, struct cwc_shm_pool *pool,
+                                             uint32_t id, int32_t offset, int32_t width, int32_t height,
+                                             int32_t stride, uint32_t format) {
+    struct wl_resource *resource = wl_resource_create(client, &wl_buffer_interface, 1, id);
+    if (!resource) {
+        return NULL;
+    }
+
+    struct cwc_shm_buffer *buffer = cwc_slab_alloc(&buffer_slab);
+    cwc_buffer_init(&buffer->base, CWC_BUFFER_SHM, &shm_buffer_impl, resource,
+                    width, height, format);
+    buffer->pool = pool;
+    buffer->offset = offset;
+    buffer->stride = stride;
+    buffer->create_time = time(NULL);
+
+    pool->ref_count++;
+    wl_list_insert(&pool->buffers, &buffer->link);
+
+    wl_resource_set_implementation(resource, &buffer_implementation, buffer,
+                                   cwc_shm_buffer_resource_destroy);
+    cwc_client_buffer_created(pool->server, resource);
+    return buffer;
+}
+
+/* Final teardown, called once the last reference is dropped */
+void cwc_shm_buffer_destroy(struct cwc_shm_buffer *buffer) {
+    if (!buffer) return;
+
+    wl_list_remove(&buffer->link);
+    shm_pool_unref(buffer->pool);
+    cwc_slab_free(&buffer_slab, buffer);
+}
+
+void cwc_shm_buffer_resource_destroy(struct wl_resource *resource) {
+    struct cwc_shm_buffer *buffer = wl_resource_get_user_data(resource);
+    cwc_client_buffer_destroyed(buffer->pool->server, resource);
+    cwc_buffer_resource_destroyed(&buffer->base);
+}
+
+struct cwc_shm_buffer *cwc_shm_buffer_from_resource(struct wl_resource *resource) {
+    if (!resource || !wl_resource_instance_of(resource, &wl_buffer_interface,
+                                              &buffer_implementation)) {
+        return NULL;
+    }
+    return wl_resource_get_user_data(resource);
+}
+
+/* Pixels live directly in the client's mapping; no copy is made */
+void *cwc_shm_buffer_get_data(struct cwc_shm_buffer *buffer) {
+    struct cwc_shm_mapping *map = buffer->pool->map;
+    if (!map->data) {
+        void *data = mmap(NULL, map->size, PROT_READ, MAP_SHARED, map->fd, 0);
+        if (data == MAP_FAILED) {
+            return NULL;
+        }
+        map->data = data;
+    }
+    map->last_used_ns = cwc_time_nsec();
+    return (uchar *)map->data + buffer->offset;
+}
+
+/*
+ * Writable view of the buffer, for screencopy, mapped on first use and
+ * only on the dispatch thread. The pool's own mapping stays read-only so
+ * that sealed memfds work as surface buffers; this fails for them.
+ */
+void *cwc_shm_buffer_get_writable(struct cwc_shm_buffer *buffer) {
+    struct cwc_shm_mapping *map = buffer->pool->map;
+    if (map->write_size < map->size) {
+        void *data = map->write_data ?
+                     mremap(map->write_data, map->write_size, map->size, MREMAP_MAYMOVE) :
+                     mmap(NULL, map->size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+        if (data == MAP_FAILED) {
+            return NULL;
+        }
+        map->write_data = data;
+        map->write_size = map->size;
+    }
+    map->last_used_ns = cwc_time_nsec();
+    return (uchar *)map->write_data + buffer->offset;
+}
+
+/*
+ * The pool reference keeps fd and mapping alive while pinned. Pins count
+ * on the mapping, since any pool sharing it may resize it.
+ */
+void cwc_shm_pool_pin(struct cwc_shm_pool *pool) {
+    pool->map->last_used_ns = cwc_time_nsec();
+    pool->map->pin_count++;
+    pool->ref_count++;
+}
+
+void cwc_shm_pool_unpin(struct cwc_shm_pool *pool) {
+    struct cwc_shm_mapping *map = pool->map;
+    if (--map->pin_count == 0) {
+        while (map->retired) {
+            struct cwc_shm_retired *old = map->retired;
+            map->retired = old->next;
+            munmap(old->data, old->size);
+            cwc_free(old);
+        }
+    }
+    shm_pool_unref(pool);
+}
+
+/*
+ * Memory manager hook. An idle mapping is freed, closing the fd that
+ * kept the client's file alive. A live one is only unmapped: the pages
+ * stay with the client's file, but no longer count towards our RSS, so
+ * the OOM killer weighs them against the client that allocated them.
+ *
+ * Unmapping is safe only because nothing off the dispatch thread holds
+ * a bare data pointer: render snapshots record map_data under a pin,
+ * and screencopy and get_data callers use it within one dispatch.
+ */
+static void shm_mapping_evict(void *owner, void *object) {
+    struct cwc_shm *shm = owner;
+    struct cwc_shm_mapping *map = object;
+    assert(map->pin_count == 0);
+    if (map->ref_count == 0) {
+        shm_mapping_free(shm, map);
+        return;
+    }
+
+    munmap(map->data, map->size);
+    map->data = NULL;
+    if (map->write_data) {
+        munmap(map->write_data, map->write_size);
+        map->write_data = NULL;
+        map->write_size = 0;
+    }
+}
+
+/* Pinned mappings are being read by a render worker and are left alone */
+void cwc_shm_memory_collect(struct cwc_server *server, struct cwc_memory_candidates *candidates) {
+    struct cwc_shm *shm;
+    wl_list_for_each(shm, &server->shms, link) {
+        struct cwc_shm_mapping *map;
+        wl_list_for_each(map, &shm->mappings, link) {
+            if (!map->data || map->pin_count) {
+                continue;
+            }
+            cwc_memory_offer(candidates, &(struct cwc_memory_entry){
+                .last_used_ns = map->last_used_ns,
+                .bytes = map->size + map->write_size,
+                .evict = shm_mapping_evict,
+                .owner = shm,
+                .object = map,
+            });
+        }
+    }
+}
+
+/* data/size is the mapping being accessed, which may be a retired one */
+void cwc_shm_access_begin(struct cwc_shm_pool *pool, const void *data, size_t size) {
+    if (sigbus_depth == CWC_SHM_ACCESS_DEPTH) {
+        abort();
+    }
+    struct shm_access *access = &sigbus_access[sigbus_depth];
+    access->pool = pool;
+    access->data = (void *)(uintptr_t)data;
+    access->size = size;
+    sigbus_depth++;
+}
+
+/* Ends the innermost access */
+void cwc_shm_access_end(void) {
+    if (sigbus_depth > 0) {
+        sigbus_depth--;
+    }
+}
+
+void cwc_shm_pool_check_access(struct cwc_shm_pool *pool) {
+    if (atomic_exchange(&pool->sigbus_hit, false)) {
+        pool->map->poisoned = true;
+        if (pool->resource) {
+            wl_resource_post_error(pool->resource, WL_SHM_ERROR_INVALID_FD,
+                                   "Error accessing SHM buffer");
+        }
+    }
+}
+
+bool cwc_shm_format_supported(uint32_t format) {
+    return cwc_format_from_shm(format) != NULL;
+}
+
+bool cwc_shm_pool_validate_size(int32_t size) {
+    return size > 0 && size <= CWC_SHM_MAX_POOL_SIZE;
+}
+
+bool cwc_shm_buffer_validate(int32_t offset, int32_t width, int32_t height,
+                             int32_t stride, uint32_t format, size_t pool_size) {
+    const struct cwc_format *pixel_format = cwc_format_from_shm(format);
+    if (!pixel_format || offset < 0 || width <= 0 || height <= 0) {
+        return false;
+    }
+
+    int64_t row_bytes = (int64_t)width * pixel_format->bytes_per_pixel;
+    if ((int64_t)stride < row_bytes) {
+        return false;
+    }
+
+    int64_t end = (int64_t)offset + (int64_t)stride * (height - 1) + row_bytes;
+    return end <= (int64_t)pool_size;
+}
+
+/* Orphaned pools that still back buffers count against the client too */
+bool cwc_shm_check_client_limits(struct wl_client *client, struct cwc_server *server) {
+    struct cwc_client_state *client_state = cwc_client_state_lookup(server, client);
+    return !client_state || client_state->shm_pool_count < CWC_SHM_MAX_POOLS_PER_CLIENT;
+}
+
+/* Destroying one pool never frees another, so a safe walk is enough */
+void cwc_shm_cleanup_client_pools(struct wl_client *client, struct cwc_server *server) {
+    struct cwc_client_state *client_state = cwc_client_state_lookup(server, client);
+    if (!client_state) return;
+
+    struct cwc_shm_pool *pool, *tmp;
+    wl_list_for_each_safe(pool, tmp, &client_state->shm_pools, client_link) {
+        if (pool->resource) {
+            wl_resource_destroy(pool->resource);
+        }
+    }
+}
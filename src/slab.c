@@ -0,0 +1,197 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Slab allocator for per-object structs and small arrays. Objects are
+ * carved out of 16K pages and recycled through a free list; pages are
+ * only returned when the slab is destroyed at shutdown.
+ *
+ * Under AddressSanitizer every object is a separate heap allocation so
+ * use-after-free is still caught.
+ */
+
+#include "../include/slab.h"
+
+#define CWC_SLAB_ALIGN 16
+#define CWC_SLAB_MIN_OBJECTS 8
+
+/* Page header, padded so objects stay CWC_SLAB_ALIGN aligned */
+struct slab_page {
+    struct slab_page *next;
+    uchar pad[CWC_SLAB_ALIGN - sizeof(struct slab_page *)];
+};
+
+static struct cwc_slab *slab_registry = NULL;
+static atomic_flag slab_registry_lock = ATOMIC_FLAG_INIT;
+
+/* Size classes: 64, 128, 256, 512 and 1024 bytes */
+static struct cwc_slab size_classes[] = {
+    CWC_SLAB_INIT_THREADSAFE("array-64", 64),
+    CWC_SLAB_INIT_THREADSAFE("array-128", 128),
+    CWC_SLAB_INIT_THREADSAFE("array-256", 256),
+    CWC_SLAB_INIT_THREADSAFE("array-512", 512),
+    CWC_SLAB_INIT_THREADSAFE("array-1024", 1024),
+};
+
+static void spin_lock(atomic_flag *lock) {
+    while (atomic_flag_test_and_set_explicit(lock, memory_order_acquire)) {
+        /* spin; critical sections are a few instructions long */
+    }
+}
+
+static void spin_unlock(atomic_flag *lock) {
+    atomic_flag_clear_explicit(lock, memory_order_release);
+}
+
+static void slab_setup(struct cwc_slab *slab) {
+    size_t stride = slab->object_size < sizeof(void *) ? sizeof(void *) : slab->object_size;
+    slab->stride = (stride + CWC_SLAB_ALIGN - 1) & ~(size_t)(CWC_SLAB_ALIGN - 1);
+
+    slab->objects_per_page = (CWC_SLAB_PAGE_SIZE - sizeof(struct slab_page)) / slab->stride;
+    if (slab->objects_per_page < CWC_SLAB_MIN_OBJECTS) {
+        slab->objects_per_page = CWC_SLAB_MIN_OBJECTS;
+    }
+
+    spin_lock(&slab_registry_lock);
+    slab->next = slab_registry;
+    slab_registry = slab;
+    spin_unlock(&slab_registry_lock);
+
+    slab->registered = true;
+}
+
+/* Carve a new page into objects and push them all on the free list */
+static void slab_grow(struct cwc_slab *slab) {
+    struct slab_page *page = cwc_malloc(sizeof(*page) + slab->objects_per_page * slab->stride);
+    page->next = slab->pages;
+    slab->pages = page;
+
+    uchar *objects = (uchar *)(page + 1);
+    for (size_t i = slab->objects_per_page; i-- > 0;) {
+        void **object = (void **)(void *)(objects + i * slab->stride);
+        *object = slab->free_list;
+        slab->free_list = object;
+    }
+
+#ifdef DEBUG
+    slab->page_count++;
+#endif
+}
+
+/* Zeroed object of slab->object_size bytes; never fails */
+void *cwc_slab_alloc(struct cwc_slab *slab) {
+    if (slab->threadsafe) spin_lock(&slab->lock);
+
+    if (!slab->registered) {
+        slab_setup(slab);
+    }
+
+#ifdef __SANITIZE_ADDRESS__
+    void *object = cwc_calloc(1, slab->object_size);
+#else
+    if (!slab->free_list) {
+        slab_grow(slab);
+    }
+
+    void **object = slab->free_list;
+    slab->free_list = *object;
+#endif
+
+#ifdef DEBUG
+    if (++slab->live > slab->peak) {
+        slab->peak = slab->live;
+    }
+#endif
+
+    if (slab->threadsafe) spin_unlock(&slab->lock);
+
+    memset(object, 0, slab->object_size);
+    return object;
+}
+
+void cwc_slab_free(struct cwc_slab *slab, void *ptr) {
+    if (!ptr) return;
+
+    if (slab->threadsafe) spin_lock(&slab->lock);
+
+#ifdef __SANITIZE_ADDRESS__
+    cwc_free(ptr);
+#else
+    void **object = ptr;
+    *object = slab->free_list;
+    slab->free_list = object;
+#endif
+
+#ifdef DEBUG
+    slab->live--;
+#endif
+
+    if (slab->threadsafe) spin_unlock(&slab->lock);
+}
+
+/* Release every page; all objects of the slab must be dead */
+void cwc_slab_destroy(struct cwc_slab *slab) {
+    struct slab_page *page = slab->pages;
+    while (page) {
+        struct slab_page *next = page->next;
+        cwc_free(page);
+        page = next;
+    }
+
+    slab->pages = NULL;
+    slab->free_list = NULL;
+#ifdef DEBUG
+    slab->page_count = 0;
+#endif
+}
+
+static struct cwc_slab *size_class_for(size_t size) {
+    if (size > CWC_SLAB_MAX_CLASS) {
+        return NULL;
+    }
+
+    size_t class_size = CWC_SLAB_MIN_CLASS;
+    for (size_t i = 0; i < sizeof(size_classes) / sizeof(size_classes[0]); i++) {
+        if (size <= class_size) {
+            return &size_classes[i];
+        }
+        class_size *= 2;
+    }
+    return NULL;
+}
+
+/* Arrays past the largest class fall back to the heap */
+void *cwc_slab_alloc_size(size_t size) {
+    struct cwc_slab *slab = size_class_for(size);
+    return slab ? cwc_slab_alloc(slab) : cwc_calloc(1, size);
+}
+
+/* size must be the size that was passed to cwc_slab_alloc_size() */
+void cwc_slab_free_size(void *ptr, size_t size) {
+    struct cwc_slab *slab = size_class_for(size);
+    if (slab) {
+        cwc_slab_free(slab, ptr);
+    } else {
+        cwc_free(ptr);
+    }
+}
+
+void cwc_slab_log_stats(struct cwc_server *server) {
+#ifdef DEBUG
+    spin_lock(&slab_registry_lock);
+    for (struct cwc_slab *slab = slab_registry; slab; slab = slab->next) {
+        cwc_log(server, CWC_LOG_DEBUG, "slab %-16s size %4zu live %6zu peak %6zu pages %4zu",
+                slab->name, slab->object_size, slab->live, slab->peak, slab->page_count);
+    }
+    spin_unlock(&slab_registry_lock);
+#else
+    (void)server;
+#endif
+}
+
+void cwc_slab_destroy_all(void) {
+    spin_lock(&slab_registry_lock);
+    for (struct cwc_slab *slab = slab_registry; slab; slab = slab->next) {
+        cwc_slab_destroy(slab);
+    }
+    spin_unlock(&slab_registry_lock);
+}
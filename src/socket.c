@@ -0,0 +1,188 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Listening socket. Follows libwayland's naming and locking, so clients
+ * and other compositors see no difference: $XDG_RUNTIME_DIR/NAME guarded
+ * by NAME.lock. Accepting is done here rather than by libwayland so that
+ * a burst of connecting clients costs one wakeup per batch instead of one
+ * per client, and so the per-connection heap cost can be measured.
+ */
+
+#include "../include/socket.h"
+#include "../include/stats.h"
+#include <malloc.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+/* Heap bytes in use, 0 where mallinfo2() is missing */
+static size_t heap_in_use(void) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+/* Every client costs a descriptor; the usual soft limit of 1024 is too low */
+static void raise_fd_limit(struct cwc_server *server) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur >= limit.rlim_max) {
+        return;
+    }
+
+    rlim_t old = limit.rlim_cur;
+    limit.rlim_cur = limit.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        cwc_log(server, CWC_LOG_DEBUG, "File descriptor limit raised from %llu to %llu",
+                (unsigned long long)old, (unsigned long long)limit.rlim_cur);
+    }
+}
+
+static int socket_retry_timer(void *data) {
+    struct cwc_socket *sock = data;
+    wl_event_source_fd_update(sock->source, WL_EVENT_READABLE);
+    return 0;
+}
+
+/*
+ * Out of descriptors: the pending connection stays queued and would wake
+ * the loop forever, so stop listening for a moment instead.
+ */
+static void socket_pause(struct cwc_server *server, struct cwc_socket *sock) {
+    if (!sock->retry_timer) {
+        sock->retry_timer = wl_event_loop_add_timer(server->event_loop, socket_retry_timer, sock);
+    }
+    if (!sock->retry_timer) {
+        return;
+    }
+
+    cwc_log(server, CWC_LOG_WARN, "Out of file descriptors with %u clients, pausing accept",
+            server->client_count);
+    wl_event_source_fd_update(sock->source, 0);
+    wl_event_source_timer_update(sock->retry_timer, CWC_SOCKET_EMFILE_RETRY_MS);
+}
+
+static int socket_handle_connections(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct cwc_server *server = data;
+    struct cwc_stats *stats = server->stats;
+
+    for (int i = 0; i < CWC_SOCKET_ACCEPT_BATCH; i++) {
+        int client_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EMFILE || errno == ENFILE) {
+                socket_pause(server, server->socket);
+            }
+            break;
+        }
+
+        if (server->client_count >= server->max_clients) {
+            cwc_log(server, CWC_LOG_DEBUG, "Client limit (%u) reached, rejecting connection",
+                    server->max_clients);
+            close(client_fd);
+            if (stats) {
+                stats->rejected_clients++;
+            }
+            continue;
+        }
+
+        /* Includes our own state, created by the client-created signal */
+        size_t before = heap_in_use();
+        if (!wl_client_create(server->display, client_fd)) {
+            close(client_fd);
+            continue;
+        }
+        size_t after = heap_in_use();
+        if (stats && after >= before) {
+            cwc_histogram_record(&stats->connect_bytes, after - before);
+        }
+    }
+    return 0;
+}
+
+cwc_error_t cwc_socket_init(struct cwc_server *server) {
+    struct cwc_socket *sock = cwc_calloc(1, sizeof(*sock));
+    sock->fd = -1;
+    sock->lock_fd = -1;
+    server->socket = sock;
+
+    /* Absolute names are used as they are, like WAYLAND_DISPLAY allows */
+    const char *name = server->socket_name;
+    const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+    int n;
+    if (name[0] == '/') {
+        n = snprintf(sock->path, sizeof(sock->path), "%s", name);
+    } else if (runtime_dir) {
+        n = snprintf(sock->path, sizeof(sock->path), "%s/%s", runtime_dir, name);
+    } else {
+        cwc_log(server, CWC_LOG_ERROR, "XDG_RUNTIME_DIR is not set");
+        return CWC_ERROR_SOCKET;
+    }
+    if (n < 0 || (size_t)n >= sizeof(sock->path)) {
+        cwc_log(server, CWC_LOG_ERROR, "Socket path for '%s' is too long", name);
+        return CWC_ERROR_SOCKET;
+    }
+    snprintf(sock->lock_path, sizeof(sock->lock_path), "%s.lock", sock->path);
+
+    sock->lock_fd = open(sock->lock_path, O_CREAT | O_CLOEXEC | O_RDWR,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (sock->lock_fd == -1 || flock(sock->lock_fd, LOCK_EX | LOCK_NB) == -1) {
+        cwc_log(server, CWC_LOG_ERROR, "Socket %s is in use by another compositor", sock->path);
+        if (sock->lock_fd != -1) {
+            close(sock->lock_fd);
+            sock->lock_fd = -1;
+        }
+        return CWC_ERROR_SOCKET;
+    }
+
+    /* Holding the lock, so whatever socket is there was left behind */
+    struct stat st;
+    if (lstat(sock->path, &st) == 0 && (st.st_mode & (S_IWUSR | S_IWGRP))) {
+        unlink(sock->path);
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    memcpy(addr.sun_path, sock->path, sizeof(sock->path));
+    sock->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (sock->fd == -1 || bind(sock->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+        listen(sock->fd, CWC_SOCKET_BACKLOG) == -1) {
+        cwc_log(server, CWC_LOG_ERROR, "Cannot listen on %s: %s", sock->path, strerror(errno));
+        return CWC_ERROR_SOCKET;
+    }
+
+    sock->source = wl_event_loop_add_fd(server->event_loop, sock->fd, WL_EVENT_READABLE,
+                                        socket_handle_connections, server);
+    if (!sock->source) {
+        return CWC_ERROR_SOCKET;
+    }
+
+    raise_fd_limit(server);
+    return CWC_SUCCESS;
+}
+
+/* Also undoes a partial cwc_socket_init() */
+void cwc_socket_finish(struct cwc_server *server) {
+    struct cwc_socket *sock = server->socket;
+    if (!sock) return;
+
+    if (sock->retry_timer) {
+        wl_event_source_remove(sock->retry_timer);
+    }
+    if (sock->source) {
+        wl_event_source_remove(sock->source);
+    }
+    if (sock->fd != -1) {
+        close(sock->fd);
+        unlink(sock->path);
+    }
+    if (sock->lock_fd != -1) {
+        unlink(sock->lock_path);
+        close(sock->lock_fd);
+    }
+
+    cwc_free(sock);
+    server->socket = NULL;
+}
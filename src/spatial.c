@@ -0,0 +1,225 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Sparse uniform grid for hit-testing and output intersection. Surfaces
+ * are registered in every cell their box touches, so a pointer query only
+ * looks at the handful of surfaces sharing its cell instead of the whole
+ * stack.
+ */
+
+#include "../include/spatial.h"
+
+struct cwc_spatial_cell {
+    struct cwc_spatial_entry **entries;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+/* Arithmetic shift, so negative coordinates round towards -infinity */
+static int32_t cell_coord(int32_t v) {
+    return v >> CWC_SPATIAL_CELL_SHIFT;
+}
+
+static uint64_t cell_key(int32_t cx, int32_t cy) {
+    return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+}
+
+/* Inclusive cell range covered by a non-empty box */
+static void cell_range(const struct cwc_box *box, struct cwc_box *range) {
+    range->x1 = cell_coord(box->x1);
+    range->y1 = cell_coord(box->y1);
+    range->x2 = cell_coord(box->x2 - 1);
+    range->y2 = cell_coord(box->y2 - 1);
+}
+
+static uint64_t range_cells(const struct cwc_box *range) {
+    return (uint64_t)((int64_t)range->x2 - range->x1 + 1) *
+           (uint64_t)((int64_t)range->y2 - range->y1 + 1);
+}
+
+static void cell_add(struct cwc_spatial_grid *grid, int32_t cx, int32_t cy,
+                     struct cwc_spatial_entry *entry) {
+    uint64_t key = cell_key(cx, cy);
+    struct cwc_spatial_cell *cell = cwc_hash_lookup(&grid->cells, key);
+    if (!cell) {
+        cell = cwc_calloc(1, sizeof(*cell));
+        cwc_hash_insert(&grid->cells, key, cell);
+    }
+
+    if (cell->count == cell->capacity) {
+        cell->capacity = cell->capacity ? cell->capacity * 2 : 4;
+        cell->entries = cwc_realloc(cell->entries, cell->capacity * sizeof(*cell->entries));
+    }
+    cell->entries[cell->count++] = entry;
+}
+
+static void cell_del(struct cwc_spatial_grid *grid, int32_t cx, int32_t cy,
+                     struct cwc_spatial_entry *entry) {
+    uint64_t key = cell_key(cx, cy);
+    struct cwc_spatial_cell *cell = cwc_hash_lookup(&grid->cells, key);
+    if (!cell) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < cell->count; i++) {
+        if (cell->entries[i] == entry) {
+            cell->entries[i] = cell->entries[--cell->count];
+            break;
+        }
+    }
+
+    if (cell->count == 0) {
+        cwc_hash_remove(&grid->cells, key);
+        cwc_free(cell->entries);
+        cwc_free(cell);
+    }
+}
+
+void cwc_spatial_init(struct cwc_spatial_grid *grid) {
+    cwc_hash_init(&grid->cells);
+    wl_list_init(&grid->oversize);
+    grid->query_seq = 0;
+}
+
+void cwc_spatial_fini(struct cwc_spatial_grid *grid) {
+    struct cwc_hash_entry *slot;
+    cwc_hash_for_each(slot, &grid->cells) {
+        struct cwc_spatial_cell *cell = slot->value;
+        cwc_free(cell->entries);
+        cwc_free(cell);
+    }
+    cwc_hash_fini(&grid->cells);
+
+    struct cwc_spatial_entry *entry, *tmp;
+    wl_list_for_each_safe(entry, tmp, &grid->oversize, oversize_link) {
+        wl_list_remove(&entry->oversize_link);
+        entry->indexed = false;
+    }
+}
+
+void cwc_spatial_remove(struct cwc_spatial_grid *grid, struct cwc_spatial_entry *entry) {
+    if (!entry->indexed) {
+        return;
+    }
+
+    if (entry->oversize) {
+        wl_list_remove(&entry->oversize_link);
+    } else {
+        struct cwc_box range;
+        cell_range(&entry->box, &range);
+        for (int32_t cy = range.y1; cy <= range.y2; cy++) {
+            for (int32_t cx = range.x1; cx <= range.x2; cx++) {
+                cell_del(grid, cx, cy, entry);
+            }
+        }
+    }
+
+    entry->indexed = false;
+    entry->oversize = false;
+    memset(&entry->box, 0, sizeof(entry->box));
+}
+
+void cwc_spatial_update(struct cwc_spatial_grid *grid, struct cwc_spatial_entry *entry,
+                        const struct cwc_box *box) {
+    if (entry->indexed && memcmp(&entry->box, box, sizeof(*box)) == 0) {
+        return;
+    }
+
+    cwc_spatial_remove(grid, entry);
+    if (cwc_box_is_empty(box)) {
+        return;
+    }
+
+    entry->box = *box;
+    entry->indexed = true;
+
+    struct cwc_box range;
+    cell_range(box, &range);
+    if (range_cells(&range) > CWC_SPATIAL_MAX_CELLS) {
+        entry->oversize = true;
+        wl_list_insert(&grid->oversize, &entry->oversize_link);
+        return;
+    }
+
+    for (int32_t cy = range.y1; cy <= range.y2; cy++) {
+        for (int32_t cx = range.x1; cx <= range.x2; cx++) {
+            cell_add(grid, cx, cy, entry);
+        }
+    }
+}
+
+static bool box_contains_point(const struct cwc_box *box, int32_t x, int32_t y) {
+    return x >= box->x1 && x < box->x2 && y >= box->y1 && y < box->y2;
+}
+
+/* The iterator must not modify the grid */
+void cwc_spatial_query_point(struct cwc_spatial_grid *grid, int32_t x, int32_t y,
+                             cwc_spatial_iter_func_t iterator, void *data) {
+    struct cwc_spatial_cell *cell = cwc_hash_lookup(&grid->cells,
+                                                    cell_key(cell_coord(x), cell_coord(y)));
+    if (cell) {
+        for (uint32_t i = 0; i < cell->count; i++) {
+            if (box_contains_point(&cell->entries[i]->box, x, y)) {
+                iterator(cell->entries[i], data);
+            }
+        }
+    }
+
+    struct cwc_spatial_entry *entry;
+    wl_list_for_each(entry, &grid->oversize, oversize_link) {
+        if (box_contains_point(&entry->box, x, y)) {
+            iterator(entry, data);
+        }
+    }
+}
+
+static void query_cell(struct cwc_spatial_cell *cell, const struct cwc_box *box,
+                       uint32_t seq, cwc_spatial_iter_func_t iterator, void *data) {
+    for (uint32_t i = 0; i < cell->count; i++) {
+        struct cwc_spatial_entry *entry = cell->entries[i];
+        struct cwc_box overlap;
+        if (entry->query_seq == seq || !cwc_box_intersect(&overlap, &entry->box, box)) {
+            continue;
+        }
+        entry->query_seq = seq;
+        iterator(entry, data);
+    }
+}
+
+/* The iterator must not modify the grid */
+void cwc_spatial_query_box(struct cwc_spatial_grid *grid, const struct cwc_box *box,
+                           cwc_spatial_iter_func_t iterator, void *data) {
+    if (cwc_box_is_empty(box)) {
+        return;
+    }
+
+    /* Entries span several cells; the sequence number reports each once */
+    uint32_t seq = ++grid->query_seq;
+
+    struct cwc_box range;
+    cell_range(box, &range);
+    if (range_cells(&range) > grid->cells.count) {
+        /* Fewer occupied cells than the box covers: walk those instead */
+        struct cwc_hash_entry *slot;
+        cwc_hash_for_each(slot, &grid->cells) {
+            query_cell(slot->value, box, seq, iterator, data);
+        }
+    } else {
+        for (int32_t cy = range.y1; cy <= range.y2; cy++) {
+            for (int32_t cx = range.x1; cx <= range.x2; cx++) {
+                struct cwc_spatial_cell *cell = cwc_hash_lookup(&grid->cells, cell_key(cx, cy));
+                if (cell) {
+                    query_cell(cell, box, seq, iterator, data);
+                }
+            }
+        }
+    }
+
+    struct cwc_spatial_entry *entry;
+    wl_list_for_each(entry, &grid->oversize, oversize_link) {
+        struct cwc_box overlap;
+        if (cwc_box_intersect(&overlap, &entry->box, box)) {
+            iterator(entry, data);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Parallel startup. The listening socket and the core globals come up
+ * first, on the dispatch thread, so clients connect right away; slow
+ * subsystems initialize on threads of their own meanwhile and are
+ * installed from the event loop as each one finishes.
+ */
+
+#include "../include/startup.h"
+#include "../include/threadpool.h"
+#include <sys/eventfd.h>
+
+static void *startup_thread(void *data) {
+    struct cwc_startup_task *task = data;
+    task->result = task->run(task->server, task->data);
+
+    uint64_t one = 1;
+    if (write(task->done_fd, &one, sizeof(one)) < 0) {
+        /* counter overflow is impossible with one write per task */
+    }
+    return NULL;
+}
+
+/* Dispatch thread only; the thread has exited or is about to */
+static void startup_complete(struct cwc_startup_task *task) {
+    pthread_join(task->thread, NULL);
+    wl_event_source_remove(task->done_source);
+    close(task->done_fd);
+    wl_list_remove(&task->link);
+
+    struct cwc_server *server = task->server;
+    cwc_log(server, CWC_LOG_DEBUG, "%s ready after %llu ms", task->name,
+            (unsigned long long)((cwc_time_nsec() - task->start_ns) / 1000000));
+    task->done(server, task->result, task->data);
+    cwc_free(task);
+}
+
+static int startup_handle_done(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+        return 0;
+    }
+    startup_complete(data);
+    return 0;
+}
+
+void cwc_startup_spawn(struct cwc_server *server, const char *name, cwc_startup_run_func_t run,
+                       cwc_startup_done_func_t done, void *data) {
+    struct cwc_startup_task *task = cwc_calloc(1, sizeof(*task));
+    task->server = server;
+    task->name = name;
+    task->run = run;
+    task->done = done;
+    task->data = data;
+    task->start_ns = cwc_time_nsec();
+
+    task->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (task->done_fd == -1) {
+        goto inline_run;
+    }
+    task->done_source = wl_event_loop_add_fd(server->event_loop, task->done_fd,
+                                             WL_EVENT_READABLE, startup_handle_done, task);
+    if (!task->done_source) {
+        goto error_fd;
+    }
+
+    char thread_name[16];
+    snprintf(thread_name, sizeof(thread_name), "cwc-init-%s", name);
+    if (cwc_thread_create(&task->thread, thread_name, startup_thread, task, false) != 0) {
+        wl_event_source_remove(task->done_source);
+        goto error_fd;
+    }
+    wl_list_insert(server->startup_tasks.prev, &task->link);
+    return;
+
+error_fd:
+    close(task->done_fd);
+inline_run:
+    cwc_log(server, CWC_LOG_WARN, "No startup thread for %s, initializing inline", name);
+    done(server, run(server, data), data);
+    cwc_free(task);
+}
+
+void cwc_startup_finish(struct cwc_server *server) {
+    while (!wl_list_empty(&server->startup_tasks)) {
+        struct cwc_startup_task *task =
+            wl_container_of(server->startup_tasks.next, task, link);
+        startup_complete(task);
+    }
+}
@@ -0,0 +1,288 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Frame-timing and dispatch instrumentation. Histograms are filled on the
+ * hot paths and read out as JSON, either by connecting to the stats
+ * socket next to the Wayland socket or by sending the compositor SIGUSR1,
+ * which writes the same document to the log.
+ *
+ *   socat - UNIX-CONNECT:$XDG_RUNTIME_DIR/wayland-1.stats
+ */
+
+#include "../include/stats.h"
+#include "../include/output.h"
+#include "../include/socket.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static uint32_t histogram_bucket(uint64_t value) {
+    if (value == 0) {
+        return 0;
+    }
+    uint32_t bucket = 64 - (uint32_t)__builtin_clzll(value);
+    return bucket < CWC_HISTOGRAM_BUCKETS ? bucket : CWC_HISTOGRAM_BUCKETS - 1;
+}
+
+/* Largest value that lands in a bucket */
+static uint64_t histogram_bucket_limit(uint32_t bucket) {
+    return bucket >= 64 ? UINT64_MAX : (UINT64_C(1) << bucket) - 1;
+}
+
+void cwc_histogram_record(struct cwc_histogram *histogram, uint64_t value) {
+    atomic_fetch_add_explicit(&histogram->buckets[histogram_bucket(value)], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max, &max, value,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+        /* max was reloaded by the failed exchange */
+    }
+}
+
+/* Upper bound of the bucket holding the given fraction of samples */
+uint64_t cwc_histogram_percentile(const struct cwc_histogram *histogram, double fraction) {
+    uint64_t count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((double)count * fraction);
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < CWC_HISTOGRAM_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t limit = histogram_bucket_limit(i);
+            return limit < max ? limit : max;
+        }
+    }
+    return max;
+}
+
+static void stats_write_histogram(FILE *out, const char *name,
+                                  const struct cwc_histogram *histogram) {
+    fprintf(out, "\"%s\":{\"count\":%llu,\"sum\":%llu,\"max\":%llu,"
+                 "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"buckets\":[",
+            name,
+            (unsigned long long)atomic_load(&histogram->count),
+            (unsigned long long)atomic_load(&histogram->sum),
+            (unsigned long long)atomic_load(&histogram->max),
+            (unsigned long long)cwc_histogram_percentile(histogram, 0.50),
+            (unsigned long long)cwc_histogram_percentile(histogram, 0.90),
+            (unsigned long long)cwc_histogram_percentile(histogram, 0.99));
+
+    /* Only non-empty buckets, as [upper bound, count] pairs */
+    bool first = true;
+    for (uint32_t i = 0; i < CWC_HISTOGRAM_BUCKETS; i++) {
+        uint64_t n = atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (!n) continue;
+        fprintf(out, "%s[%llu,%llu]", first ? "" : ",",
+                (unsigned long long)histogram_bucket_limit(i), (unsigned long long)n);
+        first = false;
+    }
+    fputs("]}", out);
+}
+
+/* JSON document with every histogram; release with free() */
+char *cwc_stats_format(struct cwc_server *server, size_t *length) {
+    char *buffer = NULL;
+    FILE *out = open_memstream(&buffer, length);
+    if (!out) {
+        return NULL;
+    }
+
+    struct cwc_stats *stats = server->stats;
+    fprintf(out, "{\"version\":1,\"uptime_s\":%lld,\"clients\":%u,\"max_clients\":%u,"
+                 "\"rejected_clients\":%llu,\"client_state_bytes\":%zu,\"surfaces\":%u,"
+                 "\"throttled_callbacks\":%llu,\"presented_feedbacks\":%llu,"
+                 "\"discarded_feedbacks\":%llu,\"shm_mappings_created\":%llu,"
+                 "\"shm_mappings_reused\":%llu,\"scene_nodes_updated\":%llu,"
+                 "\"screencopy_frames\":%llu,\"screencopy_bytes\":%llu,"
+                 "\"coalesced_motions\":%llu,\"memory_evictions\":%llu,"
+                 "\"memory_evicted_bytes\":%llu,\"memory_pressure_events\":%llu,",
+            (long long)(time(NULL) - server->start_time), server->client_count,
+            server->max_clients, (unsigned long long)stats->rejected_clients,
+            sizeof(struct cwc_client_state), server->surface_count, (unsigned long long)stats->throttled_callbacks,
+            (unsigned long long)stats->presented_feedbacks,
+            (unsigned long long)stats->discarded_feedbacks,
+            (unsigned long long)stats->shm_mappings_created,
+            (unsigned long long)stats->shm_mappings_reused,
+            (unsigned long long)stats->scene_nodes_updated,
+            (unsigned long long)stats->screencopy_frames,
+            (unsigned long long)stats->screencopy_bytes,
+            (unsigned long long)stats->coalesced_motions,
+            (unsigned long long)stats->memory_evictions,
+            (unsigned long long)stats->memory_evicted_bytes,
+            (unsigned long long)stats->memory_pressure_events);
+    stats_write_histogram(out, "dispatch_ns", &stats->dispatch_ns);
+    fputc(',', out);
+    stats_write_histogram(out, "commit_to_present_ns", &stats->commit_to_present_ns);
+    fputc(',', out);
+    stats_write_histogram(out, "connect_bytes", &stats->connect_bytes);
+    fputc(',', out);
+    stats_write_histogram(out, "input_to_present_ns", &stats->input_to_present_ns);
+
+    fputs(",\"outputs\":[", out);
+    uint32_t index = 0;
+    struct cwc_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        fprintf(out, "%s{\"index\":%u,\"width\":%d,\"height\":%d,\"refresh_mhz\":%d,"
+                     "\"frames\":%llu,\"scanout_frames\":%llu,\"last_present_ns\":%llu,",
+                index ? "," : "", index, output->config.width, output->config.height,
+                output->config.refresh_rate, (unsigned long long)output->frame_seq,
+                (unsigned long long)output->scanout_frames,
+                (unsigned long long)output->last_present_ns);
+        fprintf(out, "\"framebuffer\":{\"backing\":\"%s\",\"bytes\":%zu,\"mapped\":%zu,"
+                     "\"huge_bytes\":%zu,\"populate_ns\":%llu},",
+                cwc_fbmem_backing_name(output->fb.backing), output->fb.size, output->fb.mapped,
+                cwc_fbmem_huge_bytes(&output->fb), (unsigned long long)output->fb.populate_ns);
+        stats_write_histogram(out, "present_interval_ns", &output->present_interval_ns);
+        fputc(',', out);
+        stats_write_histogram(out, "composite_ns", &output->composite_ns);
+        fputc(',', out);
+        stats_write_histogram(out, "frame_bytes", &output->frame_bytes);
+        fputc('}', out);
+        index++;
+    }
+    fputs("]}\n", out);
+
+    if (fclose(out) != 0) {
+        free(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+/*
+ * Non-blocking: a reader that stops reading once the socket buffer is
+ * full must not stall the dispatch thread, so it gets a truncated
+ * document instead.
+ */
+static void stats_send(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        data += sent;
+        length -= (size_t)sent;
+    }
+}
+
+/* Every connection gets one document, then the socket is closed */
+static int stats_handle_connection(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct cwc_server *server = data;
+
+    int client_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client_fd == -1) {
+        return 0;
+    }
+
+    size_t length;
+    char *document = cwc_stats_format(server, &length);
+    if (document) {
+        stats_send(client_fd, document, length);
+        free(document);
+    }
+    close(client_fd);
+    return 0;
+}
+
+static int stats_handle_sigusr1(int signal_number, void *data) {
+    (void)signal_number;
+    struct cwc_server *server = data;
+
+    size_t length;
+    char *document = cwc_stats_format(server, &length);
+    if (document) {
+        cwc_log(server, CWC_LOG_INFO, "Stats dump follows (%zu bytes)", length);
+        cwc_log_write_document(server, document, length);
+    }
+    return 0;
+}
+
+static int stats_open_socket(struct cwc_server *server, struct cwc_stats *stats) {
+    if (!server->socket) {
+        return -1;
+    }
+
+    /* Next to the Wayland socket, wherever an absolute name put it */
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int n = snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", server->socket->path,
+                     CWC_STATS_SOCKET_SUFFIX);
+    if (n < 0 || (size_t)n >= sizeof(addr.sun_path)) {
+        cwc_log(server, CWC_LOG_WARN, "Stats socket path too long for %s",
+                server->socket->path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    /*
+     * A stale socket from a crashed compositor may be in the way. We hold
+     * the lock on the Wayland socket this one is named after, so nobody
+     * else is using it.
+     */
+    unlink(addr.sun_path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 4) == -1) {
+        cwc_log(server, CWC_LOG_WARN, "Cannot listen on %s: %s", addr.sun_path,
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    stats->socket_path = strdup(addr.sun_path);
+    return fd;
+}
+
+cwc_error_t cwc_stats_init(struct cwc_server *server) {
+    struct cwc_stats *stats = cwc_calloc(1, sizeof(*stats));
+    server->stats = stats;
+
+    stats->listen_fd = stats_open_socket(server, stats);
+    if (stats->listen_fd != -1) {
+        stats->listen_source = wl_event_loop_add_fd(server->event_loop, stats->listen_fd,
+                                                    WL_EVENT_READABLE, stats_handle_connection,
+                                                    server);
+        cwc_log(server, CWC_LOG_INFO, "Stats socket at %s", stats->socket_path);
+    } else {
+        cwc_log(server, CWC_LOG_WARN, "Stats socket unavailable, SIGUSR1 dumps only");
+    }
+
+    stats->sigusr1_source = wl_event_loop_add_signal(server->event_loop, SIGUSR1,
+                                                     stats_handle_sigusr1, server);
+    return stats->sigusr1_source ? CWC_SUCCESS : CWC_ERROR_RESOURCE;
+}
+
+void cwc_stats_finish(struct cwc_server *server) {
+    struct cwc_stats *stats = server->stats;
+    if (!stats) return;
+
+    if (stats->sigusr1_source) {
+        wl_event_source_remove(stats->sigusr1_source);
+    }
+    if (stats->listen_source) {
+        wl_event_source_remove(stats->listen_source);
+    }
+    if (stats->listen_fd != -1) {
+        close(stats->listen_fd);
+        unlink(stats->socket_path);
+    }
+
+    free(stats->socket_path);
+    cwc_free(stats);
+    server->stats = NULL;
+}
@@ -0,0 +1,179 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Work-stealing fork/join pool. A batch of n tasks is split into one
+ * contiguous range per participant; each claims tasks from its own range
+ * with an atomic increment and then walks the other ranges to steal
+ * what is left, so no locks are taken per task.
+ */
+
+#include "../include/threadpool.h"
+
+int cwc_thread_create(pthread_t *thread, const char *name, void *(*run)(void *), void *data,
+                      bool shm_access) {
+    sigset_t all, saved;
+    sigfillset(&all);
+    if (shm_access) {
+        sigdelset(&all, SIGBUS);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &all, &saved);
+    int ret = pthread_create(thread, NULL, run, data);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (ret == 0) {
+        pthread_setname_np(*thread, name);
+    }
+    return ret;
+}
+
+/* Drain our own range first, then steal from everybody else's */
+static void pool_work(struct cwc_thread_pool *pool, uint32_t self) {
+    for (uint32_t k = 0; k < pool->n_ranges; k++) {
+        struct cwc_task_range *range = &pool->ranges[(self + k) % pool->n_ranges];
+        for (;;) {
+            uint32_t task = atomic_fetch_add_explicit(&range->next, 1, memory_order_relaxed);
+            if (task >= range->end) {
+                break;
+            }
+            pool->func(task, pool->data);
+        }
+    }
+}
+
+struct pool_thread_arg {
+    struct cwc_thread_pool *pool;
+    uint32_t index;
+};
+
+static void *pool_thread(void *data) {
+    struct pool_thread_arg *arg = data;
+    struct cwc_thread_pool *pool = arg->pool;
+    uint32_t self = arg->index + 1;   /* range 0 belongs to the submitter */
+    cwc_free(arg);
+
+    pthread_mutex_lock(&pool->lock);
+    uint64_t seen = pool->generation;
+    for (;;) {
+        while (!pool->quit && pool->generation == seen) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool_work(pool, self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) {
+            pthread_cond_signal(&pool->finish);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+/* Returns NULL for n_threads == 0; callers then run batches inline */
+struct cwc_thread_pool *cwc_thread_pool_create(uint32_t n_threads) {
+    if (n_threads == 0) {
+        return NULL;
+    }
+    if (n_threads > CWC_THREAD_POOL_MAX_THREADS) {
+        n_threads = CWC_THREAD_POOL_MAX_THREADS;
+    }
+
+    struct cwc_thread_pool *pool = cwc_calloc(1, sizeof(*pool));
+    pthread_mutex_init(&pool->batch_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finish, NULL);
+
+    for (uint32_t i = 0; i < n_threads; i++) {
+        struct pool_thread_arg *arg = cwc_malloc(sizeof(*arg));
+        arg->pool = pool;
+        arg->index = i;
+
+        char name[16];
+        snprintf(name, sizeof(name), "cwc-tile-%u", i);
+        if (cwc_thread_create(&pool->threads[i], name, pool_thread, arg, true) != 0) {
+            cwc_free(arg);
+            break;
+        }
+        pool->n_threads++;
+    }
+
+    if (pool->n_threads == 0) {
+        cwc_thread_pool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void cwc_thread_pool_destroy(struct cwc_thread_pool *pool) {
+    if (!pool) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (uint32_t i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->finish);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->batch_lock);
+    cwc_free(pool);
+}
+
+/*
+ * Run func(0..n_tasks-1) and return once all calls are done. If another
+ * thread is already running a batch, the tasks simply run inline: each
+ * output already has its own render worker, so nothing is lost by not
+ * queueing behind it.
+ */
+void cwc_thread_pool_run(struct cwc_thread_pool *pool, uint32_t n_tasks,
+                         cwc_task_func_t func, void *data) {
+    if (!pool || n_tasks < 2 || pthread_mutex_trylock(&pool->batch_lock) != 0) {
+        for (uint32_t i = 0; i < n_tasks; i++) {
+            func(i, data);
+        }
+        return;
+    }
+
+    uint32_t n_ranges = pool->n_threads + 1;
+    if (n_ranges > n_tasks) {
+        n_ranges = n_tasks;
+    }
+
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < n_ranges; i++) {
+        uint32_t length = n_tasks / n_ranges + (i < n_tasks % n_ranges ? 1 : 0);
+        atomic_store_explicit(&pool->ranges[i].next, start, memory_order_relaxed);
+        pool->ranges[i].end = start + length;
+        start += length;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->data = data;
+    pool->n_ranges = n_ranges;
+    pool->active = pool->n_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool_work(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) {
+        pthread_cond_wait(&pool->finish, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->batch_lock);
+}
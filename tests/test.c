@@ -0,0 +1,67 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Test support: the allocation and logging helpers the tested sources
+ * expect from the compositor, and a reproducible random source.
+ */
+
+#include "test.h"
+
+int cwc_test_failures = 0;
+
+static uint32_t test_state = 0x9e3779b9u;
+
+void cwc_test_seed(uint32_t seed) {
+    test_state = seed ? seed : 0x9e3779b9u;
+}
+
+uint32_t cwc_test_random(void) {
+    test_state ^= test_state << 13;
+    test_state ^= test_state >> 17;
+    test_state ^= test_state << 5;
+    return test_state;
+}
+
+int cwc_test_finish(const char *name) {
+    if (cwc_test_failures) {
+        fprintf(stderr, "%s: %d checks failed\n", name, cwc_test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("%s: ok\n", name);
+    return EXIT_SUCCESS;
+}
+
+void *cwc_malloc(size_t size) {
+    void *ptr = malloc(size);
+    if (!ptr && size > 0) {
+        abort();
+    }
+    return ptr;
+}
+
+void *cwc_calloc(size_t nmemb, size_t size) {
+    void *ptr = calloc(nmemb, size);
+    if (!ptr && nmemb > 0 && size > 0) {
+        abort();
+    }
+    return ptr;
+}
+
+void *cwc_realloc(void *ptr, size_t size) {
+    void *new_ptr = realloc(ptr, size);
+    if (!new_ptr && size > 0) {
+        abort();
+    }
+    return new_ptr;
+}
+
+void cwc_free(void *ptr) {
+    free(ptr);
+}
+
+/* Tests pass no server, so the cwc_log() macro never gets here */
+void cwc_log_write(struct cwc_server *server, cwc_log_level_t level, const char *format, ...) {
+    (void)server;
+    (void)level;
+    (void)format;
+}
@@ -0,0 +1,31 @@
+#ifndef CWC_TEST_H
+#define CWC_TEST_H
+
+#include "../include/cwc.h"
+
+/*
+ * Minimal harness for the unit tests. Each test program links the
+ * sources it exercises plus test.c, which stands in for the parts of
+ * main.c and log.c they call.
+ */
+
+extern int cwc_test_failures;
+
+#define CWC_TEST_CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fputc('\n', stderr); \
+            cwc_test_failures++; \
+        } \
+    } while (0)
+
+/* xorshift32, seeded so a failure can be reproduced */
+uint32_t cwc_test_random(void);
+void cwc_test_seed(uint32_t seed);
+
+/* 0 when every check passed */
+int cwc_test_finish(const char *name);
+
+#endif /* CWC_TEST_H */
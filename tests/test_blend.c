@@ -0,0 +1,169 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Blend kernel tests. Every kernel set this CPU supports must give the
+ * same bits as the scalar one, and every format's row functions the
+ * same bits as decoding with fetch and blending one pixel at a time.
+ * Widths cover empty rows, SIMD tails and odd lengths; rows start at
+ * every offset within a vector so unaligned loads are exercised too.
+ */
+
+#include "test.h"
+#include "../include/blend.h"
+#include "../include/format.h"
+
+#define TEST_MAX_WIDTH 67
+#define TEST_MAX_OFFSET 8
+#define TEST_ROWS 64
+#define TEST_ROW_SIZE (TEST_MAX_OFFSET + TEST_MAX_WIDTH)
+
+static const char *const kernel_names[] = { "scalar", "sse2", "avx2", "neon" };
+
+/*
+ * Premultiplied ARGB8888 with runs of opaque and transparent pixels, so
+ * the whole-vector shortcuts in the SIMD kernels get taken as well
+ */
+static uint32_t random_premultiplied(uint32_t *run_alpha, uint32_t *run_left) {
+    if (*run_left == 0) {
+        uint32_t pick = cwc_test_random() % 4;
+        *run_alpha = pick == 0 ? 0x00 : pick == 1 ? 0xff : 0x100;
+        *run_left = 1 + cwc_test_random() % 12;
+    }
+    (*run_left)--;
+
+    uint32_t alpha = *run_alpha == 0x100 ? cwc_test_random() & 0xff : *run_alpha;
+    uint32_t pixel = alpha << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+        pixel |= (alpha ? cwc_test_random() % (alpha + 1) : 0) << shift;
+    }
+    return pixel;
+}
+
+static void random_row(uint32_t *row, size_t n) {
+    uint32_t run_alpha = 0, run_left = 0;
+    for (size_t i = 0; i < n; i++) {
+        row[i] = random_premultiplied(&run_alpha, &run_left);
+    }
+}
+
+/* Opaque destination rows, as in the framebuffer */
+static void random_dst(uint32_t *row, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        row[i] = cwc_test_random() | 0xff000000u;
+    }
+}
+
+static void test_kernels(const struct cwc_blend_kernels *kernels,
+                         const struct cwc_blend_kernels *scalar) {
+    uint32_t src[TEST_ROW_SIZE], dst[TEST_ROW_SIZE];
+    uint32_t expected[TEST_ROW_SIZE], actual[TEST_ROW_SIZE];
+
+    for (int rows = 0; rows < TEST_ROWS; rows++) {
+        for (size_t offset = 0; offset < TEST_MAX_OFFSET; offset++) {
+            for (size_t n = 0; n <= TEST_MAX_WIDTH; n++) {
+                random_row(src, TEST_ROW_SIZE);
+                random_dst(dst, TEST_ROW_SIZE);
+
+                memcpy(expected, dst, sizeof(dst));
+                memcpy(actual, dst, sizeof(dst));
+                scalar->over(expected + offset, src + offset, n);
+                kernels->over(actual + offset, src + offset, n);
+                CWC_TEST_CHECK(memcmp(expected, actual, sizeof(actual)) == 0,
+                               "%s over differs, width %zu offset %zu", kernels->name, n, offset);
+
+                memcpy(expected, dst, sizeof(dst));
+                memcpy(actual, dst, sizeof(dst));
+                scalar->copy_xrgb(expected + offset, src + offset, n);
+                kernels->copy_xrgb(actual + offset, src + offset, n);
+                CWC_TEST_CHECK(memcmp(expected, actual, sizeof(actual)) == 0,
+                               "%s copy_xrgb differs, width %zu offset %zu", kernels->name, n,
+                               offset);
+
+                uint32_t color = cwc_test_random();
+                memcpy(expected, dst, sizeof(dst));
+                memcpy(actual, dst, sizeof(dst));
+                scalar->fill(expected + offset, color, n);
+                kernels->fill(actual + offset, color, n);
+                CWC_TEST_CHECK(memcmp(expected, actual, sizeof(actual)) == 0,
+                               "%s fill differs, width %zu offset %zu", kernels->name, n, offset);
+            }
+        }
+    }
+}
+
+/* Source bytes in the format's own layout; native ones must be premultiplied */
+static void random_format_row(const struct cwc_format *format, uchar *row, size_t n) {
+    if (format->native) {
+        uint32_t pixels[TEST_ROW_SIZE];
+        random_row(pixels, n);
+        memcpy(row, pixels, n * sizeof(*pixels));
+        return;
+    }
+    for (size_t i = 0; i < n * format->bytes_per_pixel; i++) {
+        row[i] = (uchar)cwc_test_random();
+    }
+}
+
+static void test_format(const struct cwc_format *format, const struct cwc_blend_kernels *kernels) {
+    uchar src[TEST_ROW_SIZE * 4];
+    uint32_t dst[TEST_ROW_SIZE], decoded[TEST_ROW_SIZE];
+    uint32_t expected[TEST_ROW_SIZE], actual[TEST_ROW_SIZE];
+    size_t bpp = format->bytes_per_pixel;
+
+    cwc_blend = kernels;
+    for (int rows = 0; rows < TEST_ROWS; rows++) {
+        for (size_t offset = 0; offset < TEST_MAX_OFFSET; offset++) {
+            for (size_t n = 0; n <= TEST_MAX_WIDTH; n++) {
+                random_format_row(format, src, TEST_ROW_SIZE);
+                random_dst(dst, TEST_ROW_SIZE);
+                format->fetch(decoded, src + offset * bpp, n);
+
+                memcpy(expected, dst, sizeof(dst));
+                memcpy(actual, dst, sizeof(dst));
+                for (size_t i = 0; i < n; i++) {
+                    expected[offset + i] = format->has_alpha ?
+                        cwc_blend_over_pixel(decoded[i], dst[offset + i]) :
+                        decoded[i] | 0xff000000u;
+                }
+                format->over(actual + offset, src + offset * bpp, n);
+                CWC_TEST_CHECK(memcmp(expected, actual, sizeof(actual)) == 0,
+                               "%s over with %s differs, width %zu offset %zu", format->name,
+                               kernels->name, n, offset);
+
+                memcpy(expected, dst, sizeof(dst));
+                memcpy(actual, dst, sizeof(dst));
+                for (size_t i = 0; i < n; i++) {
+                    expected[offset + i] = decoded[i] | 0xff000000u;
+                }
+                format->copy(actual + offset, src + offset * bpp, n);
+                CWC_TEST_CHECK(memcmp(expected, actual, sizeof(actual)) == 0,
+                               "%s copy with %s differs, width %zu offset %zu", format->name,
+                               kernels->name, n, offset);
+            }
+        }
+    }
+}
+
+int main(void) {
+    const struct cwc_blend_kernels *scalar = cwc_blend_find("scalar");
+    CWC_TEST_CHECK(scalar != NULL, "no scalar kernels");
+    if (!scalar) {
+        return cwc_test_finish("blend");
+    }
+
+    for (size_t i = 0; i < sizeof(kernel_names) / sizeof(kernel_names[0]); i++) {
+        const struct cwc_blend_kernels *kernels = cwc_blend_find(kernel_names[i]);
+        if (!kernels) {
+            printf("blend: %s not available, skipped\n", kernel_names[i]);
+            continue;
+        }
+
+        cwc_test_seed((uint32_t)i + 1);
+        test_kernels(kernels, scalar);
+        for (size_t f = 0; f < CWC_FORMAT_COUNT; f++) {
+            test_format(&cwc_formats[f], kernels);
+        }
+    }
+    cwc_blend = scalar;
+    return cwc_test_finish("blend");
+}
@@ -0,0 +1,204 @@
+/*
+ * CWC - Custom Wayland Compositor
+ *
+ * Region tests. Random sequences of union and subtract, the operations
+ * damage tracking and occlusion culling are built on, are checked
+ * against a bitmap of the same grid after every step, along with the
+ * invariants the rest of the compositor relies on: boxes that are
+ * non-empty and disjoint, and extents that bound them exactly.
+ */
+
+#include "test.h"
+#include "../include/region.h"
+
+#define TEST_GRID 48
+#define TEST_SEQUENCES 200
+#define TEST_STEPS 40
+
+struct test_bitmap {
+    bool set[TEST_GRID][TEST_GRID];
+};
+
+static void random_box(struct cwc_box *box) {
+    /* Reach past the grid on both sides so clipped edges are covered */
+    box->x1 = (int32_t)(cwc_test_random() % (TEST_GRID + 8)) - 4;
+    box->y1 = (int32_t)(cwc_test_random() % (TEST_GRID + 8)) - 4;
+    box->x2 = box->x1 + (int32_t)(cwc_test_random() % (TEST_GRID / 2));
+    box->y2 = box->y1 + (int32_t)(cwc_test_random() % (TEST_GRID / 2));
+}
+
+/* The grid is a window onto the plane; boxes are clipped to it first */
+static void clip_box(struct cwc_box *box) {
+    struct cwc_box grid = { 0, 0, TEST_GRID, TEST_GRID };
+    if (!cwc_box_intersect(box, box, &grid)) {
+        *box = (struct cwc_box){ 0, 0, 0, 0 };
+    }
+}
+
+static void bitmap_set(struct test_bitmap *bitmap, const struct cwc_box *box, bool value) {
+    for (int32_t y = box->y1; y < box->y2; y++) {
+        for (int32_t x = box->x1; x < box->x2; x++) {
+            bitmap->set[y][x] = value;
+        }
+    }
+}
+
+static void check_region(const struct cwc_region *region, const struct test_bitmap *bitmap,
+                         const char *step) {
+    uint64_t area = 0;
+    struct cwc_box extents = { 0, 0, 0, 0 };
+    bool first = true;
+
+    for (int32_t y = 0; y < TEST_GRID; y++) {
+        for (int32_t x = 0; x < TEST_GRID; x++) {
+            struct cwc_box pixel = { x, y, x + 1, y + 1 };
+            bool set = bitmap->set[y][x];
+            CWC_TEST_CHECK(cwc_region_contains_box(region, &pixel) == set,
+                           "%s: pixel %d,%d should be %s", step, x, y, set ? "set" : "clear");
+            if (!set) {
+                continue;
+            }
+            area++;
+            if (first) {
+                extents = pixel;
+                first = false;
+            }
+            extents.x1 = x < extents.x1 ? x : extents.x1;
+            extents.x2 = x + 1 > extents.x2 ? x + 1 : extents.x2;
+            extents.y2 = y + 1;
+        }
+    }
+
+    CWC_TEST_CHECK(cwc_region_area(region) == area, "%s: area %llu, expected %llu", step,
+                   (unsigned long long)cwc_region_area(region), (unsigned long long)area);
+    CWC_TEST_CHECK(cwc_region_is_empty(region) == (area == 0), "%s: wrong emptiness", step);
+    if (area) {
+        CWC_TEST_CHECK(memcmp(&region->extents, &extents, sizeof(extents)) == 0,
+                       "%s: extents %d,%d-%d,%d, expected %d,%d-%d,%d", step,
+                       region->extents.x1, region->extents.y1, region->extents.x2,
+                       region->extents.y2, extents.x1, extents.y1, extents.x2, extents.y2);
+    }
+
+    for (uint32_t i = 0; i < region->n_rects; i++) {
+        const struct cwc_box *a = &region->rects[i];
+        CWC_TEST_CHECK(!cwc_box_is_empty(a), "%s: empty box %u", step, i);
+        for (uint32_t j = i + 1; j < region->n_rects; j++) {
+            struct cwc_box overlap;
+            CWC_TEST_CHECK(!cwc_box_intersect(&overlap, a, &region->rects[j]),
+                           "%s: boxes %u and %u overlap", step, i, j);
+        }
+    }
+}
+
+/* Box operations, one box at a time as damage accumulates */
+static void test_box_sequence(void) {
+    struct cwc_region region;
+    struct test_bitmap bitmap = { 0 };
+    struct cwc_box grid = { 0, 0, TEST_GRID, TEST_GRID };
+    cwc_region_init(&region);
+
+    for (int step = 0; step < TEST_STEPS; step++) {
+        struct cwc_box box;
+        random_box(&box);
+        bool add = cwc_test_random() % 3 != 0;
+        if (add) {
+            cwc_region_union_box(&region, &box);
+        } else {
+            cwc_region_subtract_box(&region, &box);
+        }
+        cwc_region_intersect_box(&region, &grid);
+        clip_box(&box);
+        bitmap_set(&bitmap, &box, add);
+        check_region(&region, &bitmap, add ? "union_box" : "subtract_box");
+    }
+    cwc_region_fini(&region);
+}
+
+/* Region operations, as occlusion subtracts each opaque surface's region */
+static void test_region_sequence(void) {
+    struct cwc_region region, other;
+    struct test_bitmap bitmap = { 0 };
+    cwc_region_init(&region);
+    cwc_region_init(&other);
+
+    for (int step = 0; step < TEST_STEPS / 4; step++) {
+        struct test_bitmap other_bitmap = { 0 };
+        cwc_region_clear(&other);
+        uint32_t boxes = 1 + cwc_test_random() % 6;
+        for (uint32_t i = 0; i < boxes; i++) {
+            struct cwc_box box;
+            random_box(&box);
+            clip_box(&box);
+            cwc_region_union_box(&other, &box);
+            bitmap_set(&other_bitmap, &box, true);
+        }
+        check_region(&other, &other_bitmap, "union_box");
+
+        bool add = cwc_test_random() % 2 != 0;
+        if (add) {
+            cwc_region_union(&region, &other);
+        } else {
+            cwc_region_subtract(&region, &other);
+        }
+        for (int32_t y = 0; y < TEST_GRID; y++) {
+            for (int32_t x = 0; x < TEST_GRID; x++) {
+                if (other_bitmap.set[y][x]) {
+                    bitmap.set[y][x] = add;
+                }
+            }
+        }
+        check_region(&region, &bitmap, add ? "union" : "subtract");
+    }
+
+    /* Taking a region away from itself leaves nothing */
+    cwc_region_copy(&other, &region);
+    cwc_region_subtract(&region, &other);
+    memset(&bitmap, 0, sizeof(bitmap));
+    check_region(&region, &bitmap, "subtract self");
+
+    cwc_region_fini(&other);
+    cwc_region_fini(&region);
+}
+
+static void test_edge_cases(void) {
+    struct cwc_region region;
+    struct test_bitmap bitmap = { 0 };
+    cwc_region_init(&region);
+
+    /* Empty and inverted rectangles add nothing */
+    cwc_region_union_rect(&region, 5, 5, 0, 10);
+    cwc_region_union_rect(&region, 5, 5, -3, 4);
+    check_region(&region, &bitmap, "union empty");
+
+    /* Touching boxes share an edge, not a pixel */
+    struct cwc_box left = { 0, 0, 10, 10 }, right = { 10, 0, 20, 10 };
+    cwc_region_union_box(&region, &left);
+    cwc_region_union_box(&region, &right);
+    bitmap_set(&bitmap, &left, true);
+    bitmap_set(&bitmap, &right, true);
+    check_region(&region, &bitmap, "union touching");
+
+    /* A hole in the middle splits the region around it */
+    struct cwc_box hole = { 5, 2, 15, 8 };
+    cwc_region_subtract_box(&region, &hole);
+    bitmap_set(&bitmap, &hole, false);
+    check_region(&region, &bitmap, "subtract hole");
+
+    /* Subtracting from an empty region is a no-op */
+    cwc_region_clear(&region);
+    cwc_region_subtract_box(&region, &hole);
+    memset(&bitmap, 0, sizeof(bitmap));
+    check_region(&region, &bitmap, "subtract from empty");
+
+    cwc_region_fini(&region);
+}
+
+int main(void) {
+    cwc_test_seed(1);
+    test_edge_cases();
+    for (int i = 0; i < TEST_SEQUENCES; i++) {
+        test_box_sequence();
+        test_region_sequence();
+    }
+    return cwc_test_finish("region");
+}